@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+#
+# Turns the per-port Counters published by the PS/2 device nubs into rates,
+# by comparing two snapshots of the registry.
+#
+#   ./ps2counters.py                  # two live samples, 5 seconds apart
+#   ./ps2counters.py -i 60            # two live samples, a minute apart
+#   ./ps2counters.py a.plist b.plist  # two saved `ioreg -a -r -c ApplePS2Device` dumps
+#
+# Counter names, see PS2CounterKind in ApplePS2Device.h.  "Time" is the
+# uptime (ns) at which a snapshot was taken.
+#
+
+import argparse
+import plistlib
+import subprocess
+import time
+
+PORT_KEY = 'Port Num'
+PORTS = {0: 'kbd', 1: 'aux', 2: 'aux1', 3: 'aux2', 4: 'aux3', 5: 'aux4'}
+
+
+def find_counters(node, found):
+    if isinstance(node, dict):
+        if 'Counters' in node:
+            port = node.get(PORT_KEY, len(found))
+            found[PORTS.get(port, 'port%d' % port)] = node['Counters']
+        node = node.get('IORegistryEntryChildren', [])
+    if isinstance(node, list):
+        for child in node:
+            find_counters(child, found)
+    return found
+
+
+def snapshot(path=None):
+    if path:
+        with open(path, 'rb') as f:
+            tree = plistlib.load(f)
+    else:
+        out = subprocess.check_output(['ioreg', '-a', '-r', '-c', 'ApplePS2Device'])
+        tree = plistlib.loads(out)
+    return find_counters(tree, {})
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('snapshots', nargs='*')
+    parser.add_argument('-i', '--interval', type=float, default=5.0)
+    args = parser.parse_args()
+
+    if len(args.snapshots) == 2:
+        before, after = snapshot(args.snapshots[0]), snapshot(args.snapshots[1])
+    elif not args.snapshots:
+        before = snapshot()
+        time.sleep(args.interval)
+        after = snapshot()
+    else:
+        parser.error('give two snapshots, or none to sample live')
+
+    for port in sorted(after):
+        now, then = after[port], before.get(port, {})
+        seconds = (now.get('Time', 0) - then.get('Time', 0)) / 1e9
+        print('%s (%.1f s):' % (port, seconds))
+        for name in sorted(now):
+            if name == 'Time':
+                continue
+            delta = now[name] - then.get(name, 0)
+            if delta < 0:
+                delta += 1 << 32    # wrapped
+            rate = delta / seconds if seconds > 0 else 0
+            print('  %-16s %12d %+10d %12.1f/s' % (name, now[name], delta, rate))
+
+
+if __name__ == '__main__':
+    main()
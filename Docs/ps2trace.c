@@ -0,0 +1,54 @@
+//
+// Dumps the ApplePS2Controller byte trace (BYTE_TRACE) to a file, for
+// Docs/ps2trace.py.  The trace shows every keystroke, so this must run
+// as root.
+//
+//   clang -framework IOKit -o ps2trace ps2trace.c
+//   sudo ./ps2trace trace.bin
+//
+
+#include <IOKit/IOKitLib.h>
+#include <mach/mach.h>
+#include <stdio.h>
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <output file>\n", argv[0]);
+        return 1;
+    }
+
+    io_service_t service = IOServiceGetMatchingService(MACH_PORT_NULL, IOServiceMatching("ApplePS2Controller"));
+    if (!service) {
+        fprintf(stderr, "ApplePS2Controller not found\n");
+        return 1;
+    }
+
+    io_connect_t connect;
+    kern_return_t kr = IOServiceOpen(service, mach_task_self(), 0, &connect);
+    IOObjectRelease(service);
+    if (kr != KERN_SUCCESS) {
+        fprintf(stderr, "IOServiceOpen failed: 0x%x (not root, or BYTE_TRACE disabled?)\n", kr);
+        return 1;
+    }
+
+    mach_vm_address_t address = 0;
+    mach_vm_size_t size = 0;
+    kr = IOConnectMapMemory64(connect, 0, mach_task_self(), &address, &size, kIOMapAnywhere);
+    if (kr != KERN_SUCCESS) {
+        fprintf(stderr, "IOConnectMapMemory64 failed: 0x%x\n", kr);
+        IOServiceClose(connect);
+        return 1;
+    }
+
+    FILE* file = fopen(argv[1], "wb");
+    int result = !file || fwrite((const void*)address, 1, size, file) != size;
+    if (file)
+        fclose(file);
+    if (result)
+        perror(argv[1]);
+
+    IOConnectUnmapMemory64(connect, 0, mach_task_self(), address);
+    IOServiceClose(connect);
+    return result;
+}
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+#
+# Decodes a byte trace dumped by Docs/ps2trace.c into per-device streams:
+# the commands sent to each device with their responses, and the data
+# packets each device sent on its own.
+#
+#   ./ps2trace.py trace.bin          # per-device streams
+#   ./ps2trace.py -r trace.bin       # raw entries, in order
+#   ./ps2trace.py -t 1.0 trace.bin   # timebase ticks per ns (default 1.0)
+#
+# Layout (little endian), see PS2TraceBuffer in VoodooPS2Controller.h:
+#   header: UInt32 magic, entries, head, reserved
+#   entry:  UInt64 time, UInt32 sequence, UInt8 kind, port, data, status
+#
+
+import argparse
+import struct
+
+MAGIC = 0x54325350
+KINDS = ['read', 'flush', 'data', 'cmd']
+NO_PORT = 0xff
+
+# a device that stays quiet this long ends its packet (usec)
+PACKET_GAP = 2000
+
+
+def port_name(port):
+    if port == 0:
+        return 'kbd'
+    if port == 1:
+        return 'aux'
+    if port == NO_PORT:
+        return 'ctrl'
+    return 'aux%d' % (port - 2)
+
+
+def load(path):
+    with open(path, 'rb') as f:
+        blob = f.read()
+    magic, count, head, _ = struct.unpack_from('<IIII', blob, 0)
+    if magic != MAGIC:
+        raise SystemExit('%s: not a PS/2 byte trace' % path)
+
+    entries = []
+    for i in range(count):
+        time, seq, kind, port, data, status = struct.unpack_from('<QIBBBB', blob, 16 + 16 * i)
+        # skip empty entries and entries being written while dumped
+        if seq and (seq - 1) % count == i:
+            entries.append((seq, time, kind, port, data, status))
+    entries.sort()
+    dropped = head - len(entries)
+    return entries, dropped
+
+
+def target_of(command):
+    # command port bytes that route the next data byte to a device
+    if command == 0xd4:
+        return 1
+    if 0x90 <= command <= 0x93:
+        return 2 + (command - 0x90)
+    return NO_PORT
+
+
+def decode(entries, ticks_per_ns):
+    streams = {}
+    pending = {}    # port -> (time, command bytes, responses)
+    packets = {}    # port -> (time, bytes)
+    target = 0
+    start = entries[0][1] if entries else 0
+
+    def usec(time):
+        return (time - start) / ticks_per_ns / 1000
+
+    def flush_packet(port):
+        if port in packets:
+            time, data = packets.pop(port)
+            streams.setdefault(port, []).append((time, 'packet', data))
+
+    for seq, time, kind, port, data, status in entries:
+        now = usec(time)
+        if kind == 3:
+            target = target_of(data)
+            if target == NO_PORT:
+                streams.setdefault(NO_PORT, []).append((now, 'command', [data]))
+            continue
+        if kind == 2:
+            dest = target
+            target = 0
+            flush_packet(dest)
+            prev = pending.get(dest)
+            if prev and not prev[2]:
+                prev[1].append(data)    # command argument
+            else:
+                if prev:
+                    streams.setdefault(dest, []).append((prev[0], 'command', prev[1], prev[2]))
+                pending[dest] = (now, [data], [])
+            continue
+
+        # reads: responses to a pending command, or device data
+        if port in pending and (not pending[port][2] or now - pending[port][0] < PACKET_GAP):
+            pending[port][2].append(data)
+            continue
+        if port in pending:
+            prev = pending.pop(port)
+            streams.setdefault(port, []).append((prev[0], 'command', prev[1], prev[2]))
+        if port in packets and now - packets[port][0] > PACKET_GAP:
+            flush_packet(port)
+        packets.setdefault(port, (now, []))[1].append(data)
+
+    for port, prev in pending.items():
+        streams.setdefault(port, []).append((prev[0], 'command', prev[1], prev[2]))
+    for port in list(packets):
+        flush_packet(port)
+    return streams
+
+
+def hexs(data):
+    return ' '.join('%02x' % b for b in data)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('trace')
+    parser.add_argument('-r', '--raw', action='store_true')
+    parser.add_argument('-t', '--ticks-per-ns', type=float, default=1.0)
+    args = parser.parse_args()
+
+    entries, dropped = load(args.trace)
+    print('%d entries, %d overwritten' % (len(entries), dropped))
+
+    if args.raw:
+        start = entries[0][1] if entries else 0
+        for seq, time, kind, port, data, status in entries:
+            print('%10d %12.1f  %-5s %-4s %02x  status %02x' %
+                  (seq, (time - start) / args.ticks_per_ns / 1000, KINDS[kind], port_name(port), data, status))
+        return
+
+    for port, events in sorted(decode(entries, args.ticks_per_ns).items()):
+        print('\n%s:' % port_name(port))
+        for event in sorted(events, key=lambda e: e[0]):
+            if event[1] == 'packet':
+                print('  %12.1f  <- %s' % (event[0], hexs(event[2])))
+            else:
+                responses = event[3] if len(event) > 3 else []
+                print('  %12.1f  -> %-12s <- %s' % (event[0], hexs(event[2]), hexs(responses)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+#
+# Renders the ResumeTimeline property published by ApplePS2Controller after
+# a wake from sleep, and points out where the resume spent its time.
+#
+#   ./resumetimeline.py              # reads the live registry through ioreg
+#   ./resumetimeline.py dump.plist   # reads a saved `ioreg -a` dump
+#
+# Entry layout (8 bytes, little endian), see PS2TimelineEntry in
+# VoodooPS2Controller.h:
+#   UInt32 time (usec since resume began), UInt8 kind, port, data, extra
+#
+
+import plistlib
+import struct
+import subprocess
+import sys
+
+PHASES = ['Resume', 'WakeDelay', 'ResetController', 'MuxMode',
+          'ResetDevices', 'EnableClocks', 'WakeDevice', 'EnableIRQs']
+
+COMMANDS = ['ReadDataPort', 'ReadDataPortAndCompare', 'WriteDataPort',
+            'SendCommandAndCompareAck', 'FlushDataPort', 'SleepMS',
+            'ModifyCommandByte']
+
+PORTS = {0: 'kbd', 1: 'aux', 2: 'aux1', 3: 'aux2', 4: 'aux3', 5: 'aux4'}
+
+
+def find_timeline(node):
+    if isinstance(node, dict):
+        if 'ResumeTimeline' in node:
+            return node['ResumeTimeline']
+        node = node.get('IORegistryEntryChildren', [])
+    if isinstance(node, list):
+        for child in node:
+            found = find_timeline(child)
+            if found is not None:
+                return found
+    return None
+
+
+def load(argv):
+    if len(argv) > 1:
+        with open(argv[1], 'rb') as f:
+            tree = plistlib.load(f)
+    else:
+        out = subprocess.check_output(['ioreg', '-a', '-r', '-c', 'ApplePS2Controller'])
+        tree = plistlib.loads(out)
+    return find_timeline(tree)
+
+
+def port_name(port):
+    return PORTS.get(port, '-')
+
+
+def phase_name(phase, port):
+    name = PHASES[phase] if phase < len(PHASES) else 'phase%d' % phase
+    return name + ('(%s)' % port_name(port) if name == 'WakeDevice' else '')
+
+
+def main(argv):
+    blob = load(argv)
+    if not blob:
+        sys.exit('no ResumeTimeline found (has the machine slept since boot?)')
+
+    entries = list(struct.iter_unpack('<IBBBB', blob))
+    open_phases = {}
+    phases = []
+    last = 0
+
+    for time, kind, port, data, extra in entries:
+        gap = time - last
+        last = time
+        if kind == 0:
+            open_phases[(data, port)] = time
+            print('%9d %+7d  %-5s begin %s' % (time, gap, port_name(port), phase_name(data, port)))
+        elif kind == 1:
+            start = open_phases.pop((data, port), 0)
+            phases.append((time - start, phase_name(data, port)))
+            print('%9d %+7d  %-5s end   %s (%d us)' % (time, gap, port_name(port), phase_name(data, port), time - start))
+        elif kind == 2:
+            name = COMMANDS[extra] if extra < len(COMMANDS) else 'cmd%d' % extra
+            print('%9d %+7d  %-5s   %-32s %02x' % (time, gap, port_name(port), name, data))
+        elif kind == 3:
+            print('%9d %+7d  %-5s   %-32s %02x%s' % (time, gap, port_name(port), '<-', data, ' FAILED' if extra else ''))
+
+    # Phases are sequential on the wake path, so the critical path is simply
+    # the phases ordered by cost.
+    print()
+    print('critical path:')
+    total = max((d for d, n in phases if n == 'Resume'), default=last)
+    for duration, name in sorted((p for p in phases if p[1] != 'Resume'), reverse=True):
+        print('  %-24s %9d us %5.1f%%' % (name, duration, 100.0 * duration / total if total else 0))
+    print('  %-24s %9d us' % ('total', total))
+
+
+if __name__ == '__main__':
+    main(sys.argv)
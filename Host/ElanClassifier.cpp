@@ -0,0 +1,301 @@
+//
+// ElanClassifier: checks the v3/v4 packet classifier of ElanDecoder, the
+// lookup tables built at compile time, against the mask and compare chains
+// it replaced (elantechPacketCheckV3/V4 of ApplePS2Elan, below as they were),
+// for every value of packet bytes 0 and 3 and every set of device flags.
+// Then times both on a stream of packets.
+//
+// usage: elanclassifier [-n packets]
+//
+// Exits non-zero on the first set of flags where they disagree.
+//
+
+// the decoder itself, for its rules and tables (packetRuleV3/V4)
+#include "../VoodooPS2Trackpad/VoodooPS2ElanDecoder.cpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+static uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// The classifiers before the lookup tables
+//
+
+static int referenceV3(const elantech_device_info &info, const uint8_t *packet) {
+    static const uint8_t debounce_packet[] = {
+        0xc4, 0xff, 0xff, 0x02, 0xff, 0xff
+    };
+
+    // check debounce first, it has the same signature in byte 0
+    // and byte 3 as PACKET_V3_HEAD.
+    if (!memcmp(packet, debounce_packet, sizeof(debounce_packet))) {
+        return PACKET_DEBOUNCE;
+    }
+
+    // If the hardware flag 'crc_enabled' is set the packets have different signatures.
+    if (info.crc_enabled) {
+        if ((packet[3] & 0x09) == 0x08) {
+            return PACKET_V3_HEAD;
+        }
+
+        if ((packet[3] & 0x09) == 0x09) {
+            return PACKET_V3_TAIL;
+        }
+    } else {
+        if ((packet[0] & 0x0c) == 0x04 && (packet[3] & 0xcf) == 0x02) {
+            return PACKET_V3_HEAD;
+        }
+
+        if ((packet[0] & 0x0c) == 0x0c && (packet[3] & 0xce) == 0x0c) {
+            return PACKET_V3_TAIL;
+        }
+
+        if ((packet[3] & 0x0f) == 0x06) {
+            return PACKET_TRACKPOINT;
+        }
+    }
+
+    return PACKET_UNKNOWN;
+}
+
+static int referenceV4(const elantech_device_info &info, const uint8_t *packet) {
+    unsigned char packet_type = packet[3] & 0x03;
+    unsigned int ic_version;
+    bool sanity_check;
+
+    if (info.has_trackpoint && (packet[3] & 0x0f) == 0x06) {
+        return PACKET_TRACKPOINT;
+    }
+
+    // This represents the version of IC body.
+    ic_version = (info.fw_version & 0x0f0000) >> 16;
+
+    // Sanity check based on the constant bits of a packet.
+    // The constant bits change depending on the value of
+    // the hardware flag 'crc_enabled' and the version of
+    // the IC body, but are the same for every packet,
+    // regardless of the type.
+    if (info.crc_enabled) {
+        sanity_check = ((packet[3] & 0x08) == 0x00);
+    } else if (ic_version == 7 && info.samples[1] == 0x2A) {
+        sanity_check = ((packet[3] & 0x1c) == 0x10);
+    } else {
+        sanity_check = ((packet[0] & 0x08) == 0x00 && (packet[3] & 0x1c) == 0x10);
+    }
+
+    if (!sanity_check) {
+        return PACKET_UNKNOWN;
+    }
+
+    switch (packet_type) {
+        case 0:
+            return PACKET_V4_STATUS;
+
+        case 1:
+            return PACKET_V4_HEAD;
+
+        case 2:
+            return PACKET_V4_MOTION;
+    }
+
+    return PACKET_UNKNOWN;
+}
+
+static int reference(const elantech_device_info &info, const uint8_t *packet) {
+    return info.hw_version == 3 ? referenceV3(info, packet) : referenceV4(info, packet);
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+//
+// Every set of flags the classifiers look at: hardware version, crc_enabled,
+// has_trackpoint, the IC body of the firmware version (7 or not, and the
+// ETD0108 firmware) and samples[1].
+//
+
+struct Variant
+{
+    int hw_version;
+    bool crc_enabled;
+    bool has_trackpoint;
+    unsigned int fw_version;
+    unsigned char sample;
+};
+
+static std::vector<Variant> variants()
+{
+    static const unsigned int firmware[] = { 0x450f02, 0x470f02, ETP_FW_VERSION_ETD0108 };
+    static const unsigned char samples[] = { 0x00, 0x2A };
+    std::vector<Variant> list;
+    for (int version = 3; version <= 4; version++)
+        for (int crc = 0; crc < 2; crc++)
+            for (int trackpoint = 0; trackpoint < 2; trackpoint++)
+                for (unsigned int fw : firmware)
+                    for (unsigned char sample : samples)
+                        list.push_back({ version, crc != 0, trackpoint != 0, fw, sample });
+    return list;
+}
+
+static void describe(const Variant &variant)
+{
+    printf("v%d, crc %d, trackpoint %d, firmware %06x, samples[1] %02x", variant.hw_version, variant.crc_enabled,
+           variant.has_trackpoint, variant.fw_version, variant.sample);
+}
+
+static void setUp(elantech_device_info &info, const Variant &variant)
+{
+    info = {};
+    info.hw_version = variant.hw_version;
+    info.crc_enabled = variant.crc_enabled;
+    info.has_trackpoint = variant.has_trackpoint;
+    info.fw_version = variant.fw_version;
+    info.samples[1] = variant.sample;
+}
+
+// the packets the v3 debounce check compares in full: the debounce packet,
+// and the same with each byte outside 0 and 3 changed
+static std::vector<std::vector<uint8_t>> debouncePackets()
+{
+    std::vector<std::vector<uint8_t>> packets;
+    const std::vector<uint8_t> debounce = { 0xc4, 0xff, 0xff, 0x02, 0xff, 0xff };
+    packets.push_back(debounce);
+    for (int i : { 1, 2, 4, 5 })
+    {
+        std::vector<uint8_t> packet = debounce;
+        packet[i] = 0xfe;
+        packets.push_back(packet);
+    }
+    return packets;
+}
+
+static bool checkEquivalence()
+{
+    elantech_device_info info;
+    elantech_data etd {};
+    ElanDecoder decoder(info, etd);
+    std::vector<Variant> list = variants();
+    unsigned long checked = 0;
+
+    for (const Variant &variant : list)
+    {
+        setUp(info, variant);
+        decoder.selectClassifier();
+
+        // the other bytes are 0xff, as in the debounce packet
+        uint8_t packet[6] = { 0, 0xff, 0xff, 0, 0xff, 0xff };
+        unsigned int ic_version = (info.fw_version & 0x0f0000) >> 16;
+        int sanity = info.crc_enabled ? kElanV4SanityCRC :
+                     (ic_version == 7 && info.samples[1] == 0x2A) ? kElanV4SanityIC7 : kElanV4SanityDefault;
+        for (unsigned int byte0 = 0; byte0 < 256; byte0++)
+        {
+            for (unsigned int byte3 = 0; byte3 < 256; byte3++)
+            {
+                packet[0] = byte0;
+                packet[3] = byte3;
+                int expected = reference(info, packet);
+                int table = decoder.packetType(packet);
+                int rule = expected;
+                if (info.hw_version == 4)
+                    rule = packetRuleV4(packetIndexV4(packet), sanity, info.has_trackpoint);
+                else if (expected != PACKET_DEBOUNCE)
+                    rule = packetRuleV3(packetIndexV3(packet), info.crc_enabled);
+                if (table != expected || rule != expected)
+                {
+                    printf("  FAILED: ");
+                    describe(variant);
+                    printf(": %02x .. .. %02x is %d, table %d, rule %d\n", byte0, byte3, expected, table, rule);
+                    return false;
+                }
+                checked++;
+            }
+        }
+        for (const std::vector<uint8_t> &packet : debouncePackets())
+        {
+            if (decoder.packetType(packet.data()) != reference(info, packet.data()))
+            {
+                printf("  FAILED: ");
+                describe(variant);
+                printf(": debounce packet variant\n");
+                return false;
+            }
+            checked++;
+        }
+    }
+    printf("  %lu packets in %zu flag sets: the tables agree with the old checks\n", checked, list.size());
+    return true;
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static void benchmark(size_t count)
+{
+    elantech_device_info info;
+    elantech_data etd {};
+    ElanDecoder decoder(info, etd);
+    Variant variant = { 4, false, false, 0x450f02, 0x00 };
+
+    // v4 packets with random bytes 0 and 3, most of them valid
+    std::mt19937 random(1);
+    std::vector<uint8_t> stream(count * 6);
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t *packet = &stream[i * 6];
+        for (int j = 0; j < 6; j++)
+            packet[j] = random();
+        if (random() % 8)
+        {
+            packet[0] &= ~0x08;
+            packet[3] = (packet[3] & ~0x1c) | 0x10;
+        }
+    }
+
+    for (int version = 4; version >= 3; version--)
+    {
+        variant.hw_version = version;
+        setUp(info, variant);
+        decoder.selectClassifier();
+
+        unsigned long sum = 0;
+        uint64_t start = now();
+        for (size_t i = 0; i < count; i++)
+            sum += decoder.packetType(&stream[i * 6]);
+        uint64_t tables = now() - start;
+
+        start = now();
+        for (size_t i = 0; i < count; i++)
+            sum -= reference(info, &stream[i * 6]);
+        uint64_t checks = now() - start;
+
+        printf("  v%d  tables %6.2f ns/packet (%4.0f M/s), old checks %6.2f ns/packet (%4.0f M/s)%s\n", version,
+               (double)tables / count, count * 1e3 / tables, (double)checks / count, count * 1e3 / checks,
+               sum ? ", results differ" : "");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t count = 10000000;
+    if (argc == 3 && !strcmp(argv[1], "-n"))
+        count = strtoul(argv[2], NULL, 10);
+    else if (argc != 1)
+    {
+        fprintf(stderr, "usage: elanclassifier [-n packets]\n");
+        return 2;
+    }
+
+    printf("elanclassifier: equivalence\n");
+    if (!checkEquivalence())
+        return 1;
+    printf("elanclassifier: %zu packets\n", count);
+    benchmark(count);
+    return 0;
+}
@@ -0,0 +1,305 @@
+//
+// ElanReplay: replays a stream of Elan touchpad packets through ElanDecoder,
+// the decoder of the Elan trackpad driver, and reports its throughput:
+// packets and frames decoded per second, and the time decode() takes per
+// packet (percentiles).
+//
+// usage: elanreplay [-v hw-version] [-f fw-version] [-c] [-t] [-n loops]
+//                   (<stream> | -g packets) [-w stream]
+//
+// A stream is text: the packet lines ("<- 04 12 34 12 05 67") of the aux
+// port in the output of Docs/ps2trace.py, or lines of hex bytes.  Its bytes
+// are cut into 6-byte packets.  -g generates a stream of v4 packets instead
+// (one and two finger strokes), -w writes the stream that was replayed.
+// -v, -f, -c and -t describe the touchpad (hardware version, firmware
+// version in hex, crc_enabled, has_trackpoint), -n replays the stream that
+// many times.  Exits non-zero if no frame was decoded, or a generated packet
+// did not decode.
+//
+
+#include "../VoodooPS2Trackpad/VoodooPS2ElanDecoder.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+typedef std::vector<uint8_t> Stream;
+
+static void usage()
+{
+    fprintf(stderr, "usage: elanreplay [-v hw-version] [-f fw-version] [-c] [-t] [-n loops] (<stream> | -g packets) [-w stream]\n");
+    exit(2);
+}
+
+static uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t percentile(std::vector<uint64_t> samples, double p)
+{
+    if (samples.empty())
+        return 0;
+    size_t index = std::min(samples.size() - 1, (size_t)(p / 100.0 * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static bool hexBytes(const char* text, Stream& bytes)
+{
+    // appends the hex bytes of text, false if there is anything else
+    Stream line;
+    while (*text)
+    {
+        if (isspace((unsigned char)*text))
+        {
+            text++;
+            continue;
+        }
+        if (!isxdigit((unsigned char)text[0]) || !isxdigit((unsigned char)text[1]) ||
+            (text[2] && !isspace((unsigned char)text[2])))
+            return false;
+        line.push_back((uint8_t)strtoul(std::string(text, 2).c_str(), NULL, 16));
+        text += 2;
+    }
+    bytes.insert(bytes.end(), line.begin(), line.end());
+    return true;
+}
+
+static bool readStream(const char* path, Stream& bytes)
+{
+    FILE* file = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    if (!file)
+    {
+        perror(path);
+        return false;
+    }
+
+    // ps2trace.py output: packets ("<- ...") of the aux section only
+    bool sections = false, aux = false;
+    char line[512];
+    while (fgets(line, sizeof(line), file))
+    {
+        line[strcspn(line, "\r\n")] = 0;
+        size_t length = strlen(line);
+        if (length && line[length - 1] == ':' && !isspace((unsigned char)line[0]))
+        {
+            sections = true;
+            aux = !strcmp(line, "aux:");
+            continue;
+        }
+        if (sections && !aux)
+            continue;
+        const char* arrow = strstr(line, "<-");
+        if (strstr(line, "->"))
+            continue;
+        hexBytes(arrow ? arrow + 2 : line, bytes);
+    }
+    if (file != stdin)
+        fclose(file);
+    return true;
+}
+
+static bool writeStream(const char* path, const Stream& bytes)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+    {
+        perror(path);
+        return false;
+    }
+    for (size_t i = 0; i + 6 <= bytes.size(); i += 6)
+        fprintf(file, "%02x %02x %02x %02x %02x %02x\n",
+                bytes[i], bytes[i + 1], bytes[i + 2], bytes[i + 3], bytes[i + 4], bytes[i + 5]);
+    fclose(file);
+    return true;
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+//
+// v4 packets, without crc and with the constant bits of IC bodies other than
+// 7: status (fingers down), head (absolute position of one finger) and
+// motion (deltas of one or two fingers).
+//
+
+static void statusV4(Stream& s, unsigned fingers)
+{
+    const uint8_t packet[6] = { 0x00, (uint8_t)fingers, 0x00, 0x10, 0x00, 0x00 };
+    s.insert(s.end(), packet, packet + 6);
+}
+
+static void headV4(Stream& s, const elantech_device_info& info, int id, unsigned x, unsigned y)
+{
+    unsigned pressure = 0x40, traces = 4;
+    unsigned y2 = info.y_max - y;
+    const uint8_t packet[6] = {
+        (uint8_t)(traces << 4),
+        (uint8_t)((pressure & 0xf0) | ((x >> 8) & 0x0f)),
+        (uint8_t)x,
+        (uint8_t)(((id + 1) << 5) | 0x10 | 0x01),
+        (uint8_t)(((pressure & 0x0f) << 4) | ((y2 >> 8) & 0x0f)),
+        (uint8_t)y2,
+    };
+    s.insert(s.end(), packet, packet + 6);
+}
+
+static void motionV4(Stream& s, int id, int sid, int dx, int dy)
+{
+    const uint8_t packet[6] = {
+        (uint8_t)((id + 1) << 5),
+        (uint8_t)(int8_t)dx,
+        (uint8_t)(int8_t)dy,
+        (uint8_t)(((sid + 1) << 5) | 0x10 | 0x02),
+        (uint8_t)(int8_t)(sid >= 0 ? -dx : 0),
+        (uint8_t)(int8_t)(sid >= 0 ? -dy : 0),
+    };
+    s.insert(s.end(), packet, packet + 6);
+}
+
+static Stream generateV4(const elantech_device_info& info, size_t packets)
+{
+    Stream s;
+    for (unsigned stroke = 0; s.size() < packets * 6; stroke++)
+    {
+        bool two = stroke % 3 == 2;
+        unsigned x = 1000 + (stroke * 37) % 1000, y = 1000 + (stroke * 53) % 1000;
+        statusV4(s, two ? 0x03 : 0x01);
+        headV4(s, info, 0, x, y);
+        if (two)
+            headV4(s, info, 1, x + 500, y);
+        for (int i = 0; i < 40; i++)
+            motionV4(s, 0, two ? 1 : -1, (i % 7) - 3, 2);
+        statusV4(s, 0);
+    }
+    s.resize(packets * 6);
+    return s;
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+int main(int argc, char** argv)
+{
+    elantech_device_info info {};
+    elantech_data etd {};
+    info.hw_version = 4;
+    info.fw_version = 0x450f02;
+    info.x_max = 3094;
+    info.y_max = 3096;
+    info.x_res = 31;
+    info.y_res = 31;
+    info.width = 4;
+    info.x_traces = 16;
+    info.y_traces = 10;
+    info.reports_pressure = true;
+    info.paritycheck = true;
+    unsigned loops = 1;
+    size_t generate = 0;
+    const char* path = NULL;
+    const char* output = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if (!strcmp(arg, "-c"))
+            info.crc_enabled = true;
+        else if (!strcmp(arg, "-t"))
+            info.has_trackpoint = true;
+        else if (arg[0] == '-' && arg[1] && !arg[2] && strchr("vfngw", arg[1]))
+        {
+            if (i + 1 >= argc)
+                usage();
+            const char* value = argv[++i];
+            switch (arg[1])
+            {
+                case 'v': info.hw_version = atoi(value); break;
+                case 'f': info.fw_version = strtoul(value, NULL, 16); break;
+                case 'n': loops = std::max(atoi(value), 1); break;
+                case 'g': generate = strtoul(value, NULL, 10); break;
+                case 'w': output = value; break;
+            }
+        }
+        else if (!path && (arg[0] != '-' || !arg[1]))
+            path = arg;
+        else
+            usage();
+    }
+    if ((!path) == (!generate) || info.hw_version < 1 || info.hw_version > 4 || (generate && info.hw_version != 4))
+        usage();
+
+    // as ApplePS2Elan sets up the decoder
+    etd.parity[0] = 1;
+    for (int i = 1; i < 256; i++)
+        etd.parity[i] = etd.parity[i & (i - 1)] ^ 1;
+    ElanDecoder decoder(info, etd);
+    decoder.selectClassifier();
+
+    Stream stream;
+    if (generate)
+        stream = generateV4(info, generate);
+    else if (!readStream(path, stream))
+        return 1;
+    size_t packets = stream.size() / 6;
+    if (output && !writeStream(output, stream))
+        return 1;
+    if (!packets)
+    {
+        fprintf(stderr, "elanreplay: no packets in %s\n", path);
+        return 1;
+    }
+
+    // throughput: the stream decoded back to back
+    uint64_t frames = 0, invalid = 0, trackpoint = 0;
+    uint64_t start = now();
+    for (unsigned loop = 0; loop < loops; loop++)
+    {
+        for (size_t i = 0; i < packets; i++)
+        {
+            int result = decoder.decode(&stream[i * 6]);
+            frames += (result & kElanDecodeFrame) != 0;
+            invalid += (result & kElanDecodeInvalid) != 0;
+            trackpoint += (result & kElanDecodeTrackpoint) != 0;
+        }
+    }
+    double elapsed = (now() - start) / 1e9;
+
+    // latency: each packet timed on its own, less what reading the clock costs
+    std::vector<uint64_t> clock, latency;
+    clock.reserve(1000);
+    for (int i = 0; i < 1000; i++)
+    {
+        uint64_t before = now();
+        clock.push_back(now() - before);
+    }
+    uint64_t clockCost = percentile(clock, 50);
+    latency.reserve(packets);
+    for (size_t i = 0; i < packets; i++)
+    {
+        uint64_t before = now();
+        decoder.decode(&stream[i * 6]);
+        uint64_t spent = now() - before;
+        latency.push_back(spent > clockCost ? spent - clockCost : 0);
+    }
+
+    uint64_t total = (uint64_t)packets * loops;
+    printf("elanreplay: v%d, firmware %06x%s%s, %zu packets%s, %u loops\n", info.hw_version, info.fw_version,
+           info.crc_enabled ? ", crc" : "", info.has_trackpoint ? ", trackpoint" : "", packets,
+           generate ? " generated" : "", loops);
+    printf("  decoded     %llu packets in %.3f s: %.0f packets/s, %.0f frames/s\n",
+           (unsigned long long)total, elapsed, total / elapsed, frames / elapsed);
+    printf("  per packet  %llu ns p50, %llu ns p90, %llu ns p99, %llu ns max (clock read %llu ns, subtracted)\n",
+           (unsigned long long)percentile(latency, 50), (unsigned long long)percentile(latency, 90),
+           (unsigned long long)percentile(latency, 99), (unsigned long long)percentile(latency, 100),
+           (unsigned long long)clockCost);
+    printf("  packets     %llu frames, %llu invalid, %llu trackpoint\n",
+           (unsigned long long)frames, (unsigned long long)invalid, (unsigned long long)trackpoint);
+    return frames && !(generate && invalid) ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+//
+// Controller bring-up on the i8042 model (see HostSystem.h).
+//
+
+#include "HostSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+static void setNumber(OSDictionary* dict, const char* key, unsigned value)
+{
+    OSNumber* number = OSNumber::withNumber(value, 32);
+    dict->setObject(key, number);
+    number->release();
+}
+
+bool HostSystem::start(const I8042Timing& timing, bool multiplexing, int touchpads, OSDictionary* config)
+{
+    I8042Model& model = I8042Model::shared();
+    model.configure(timing, multiplexing);
+    model.attach(kPS2KbdIdx, &_keyboard);
+    for (int i = 0; i < touchpads && i < PS2_MUX_PORTS; i++)
+        model.attach(kPS2AuxIdx + i, &_touchpads[i]);
+
+    _provider = new IOService;
+    if (!_provider->init())
+        return false;
+    model.setInterruptProvider(_provider);
+
+    // Platform Profile: the Info.plist defaults, then the caller's entries
+    OSDictionary* defaults = OSDictionary::withCapacity(8);
+    defaults->setObject("CalibrateDataDelay", kOSBooleanFalse);
+    defaults->setObject("CoalesceRequests", kOSBooleanTrue);
+    setNumber(defaults, "DataDelay", kDataDelay);
+    defaults->setObject("DedicatedWorkLoop", kOSBooleanFalse);
+    defaults->setObject("DetectLostInterrupts", kOSBooleanTrue);
+    defaults->setObject("MouseWakeFirst", kOSBooleanFalse);
+    defaults->setObject("OverlapDeviceWake", kOSBooleanTrue);
+    setNumber(defaults, "WakeDelay", 10);
+    if (config)
+        defaults->merge(config);
+    OSDictionary* profile = OSDictionary::withCapacity(1);
+    profile->setObject("Default", defaults);
+    defaults->release();
+
+    _controller = new ApplePS2Controller;
+    if (!_controller->init(NULL))
+        return false;
+    _controller->setProperty(kPlatformProfile, profile);
+    profile->release();
+
+    SInt32 score = 0;
+    return _controller->probe(_provider, &score) &&
+           _controller->attach(_provider) &&
+           _controller->start(_provider);
+}
+
+ApplePS2Device* HostSystem::nub(size_t port) const
+{
+    for (IOService* client : HostClients(_controller))
+    {
+        ApplePS2Device* device = OSDynamicCast(ApplePS2Device, client);
+        OSNumber* number = device ? OSDynamicCast(OSNumber, device->getProperty(kPortKey)) : NULL;
+        if (number && number->unsigned32BitValue() == port)
+            return device;
+    }
+    return NULL;
+}
+
+bool HostSystem::setPowerState(unsigned long state, unsigned timeoutMS)
+{
+    UInt32 count = HostPowerAcknowledgeCount();
+    _controller->setPowerState(state, _controller);
+    return HostWaitPowerAcknowledge(count, timeoutMS);
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool HostDriver::start(ApplePS2Device* device, unsigned packetSize, PowerAction power)
+{
+    if (!device || !super::init())
+        return false;
+    _device = device;
+    _packetSize = std::max(packetSize, 1U);
+    _power = power;
+    _device->installInterruptAction<HostDriver, &HostDriver::interruptOccurred, &HostDriver::packetReady>(this);
+    _device->installPowerControlAction(this, &HostDriver::powerAction);
+    return true;
+}
+
+PS2InterruptResult HostDriver::interruptOccurred(UInt8 data)
+{
+    uint64_t zero = 0;
+    _firstByte.compare_exchange_strong(zero, HostNow());
+    _bytes++;
+    if (++_buffered < _packetSize)
+        return kPS2IR_packetBuffering;
+    _buffered = 0;
+    return kPS2IR_packetReady;
+}
+
+void HostDriver::packetReady()
+{
+    _packets++;
+}
+
+void HostDriver::powerAction(void* target, UInt32 whatToDo)
+{
+    HostDriver* me = static_cast<HostDriver*>(static_cast<OSObject*>(target));
+    if (whatToDo == kPS2C_EnableDevice)
+        me->_buffered = 0;
+    if (me->_power)
+        me->_power(me, whatToDo);
+}
+
+void HostDriver::mark()
+{
+    _firstByte = 0;
+}
+
+bool HostDriver::waitForBytes(uint64_t count, unsigned timeoutMS)
+{
+    uint64_t deadline = HostNow() + timeoutMS * 1000000ULL;
+    while (_bytes.load() < count)
+    {
+        if (HostNow() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    return true;
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+uint64_t HostNow(void)
+{
+    return I8042Model::now();
+}
+
+uint64_t HostPercentile(std::vector<uint64_t> samples, double p)
+{
+    if (samples.empty())
+        return 0;
+    size_t index = std::min(samples.size() - 1, (size_t)(p / 100.0 * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
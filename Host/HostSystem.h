@@ -0,0 +1,92 @@
+//
+// Brings the controller up on the i8042 model the way IOKit does on a Mac:
+// a provider that carries the interrupts, probe with a Platform Profile,
+// start, and the nubs the controller publishes.  HostDriver plays the part
+// of a keyboard or trackpad driver on a nub.
+//
+
+#ifndef _HOSTSYSTEM_H
+#define _HOSTSYSTEM_H
+
+#include "I8042Model.h"
+#include "../VoodooPS2Controller/VoodooPS2Controller.h"
+
+#include <functional>
+
+class HostSystem
+{
+public:
+    // config holds the "Controller" entries of the Platform Profile, on top
+    // of the defaults of the Info.plist (may be NULL)
+    bool start(const I8042Timing& timing, bool multiplexing, int touchpads, OSDictionary* config = NULL);
+
+    ApplePS2Controller* controller() const { return _controller; }
+    IOService* provider() const { return _provider; }
+    ApplePS2Device* nub(size_t port) const;
+    I8042Keyboard* keyboard() { return &_keyboard; }
+    I8042Touchpad* touchpad(size_t port) { return &_touchpads[port - kPS2AuxIdx]; }
+
+    // a power state change as the power manager makes it, waits for the
+    // controller to acknowledge it
+    bool setPowerState(unsigned long state, unsigned timeoutMS = 10000);
+
+private:
+    IOService* _provider {NULL};
+    ApplePS2Controller* _controller {NULL};
+    I8042Keyboard _keyboard;
+    I8042Touchpad _touchpads[PS2_MUX_PORTS];
+};
+
+//
+// A client driver on a nub.  Counts what the controller delivers, and runs
+// the given power action (eg. the request sequence of the real driver) on
+// power changes.
+//
+
+class HostDriver : public OSObject
+{
+    typedef OSObject super;
+
+public:
+    typedef std::function<void (HostDriver* driver, UInt32 whatToDo)> PowerAction;
+
+    bool start(ApplePS2Device* device, unsigned packetSize, PowerAction power = PowerAction());
+    ApplePS2Device* device() const { return _device; }
+
+    // a blocking request on the nub, true if every command completed
+    template <class... Steps> bool send(Steps... steps)
+    {
+        auto request = makePS2Script(steps...);
+        _device->submitRequestAndBlock(&request);
+        return request.succeeded();
+    }
+
+    uint64_t bytes() const { return _bytes.load(); }
+    uint64_t packets() const { return _packets.load(); }
+
+    // forget the first byte seen so far; firstByte is the time of the first
+    // one after this, or 0
+    void mark();
+    uint64_t firstByte() const { return _firstByte.load(); }
+    bool waitForBytes(uint64_t count, unsigned timeoutMS);
+
+    // the routines installed on the nub
+    PS2InterruptResult interruptOccurred(UInt8 data);
+    void packetReady();
+    static void powerAction(void* target, UInt32 whatToDo);
+
+private:
+    ApplePS2Device* _device {NULL};
+    PowerAction _power;
+    unsigned _packetSize {1};
+    unsigned _buffered {0};
+    std::atomic<uint64_t> _bytes {0};
+    std::atomic<uint64_t> _packets {0};
+    std::atomic<uint64_t> _firstByte {0};
+};
+
+// Nanoseconds of the uptime clock, and the p-th percentile of samples.
+uint64_t HostNow(void);
+uint64_t HostPercentile(std::vector<uint64_t> samples, double p);
+
+#endif
@@ -0,0 +1,778 @@
+//
+// Software model of an i8042 keyboard controller (see I8042Model.h).
+//
+
+#include "I8042Model.h"
+
+#include <IOKit/IOService.h>
+#include <algorithm>
+
+#define kStatusOutputReady      0x01
+#define kStatusInputBusy        0x02
+#define kStatusSystemFlag       0x04
+#define kStatusCommandLastSent  0x08
+#define kStatusNotInhibited     0x10
+#define kStatusAuxData          0x20
+#define kStatusTimeout          0x40
+#define kStatusMuxShift         6
+
+#define kCBKeyboardIRQ          0x01
+#define kCBAuxIRQ               0x02
+#define kCBKeyboardClockOff     0x10
+#define kCBAuxClockOff          0x20
+
+#define kMuxVersion             0x11    // active multiplexing 1.1
+
+static const uint64_t kUs = 1000;
+
+// set while the model thread runs an interrupt handler
+static thread_local bool tInInterrupt;
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Port I/O backend of the controller (PS2_PORT_IO_EXTERNAL)
+//
+
+extern "C" UInt8 ps2_inb(UInt16 port)
+{
+    return I8042Model::shared().inb(port);
+}
+
+extern "C" void ps2_outb(UInt16 port, UInt8 data)
+{
+    I8042Model::shared().outb(port, data);
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Devices
+//
+
+void I8042Device::send(const uint8_t* bytes, size_t count, unsigned delayUs)
+{
+    I8042Model::Port& port = _model->_ports[_port];
+    for (size_t i = 0; i < count; i++)
+        port.tx.push_back({bytes[i], _model->_eventTime + delayUs * kUs});
+}
+
+void I8042Device::discard()
+{
+    _model->_ports[_port].tx.clear();
+}
+
+bool I8042Device::sending() const
+{
+    return !_model->_ports[_port].tx.empty();
+}
+
+const I8042Timing& I8042Device::timing() const
+{
+    return _model->_timing;
+}
+
+void I8042Keyboard::receive(uint8_t byte, uint64_t now)
+{
+    // a command aborts the byte on the wire; a typed one is sent again later
+    if (_sendingTyped && sending())
+        _typed.push_front(_inFlight);
+    _sendingTyped = false;
+    discard();
+
+    unsigned delay = timing().deviceUs;
+    if (_pending)
+    {
+        _pending = 0;
+        send(0xFA, delay);
+        return;
+    }
+
+    switch (byte)
+    {
+        case 0xFF:                      // reset
+            _typed.clear();
+            _scanning = true;
+            send(0xFA, delay);
+            send(0xAA, timing().resetUs);
+            break;
+
+        case 0xF2:                      // identify
+        {
+            static const uint8_t id[] = { 0xFA, 0xAB, 0x83 };
+            send(id, sizeof(id), delay);
+            break;
+        }
+
+        case 0xED:                      // LEDs
+        case 0xF0:                      // scan code set
+        case 0xF3:                      // typematic rate
+            _pending = byte;
+            send(0xFA, delay);
+            break;
+
+        case 0xEE:                      // echo
+            send(0xEE, delay);
+            break;
+
+        case 0xF4:                      // enable scanning
+            _scanning = true;
+            send(0xFA, delay);
+            break;
+
+        case 0xF5:                      // set defaults and disable
+            _typed.clear();
+            _scanning = false;
+            send(0xFA, delay);
+            break;
+
+        default:
+            send(0xFA, delay);
+            break;
+    }
+}
+
+uint64_t I8042Keyboard::deadline() const
+{
+    // next typed byte as soon as the last one has been taken
+    return (_scanning && !_typed.empty() && !sending()) ? 1 : 0;
+}
+
+void I8042Keyboard::run(uint64_t now)
+{
+    _inFlight = _typed.front();
+    _typed.pop_front();
+    _sendingTyped = true;
+    send(_inFlight, 0);
+}
+
+void I8042Keyboard::type(const uint8_t* bytes, size_t count)
+{
+    _typed.insert(_typed.end(), bytes, bytes + count);
+}
+
+void I8042Touchpad::receive(uint8_t byte, uint64_t now)
+{
+    // a command cancels the rest of a packet
+    discard();
+
+    unsigned delay = timing().deviceUs;
+    if (_pending)
+    {
+        if (_pending == 0xF3)
+            _rate = byte;
+        else if (_pending == 0xE8)
+            _resolution = byte;
+        _pending = 0;
+        send(0xFA, delay);
+        return;
+    }
+
+    if (byte != 0xE6 && byte != 0xE9)
+        _knock = 0;
+
+    switch (byte)
+    {
+        case 0xFF:                      // reset and self-test
+        {
+            static const uint8_t selfTest[] = { 0xAA, 0x00 };
+            _reporting = false;
+            _rate = 100;
+            _resolution = 2;
+            send(0xFA, delay);
+            send(selfTest, sizeof(selfTest), timing().resetUs);
+            break;
+        }
+
+        case 0xF2:                      // identify
+        {
+            static const uint8_t id[] = { 0xFA, 0x00 };
+            send(id, sizeof(id), delay);
+            break;
+        }
+
+        case 0xE9:                      // status, or the Elan signature after E6 E6 E6
+        {
+            uint8_t status[] = { 0xFA, (uint8_t)(_reporting ? 0x20 : 0x00), _resolution, _rate };
+            if (_knock >= 3)
+            {
+                status[1] = 0x3C;
+                status[2] = 0x03;
+                status[3] = 0xC8;
+            }
+            _knock = 0;
+            send(status, sizeof(status), delay);
+            break;
+        }
+
+        case 0xE6:                      // scaling 1:1
+            _knock++;
+            send(0xFA, delay);
+            break;
+
+        case 0xE8:                      // resolution
+        case 0xF3:                      // sample rate
+            _pending = byte;
+            send(0xFA, delay);
+            break;
+
+        case 0xF4:                      // enable reporting
+            _reporting = true;
+            _next = now + _period;
+            send(0xFA, delay);
+            break;
+
+        case 0xF5:                      // disable reporting
+            _reporting = false;
+            send(0xFA, delay);
+            break;
+
+        case 0xF6:                      // set defaults
+            _rate = 100;
+            _resolution = 2;
+            send(0xFA, delay);
+            break;
+
+        default:
+            send(0xFA, delay);
+            break;
+    }
+}
+
+uint64_t I8042Touchpad::deadline() const
+{
+    return (_reporting && _finger) ? _next : 0;
+}
+
+void I8042Touchpad::run(uint64_t now)
+{
+    // an Elan v4 head packet; a sample is dropped while the last one is
+    // still going out
+    static const uint8_t packet[] = { 0x84, 0x1f, 0x3f, 0x11, 0x20, 0x40 };
+    if (!sending())
+        send(packet, sizeof(packet), 0);
+    _next += _period;
+    if (_next <= now)
+        _next = now + _period;
+}
+
+void I8042Touchpad::setFinger(bool down, unsigned packetsPerSecond)
+{
+    _finger = down;
+    _period = 1000000000ULL / std::max(packetsPerSecond, 1U);
+    _next = I8042Model::now() + _period;
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Controller
+//
+
+I8042Model& I8042Model::shared()
+{
+    static I8042Model* model = new I8042Model;
+    return *model;
+}
+
+I8042Model::I8042Model()
+{
+}
+
+uint64_t I8042Model::now()
+{
+    uint64_t now;
+    clock_get_uptime(&now);
+    return now;
+}
+
+void I8042Model::configure(const I8042Timing& timing, bool multiplexing)
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    _timing = timing;
+    _portAccessNs = timing.portAccessNs;
+    _muxCapable = multiplexing;
+}
+
+void I8042Model::attach(int port, I8042Device* device)
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    device->_model = this;
+    device->_port = port;
+    _ports[port].device = device;
+}
+
+void I8042Model::setInterruptProvider(IOService* provider)
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    _provider = provider;
+    if (!_started)
+    {
+        // the model thread raises interrupts and runs the devices' clocks;
+        // like the work loops it lives as long as the process
+        _started = true;
+        std::thread(&I8042Model::threadMain, this).detach();
+    }
+}
+
+void I8042Model::setTiming(const I8042Timing& timing)
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    _timing = timing;
+    _portAccessNs = timing.portAccessNs;
+}
+
+I8042Timing I8042Model::currentTiming()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    return _timing;
+}
+
+I8042Statistics I8042Model::statistics()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    return _stats;
+}
+
+void I8042Model::resetStatistics()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    _stats = I8042Statistics();
+}
+
+bool I8042Model::multiplexing()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    return _mux;
+}
+
+uint8_t I8042Model::commandByte()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    return _commandByte;
+}
+
+void I8042Model::spin(unsigned ns)
+{
+    // an in or out instruction stalls the CPU for about a microsecond
+    uint64_t end = now() + ns;
+    while (now() < end)
+        ;
+}
+
+uint8_t I8042Model::inb(uint16_t port)
+{
+    spin(_portAccessNs);
+
+    std::unique_lock<std::mutex> lock(_lock);
+    uint64_t time = now();
+    advance(time);
+
+    if (port != 0x60)
+    {
+        _stats.statusReads++;
+        uint8_t status = kStatusNotInhibited | (_commandByte & kStatusSystemFlag);
+        if (_lastCommand)
+            status |= kStatusCommandLastSent;
+        if (time < _ibfUntil)
+            status |= kStatusInputBusy;
+        if (_obf)
+        {
+            status |= kStatusOutputReady | _obfStatus;
+            if (!_obfSeenAt)
+                _obfSeenAt = time;
+        }
+        return status;
+    }
+
+    _stats.dataReads++;
+    if (tInInterrupt)
+        _stats.interruptReads++;
+    if (!_obf)
+        return _dataRegister;
+
+    // the data port only shows the new byte once it has settled; read too
+    // early it still shows the last one, and the new one is gone
+    uint8_t data = _obfData;
+    if (time - (_obfSeenAt ? _obfSeenAt : _obfAt) < _timing.settleUs * kUs)
+    {
+        data = _dataRegister;
+        _stats.bytesLost++;
+    }
+    _dataRegister = _obfData;
+    release(time);
+    return data;
+}
+
+void I8042Model::outb(uint16_t port, uint8_t data)
+{
+    spin(_portAccessNs);
+
+    std::unique_lock<std::mutex> lock(_lock);
+    uint64_t time = now();
+    advance(time);
+
+    _stats.writes++;
+    _lastCommand = (port != 0x60);
+    _ibfUntil = time + _timing.controllerUs * kUs;
+    if (_lastCommand)
+        controllerCommand(data, time);
+    else
+        controllerData(data, time);
+    advance(time);
+    _changed.notify_all();
+}
+
+void I8042Model::controllerCommand(uint8_t command, uint64_t now)
+{
+    uint8_t pending = _pendingCommand;
+    _pendingCommand = 0;
+
+    switch (command)
+    {
+        case 0x20:                      // read command byte
+            controllerOutput(_commandByte, 0, 0, now, _timing.controllerUs);
+            break;
+
+        case 0x60:                      // write command byte
+        case 0xD1:                      // write output port
+        case 0xD2:                      // write keyboard output buffer
+        case 0xD3:                      // write aux output buffer
+        case 0xD4:                      // write to aux device
+        case 0x90: case 0x91: case 0x92: case 0x93:     // route to mux port
+            _pendingCommand = command;
+            break;
+
+        case 0xA7:                      // disable aux
+        case 0xA8:                      // enable aux
+            if (_mux && pending >= 0x90 && pending <= 0x93)
+                setClock(1 + pending - 0x90, command == 0xA8, now);
+            else if (command == 0xA8)
+                setCommandByte(_commandByte & ~kCBAuxClockOff, now);
+            else
+                setCommandByte(_commandByte | kCBAuxClockOff, now);
+            break;
+
+        case 0xA9:                      // test aux port
+        case 0xAB:                      // test keyboard port
+            controllerOutput(0x00, 0, 0, now, _timing.controllerUs);
+            break;
+
+        case 0xAA:                      // self-test; leaves multiplexing off
+            _mux = false;
+            controllerOutput(0x55, 0, 0, now, _timing.controllerUs);
+            break;
+
+        case 0xAD:                      // disable keyboard
+            setCommandByte(_commandByte | kCBKeyboardClockOff, now);
+            break;
+
+        case 0xAE:                      // enable keyboard
+            setCommandByte(_commandByte & ~kCBKeyboardClockOff, now);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void I8042Model::controllerData(uint8_t data, uint64_t now)
+{
+    uint8_t pending = _pendingCommand;
+    _pendingCommand = 0;
+
+    switch (pending)
+    {
+        case 0x60:
+            setCommandByte(data, now);
+            break;
+
+        case 0xD1:
+            break;
+
+        case 0xD2:
+            controllerOutput(data, 0, 0, now, _timing.controllerUs);
+            break;
+
+        case 0xD3:
+        {
+            // aux output buffer echoes the byte, except for the active
+            // multiplexing handshake: F0 56 A4 answers the version, F0 F6 A5
+            // turns multiplexing off
+            _handshake[0] = _handshake[1];
+            _handshake[1] = _handshake[2];
+            _handshake[2] = data;
+            uint8_t reply = data;
+            if (_muxCapable && _handshake[0] == 0xF0 && _handshake[1] == 0x56 && data == 0xA4)
+            {
+                _mux = true;
+                for (int port = 1; port < kPortCount; port++)
+                    _ports[port].enabled = true;
+                reply = kMuxVersion;
+            }
+            else if (_mux && _handshake[0] == 0xF0 && _handshake[1] == 0xF6 && data == 0xA5)
+                _mux = false;
+            controllerOutput(reply, 1, portStatus(1), now, _timing.controllerUs);
+            break;
+        }
+
+        case 0xD4:
+            transmit(1, data, now);
+            break;
+
+        case 0x90: case 0x91: case 0x92: case 0x93:
+            transmit(1 + pending - 0x90, data, now);
+            break;
+
+        default:
+            transmit(0, data, now);
+            break;
+    }
+}
+
+void I8042Model::controllerOutput(uint8_t data, int port, uint8_t status, uint64_t now, unsigned delayUs)
+{
+    _outputs.push_back({data, status, port, now + delayUs * kUs});
+}
+
+void I8042Model::transmit(int port, uint8_t data, uint64_t now)
+{
+    // the controller takes the byte once the last one has gone out, and
+    // keeps its input buffer busy until then
+    uint64_t start = std::max(now, _wireBusyUntil);
+    _ibfUntil = start + _timing.controllerUs * kUs;
+
+    bool reachable = _ports[port].device && (port <= 1 || _mux);
+    if (!reachable)
+    {
+        uint8_t status = portStatus(port) | (_mux ? 0 : kStatusTimeout);
+        _outputs.push_back({0xFE, status, port, start + _timing.absentUs * kUs});
+        return;
+    }
+
+    uint64_t arrival = start + _timing.byteUs * kUs;
+    _wireBusyUntil = arrival;
+    _wire.push_back({port, data, arrival});
+}
+
+bool I8042Model::portClock(int port) const
+{
+    if (port == 0)
+        return !(_commandByte & kCBKeyboardClockOff);
+    if (_commandByte & kCBAuxClockOff)
+        return false;
+    return _mux ? _ports[port].enabled : port == 1;
+}
+
+uint8_t I8042Model::portStatus(int port) const
+{
+    if (port == 0)
+        return 0;
+    return kStatusAuxData | (_mux ? (uint8_t)((port - 1) << kStatusMuxShift) : 0);
+}
+
+void I8042Model::setClock(int port, bool enabled, uint64_t now)
+{
+    bool was = portClock(port);
+    _ports[port].enabled = enabled;
+    if (!was && portClock(port))
+        _ports[port].clockSince = now;
+}
+
+void I8042Model::setCommandByte(uint8_t value, uint64_t now)
+{
+    bool was[kPortCount];
+    for (int port = 0; port < kPortCount; port++)
+        was[port] = portClock(port);
+    uint8_t enabled = value & ~_commandByte;
+    _commandByte = value;
+    for (int port = 0; port < kPortCount; port++)
+        if (!was[port] && portClock(port))
+            _ports[port].clockSince = now;
+
+    // the interrupt line follows a full output buffer
+    if (_obf)
+    {
+        bool aux = _obfStatus & kStatusAuxData;
+        if (aux ? (enabled & kCBAuxIRQ) : (enabled & kCBKeyboardIRQ))
+            _irqs.push_back(aux ? 12 : 1);
+    }
+}
+
+uint64_t I8042Model::readyAt(int port) const
+{
+    const Port& p = _ports[port];
+    uint64_t start = std::max(std::max(p.tx.front().notBefore, _obfFreeSince), p.clockSince);
+    return start + _timing.byteUs * kUs;
+}
+
+void I8042Model::load(uint8_t data, uint8_t status, int port, uint64_t now)
+{
+    _obf = true;
+    _obfData = data;
+    _obfStatus = status;
+    _obfAt = now;
+    _obfSeenAt = 0;
+    _stats.bytesToHost++;
+
+    uint8_t irq = (status & kStatusAuxData) ? kCBAuxIRQ : kCBKeyboardIRQ;
+    if (_commandByte & irq)
+        _irqs.push_back(irq == kCBAuxIRQ ? 12 : 1);
+}
+
+void I8042Model::release(uint64_t now)
+{
+    // a full output buffer holds every device off; they start over now
+    _obf = false;
+    _obfFreeSince = now;
+    advance(now);
+    _changed.notify_all();
+}
+
+void I8042Model::advance(uint64_t now)
+{
+    // process everything due by now, in time order
+    for (;;)
+    {
+        enum { kNone, kDelivery, kDevice, kOutput, kDeviceByte } kind = kNone;
+        uint64_t at = now + 1;
+        int which = -1;
+
+        if (!_wire.empty() && _wire.front().arrival < at)
+        {
+            kind = kDelivery;
+            at = _wire.front().arrival;
+        }
+        for (int port = 0; port < kPortCount; port++)
+        {
+            I8042Device* device = _ports[port].device;
+            uint64_t deadline = device ? device->deadline() : 0;
+            if (deadline && deadline < at)
+            {
+                kind = kDevice;
+                at = deadline;
+                which = port;
+            }
+        }
+        if (!_obf)
+        {
+            if (!_outputs.empty())
+            {
+                uint64_t ready = std::max(_outputs.front().notBefore, _obfFreeSince);
+                if (ready < at)
+                {
+                    kind = kOutput;
+                    at = ready;
+                }
+            }
+            for (int port = 0; port < kPortCount; port++)
+            {
+                if (_ports[port].tx.empty() || !portClock(port))
+                    continue;
+                uint64_t ready = readyAt(port);
+                if (ready < at)
+                {
+                    kind = kDeviceByte;
+                    at = ready;
+                    which = port;
+                }
+            }
+        }
+        if (kind == kNone)
+            break;
+
+        _eventTime = std::max(_eventTime, at);
+        switch (kind)
+        {
+            case kDelivery:
+            {
+                Delivery delivery = _wire.front();
+                _wire.pop_front();
+                _stats.bytesToDevices++;
+                _ports[delivery.port].device->receive(delivery.data, _eventTime);
+                break;
+            }
+
+            case kDevice:
+                _ports[which].device->run(_eventTime);
+                break;
+
+            case kOutput:
+            {
+                Output output = _outputs.front();
+                _outputs.pop_front();
+                load(output.data, output.status, output.port, _eventTime);
+                break;
+            }
+
+            case kDeviceByte:
+            {
+                uint8_t data = _ports[which].tx.front().data;
+                _ports[which].tx.pop_front();
+                load(data, portStatus(which), which, _eventTime);
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+    _eventTime = std::max(_eventTime, now);
+    if (!_irqs.empty())
+        _changed.notify_all();
+}
+
+uint64_t I8042Model::nextEvent()
+{
+    uint64_t next = UINT64_MAX;
+    if (!_wire.empty())
+        next = _wire.front().arrival;
+    for (int port = 0; port < kPortCount; port++)
+    {
+        I8042Device* device = _ports[port].device;
+        uint64_t deadline = device ? device->deadline() : 0;
+        if (deadline)
+            next = std::min(next, deadline);
+    }
+    if (!_obf)
+    {
+        if (!_outputs.empty())
+            next = std::min(next, std::max(_outputs.front().notBefore, _obfFreeSince));
+        for (int port = 0; port < kPortCount; port++)
+            if (!_ports[port].tx.empty() && portClock(port))
+                next = std::min(next, readyAt(port));
+    }
+    return next;
+}
+
+void I8042Model::threadMain()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    for (;;)
+    {
+        advance(now());
+        if (!_irqs.empty())
+        {
+            // the handler reads the ports itself, so call it unlocked
+            std::vector<int> irqs;
+            irqs.swap(_irqs);
+            IOService* provider = _provider;
+            lock.unlock();
+            unsigned raised = 0;
+            uint64_t start = now();
+            tInInterrupt = true;
+            for (int irq : irqs)
+                raised += HostRaiseInterrupt(provider, irq);
+            tInInterrupt = false;
+            uint64_t spent = now() - start;
+            lock.lock();
+            _stats.interrupts += raised;
+            _stats.interruptNs += spent;
+            continue;
+        }
+
+        uint64_t next = nextEvent();
+        if (next == UINT64_MAX)
+            _changed.wait(lock);
+        else
+        {
+            uint64_t time = now();
+            if (next > time)
+                _changed.wait_for(lock, std::chrono::nanoseconds(next - time));
+        }
+    }
+}
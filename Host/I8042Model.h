@@ -0,0 +1,279 @@
+//
+// Software model of an i8042 keyboard controller with its PS/2 devices, for
+// running the controller off-target (see Host/README.md).
+//
+// The model backs ps2_inb and ps2_outb (the controller is built with
+// PS2_PORT_IO_EXTERNAL), and runs in real time: every byte takes its time on
+// the wire, devices take their time to answer, and each byte loaded into the
+// output buffer raises IRQ 1 or IRQ 12 on the provider, if the command byte
+// enables it.  What is modelled:
+//
+//  - status and data ports, input buffer busy while a byte goes out to a
+//    device, output buffer shared by all ports (a full output buffer
+//    inhibits every device, like the clock line does)
+//  - the settle time: a data port read sooner than settleUs after the status
+//    port first showed the output buffer full returns the previous byte, and
+//    the new one is lost (timed from the status read, not from when the byte
+//    came in, so that what decides is the host's delay between the two reads
+//    and not how late the host got to the interrupt)
+//  - controller commands 20, 60, A7-AB, AD, AE, D1-D4, 90-93 and the active
+//    multiplexing handshake (F0, 56, A4 through D3), after which aux data
+//    carries its port in status bits 6-7
+//  - a keyboard (ACK, reset, ID, LEDs, typematic, scanning on and off, typed
+//    bytes) and touchpads (ACK, reset and self-test, ID, status, Elan knock,
+//    parameters, stream mode packets), one per aux port
+//  - a command to a port without a device times out with FE
+//
+// The keyboard speaks the translated scan code set itself, the model does
+// not translate.
+//
+
+#ifndef _I8042MODEL_H
+#define _I8042MODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class IOService;
+
+struct I8042Timing
+{
+    unsigned portAccessNs   = 1000;     // one in or out instruction
+    unsigned settleUs       = 0;        // data port valid after the status port shows it full
+    unsigned controllerUs   = 20;       // controller command turnaround
+    unsigned byteUs         = 1000;     // one byte on the wire, either way (11 bits at ~11 kHz)
+    unsigned deviceUs       = 200;      // device answers a command
+    unsigned resetUs        = 100000;   // device self-test after a reset
+    unsigned absentUs       = 2000;     // controller gives up on a missing device
+};
+
+struct I8042Statistics
+{
+    uint64_t statusReads;
+    uint64_t dataReads;
+    uint64_t writes;
+    uint64_t bytesToHost;       // loaded into the output buffer
+    uint64_t bytesLost;         // read before they settled
+    uint64_t bytesToDevices;
+    uint64_t interrupts;
+    uint64_t interruptNs;       // spent in the controller's interrupt handlers
+    uint64_t interruptReads;    // data port reads from those handlers
+};
+
+class I8042Model;
+
+//
+// A PS/2 device on one port.  Everything here runs with the model's lock
+// held: receive when a byte from the host has gone over the wire, run when
+// the time the device asked for with deadline has come.
+//
+
+class I8042Device
+{
+public:
+    virtual ~I8042Device() {}
+
+    virtual void receive(uint8_t byte, uint64_t now) = 0;
+    virtual uint64_t deadline() const { return 0; }    // 0 for nothing to do
+    virtual void run(uint64_t now) {}
+
+protected:
+    // queue bytes for the host, the first one ready delayUs from now
+    void send(const uint8_t* bytes, size_t count, unsigned delayUs);
+    void send(uint8_t byte, unsigned delayUs) { send(&byte, 1, delayUs); }
+    // drop what has not been sent yet (a host command cancels a packet)
+    void discard();
+    bool sending() const;               // bytes queued and not yet taken
+    const I8042Timing& timing() const;
+
+private:
+    friend class I8042Model;
+    I8042Model* _model = nullptr;
+    int _port = 0;
+};
+
+//
+// Keyboard: answers like an AT keyboard and sends typed bytes while
+// scanning is enabled.
+//
+
+class I8042Keyboard : public I8042Device
+{
+public:
+    void receive(uint8_t byte, uint64_t now) override;
+
+    // types bytes (make/break codes), held back while scanning is disabled;
+    // call from I8042Model::access
+    void type(const uint8_t* bytes, size_t count);
+    bool scanning() const { return _scanning; }
+
+    uint64_t deadline() const override;
+    void run(uint64_t now) override;
+
+private:
+    std::deque<uint8_t> _typed;     // keyboard buffer, one byte on the wire at a time
+    uint8_t _inFlight = 0;
+    bool _sendingTyped = false;
+    uint8_t _pending = 0;           // command waiting for its parameter
+    bool _scanning = true;
+};
+
+//
+// Touchpad: answers like an Elan touchpad on the aux port.  While a finger
+// is down and reporting is enabled it streams a 6-byte packet every period.
+//
+
+class I8042Touchpad : public I8042Device
+{
+public:
+    void receive(uint8_t byte, uint64_t now) override;
+    uint64_t deadline() const override;
+    void run(uint64_t now) override;
+
+    // call from I8042Model::access
+    void setFinger(bool down, unsigned packetsPerSecond = 80);
+    bool reporting() const { return _reporting; }
+
+private:
+    uint8_t _pending = 0;           // command waiting for its parameter
+    unsigned _knock = 0;            // consecutive E6 (Elan signature knock)
+    uint8_t _rate = 100;
+    uint8_t _resolution = 2;
+    bool _reporting = false;
+    bool _finger = false;
+    uint64_t _period = 0;
+    uint64_t _next = 0;
+};
+
+//
+// The controller.  Driver port numbering: 0 is the keyboard, 1-4 the aux
+// ports (mux ports 0-3; only port 1 is reachable without multiplexing).
+//
+
+class I8042Model
+{
+public:
+    enum { kPortCount = 5 };
+
+    // the model behind ps2_inb and ps2_outb
+    static I8042Model& shared();
+
+    // before the controller starts
+    void configure(const I8042Timing& timing, bool multiplexing);
+    void attach(int port, I8042Device* device);         // model owns device
+    void setInterruptProvider(IOService* provider);
+
+    // changes timing on the fly (eg. the settle time)
+    void setTiming(const I8042Timing& timing);
+    I8042Timing currentTiming();
+
+    I8042Statistics statistics();
+    void resetStatistics();
+    bool multiplexing();
+    uint8_t commandByte();
+
+    // runs fn with the model locked, for poking devices from the outside
+    template <typename Fn> void access(Fn fn)
+    {
+        std::unique_lock<std::mutex> lock(_lock);
+        advance(now());
+        fn();
+        _changed.notify_all();
+    }
+
+    uint8_t inb(uint16_t port);
+    void outb(uint16_t port, uint8_t data);
+
+    static uint64_t now();
+
+private:
+    friend class I8042Device;
+
+    struct Byte
+    {
+        uint8_t data;
+        uint64_t notBefore;
+    };
+
+    struct Port
+    {
+        I8042Device* device = nullptr;
+        std::deque<Byte> tx;            // device to host
+        bool enabled = true;            // per-port clock in mux mode
+        uint64_t clockSince = 0;
+    };
+
+    struct Output                       // generated by the controller
+    {
+        uint8_t data;
+        uint8_t status;
+        int port;
+        uint64_t notBefore;
+    };
+
+    struct Delivery                     // host to device, on the wire
+    {
+        int port;
+        uint8_t data;
+        uint64_t arrival;
+    };
+
+    I8042Model();
+    void threadMain();
+    void spin(unsigned ns);
+
+    void advance(uint64_t now);
+    uint64_t nextEvent();
+    bool portClock(int port) const;
+    uint8_t portStatus(int port) const;
+    void load(uint8_t data, uint8_t status, int port, uint64_t now);
+    void release(uint64_t now);
+
+    void controllerCommand(uint8_t command, uint64_t now);
+    void controllerData(uint8_t data, uint64_t now);
+    void controllerOutput(uint8_t data, int port, uint8_t status, uint64_t now, unsigned delayUs);
+    void transmit(int port, uint8_t data, uint64_t now);
+    void setClock(int port, bool enabled, uint64_t now);
+    void setCommandByte(uint8_t value, uint64_t now);
+    uint64_t readyAt(int port) const;
+
+    std::mutex _lock;
+    std::condition_variable _changed;
+    IOService* _provider = nullptr;
+    I8042Timing _timing;
+    std::atomic<unsigned> _portAccessNs{0};     // spun outside the lock
+    I8042Statistics _stats = {};
+    bool _muxCapable = false;
+    bool _started = false;
+    uint64_t _eventTime = 0;            // time of what the model is processing
+
+    Port _ports[kPortCount];
+    std::deque<Output> _outputs;
+    std::deque<Delivery> _wire;
+    std::vector<int> _irqs;             // raised by the model thread
+
+    uint8_t _commandByte = 0x47;
+    uint8_t _pendingCommand = 0;        // controller command taking a data byte
+    uint8_t _handshake[3] = {};         // last bytes through D3
+    bool _mux = false;
+
+    bool _obf = false;
+    uint8_t _obfData = 0;
+    uint8_t _obfStatus = 0;
+    uint64_t _obfAt = 0;
+    uint64_t _obfSeenAt = 0;            // first status read showing it, or 0
+    uint64_t _obfFreeSince = 0;
+    uint8_t _dataRegister = 0;          // what the data port shows
+    bool _lastCommand = false;          // status bit 3
+    uint64_t _ibfUntil = 0;
+    uint64_t _wireBusyUntil = 0;
+};
+
+#endif
@@ -0,0 +1,125 @@
+//
+// PS2Bench: throughput of the controller's interrupt drain loop on the
+// i8042 model.  A touchpad streams 6-byte packets at a given rate; the
+// benchmark reports the bytes per second that reach the driver, and the time
+// the interrupt handler spends per byte drained (status polls, settle
+// delays, data port reads and dispatch to the driver).
+//
+// usage: ps2bench [-s seconds] [-r packets/s] [-b byte-us] [-p port-ns]
+//                 [-d data-delay-us] [-m]
+//
+// -b sets the time a byte takes on the wire (1000 us on real hardware; less
+// lets the drain loop, not the wire, set the pace), -p the cost of one port
+// access, -d the controller's DataDelay, -m turns on active multiplexing.
+// Exits non-zero if no data got through, or bytes were lost.
+//
+
+#include "HostSystem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage()
+{
+    fprintf(stderr, "usage: ps2bench [-s seconds] [-r packets/s] [-b byte-us] [-p port-ns] [-d data-delay-us] [-m]\n");
+    fflush(stderr);
+    _exit(2);
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = 2;
+    unsigned rate = 1000;
+    unsigned dataDelay = kDataDelay;
+    bool multiplexing = false;
+    I8042Timing timing;
+    timing.byteUs = 100;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if (!strcmp(arg, "-m"))
+        {
+            multiplexing = true;
+            continue;
+        }
+        if (i + 1 >= argc || arg[0] != '-' || strlen(arg) != 2)
+            usage();
+        const char* value = argv[++i];
+        switch (arg[1])
+        {
+            case 's': seconds = atof(value); break;
+            case 'r': rate = atoi(value); break;
+            case 'b': timing.byteUs = atoi(value); break;
+            case 'p': timing.portAccessNs = atoi(value); break;
+            case 'd': dataDelay = atoi(value); break;
+            default: usage();
+        }
+    }
+
+    OSDictionary* config = OSDictionary::withCapacity(1);
+    OSNumber* number = OSNumber::withNumber(dataDelay, 32);
+    config->setObject("DataDelay", number);
+    number->release();
+
+    HostSystem system;
+    if (!system.start(timing, multiplexing, 1, config))
+    {
+        fprintf(stderr, "ps2bench: controller did not start\n");
+        fflush(stderr);
+        _exit(1);
+    }
+    config->release();
+
+    HostDriver* keyboard = new HostDriver;
+    HostDriver* touchpad = new HostDriver;
+    if (!keyboard->start(system.nub(kPS2KbdIdx), 1) ||
+        !touchpad->start(system.nub(kPS2AuxIdx), 6) ||
+        !touchpad->send(PS2Send(kDP_Enable)))
+    {
+        fprintf(stderr, "ps2bench: touchpad did not answer\n");
+        fflush(stderr);
+        _exit(1);
+    }
+
+    I8042Model& model = I8042Model::shared();
+    I8042Touchpad* pad = system.touchpad(kPS2AuxIdx);
+    model.access([&] { pad->setFinger(true, rate); });
+
+    // skip the first packets, then measure
+    usleep(100000);
+    I8042Statistics before = model.statistics();
+    uint64_t bytes = touchpad->bytes();
+    uint64_t packets = touchpad->packets();
+    uint64_t start = HostNow();
+    usleep((useconds_t)(seconds * 1000000));
+    I8042Statistics after = model.statistics();
+    bytes = touchpad->bytes() - bytes;
+    packets = touchpad->packets() - packets;
+    double elapsed = (HostNow() - start) / 1e9;
+    model.access([&] { pad->setFinger(false); });
+
+    uint64_t drained = after.interruptReads - before.interruptReads;
+    uint64_t interrupts = after.interrupts - before.interrupts;
+    uint64_t spent = after.interruptNs - before.interruptNs;
+    uint64_t accesses = (after.statusReads - before.statusReads) + (after.dataReads - before.dataReads) +
+                        (after.writes - before.writes);
+    uint64_t lost = after.bytesLost - before.bytesLost;
+
+    printf("ps2bench: 6-byte packets at %u/s, byte %u us, port access %u ns, data delay %u us%s\n",
+           rate, timing.byteUs, timing.portAccessNs, dataDelay,
+           !multiplexing ? "" : model.multiplexing() ? ", multiplexing" : ", multiplexing refused");
+    printf("  delivered    %llu bytes in %.2f s: %.0f bytes/s, %.0f packets/s\n",
+           (unsigned long long)bytes, elapsed, bytes / elapsed, packets / elapsed);
+    printf("  drain loop   %llu bytes in %llu interrupts: %.2f us per byte, %.2f bytes per interrupt\n",
+           (unsigned long long)drained, (unsigned long long)interrupts,
+           drained ? spent / 1000.0 / drained : 0.0, interrupts ? (double)drained / interrupts : 0.0);
+    printf("  port access  %.2f per byte\n", bytes ? (double)accesses / bytes : 0.0);
+    printf("  lost         %llu bytes\n", (unsigned long long)lost);
+    fflush(stdout);
+
+    // the work loops and the model run on detached threads for good
+    _exit(bytes && !lost ? 0 : 1);
+}
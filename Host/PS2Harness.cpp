@@ -0,0 +1,681 @@
+//
+// PS2Harness: test cases running the controller on the i8042 model.  Each
+// case brings the controller up in its own process.
+//
+// usage: ps2harness <case>
+//
+//   requests   per-request wall time and work loop blocking time of typical
+//              aux and keyboard requests, polled (before interrupts are
+//              installed) and asynchronous; a keyboard request during a
+//              multi-read aux request
+//   keyboard-latency
+//              keystroke and keyboard LED request latency while the touchpad
+//              runs an Elan-like init sequence, against an idle touchpad
+//   warm-resume
+//              Elan v3 and v4 wake sequences: full setup against the warm
+//              resume fast path (verify firmware and capabilities, replay
+//              the registers)
+//   wake       time to the first keystroke and the first touchpad packet after
+//              a wake, with and without OverlapDeviceWake
+//   data-delay calibrated DataDelay on a controller whose data port settles
+//              slowly, and bytes lost in streaming and replies at each
+//              candidate delay
+//
+
+#include "HostSystem.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+
+static HostSystem sSystem;
+static int sFailures;
+
+static void check(bool condition, const char* format, ...)
+{
+    if (condition)
+        return;
+    va_list args;
+    va_start(args, format);
+    printf("  FAILED: ");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+    sFailures++;
+}
+
+static double ms(uint64_t ns)
+{
+    return ns / 1e6;
+}
+
+static bool bringUp(const I8042Timing& timing, OSDictionary* config = NULL)
+{
+    if (sSystem.start(timing, false, 1, config))
+        return true;
+    printf("controller did not start\n");
+    return false;
+}
+
+//
+// A request run on a nub, timed: wall time of submitRequestAndBlock, time
+// the controller's work loop spent with its gate closed meanwhile, and the
+// longest single closure.
+//
+
+struct Timing
+{
+    bool succeeded;
+    uint64_t wall;
+    uint64_t held;
+    uint64_t heldMax;
+};
+
+template <class... Steps>
+static Timing timeRequest(ApplePS2Device* device, Steps... steps)
+{
+    IOWorkLoop* workLoop = sSystem.controller()->getWorkLoop();
+    auto request = makePS2Script(steps...);
+    workLoop->resetGateStatistics();
+    uint64_t start = HostNow();
+    device->submitRequestAndBlock(&request);
+    Timing timing;
+    timing.wall = HostNow() - start;
+    IOWorkLoop::GateStatistics stats = workLoop->getGateStatistics();
+    timing.succeeded = request.succeeded();
+    timing.held = stats.heldTotal;
+    timing.heldMax = stats.heldMax;
+    return timing;
+}
+
+static void report(const char* name, const Timing& timing)
+{
+    printf("  %-22s %8.2f ms wall %8.2f ms gate held %8.2f ms longest%s\n", name,
+           ms(timing.wall), ms(timing.held), ms(timing.heldMax), timing.succeeded ? "" : "  (failed)");
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+template <class... Steps>
+static Timing runRequest(const char* name, ApplePS2Device* device, Steps... steps)
+{
+    Timing timing = timeRequest(device, steps...);
+    report(name, timing);
+    check(timing.succeeded, "%s did not complete", name);
+    return timing;
+}
+
+static uint64_t runRequests(const char* mode)
+{
+    ApplePS2Device* keyboard = sSystem.nub(kPS2KbdIdx);
+    ApplePS2Device* aux = sSystem.nub(kPS2AuxIdx);
+    uint64_t heldMax = 0;
+
+    printf("%s\n", mode);
+    Timing timings[] = {
+        runRequest("aux identify", aux, PS2Send(kDP_GetId), PS2Read<1>()),
+        runRequest("aux status", aux, PS2Send(kDP_GetMouseInformation), PS2Read<3>()),
+        runRequest("aux sliced query", aux, PS2Send(kDP_SetMouseScaling1To1), PS2Sliced(0x01),
+                   PS2Send(kDP_GetMouseInformation), PS2Read<3>()),
+        runRequest("aux sample rate", aux, PS2Send(kDP_SetMouseSampleRate), PS2Send(100)),
+        runRequest("aux reset", aux, PS2Send(kDP_Reset), PS2Read<2>()),
+        runRequest("keyboard LEDs", keyboard, PS2Send(kDP_SetKeyboardLEDs), PS2Send(0x02)),
+    };
+    for (const Timing& timing : timings)
+        heldMax = std::max(heldMax, timing.heldMax);
+    return heldMax;
+}
+
+static int caseRequests()
+{
+    I8042Timing timing;
+    if (!bringUp(timing))
+        return 1;
+
+    // without interrupts the controller polls, holding its work loop
+    runRequests("polled");
+
+    HostDriver* keyboard = new HostDriver;
+    HostDriver* touchpad = new HostDriver;
+    if (!keyboard->start(sSystem.nub(kPS2KbdIdx), 1) || !touchpad->start(sSystem.nub(kPS2AuxIdx), 6))
+        return 1;
+
+    // with interrupts the work loop only runs each step as its byte arrives
+    uint64_t heldMax = runRequests("asynchronous");
+    check(heldMax < 5000000, "work loop held for %.2f ms at a time", ms(heldMax));
+
+    // keyboard requests landing at every point of multi-read aux requests:
+    // the replies must reach the requests, not the drivers
+    printf("keyboard requests during multi-read aux requests\n");
+    uint64_t leaked = touchpad->bytes() + keyboard->bytes();
+    uint64_t longest = 0;
+    int completed = 0, intact = 0;
+    const int rounds = 16;
+    for (int round = 0; round < rounds; round++)
+    {
+        UInt8 status[3] = {}, reset[2] = {};
+        bool auxDone = false;
+        std::thread aux([&] {
+            auto query = makePS2Script(PS2Send(kDP_GetMouseInformation), PS2Read<3>());
+            touchpad->device()->submitRequestAndBlock(&query);
+            query.results(status);
+            auto selfTest = makePS2Script(PS2Send(kDP_Reset), PS2Read<2>());
+            touchpad->device()->submitRequestAndBlock(&selfTest);
+            selfTest.results(reset);
+            auxDone = query.succeeded() && selfTest.succeeded();
+        });
+        usleep(round * 500);
+        Timing leds = timeRequest(keyboard->device(), PS2Send(kDP_SetKeyboardLEDs), PS2Send(round & 7));
+        aux.join();
+        longest = std::max(longest, leds.wall);
+        completed += auxDone && leds.succeeded;
+        intact += status[0] == 0x00 && status[1] == 0x02 && status[2] == 100 && reset[0] == 0xAA && reset[1] == 0x00;
+    }
+    leaked = touchpad->bytes() + keyboard->bytes() - leaked;
+    printf("  %d of %d rounds completed, %d with intact replies, %llu bytes leaked to drivers, keyboard request %.2f ms at most\n",
+           completed, rounds, intact, (unsigned long long)leaked, ms(longest));
+    check(completed == rounds, "requests did not complete");
+    check(intact == rounds, "aux replies were corrupted");
+    check(!leaked, "replies were delivered to the drivers");
+    return 0;
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+//
+// The requests an Elan v4 touchpad driver makes to bring the touchpad up:
+// reset (the Synaptics-style one, sleeping before the self-test bytes),
+// signature, firmware and capability queries, two register writes of nine
+// single-command requests each, PS/2 parameters.
+//
+
+static bool elanCommand(HostDriver* touchpad, UInt8 command)
+{
+    return touchpad->send(PS2Send(command), PS2Read<0>());
+}
+
+// elantechWriteReg and elantechReadReg of v3 and v4 touchpads: one request
+// per command
+static bool elanWriteReg(HostDriver* touchpad, int version, UInt8 reg, UInt8 value)
+{
+    if (version == 3)
+        return elanCommand(touchpad, 0xF8) && elanCommand(touchpad, 0x00) && elanCommand(touchpad, 0xF8) &&
+               elanCommand(touchpad, reg) && elanCommand(touchpad, 0xF8) && elanCommand(touchpad, value) &&
+               elanCommand(touchpad, kDP_SetMouseScaling1To1);
+    return elanCommand(touchpad, 0xF8) && elanCommand(touchpad, 0x00) && elanCommand(touchpad, 0xF8) &&
+           elanCommand(touchpad, reg) && elanCommand(touchpad, 0xF8) && elanCommand(touchpad, 0x00) &&
+           elanCommand(touchpad, 0xF8) && elanCommand(touchpad, value) &&
+           elanCommand(touchpad, kDP_SetMouseScaling1To1);
+}
+
+static bool elanReadReg(HostDriver* touchpad, UInt8 reg)
+{
+    return elanCommand(touchpad, 0xF8) && elanCommand(touchpad, 0x00) && elanCommand(touchpad, 0xF8) &&
+           elanCommand(touchpad, reg) && touchpad->send(PS2Send(kDP_GetMouseInformation), PS2Read<3>());
+}
+
+static bool elanSetPS2Params(HostDriver* touchpad)
+{
+    return touchpad->send(PS2Send(kDP_SetDefaultsAndDisable), PS2Send(kDP_SetMouseSampleRate), PS2Send(200),
+                          PS2Send(kDP_SetMouseResolution), PS2Send(3), PS2Send(kDP_SetMouseScaling1To1),
+                          PS2Send(kDP_Enable));
+}
+
+static bool elanInit(HostDriver* touchpad)
+{
+    UInt8 wakeDelay = 10;
+    return touchpad->send(PS2Send(kDP_SetDefaultsAndDisable), PS2Send(kDP_SetDefaultsAndDisable),
+                          PS2Send(kDP_Reset), PS2SleepMS(wakeDelay * 2), PS2Read<2>()) &&
+           touchpad->send(PS2Send(kDP_SetMouseScaling1To1), PS2Send(kDP_SetMouseScaling1To1),
+                          PS2Send(kDP_SetMouseScaling1To1), PS2Send(kDP_GetMouseInformation), PS2Read<3>()) &&
+           touchpad->send(PS2Send(kDP_SetMouseScaling1To1), PS2Sliced(0x01)) &&
+           touchpad->send(PS2Send(kDP_GetMouseInformation), PS2Read<3>()) &&
+           touchpad->send(PS2Send(kDP_SetMouseScaling1To1), PS2Sliced(0x02)) &&
+           touchpad->send(PS2Send(kDP_GetMouseInformation), PS2Read<3>()) &&
+           elanWriteReg(touchpad, 4, 0x07, 0x01) &&
+           elanWriteReg(touchpad, 4, 0x07, 0x01) &&
+           touchpad->send(PS2Send(kDP_SetDefaultsAndDisable), PS2Send(kDP_SetMouseSampleRate), PS2Send(100),
+                          PS2Send(kDP_SetMouseResolution), PS2Send(2), PS2Send(kDP_SetMouseScaling1To1),
+                          PS2Send(kDP_Enable));
+}
+
+//
+// Types a key every 2 ms and times it from the keyboard to the driver; every
+// tenth keystroke also times an LED request.  Runs until done is set, or for
+// count keystrokes.
+//
+
+struct KeyboardLatency
+{
+    std::vector<uint64_t> keystrokes;
+    std::vector<uint64_t> leds;
+    int typed = 0;
+    int lost = 0;                   // keystrokes not delivered within 500 ms
+    int failed = 0;                 // LED requests
+};
+
+static KeyboardLatency typeKeys(HostDriver* keyboard, const std::atomic<bool>* done, int count)
+{
+    KeyboardLatency latency;
+    I8042Model& model = I8042Model::shared();
+    I8042Keyboard* device = sSystem.keyboard();
+    static const UInt8 key = 0x1C;
+
+    for (int i = 0; done ? !done->load() : i < count; i++, latency.typed++)
+    {
+        uint64_t bytes = keyboard->bytes();
+        keyboard->mark();
+        uint64_t typed = 0;
+        model.access([&] {
+            typed = HostNow();
+            device->type(&key, 1);
+        });
+        if (!keyboard->waitForBytes(bytes + 1, 500))
+            latency.lost++;
+        else
+            latency.keystrokes.push_back(keyboard->firstByte() - typed);
+
+        if (i % 10 == 9)
+        {
+            Timing leds = timeRequest(keyboard->device(), PS2Send(kDP_SetKeyboardLEDs), PS2Send(i & 7));
+            if (leds.succeeded)
+                latency.leds.push_back(leds.wall);
+            else
+                latency.failed++;
+        }
+        usleep(2000);
+    }
+    return latency;
+}
+
+static void reportLatency(const char* name, const KeyboardLatency& latency)
+{
+    printf("  %-20s keystroke %6.2f ms p50 %6.2f ms p99 %6.2f ms max, LED request %6.2f ms p50 %6.2f ms max (%zu, %zu)\n",
+           name, ms(HostPercentile(latency.keystrokes, 50)), ms(HostPercentile(latency.keystrokes, 99)),
+           ms(HostPercentile(latency.keystrokes, 100)), ms(HostPercentile(latency.leds, 50)),
+           ms(HostPercentile(latency.leds, 100)), latency.keystrokes.size(), latency.leds.size());
+}
+
+static int caseKeyboardLatency()
+{
+    I8042Timing timing;
+    if (!bringUp(timing))
+        return 1;
+
+    HostDriver* keyboard = new HostDriver;
+    HostDriver* touchpad = new HostDriver;
+    if (!keyboard->start(sSystem.nub(kPS2KbdIdx), 1) || !touchpad->start(sSystem.nub(kPS2AuxIdx), 6) ||
+        !keyboard->send(PS2Send(kDP_Enable)))
+        return 1;
+
+    uint64_t start = HostNow();
+    bool initialized = elanInit(touchpad);
+    uint64_t initTime = HostNow() - start;
+    check(initialized, "touchpad init sequence failed");
+    printf("touchpad init sequence alone: %.2f ms\n", ms(initTime));
+
+    printf("keyboard\n");
+    KeyboardLatency idle = typeKeys(keyboard, NULL, 200);
+    reportLatency("touchpad idle", idle);
+
+    // the touchpad is initialized over and over while keys are typed; no
+    // finger is down, anything the touchpad driver gets is a stray reply
+    uint64_t keyboardBytes = keyboard->bytes();
+    uint64_t touchpadBytes = touchpad->bytes();
+    std::atomic<bool> done {false};
+    int passes = 0, failed = 0;
+    std::thread init([&] {
+        while (passes < 4)
+        {
+            failed += !elanInit(touchpad);
+            passes++;
+        }
+        done = true;
+    });
+    KeyboardLatency busy = typeKeys(keyboard, &done, 0);
+    init.join();
+    reportLatency("touchpad init", busy);
+    uint64_t strayKeyboard = keyboard->bytes() - keyboardBytes - busy.typed;
+    uint64_t strayTouchpad = touchpad->bytes() - touchpadBytes;
+    printf("  %d init passes, %d failed; %d keystrokes, %d late; %d LED requests failed; %llu stray bytes\n",
+           passes, failed, busy.typed, busy.lost, busy.failed, (unsigned long long)(strayKeyboard + strayTouchpad));
+
+    check(!idle.lost && !busy.lost, "keystrokes were not delivered");
+    check(!idle.failed && !busy.failed, "LED requests failed");
+    check(!failed, "touchpad init failed while typing");
+    check(!strayKeyboard && !strayTouchpad, "replies were delivered to the drivers");
+
+    // keystrokes are not requests: they never wait for the touchpad
+    uint64_t idleP99 = HostPercentile(idle.keystrokes, 99);
+    uint64_t busyP99 = HostPercentile(busy.keystrokes, 99);
+    check(busyP99 < idleP99 + 2000000, "keystrokes wait for the touchpad (p99 %.2f ms, idle %.2f ms)",
+          ms(busyP99), ms(idleP99));
+
+    // LED requests wait at most for the touchpad command in flight, most of
+    // them for nothing
+    check(HostPercentile(busy.leds, 50) < 10000000, "LED requests wait for the touchpad sequence");
+    return 0;
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+//
+// What ApplePS2Elan::setDevicePowerState does with the touchpad on wake after
+// its reset: elantechSetupPS2 (absolute mode, with the register read back on
+// v3, then the PS/2 parameters), or elantechWarmResume (firmware version
+// and capabilities compared, the registers of the last setup replayed, read
+// back on v3, the PS/2 parameters); then the touchpad is enabled.
+//
+
+static bool elanFullSetup(HostDriver* touchpad, int version)
+{
+    UInt8 reg = version == 3 ? 0x10 : 0x07;
+    return elanWriteReg(touchpad, version, reg, 0x01) &&
+           (version != 3 || elanReadReg(touchpad, reg)) &&
+           elanSetPS2Params(touchpad) &&
+           elanCommand(touchpad, kDP_Enable);
+}
+
+static bool elanWarmResume(HostDriver* touchpad, int version)
+{
+    UInt8 reg = version == 3 ? 0x10 : 0x07;
+    return touchpad->send(PS2Send(kDP_SetMouseScaling1To1), PS2Sliced(0x01)) &&
+           touchpad->send(PS2Send(kDP_GetMouseInformation), PS2Read<3>()) &&
+           elanCommand(touchpad, 0xF8) && elanCommand(touchpad, 0x02) &&
+           touchpad->send(PS2Send(kDP_GetMouseInformation), PS2Read<3>()) &&
+           elanWriteReg(touchpad, version, reg, 0x01) &&
+           (version != 3 || elanReadReg(touchpad, reg)) &&
+           elanSetPS2Params(touchpad) &&
+           elanCommand(touchpad, kDP_Enable);
+}
+
+static int caseWarmResume()
+{
+    I8042Timing timing;
+    if (!bringUp(timing))
+        return 1;
+
+    HostDriver* touchpad = new HostDriver;
+    if (!touchpad->start(sSystem.nub(kPS2AuxIdx), 6))
+        return 1;
+    I8042Touchpad* pad = sSystem.touchpad(kPS2AuxIdx);
+
+    const int rounds = 10;
+    for (int version = 3; version <= 4; version++)
+    {
+        std::vector<uint64_t> times[2];
+        for (int round = 0; round < rounds; round++)
+        {
+            for (int warm = 0; warm < 2; warm++)
+            {
+                // both start from the reset the wake path does first
+                bool reset = touchpad->send(PS2Send(kDP_Reset), PS2Read<2>());
+                uint64_t start = HostNow();
+                bool done = warm ? elanWarmResume(touchpad, version) : elanFullSetup(touchpad, version);
+                uint64_t elapsed = HostNow() - start;
+                check(reset && done, "v%d %s failed", version, warm ? "warm resume" : "full setup");
+                check(pad->reporting(), "v%d touchpad not reporting after %s", version, warm ? "warm resume" : "full setup");
+                times[warm].push_back(elapsed);
+            }
+        }
+        uint64_t full = HostPercentile(times[0], 50);
+        uint64_t warm = HostPercentile(times[1], 50);
+        printf("v%d  full setup %7.2f ms  warm resume %7.2f ms  (medians of %d, warm %+.2f ms)\n", version,
+               ms(full), ms(warm), rounds, ms(warm) - ms(full));
+    }
+    return 0;
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static void setProperty(const char* key, OSObject* value)
+{
+    OSDictionary* props = OSDictionary::withCapacity(1);
+    props->setObject(key, value);
+    sSystem.controller()->setProperties(props);
+    props->release();
+}
+
+//
+// The power actions of ApplePS2Keyboard (initKeyboard on wake) and of
+// ApplePS2Elan (wake delay, reset, full setup of a v4 touchpad, enable).
+//
+
+static std::atomic<int> sWakeFailures;
+
+static void keyboardPower(HostDriver* keyboard, UInt32 whatToDo)
+{
+    bool done = keyboard->send(PS2Send(kDP_SetDefaults));
+    if (whatToDo == kPS2C_EnableDevice)
+    {
+        done = done && keyboard->send(PS2Send(kDP_SetKeyboardLEDs), PS2Send(0x00)) &&
+               keyboard->send(PS2Send(kDP_Enable));
+        keyboard->device()->setCommandByte(kCB_TranslateMode, 0);
+    }
+    sWakeFailures += !done;
+}
+
+static void touchpadPower(HostDriver* touchpad, UInt32 whatToDo)
+{
+    if (whatToDo != kPS2C_EnableDevice)
+    {
+        sWakeFailures += !elanCommand(touchpad, kDP_SetDefaultsAndDisable);
+        return;
+    }
+    IOSleep(1000);
+    sWakeFailures += !(touchpad->send(PS2Send(kDP_Reset), PS2Read<2>()) && elanFullSetup(touchpad, 4));
+}
+
+static int caseWake()
+{
+    I8042Timing timing;
+    if (!bringUp(timing))
+        return 1;
+
+    HostDriver* keyboard = new HostDriver;
+    HostDriver* touchpad = new HostDriver;
+    if (!keyboard->start(sSystem.nub(kPS2KbdIdx), 1, keyboardPower) ||
+        !touchpad->start(sSystem.nub(kPS2AuxIdx), 6, touchpadPower) ||
+        !keyboard->send(PS2Send(kDP_Enable)))
+        return 1;
+
+    I8042Model& model = I8042Model::shared();
+    I8042Touchpad* pad = sSystem.touchpad(kPS2AuxIdx);
+    static const UInt8 key = 0x1C;
+
+    static const struct
+    {
+        const char* name;
+        bool overlap;
+        bool mouseFirst;
+    } modes[] = {
+        { "sequential", false, false },
+        { "sequential, mouse first", false, true },
+        { "overlapped", true, false },
+        { "overlapped, mouse first", true, true },
+    };
+    uint64_t wakeTimes[4];
+    for (const auto& mode : modes)
+    {
+        setProperty("OverlapDeviceWake", mode.overlap ? kOSBooleanTrue : kOSBooleanFalse);
+        setProperty("MouseWakeFirst", mode.mouseFirst ? kOSBooleanTrue : kOSBooleanFalse);
+
+        std::vector<uint64_t> wake, keystroke, touch;
+        const int rounds = 2;
+        for (int round = 0; round < rounds; round++)
+        {
+            sWakeFailures = 0;
+            check(sSystem.setPowerState(0), "%s: no sleep", mode.name);
+
+            // a finger put down as the lid opens, and a key pressed every
+            // 5 ms until one gets through (the keyboard drops what it has
+            // buffered when the driver resets it)
+            keyboard->mark();
+            touchpad->mark();
+            uint64_t start = HostNow();
+            model.access([&] { pad->setFinger(true); });
+            bool woken = false;
+            std::thread power([&] { woken = sSystem.setPowerState(2); });
+            while (!keyboard->firstByte() && HostNow() - start < 3000000000ULL)
+            {
+                model.access([&] { sSystem.keyboard()->type(&key, 1); });
+                usleep(5000);
+            }
+            power.join();
+            wake.push_back(HostNow() - start);
+            check(woken, "%s: no wake", mode.name);
+            check(keyboard->firstByte(), "%s: no keystroke after the wake", mode.name);
+            check(touchpad->firstByte() || touchpad->waitForBytes(touchpad->bytes() + 1, 2000),
+                  "%s: no touchpad packet after the wake", mode.name);
+            keystroke.push_back(keyboard->firstByte() - start);
+            touch.push_back(touchpad->firstByte() - start);
+            model.access([&] { pad->setFinger(false); });
+            check(!sWakeFailures, "%s: %d power action requests failed", mode.name, sWakeFailures.load());
+        }
+        printf("  %-24s wake %7.2f ms, first keystroke %7.2f ms, first touch %7.2f ms\n", mode.name,
+               ms(HostPercentile(wake, 50)), ms(HostPercentile(keystroke, 50)), ms(HostPercentile(touch, 50)));
+        wakeTimes[&mode - modes] = HostPercentile(wake, 50);
+    }
+
+    // the keyboard is set up while the touchpad driver sleeps before its reset
+    check(wakeTimes[2] < wakeTimes[0] + 2000000 && wakeTimes[3] < wakeTimes[1] + 2000000,
+          "overlapped wake slower than sequential");
+    return 0;
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static void setDataDelay(unsigned delay)
+{
+    OSDictionary* props = OSDictionary::withCapacity(1);
+    OSNumber* number = OSNumber::withNumber(delay, 32);
+    props->setObject("DataDelay", number);
+    number->release();
+    sSystem.controller()->setProperties(props);
+    props->release();
+}
+
+static int caseDataDelay()
+{
+    // the data port shows a new byte 4 us after the status port does: delays
+    // from 4 us read it safely, 2 us and less (plus the access time) do not
+    I8042Timing timing;
+    timing.settleUs = 4;
+    timing.byteUs = 100;
+    OSDictionary* config = OSDictionary::withCapacity(1);
+    config->setObject("CalibrateDataDelay", kOSBooleanTrue);
+    bool started = bringUp(timing, config);
+    config->release();
+    if (!started)
+        return 1;
+
+    OSNumber* number = OSDynamicCast(OSNumber, sSystem.controller()->getProperty("DataDelay"));
+    OSNumber* cost = OSDynamicCast(OSNumber, sSystem.controller()->getProperty("ByteReadCost"));
+    unsigned calibrated = number ? number->unsigned32BitValue() : kDataDelay;
+    printf("calibrated data delay %u us, %u ns per byte\n", calibrated, cost ? cost->unsigned32BitValue() : 0);
+    check(calibrated == 4, "calibrated %u us, the model needs 4 us", calibrated);
+
+    HostDriver* keyboard = new HostDriver;
+    HostDriver* touchpad = new HostDriver;
+    if (!keyboard->start(sSystem.nub(kPS2KbdIdx), 1) || !touchpad->start(sSystem.nub(kPS2AuxIdx), 6))
+        return 1;
+
+    I8042Model& model = I8042Model::shared();
+    I8042Touchpad* pad = sSystem.touchpad(kPS2AuxIdx);
+    static const unsigned delays[] = { 0, 1, 2, 4, 7 };
+    uint64_t lostAtZero = 0;
+    for (unsigned delay : delays)
+    {
+        setDataDelay(delay);
+
+        // packets streamed from the interrupt
+        if (!touchpad->send(PS2Send(kDP_Enable)))
+            touchpad->send(PS2Send(kDP_Enable));
+        I8042Statistics before = model.statistics();
+        uint64_t bytes = touchpad->bytes();
+        model.access([&] { pad->setFinger(true, 1000); });
+        usleep(300000);
+        model.access([&] { pad->setFinger(false); });
+        usleep(10000);
+        uint64_t streamed = touchpad->bytes() - bytes;
+        uint64_t streamLost = model.statistics().bytesLost - before.bytesLost;
+
+        // status replies read by requests, the touchpad quiet
+        before = model.statistics();
+        int intact = 0;
+        const int queries = 20;
+        for (int i = 0; i < queries; i++)
+        {
+            auto status = makePS2Script(PS2Send(kDP_GetMouseInformation), PS2Read<3>());
+            touchpad->device()->submitRequestAndBlock(&status);
+            UInt8 reply[3] = {};
+            status.results(reply);
+            intact += status.succeeded() && reply[0] == 0x20 && reply[1] == 0x02 && reply[2] == 100;
+        }
+        uint64_t replyLost = model.statistics().bytesLost - before.bytesLost;
+
+        printf("  data delay %u us: %6llu bytes streamed, %4llu lost; %2d of %d status replies intact, %llu bytes lost\n",
+               delay, (unsigned long long)streamed, (unsigned long long)streamLost, intact, queries,
+               (unsigned long long)replyLost);
+        if (delay >= calibrated)
+        {
+            check(streamed && !streamLost, "bytes lost streaming at %u us", delay);
+            check(intact == queries && !replyLost, "replies lost at %u us", delay);
+        }
+        if (!delay)
+            lostAtZero = streamLost + replyLost;
+
+        // whatever half packet a lost byte left behind
+        touchpad->send(PS2Send(kDP_SetDefaultsAndDisable));
+        usleep(10000);
+    }
+
+    // the model is right about what a too short delay does
+    check(lostAtZero, "no bytes lost without a data delay");
+    return 0;
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static const struct
+{
+    const char* name;
+    int (*run)();
+} sCases[] = {
+    { "requests", caseRequests },
+    { "keyboard-latency", caseKeyboardLatency },
+    { "warm-resume", caseWarmResume },
+    { "wake", caseWake },
+    { "data-delay", caseDataDelay },
+};
+
+int main(int argc, char** argv)
+{
+    int result = 2;
+    for (const auto& entry : sCases)
+    {
+        if (argc == 2 && !strcmp(argv[1], entry.name))
+        {
+            printf("ps2harness: %s\n", entry.name);
+            result = entry.run();
+            if (!result && sFailures)
+                result = 1;
+            printf("%s\n", result ? "FAIL" : "PASS");
+        }
+    }
+    if (result == 2)
+    {
+        fprintf(stderr, "usage: ps2harness <case>, one of:");
+        for (const auto& entry : sCases)
+            fprintf(stderr, " %s", entry.name);
+        fprintf(stderr, "\n");
+    }
+    fflush(stdout);
+    fflush(stderr);
+
+    // the work loops and the model run on detached threads for good
+    _exit(result);
+}
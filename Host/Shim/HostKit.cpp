@@ -0,0 +1,1215 @@
+//
+// HostKit implementation, see HostKit.h.
+//
+
+#include "HostKit.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <cxxabi.h>
+#include <map>
+#include <typeinfo>
+
+unsigned long page_size = 4096;
+
+const IORegistryPlane* gIOServicePlane = NULL;
+
+static OSBoolean sBooleanTrue(true);
+static OSBoolean sBooleanFalse(false);
+OSBoolean* const kOSBooleanTrue = &sBooleanTrue;
+OSBoolean* const kOSBooleanFalse = &sBooleanFalse;
+
+const OSSymbol* gIOPublishNotification = OSSymbol::withCString("IOServicePublish");
+const OSSymbol* gIOFirstPublishNotification = OSSymbol::withCString("IOServiceFirstPublish");
+const OSSymbol* gIOTerminatedNotification = OSSymbol::withCString("IOServiceTerminate");
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Objects
+//
+
+void OSMetaClassBase::release() const
+{
+    if (_retainCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        const_cast<OSMetaClassBase*>(this)->free();
+}
+
+OSMetaClassBase::_ptf_t OSMetaClassBase::_ptmf2ptf(const OSMetaClassBase* self, void (OSMetaClassBase::*func)(void))
+{
+    // { function address or 1 + vtable offset, this adjustment }
+    struct PTMF
+    {
+        uintptr_t fn;
+        ptrdiff_t delta;
+    } ptmf;
+    static_assert(sizeof(ptmf) == sizeof(func), "unexpected member function pointer layout");
+    memcpy(&ptmf, &func, sizeof(ptmf));
+
+    if (!(ptmf.fn & 1))
+        return (_ptf_t)ptmf.fn;
+    const char* object = (const char*)self + ptmf.delta;
+    const char* vtable = *(const char* const*)object;
+    return *(const _ptf_t*)(vtable + ptmf.fn - 1);
+}
+
+OSString* OSString::withCString(const char* cString)
+{
+    OSString* string = new OSString;
+    string->_string = cString ? cString : "";
+    return string;
+}
+
+bool OSString::setChar(char c, unsigned index)
+{
+    if (index >= _string.size())
+        return false;
+    _string[index] = c;
+    return true;
+}
+
+const OSSymbol* OSSymbol::withCString(const char* cString)
+{
+    OSSymbol* symbol = new OSSymbol;
+    symbol->_string = cString ? cString : "";
+    return symbol;
+}
+
+OSNumber* OSNumber::withNumber(unsigned long long value, unsigned numberOfBits)
+{
+    OSNumber* number = new OSNumber;
+    if (numberOfBits < 64)
+        value &= (1ULL << numberOfBits) - 1;
+    number->_value = value;
+    return number;
+}
+
+OSBoolean* OSBoolean::withBoolean(bool value)
+{
+    return value ? kOSBooleanTrue : kOSBooleanFalse;
+}
+
+OSData* OSData::withBytes(const void* bytes, unsigned length)
+{
+    OSData* data = new OSData;
+    data->appendBytes(bytes, length);
+    return data;
+}
+
+OSData* OSData::withCapacity(unsigned capacity)
+{
+    OSData* data = new OSData;
+    data->_bytes.reserve(capacity);
+    return data;
+}
+
+const void* OSData::getBytesNoCopy(unsigned start, unsigned length) const
+{
+    if (start + length > _bytes.size() || !length)
+        return NULL;
+    return _bytes.data() + start;
+}
+
+bool OSData::appendBytes(const void* bytes, unsigned length)
+{
+    const UInt8* p = (const UInt8*)bytes;
+    if (p)
+        _bytes.insert(_bytes.end(), p, p + length);
+    else
+        _bytes.resize(_bytes.size() + length);
+    return true;
+}
+
+OSArray* OSArray::withCapacity(unsigned capacity)
+{
+    OSArray* array = new OSArray;
+    array->_objects.reserve(capacity);
+    return array;
+}
+
+void OSArray::flushCollection()
+{
+    for (OSObject* object : _objects)
+        object->release();
+    _objects.clear();
+}
+
+OSObject* OSArray::getObject(unsigned index) const
+{
+    return index < _objects.size() ? _objects[index] : NULL;
+}
+
+bool OSArray::setObject(const OSMetaClassBase* object)
+{
+    if (!object)
+        return false;
+    object->retain();
+    _objects.push_back((OSObject*)object);
+    return true;
+}
+
+bool OSArray::replaceObject(unsigned index, const OSMetaClassBase* object)
+{
+    if (!object || index >= _objects.size())
+        return false;
+    object->retain();
+    _objects[index]->release();
+    _objects[index] = (OSObject*)object;
+    return true;
+}
+
+void OSArray::removeObject(unsigned index)
+{
+    if (index >= _objects.size())
+        return;
+    _objects[index]->release();
+    _objects.erase(_objects.begin() + index);
+}
+
+OSDictionary* OSDictionary::withCapacity(unsigned capacity)
+{
+    OSDictionary* dict = new OSDictionary;
+    dict->_entries.reserve(capacity);
+    return dict;
+}
+
+OSDictionary* OSDictionary::withDictionary(const OSDictionary* dict, unsigned capacity)
+{
+    OSDictionary* copy = withCapacity(capacity);
+    if (dict)
+        copy->merge(dict);
+    return copy;
+}
+
+OSObject* OSDictionary::getObjectAt(unsigned index) const
+{
+    return index < _entries.size() ? _entries[index].second : NULL;
+}
+
+void OSDictionary::flushCollection()
+{
+    for (auto& entry : _entries)
+        entry.second->release();
+    _entries.clear();
+}
+
+OSObject* OSDictionary::getObject(const char* key) const
+{
+    for (const auto& entry : _entries)
+        if (entry.first == key)
+            return entry.second;
+    return NULL;
+}
+
+bool OSDictionary::setObject(const char* key, const OSMetaClassBase* object)
+{
+    if (!key || !object)
+        return false;
+    object->retain();
+    for (auto& entry : _entries)
+    {
+        if (entry.first == key)
+        {
+            entry.second->release();
+            entry.second = (OSObject*)object;
+            return true;
+        }
+    }
+    _entries.emplace_back(key, (OSObject*)object);
+    return true;
+}
+
+void OSDictionary::removeObject(const char* key)
+{
+    for (auto it = _entries.begin(); it != _entries.end(); ++it)
+    {
+        if (it->first == key)
+        {
+            it->second->release();
+            _entries.erase(it);
+            return;
+        }
+    }
+}
+
+bool OSDictionary::merge(const OSDictionary* dict)
+{
+    if (!dict)
+        return false;
+    for (const auto& entry : dict->_entries)
+        setObject(entry.first.c_str(), entry.second);
+    return true;
+}
+
+OSSet* OSSet::withCapacity(unsigned capacity)
+{
+    OSSet* set = new OSSet;
+    set->_objects.reserve(capacity);
+    return set;
+}
+
+void OSSet::flushCollection()
+{
+    for (OSObject* object : _objects)
+        object->release();
+    _objects.clear();
+}
+
+bool OSSet::setObject(const OSMetaClassBase* object)
+{
+    if (!object || containsObject(object))
+        return false;
+    object->retain();
+    _objects.push_back((OSObject*)object);
+    return true;
+}
+
+void OSSet::removeObject(const OSMetaClassBase* object)
+{
+    for (auto it = _objects.begin(); it != _objects.end(); ++it)
+    {
+        if (*it == object)
+        {
+            (*it)->release();
+            _objects.erase(it);
+            return;
+        }
+    }
+}
+
+bool OSSet::containsObject(const OSMetaClassBase* object) const
+{
+    for (OSObject* member : _objects)
+        if (member == object)
+            return true;
+    return false;
+}
+
+OSCollectionIterator* OSCollectionIterator::withCollection(const OSCollection* collection)
+{
+    if (!collection)
+        return NULL;
+    OSCollectionIterator* iterator = new OSCollectionIterator;
+    collection->retain();
+    iterator->_collection = collection;
+    return iterator;
+}
+
+OSCollectionIterator::~OSCollectionIterator()
+{
+    if (_collection)
+        _collection->release();
+}
+
+OSObject* OSCollectionIterator::getNextObject()
+{
+    if (_index >= _collection->getCount())
+        return NULL;
+    return _collection->getObjectAt(_index++);
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Time, locks and threads
+//
+
+static uint64_t uptimeNanoseconds()
+{
+    static const auto origin = std::chrono::steady_clock::now();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+static std::chrono::steady_clock::time_point timePointFromUptime(uint64_t uptime)
+{
+    uint64_t now = uptimeNanoseconds();
+    auto base = std::chrono::steady_clock::now();
+    if (uptime <= now)
+        return base;
+    return base + std::chrono::nanoseconds(uptime - now);
+}
+
+void clock_get_uptime(uint64_t* result)
+{
+    *result = uptimeNanoseconds();
+}
+
+void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t* result)
+{
+    *result = abstime;
+}
+
+void nanoseconds_to_absolutetime(uint64_t nanoseconds, uint64_t* result)
+{
+    *result = nanoseconds;
+}
+
+void clock_interval_to_deadline(uint32_t interval, uint32_t scale_factor, uint64_t* result)
+{
+    *result = uptimeNanoseconds() + (uint64_t)interval * scale_factor;
+}
+
+void clock_get_system_microtime(uint32_t* secs, uint32_t* microsecs)
+{
+    uint64_t now = uptimeNanoseconds();
+    *secs = (uint32_t)(now / 1000000000);
+    *microsecs = (uint32_t)(now / 1000 % 1000000);
+}
+
+uint64_t mach_absolute_time(void)
+{
+    return uptimeNanoseconds();
+}
+
+void IOLog(const char* format, ...)
+{
+    static const bool enabled = getenv("HOSTKIT_LOG") != NULL;
+    if (!enabled)
+        return;
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+void IOSleep(unsigned milliseconds)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+}
+
+void IODelay(unsigned microseconds)
+{
+    // spins, like the kernel's
+    uint64_t end = uptimeNanoseconds() + (uint64_t)microseconds * 1000;
+    while (uptimeNanoseconds() < end)
+        ;
+}
+
+void* IOMalloc(size_t length)
+{
+    return malloc(length);
+}
+
+void IOFree(void* address, size_t length)
+{
+    free(address);
+}
+
+void* IOMallocAligned(size_t length, size_t alignment)
+{
+    void* address = NULL;
+    if (posix_memalign(&address, alignment < sizeof(void*) ? sizeof(void*) : alignment, length))
+        return NULL;
+    return address;
+}
+
+void IOFreeAligned(void* address, size_t length)
+{
+    free(address);
+}
+
+static std::mutex sBootArgLock;
+static std::map<std::string, int> sBootArgs;
+
+void HostSetBootArg(const char* name, int value)
+{
+    std::lock_guard<std::mutex> guard(sBootArgLock);
+    sBootArgs[name] = value;
+}
+
+bool PE_parse_boot_argn(const char* arg_string, void* arg_ptr, int max_arg)
+{
+    std::lock_guard<std::mutex> guard(sBootArgLock);
+    auto it = sBootArgs.find(arg_string);
+    if (it == sBootArgs.end())
+        return false;
+    int value = it->second;
+    memcpy(arg_ptr, &value, max_arg < (int)sizeof(value) ? max_arg : sizeof(value));
+    return true;
+}
+
+bool ml_set_interrupts_enabled(bool enable)
+{
+    return true;
+}
+
+void Debugger(const char* message)
+{
+    fprintf(stderr, "Debugger: %s\n", message);
+    abort();
+}
+
+struct IOLock
+{
+    std::mutex mutex;
+};
+
+IOLock* IOLockAlloc(void)
+{
+    return new IOLock;
+}
+
+void IOLockFree(IOLock* lock)
+{
+    delete lock;
+}
+
+void IOLockLock(IOLock* lock)
+{
+    lock->mutex.lock();
+}
+
+void IOLockUnlock(IOLock* lock)
+{
+    lock->mutex.unlock();
+}
+
+struct IOSimpleLock
+{
+    std::atomic_flag flag = ATOMIC_FLAG_INIT;
+};
+
+IOSimpleLock* IOSimpleLockAlloc(void)
+{
+    return new IOSimpleLock;
+}
+
+void IOSimpleLockFree(IOSimpleLock* lock)
+{
+    delete lock;
+}
+
+void IOSimpleLockLock(IOSimpleLock* lock)
+{
+    while (lock->flag.test_and_set(std::memory_order_acquire))
+        std::this_thread::yield();
+}
+
+void IOSimpleLockUnlock(IOSimpleLock* lock)
+{
+    lock->flag.clear(std::memory_order_release);
+}
+
+IOInterruptState IOSimpleLockLockDisableInterrupt(IOSimpleLock* lock)
+{
+    IOSimpleLockLock(lock);
+    return 0;
+}
+
+void IOSimpleLockUnlockEnableInterrupt(IOSimpleLock* lock, IOInterruptState state)
+{
+    IOSimpleLockUnlock(lock);
+}
+
+struct thread_call
+{
+    thread_call_func_t  func;
+    thread_call_param_t param0;
+    std::atomic<bool>   pending {false};
+};
+
+thread_call_t thread_call_allocate(thread_call_func_t func, thread_call_param_t param0)
+{
+    thread_call_t call = new thread_call;
+    call->func = func;
+    call->param0 = param0;
+    return call;
+}
+
+bool thread_call_enter(thread_call_t call)
+{
+    return thread_call_enter1(call, NULL);
+}
+
+bool thread_call_enter1(thread_call_t call, thread_call_param_t param1)
+{
+    // returns true if the call was already pending (and is not entered again)
+    if (call->pending.exchange(true))
+        return true;
+    std::thread([call, param1]
+    {
+        call->pending.store(false);
+        call->func(call->param0, param1);
+    }).detach();
+    return false;
+}
+
+bool thread_call_cancel(thread_call_t call)
+{
+    return false;
+}
+
+bool thread_call_free(thread_call_t call)
+{
+    // a running call keeps using it, thread calls are few and never freed
+    // while the host tools run
+    return true;
+}
+
+bool OSCompareAndSwap(UInt32 oldValue, UInt32 newValue, volatile UInt32* address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+bool OSCompareAndSwapPtr(void* oldValue, void* newValue, void* volatile* address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+SInt32 OSAddAtomic(SInt32 amount, volatile SInt32* address)
+{
+    return __atomic_fetch_add(address, amount, __ATOMIC_SEQ_CST);
+}
+
+SInt64 OSAddAtomic64(SInt64 amount, volatile SInt64* address)
+{
+    return __atomic_fetch_add(address, amount, __ATOMIC_SEQ_CST);
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Registry and services
+//
+
+IORegistryEntry::IORegistryEntry()
+{
+    _properties = OSDictionary::withCapacity(16);
+}
+
+IORegistryEntry::~IORegistryEntry()
+{
+    OSSafeReleaseNULL(_properties);
+}
+
+bool IORegistryEntry::init(OSDictionary* dictionary)
+{
+    if (dictionary)
+    {
+        std::lock_guard<std::mutex> guard(_propertyLock);
+        _properties->merge(dictionary);
+    }
+    return OSObject::init();
+}
+
+OSObject* IORegistryEntry::getProperty(const char* key) const
+{
+    std::lock_guard<std::mutex> guard(_propertyLock);
+    return _properties->getObject(key);
+}
+
+OSObject* IORegistryEntry::copyProperty(const char* key) const
+{
+    std::lock_guard<std::mutex> guard(_propertyLock);
+    OSObject* object = _properties->getObject(key);
+    if (object)
+        object->retain();
+    return object;
+}
+
+bool IORegistryEntry::setProperty(const char* key, OSObject* object)
+{
+    std::lock_guard<std::mutex> guard(_propertyLock);
+    return _properties->setObject(key, object);
+}
+
+bool IORegistryEntry::setProperty(const char* key, const char* string)
+{
+    OSString* object = OSString::withCString(string);
+    bool result = setProperty(key, object);
+    object->release();
+    return result;
+}
+
+bool IORegistryEntry::setProperty(const char* key, bool value)
+{
+    return setProperty(key, value ? kOSBooleanTrue : kOSBooleanFalse);
+}
+
+bool IORegistryEntry::setProperty(const char* key, unsigned long long value, unsigned numberOfBits)
+{
+    OSNumber* object = OSNumber::withNumber(value, numberOfBits);
+    bool result = setProperty(key, object);
+    object->release();
+    return result;
+}
+
+bool IORegistryEntry::setProperty(const char* key, void* bytes, unsigned length)
+{
+    OSData* object = OSData::withBytes(bytes, length);
+    bool result = setProperty(key, object);
+    object->release();
+    return result;
+}
+
+void IORegistryEntry::removeProperty(const char* key)
+{
+    std::lock_guard<std::mutex> guard(_propertyLock);
+    _properties->removeObject(key);
+}
+
+OSDictionary* IORegistryEntry::dictionaryWithProperties() const
+{
+    std::lock_guard<std::mutex> guard(_propertyLock);
+    return OSDictionary::withDictionary(_properties);
+}
+
+IORegistryEntry* IORegistryEntry::getParentEntry(const IORegistryPlane* plane) const
+{
+    return _provider;
+}
+
+const char* IORegistryEntry::getName(const IORegistryPlane* plane) const
+{
+    if (_name.empty())
+    {
+        int status = 0;
+        char* name = abi::__cxa_demangle(typeid(*this).name(), NULL, NULL, &status);
+        _name = status == 0 && name ? name : typeid(*this).name();
+        ::free(name);
+    }
+    return _name.c_str();
+}
+
+bool IOService::attach(IOService* provider)
+{
+    _provider = provider;
+    std::lock_guard<std::mutex> guard(provider->_clientLock);
+    provider->_clients.push_back(this);
+    return true;
+}
+
+void IOService::detach(IOService* provider)
+{
+    {
+        std::lock_guard<std::mutex> guard(provider->_clientLock);
+        std::vector<IOService*>& clients = provider->_clients;
+        clients.erase(std::remove(clients.begin(), clients.end(), this), clients.end());
+    }
+    _provider = NULL;
+}
+
+std::vector<IOService*> HostClients(IOService* provider)
+{
+    std::lock_guard<std::mutex> guard(provider->_clientLock);
+    return provider->_clients;
+}
+
+IOWorkLoop* IOService::getWorkLoop() const
+{
+    return _provider ? _provider->getWorkLoop() : NULL;
+}
+
+IOReturn IOService::messageClient(UInt32 type, OSObject* client, void* argument, size_t argSize)
+{
+    IOService* service = OSDynamicCast(IOService, client);
+    return service ? service->message(type, this, argument) : kIOReturnBadArgument;
+}
+
+static std::mutex sPowerLock;
+static std::condition_variable sPowerCondition;
+static UInt32 sPowerAcknowledgements;
+
+IOReturn IOService::acknowledgeSetPowerState()
+{
+    std::lock_guard<std::mutex> guard(sPowerLock);
+    sPowerAcknowledgements++;
+    sPowerCondition.notify_all();
+    return kIOReturnSuccess;
+}
+
+UInt32 HostPowerAcknowledgeCount(void)
+{
+    std::lock_guard<std::mutex> guard(sPowerLock);
+    return sPowerAcknowledgements;
+}
+
+bool HostWaitPowerAcknowledge(UInt32 count, unsigned timeoutMS)
+{
+    std::unique_lock<std::mutex> lock(sPowerLock);
+    return sPowerCondition.wait_for(lock, std::chrono::milliseconds(timeoutMS),
+                                    [count] { return sPowerAcknowledgements > count; });
+}
+
+IOReturn IOService::registerInterrupt(int source, OSObject* target, IOInterruptAction handler, void* refCon)
+{
+    std::lock_guard<std::mutex> guard(_vectorLock);
+    for (const InterruptVector& vector : _vectors)
+        if (vector.source == source)
+            return kIOReturnNoResources;
+    _vectors.push_back({ source, target, handler, refCon, false });
+    return kIOReturnSuccess;
+}
+
+IOReturn IOService::unregisterInterrupt(int source)
+{
+    std::lock_guard<std::mutex> guard(_vectorLock);
+    for (auto it = _vectors.begin(); it != _vectors.end(); ++it)
+    {
+        if (it->source == source)
+        {
+            _vectors.erase(it);
+            return kIOReturnSuccess;
+        }
+    }
+    return kIOReturnNotFound;
+}
+
+IOReturn IOService::enableInterrupt(int source)
+{
+    std::lock_guard<std::mutex> guard(_vectorLock);
+    for (InterruptVector& vector : _vectors)
+    {
+        if (vector.source == source)
+        {
+            vector.enabled = true;
+            return kIOReturnSuccess;
+        }
+    }
+    return kIOReturnNotFound;
+}
+
+IOReturn IOService::disableInterrupt(int source)
+{
+    std::lock_guard<std::mutex> guard(_vectorLock);
+    for (InterruptVector& vector : _vectors)
+    {
+        if (vector.source == source)
+        {
+            vector.enabled = false;
+            return kIOReturnSuccess;
+        }
+    }
+    return kIOReturnNotFound;
+}
+
+bool HostRaiseInterrupt(IOService* provider, int source)
+{
+    IOService::InterruptVector vector {};
+    {
+        std::lock_guard<std::mutex> guard(provider->_vectorLock);
+        for (const IOService::InterruptVector& candidate : provider->_vectors)
+            if (candidate.source == source && candidate.enabled)
+                vector = candidate;
+    }
+    if (!vector.handler)
+        return false;
+    vector.handler(vector.target, vector.refCon, provider, source);
+    return true;
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Work loops and event sources
+//
+
+void IOEventSource::enable()
+{
+    if (_workLoop)
+    {
+        {
+            std::lock_guard<std::mutex> guard(_workLoop->_lock);
+            _enabled = true;
+        }
+        _workLoop->signalWorkAvailable();
+    }
+    else
+        _enabled = true;
+}
+
+void IOEventSource::disable()
+{
+    if (_workLoop)
+    {
+        std::lock_guard<std::mutex> guard(_workLoop->_lock);
+        _enabled = false;
+    }
+    else
+        _enabled = false;
+}
+
+IOInterruptEventSource* IOInterruptEventSource::interruptEventSource(OSObject* owner, Action action,
+                                                                     IOService* provider, int intIndex)
+{
+    IOInterruptEventSource* source = new IOInterruptEventSource;
+    source->_owner = owner;
+    source->_action = (void*)action;
+    return source;
+}
+
+void IOInterruptEventSource::interruptOccurred(void* refCon, IOService* nub, int index)
+{
+    __atomic_add_fetch(&_producerCount, 1, __ATOMIC_RELEASE);
+    if (IOWorkLoop* workLoop = __atomic_load_n(&_workLoop, __ATOMIC_ACQUIRE))
+        workLoop->signalWorkAvailable();
+}
+
+bool IOInterruptEventSource::checkForWork(uint64_t now, uint64_t* nextDeadline)
+{
+    UInt32 produced = __atomic_load_n(&_producerCount, __ATOMIC_ACQUIRE);
+    if (produced == _consumerCount)
+        return false;
+    _pending = (int)(produced - _consumerCount);
+    _consumerCount = produced;
+    return true;
+}
+
+void IOInterruptEventSource::runWork()
+{
+    if (_action)
+        ((Action)_action)(_owner, this, _pending);
+}
+
+IOTimerEventSource* IOTimerEventSource::timerEventSource(OSObject* owner, Action action)
+{
+    IOTimerEventSource* source = new IOTimerEventSource;
+    source->_owner = owner;
+    source->_action = (void*)action;
+    return source;
+}
+
+IOReturn IOTimerEventSource::setTimeout(UInt32 interval, UInt32 scaleFactor)
+{
+    uint64_t deadline;
+    clock_interval_to_deadline(interval, scaleFactor, &deadline);
+    return wakeAtTime(deadline);
+}
+
+IOReturn IOTimerEventSource::wakeAtTime(AbsoluteTime deadline)
+{
+    if (!deadline)
+        deadline = 1;
+    if (_workLoop)
+    {
+        {
+            std::lock_guard<std::mutex> guard(_workLoop->_lock);
+            _deadline = deadline;
+        }
+        _workLoop->signalWorkAvailable();
+    }
+    else
+        _deadline = deadline;
+    return kIOReturnSuccess;
+}
+
+void IOTimerEventSource::cancelTimeout()
+{
+    if (_workLoop)
+    {
+        std::lock_guard<std::mutex> guard(_workLoop->_lock);
+        _deadline = 0;
+    }
+    else
+        _deadline = 0;
+}
+
+bool IOTimerEventSource::checkForWork(uint64_t now, uint64_t* nextDeadline)
+{
+    if (!_deadline)
+        return false;
+    if (_deadline > now)
+    {
+        if (!*nextDeadline || _deadline < *nextDeadline)
+            *nextDeadline = _deadline;
+        return false;
+    }
+    _deadline = 0;
+    return true;
+}
+
+void IOTimerEventSource::runWork()
+{
+    if (_action)
+        ((Action)_action)(_owner, this);
+}
+
+IOCommandGate* IOCommandGate::commandGate(OSObject* owner, Action action)
+{
+    IOCommandGate* gate = new IOCommandGate;
+    gate->_owner = owner;
+    gate->_action = (void*)action;
+    return gate;
+}
+
+IOReturn IOCommandGate::runAction(Action action, void* arg0, void* arg1, void* arg2, void* arg3)
+{
+    if (!action)
+        action = (Action)_action;
+    if (!action || !_workLoop)
+        return kIOReturnNotReady;
+    _workLoop->closeGate();
+    IOReturn result = action(_owner, arg0, arg1, arg2, arg3);
+    _workLoop->openGate();
+    return result;
+}
+
+IOReturn IOCommandGate::attemptAction(Action action, void* arg0, void* arg1, void* arg2, void* arg3)
+{
+    if (!action)
+        action = (Action)_action;
+    if (!action || !_workLoop)
+        return kIOReturnNotReady;
+    if (!_workLoop->tryCloseGate())
+        return kIOReturnNotReady;
+    IOReturn result = action(_owner, arg0, arg1, arg2, arg3);
+    _workLoop->openGate();
+    return result;
+}
+
+IOReturn IOCommandGate::commandSleep(void* event, UInt32 interruptible)
+{
+    return _workLoop->sleepGate(event, 0);
+}
+
+IOReturn IOCommandGate::commandSleep(void* event, AbsoluteTime deadline, UInt32 interruptible)
+{
+    return _workLoop->sleepGate(event, deadline ? deadline : 1);
+}
+
+void IOCommandGate::commandWakeup(void* event, bool oneThread)
+{
+    _workLoop->wakeupGate(event, oneThread);
+}
+
+IOWorkLoop* IOWorkLoop::workLoop(void)
+{
+    // the thread holds a reference of its own, the loop is never torn down
+    IOWorkLoop* workLoop = new IOWorkLoop;
+    workLoop->retain();
+    std::mutex started;
+    std::condition_variable startedCondition;
+    bool running = false;
+    std::thread([workLoop, &started, &startedCondition, &running]
+    {
+        {
+            std::lock_guard<std::mutex> guard(started);
+            workLoop->_threadId = std::this_thread::get_id();
+            running = true;
+        }
+        startedCondition.notify_all();
+        workLoop->threadMain();
+    }).detach();
+    std::unique_lock<std::mutex> lock(started);
+    startedCondition.wait(lock, [&running] { return running; });
+    return workLoop;
+}
+
+IOReturn IOWorkLoop::addEventSource(IOEventSource* source)
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        source->retain();
+        _sources.push_back(source);
+        __atomic_store_n(&source->_workLoop, this, __ATOMIC_RELEASE);
+    }
+    signalWorkAvailable();
+    return kIOReturnSuccess;
+}
+
+IOReturn IOWorkLoop::removeEventSource(IOEventSource* source)
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    for (auto it = _sources.begin(); it != _sources.end(); ++it)
+    {
+        if (*it == source)
+        {
+            _sources.erase(it);
+            __atomic_store_n(&source->_workLoop, (IOWorkLoop*)NULL, __ATOMIC_RELEASE);
+            lock.unlock();
+            source->release();
+            return kIOReturnSuccess;
+        }
+    }
+    return kIOReturnNotFound;
+}
+
+bool IOWorkLoop::inGate() const
+{
+    std::lock_guard<std::mutex> guard(const_cast<IOWorkLoop*>(this)->_lock);
+    return _depth && _owner == std::this_thread::get_id();
+}
+
+void IOWorkLoop::acquireLocked(std::unique_lock<std::mutex>& lock)
+{
+    std::thread::id self = std::this_thread::get_id();
+    if (_depth && _owner == self)
+    {
+        _depth++;
+        return;
+    }
+    _condition.wait(lock, [this] { return _depth == 0; });
+    _owner = self;
+    _depth = 1;
+    _closedAt = uptimeNanoseconds();
+    _stats.closes++;
+}
+
+void IOWorkLoop::releaseLocked()
+{
+    if (--_depth)
+        return;
+    uint64_t held = uptimeNanoseconds() - _closedAt;
+    _stats.heldTotal += held;
+    if (held > _stats.heldMax)
+        _stats.heldMax = held;
+    _owner = std::thread::id();
+    _condition.notify_all();
+}
+
+void IOWorkLoop::closeGate()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    acquireLocked(lock);
+}
+
+void IOWorkLoop::openGate()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    releaseLocked();
+}
+
+bool IOWorkLoop::tryCloseGate()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    if (_depth && _owner != std::this_thread::get_id())
+        return false;
+    acquireLocked(lock);
+    return true;
+}
+
+IOReturn IOWorkLoop::runAction(Action action, OSObject* target, void* arg0, void* arg1, void* arg2, void* arg3)
+{
+    closeGate();
+    IOReturn result = action(target, arg0, arg1, arg2, arg3);
+    openGate();
+    return result;
+}
+
+int IOWorkLoop::sleepGate(void* event, uint64_t deadline)
+{
+    std::unique_lock<std::mutex> lock(_lock);
+
+    // give the gate up entirely, whatever the nesting
+    int depth = _depth;
+    _depth = 1;
+    releaseLocked();
+
+    Sleeper sleeper { event, false };
+    _sleepers.push_back(&sleeper);
+    int result = THREAD_AWAKENED;
+    while (!sleeper.woken)
+    {
+        if (!deadline)
+            _condition.wait(lock);
+        else if (_condition.wait_until(lock, timePointFromUptime(deadline)) == std::cv_status::timeout &&
+                 !sleeper.woken && uptimeNanoseconds() >= deadline)
+        {
+            result = THREAD_TIMED_OUT;
+            break;
+        }
+    }
+    _sleepers.remove(&sleeper);
+
+    acquireLocked(lock);
+    _depth = depth;
+    return result;
+}
+
+void IOWorkLoop::wakeupGate(void* event, bool oneThread)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    for (Sleeper* sleeper : _sleepers)
+    {
+        if (sleeper->event == event && !sleeper->woken)
+        {
+            sleeper->woken = true;
+            if (oneThread)
+                break;
+        }
+    }
+    _condition.notify_all();
+}
+
+void IOWorkLoop::signalWorkAvailable()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _workSignaled = true;
+    _condition.notify_all();
+}
+
+IOWorkLoop::GateStatistics IOWorkLoop::getGateStatistics()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _stats;
+}
+
+void IOWorkLoop::resetGateStatistics()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _stats = GateStatistics {};
+}
+
+void IOWorkLoop::threadMain()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    while (true)
+    {
+        // the gate is taken first, so no event source runs concurrently
+        // with a gated action, like on the kernel's work loop
+        _workSignaled = false;
+        if (_depth)
+        {
+            _condition.wait(lock);
+            continue;
+        }
+
+        uint64_t now = uptimeNanoseconds();
+        uint64_t nextDeadline = 0;
+        IOEventSource* ready = NULL;
+        for (IOEventSource* source : _sources)
+        {
+            if (source->_enabled && source->checkForWork(now, &nextDeadline))
+            {
+                ready = source;
+                break;
+            }
+        }
+
+        if (ready)
+        {
+            ready->retain();
+            acquireLocked(lock);
+            lock.unlock();
+            ready->runWork();
+            ready->release();
+            lock.lock();
+            releaseLocked();
+            continue;
+        }
+
+        if (_workSignaled)
+            continue;
+        if (nextDeadline)
+            _condition.wait_until(lock, timePointFromUptime(nextDeadline));
+        else
+            _condition.wait(lock);
+    }
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Memory descriptors
+//
+
+IOBufferMemoryDescriptor* IOBufferMemoryDescriptor::withOptions(IOOptionBits options, size_t capacity, size_t alignment)
+{
+    IOBufferMemoryDescriptor* descriptor = new IOBufferMemoryDescriptor;
+    descriptor->_bytes = IOMallocAligned(capacity, alignment);
+    descriptor->_length = capacity;
+    if (!descriptor->_bytes)
+    {
+        descriptor->release();
+        return NULL;
+    }
+    return descriptor;
+}
+
+IOBufferMemoryDescriptor::~IOBufferMemoryDescriptor()
+{
+    IOFreeAligned(_bytes, _length);
+}
@@ -0,0 +1,695 @@
+//
+// HostKit: the part of IOKit and libkern the controller uses, implemented on
+// top of the C++ standard library, so that VoodooPS2Controller.cpp and
+// ApplePS2Device.cpp build and run unchanged on a Linux or macOS host.
+//
+// Work loops are threads, command gates are recursive locks owned by their
+// work loop, thread calls are detached threads and the absolute time base is
+// nanoseconds.  Interrupts registered with a provider are raised by calling
+// HostRaiseInterrupt from the thread that plays the interrupt controller.
+//
+// Only what the controller and the host tools need is here.  Anything the
+// controller calls that has no meaning on the host (ACPI, user clients,
+// power management plane) answers as if it were absent.
+//
+
+#ifndef _HOSTKIT_H
+#define _HOSTKIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <new>
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+typedef uint8_t  UInt8;
+typedef int8_t   SInt8;
+typedef uint16_t UInt16;
+typedef int16_t  SInt16;
+typedef uint32_t UInt32;
+typedef int32_t  SInt32;
+typedef uint64_t UInt64;
+typedef int64_t  SInt64;
+
+typedef int      IOReturn;
+typedef uint32_t IOOptionBits;
+typedef uint64_t AbsoluteTime;
+typedef int      kern_return_t;
+typedef int      IOInterruptState;
+typedef unsigned int natural_t;
+typedef uint32_t IOPMPowerFlags;
+typedef UInt32   IOItemCount;
+typedef void*    task_t;
+
+#define kIOReturnSuccess        0
+#define kIOReturnError          ((IOReturn)0xe00002bc)
+#define kIOReturnNoMemory       ((IOReturn)0xe00002bd)
+#define kIOReturnNoResources    ((IOReturn)0xe00002be)
+#define kIOReturnBadArgument    ((IOReturn)0xe00002c2)
+#define kIOReturnUnsupported    ((IOReturn)0xe00002c7)
+#define kIOReturnNotPrivileged  ((IOReturn)0xe00002c1)
+#define kIOReturnNotReady       ((IOReturn)0xe00002d8)
+#define kIOReturnTimeout        ((IOReturn)0xe00002d6)
+#define kIOReturnNotFound       ((IOReturn)0xe00002f0)
+#define KERN_SUCCESS            0
+
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+
+#define THREAD_UNINT            0
+#define THREAD_INTERRUPTIBLE    1
+#define THREAD_AWAKENED         0
+#define THREAD_TIMED_OUT        1
+
+#define IOPMAckImplied          0
+#define kIOPMDeviceUsable       0x00008000
+#define kIOPMDoze               0x00000400
+#define IOPMPowerOn             0x00000002
+#define kIOPMPowerOff           0
+
+#define iokit_vendor_specific_msg(message) ((UInt32)(0xe0000000 | (0x00 << 14) | (message)))
+#define kIOMessageServiceIsTerminated 0xe0000010
+
+enum
+{
+    kNanosecondScale  = 1,
+    kMicrosecondScale = 1000,
+    kMillisecondScale = 1000 * 1000,
+    kSecondScale      = 1000 * 1000 * 1000,
+};
+
+#define LIBKERN_RETURNS_RETAINED
+
+#define assert(x) ((void)0)
+#define bcopy(src, dst, len) memmove((dst), (src), (len))
+#define bzero(ptr, len) memset((ptr), 0, (len))
+
+template <typename T, typename U>
+inline auto min(T a, U b) -> decltype(a + b) { return a < b ? a : b; }
+template <typename T, typename U>
+inline auto max(T a, U b) -> decltype(a + b) { return a > b ? a : b; }
+
+extern unsigned long page_size;
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Objects
+//
+
+#define OSDeclareDefaultStructors(className)    public: className() {} private:
+#define OSDefineMetaClassAndStructors(className, superName)
+#define OSTypeAlloc(className) (new className)
+#define OSDynamicCast(type, inst) (dynamic_cast<type*>((OSMetaClassBase*)(inst)))
+#define OSSafeReleaseNULL(inst) do { if (inst) (inst)->release(); (inst) = NULL; } while (0)
+
+class OSMetaClassBase
+{
+public:
+    typedef void (*_ptf_t)(void);
+
+    virtual ~OSMetaClassBase() {}
+    virtual void retain() const { _retainCount.fetch_add(1, std::memory_order_relaxed); }
+    virtual void release() const;
+    virtual void free() { delete this; }
+    int getRetainCount() const { return _retainCount.load(std::memory_order_relaxed); }
+
+    // Itanium C++ ABI member function pointer to plain function pointer
+    static _ptf_t _ptmf2ptf(const OSMetaClassBase* self, void (OSMetaClassBase::*func)(void));
+
+private:
+    mutable std::atomic<int> _retainCount {1};
+};
+
+#define OSMemberFunctionCast(cptrtype, self, func) \
+    (cptrtype) OSMetaClassBase::_ptmf2ptf(self, (void (OSMetaClassBase::*)(void)) func)
+
+class OSObject : public OSMetaClassBase
+{
+public:
+    virtual bool init() { return true; }
+};
+
+class OSString : public OSObject
+{
+public:
+    static OSString* withCString(const char* cString);
+    static OSString* withCStringNoCopy(const char* cString) { return withCString(cString); }
+    static OSString* withString(const OSString* string) { return withCString(string->getCStringNoCopy()); }
+    const char* getCStringNoCopy() const { return _string.c_str(); }
+    unsigned getLength() const { return (unsigned)_string.size(); }
+    bool isEqualTo(const char* cString) const { return _string == cString; }
+    bool isEqualTo(const OSString* string) const { return string && _string == string->_string; }
+    bool setChar(char c, unsigned index);
+
+protected:
+    std::string _string;
+};
+
+class OSSymbol : public OSString
+{
+public:
+    static const OSSymbol* withCString(const char* cString);
+    static const OSSymbol* withCStringNoCopy(const char* cString) { return withCString(cString); }
+};
+
+class OSNumber : public OSObject
+{
+public:
+    static OSNumber* withNumber(unsigned long long value, unsigned numberOfBits);
+    unsigned char unsigned8BitValue() const { return (unsigned char)_value; }
+    unsigned short unsigned16BitValue() const { return (unsigned short)_value; }
+    unsigned int unsigned32BitValue() const { return (unsigned int)_value; }
+    unsigned long long unsigned64BitValue() const { return _value; }
+    void setValue(unsigned long long value) { _value = value; }
+
+private:
+    unsigned long long _value {0};
+};
+
+class OSBoolean : public OSObject
+{
+public:
+    static OSBoolean* withBoolean(bool value);
+    bool isTrue() const { return _value; }
+    bool isFalse() const { return !_value; }
+    bool getValue() const { return _value; }
+    void retain() const override {}
+    void release() const override {}
+
+    explicit OSBoolean(bool value) : _value(value) {}
+
+private:
+    bool _value;
+};
+
+extern OSBoolean* const kOSBooleanTrue;
+extern OSBoolean* const kOSBooleanFalse;
+
+class OSData : public OSObject
+{
+public:
+    static OSData* withBytes(const void* bytes, unsigned length);
+    static OSData* withBytesNoCopy(void* bytes, unsigned length) { return withBytes(bytes, length); }
+    static OSData* withCapacity(unsigned capacity);
+    const void* getBytesNoCopy() const { return _bytes.empty() ? NULL : _bytes.data(); }
+    const void* getBytesNoCopy(unsigned start, unsigned length) const;
+    unsigned getLength() const { return (unsigned)_bytes.size(); }
+    bool appendBytes(const void* bytes, unsigned length);
+
+private:
+    std::vector<UInt8> _bytes;
+};
+
+class OSCollection : public OSObject
+{
+public:
+    virtual unsigned getCount() const = 0;
+    virtual OSObject* getObjectAt(unsigned index) const = 0;
+    virtual void flushCollection() = 0;
+};
+
+class OSArray : public OSCollection
+{
+public:
+    static OSArray* withCapacity(unsigned capacity);
+    ~OSArray() override { flushCollection(); }
+    unsigned getCount() const override { return (unsigned)_objects.size(); }
+    OSObject* getObjectAt(unsigned index) const override { return getObject(index); }
+    void flushCollection() override;
+    OSObject* getObject(unsigned index) const;
+    bool setObject(const OSMetaClassBase* object);
+    bool replaceObject(unsigned index, const OSMetaClassBase* object);
+    void removeObject(unsigned index);
+
+private:
+    std::vector<OSObject*> _objects;
+};
+
+class OSDictionary : public OSCollection
+{
+public:
+    static OSDictionary* withCapacity(unsigned capacity);
+    static OSDictionary* withDictionary(const OSDictionary* dict, unsigned capacity = 0);
+    ~OSDictionary() override { flushCollection(); }
+    unsigned getCount() const override { return (unsigned)_entries.size(); }
+    OSObject* getObjectAt(unsigned index) const override;
+    void flushCollection() override;
+    OSObject* getObject(const char* key) const;
+    OSObject* getObject(const OSString* key) const { return key ? getObject(key->getCStringNoCopy()) : NULL; }
+    bool setObject(const char* key, const OSMetaClassBase* object);
+    bool setObject(const OSString* key, const OSMetaClassBase* object) { return key && setObject(key->getCStringNoCopy(), object); }
+    void removeObject(const char* key);
+    bool merge(const OSDictionary* dict);
+
+private:
+    std::vector<std::pair<std::string, OSObject*>> _entries;
+};
+
+class OSSet : public OSCollection
+{
+public:
+    static OSSet* withCapacity(unsigned capacity);
+    ~OSSet() override { flushCollection(); }
+    unsigned getCount() const override { return (unsigned)_objects.size(); }
+    OSObject* getObjectAt(unsigned index) const override { return index < _objects.size() ? _objects[index] : NULL; }
+    void flushCollection() override;
+    bool setObject(const OSMetaClassBase* object);
+    void removeObject(const OSMetaClassBase* object);
+    bool containsObject(const OSMetaClassBase* object) const;
+    OSObject* getAnyObject() const { return getObjectAt(0); }
+
+private:
+    std::vector<OSObject*> _objects;
+};
+
+class OSIterator : public OSObject
+{
+public:
+    virtual OSObject* getNextObject() = 0;
+    virtual void reset() = 0;
+};
+
+class OSCollectionIterator : public OSIterator
+{
+public:
+    static OSCollectionIterator* withCollection(const OSCollection* collection);
+    ~OSCollectionIterator() override;
+    OSObject* getNextObject() override;
+    void reset() override { _index = 0; }
+
+private:
+    const OSCollection* _collection {NULL};
+    unsigned _index {0};
+};
+
+class OSSerialize : public OSObject {};
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Time, locks and threads
+//
+
+void clock_get_uptime(uint64_t* result);
+void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t* result);
+void nanoseconds_to_absolutetime(uint64_t nanoseconds, uint64_t* result);
+void clock_interval_to_deadline(uint32_t interval, uint32_t scale_factor, uint64_t* result);
+void clock_get_system_microtime(uint32_t* secs, uint32_t* microsecs);
+uint64_t mach_absolute_time(void);
+
+void IOLog(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void IOSleep(unsigned milliseconds);
+void IODelay(unsigned microseconds);
+void* IOMalloc(size_t length);
+void IOFree(void* address, size_t length);
+void* IOMallocAligned(size_t length, size_t alignment);
+void IOFreeAligned(void* address, size_t length);
+
+bool PE_parse_boot_argn(const char* arg_string, void* arg_ptr, int max_arg);
+bool ml_set_interrupts_enabled(bool enable);
+void Debugger(const char* message);
+
+struct IOLock;
+struct IOSimpleLock;
+
+IOLock* IOLockAlloc(void);
+void IOLockFree(IOLock* lock);
+void IOLockLock(IOLock* lock);
+void IOLockUnlock(IOLock* lock);
+
+IOSimpleLock* IOSimpleLockAlloc(void);
+void IOSimpleLockFree(IOSimpleLock* lock);
+void IOSimpleLockLock(IOSimpleLock* lock);
+void IOSimpleLockUnlock(IOSimpleLock* lock);
+IOInterruptState IOSimpleLockLockDisableInterrupt(IOSimpleLock* lock);
+void IOSimpleLockUnlockEnableInterrupt(IOSimpleLock* lock, IOInterruptState state);
+
+typedef struct thread_call* thread_call_t;
+typedef void* thread_call_param_t;
+typedef void (*thread_call_func_t)(thread_call_param_t param0, thread_call_param_t param1);
+
+thread_call_t thread_call_allocate(thread_call_func_t func, thread_call_param_t param0);
+bool thread_call_enter(thread_call_t call);
+bool thread_call_enter1(thread_call_t call, thread_call_param_t param1);
+bool thread_call_cancel(thread_call_t call);
+bool thread_call_free(thread_call_t call);
+
+bool OSCompareAndSwap(UInt32 oldValue, UInt32 newValue, volatile UInt32* address);
+bool OSCompareAndSwapPtr(void* oldValue, void* newValue, void* volatile* address);
+SInt32 OSAddAtomic(SInt32 amount, volatile SInt32* address);
+SInt64 OSAddAtomic64(SInt64 amount, volatile SInt64* address);
+inline SInt32 OSIncrementAtomic(volatile SInt32* address) { return OSAddAtomic(1, address); }
+inline SInt32 OSDecrementAtomic(volatile SInt32* address) { return OSAddAtomic(-1, address); }
+inline SInt64 OSIncrementAtomic64(volatile SInt64* address) { return OSAddAtomic64(1, address); }
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Registry and services
+//
+
+struct IORegistryPlane;
+extern const IORegistryPlane* gIOServicePlane;
+
+class IOService;
+class IOWorkLoop;
+class IOUserClient;
+
+class IORegistryEntry : public OSObject
+{
+public:
+    IORegistryEntry();
+    ~IORegistryEntry() override;
+
+    virtual bool init(OSDictionary* dictionary = NULL);
+    OSObject* getProperty(const char* key) const;
+    OSObject* getProperty(const OSString* key) const { return key ? getProperty(key->getCStringNoCopy()) : NULL; }
+    OSObject* copyProperty(const char* key) const;
+    bool setProperty(const char* key, OSObject* object);
+    bool setProperty(const OSString* key, OSObject* object) { return key && setProperty(key->getCStringNoCopy(), object); }
+    bool setProperty(const char* key, const char* string);
+    bool setProperty(const char* key, bool value);
+    bool setProperty(const char* key, unsigned long long value, unsigned numberOfBits);
+    bool setProperty(const char* key, void* bytes, unsigned length);
+    void removeProperty(const char* key);
+    OSDictionary* dictionaryWithProperties() const;
+    virtual IOReturn setProperties(OSObject* properties) { return kIOReturnUnsupported; }
+    virtual bool serializeProperties(OSSerialize* serialize) const { return true; }
+
+    IORegistryEntry* getParentEntry(const IORegistryPlane* plane) const;
+    static IORegistryEntry* fromPath(const char* path, const IORegistryPlane* plane = NULL) { return NULL; }
+    const char* getName(const IORegistryPlane* plane = NULL) const;
+    void setName(const char* name) { _name = name; }
+
+protected:
+    IOService* _provider {NULL};
+
+private:
+    mutable std::mutex _propertyLock;
+    OSDictionary* _properties {NULL};
+    mutable std::string _name;
+};
+
+class IONotifier : public OSObject
+{
+public:
+    virtual void remove() { release(); }
+};
+
+struct IOPMPowerState
+{
+    unsigned long   version;
+    IOPMPowerFlags  capabilityFlags;
+    IOPMPowerFlags  outputPowerCharacter;
+    IOPMPowerFlags  inputPowerRequirement;
+    unsigned long   staticPower;
+    unsigned long   stateOrder;
+    unsigned long   powerToAttain;
+    unsigned long   timeToAttain;
+    unsigned long   settleUpTime;
+    unsigned long   timeToLower;
+    unsigned long   settleDownTime;
+    unsigned long   powerDomainBudget;
+};
+
+typedef bool (*IOServiceMatchingNotificationHandler)(void* target, void* refCon, IOService* newService, IONotifier* notifier);
+typedef void (*IOInterruptAction)(OSObject* target, void* refCon, IOService* nub, int source);
+
+extern const OSSymbol* gIOPublishNotification;
+extern const OSSymbol* gIOFirstPublishNotification;
+extern const OSSymbol* gIOTerminatedNotification;
+
+class IOService : public IORegistryEntry
+{
+public:
+    virtual IOService* probe(IOService* provider, SInt32* score) { return this; }
+    virtual bool start(IOService* provider) { return true; }
+    virtual void stop(IOService* provider) {}
+    virtual bool attach(IOService* provider);
+    virtual void detach(IOService* provider);
+    virtual bool terminate(IOOptionBits options = 0) { return true; }
+    virtual IOWorkLoop* getWorkLoop() const;
+    IOService* getProvider() const { return _provider; }
+    IOService* getClient() const { return NULL; }
+
+    virtual IOReturn message(UInt32 type, IOService* provider, void* argument = 0) { return kIOReturnUnsupported; }
+    IOReturn messageClient(UInt32 type, OSObject* client, void* argument = 0, size_t argSize = 0);
+    IOReturn messageClients(UInt32 type, void* argument = 0, size_t argSize = 0) { return kIOReturnSuccess; }
+    virtual bool open(IOService* forClient, IOOptionBits options = 0, void* arg = 0) { return true; }
+    virtual void close(IOService* forClient, IOOptionBits options = 0) {}
+    bool isOpen(const IOService* forClient = 0) const { return false; }
+    void registerService(IOOptionBits options = 0) {}
+
+    // power management: the host tools call setPowerState themselves, and
+    // wait for the acknowledgement with HostWaitPowerAcknowledge
+    void PMinit() {}
+    void PMstop() {}
+    IOReturn registerPowerDriver(IOService* controllingDriver, IOPMPowerState* powerStates, unsigned long numberOfStates) { return kIOReturnSuccess; }
+    void joinPMtree(IOService* driver) {}
+    virtual IOReturn setPowerState(unsigned long powerStateOrdinal, IOService* whatDevice) { return IOPMAckImplied; }
+    IOReturn acknowledgeSetPowerState();
+
+    // interrupts registered here are raised with HostRaiseInterrupt
+    IOReturn registerInterrupt(int source, OSObject* target, IOInterruptAction handler, void* refCon = 0);
+    IOReturn unregisterInterrupt(int source);
+    IOReturn enableInterrupt(int source);
+    IOReturn disableInterrupt(int source);
+
+    static OSDictionary* serviceMatching(const char* className, OSDictionary* table = 0) { return OSDictionary::withCapacity(1); }
+    static OSDictionary* nameMatching(const char* name, OSDictionary* table = 0) { return OSDictionary::withCapacity(1); }
+    static OSDictionary* propertyMatching(const OSSymbol* key, const OSObject* value, OSDictionary* table = 0) { return OSDictionary::withCapacity(1); }
+    static IONotifier* addMatchingNotification(const OSSymbol* type, OSDictionary* matching,
+                                               IOServiceMatchingNotificationHandler handler,
+                                               void* target, void* ref = 0, SInt32 priority = 0) { return new IONotifier; }
+    static IOService* waitForMatchingService(OSDictionary* matching, uint64_t timeout = UINT64_MAX) { return NULL; }
+    static OSIterator* getMatchingServices(OSDictionary* matching) { return NULL; }
+
+    virtual IOReturn callPlatformFunction(const OSSymbol* functionName, bool waitForFunction,
+                                          void* param1, void* param2, void* param3, void* param4) { return kIOReturnUnsupported; }
+    virtual IOReturn callPlatformFunction(const char* functionName, bool waitForFunction,
+                                          void* param1, void* param2, void* param3, void* param4) { return kIOReturnUnsupported; }
+    virtual IOReturn newUserClient(task_t owningTask, void* securityID, UInt32 type, IOUserClient** handler) { return kIOReturnUnsupported; }
+
+private:
+    struct InterruptVector
+    {
+        int source;
+        OSObject* target;
+        IOInterruptAction handler;
+        void* refCon;
+        bool enabled;
+    };
+    std::mutex _vectorLock;
+    std::vector<InterruptVector> _vectors;
+    std::mutex _clientLock;
+    std::vector<IOService*> _clients;
+
+    friend bool HostRaiseInterrupt(IOService* provider, int source);
+    friend std::vector<IOService*> HostClients(IOService* provider);
+};
+
+// Calls the handler registered for source on provider, as the interrupt
+// controller would.  Returns false if none is registered and enabled.
+bool HostRaiseInterrupt(IOService* provider, int source);
+
+// Services attached to provider, in attach order (eg. the controller's nubs).
+std::vector<IOService*> HostClients(IOService* provider);
+
+// Number of power state changes acknowledged so far, and a wait for the
+// count to pass a value.
+UInt32 HostPowerAcknowledgeCount(void);
+bool HostWaitPowerAcknowledge(UInt32 count, unsigned timeoutMS);
+
+// Boot arguments seen by PE_parse_boot_argn.
+void HostSetBootArg(const char* name, int value);
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Work loops and event sources
+//
+
+class IOEventSource : public OSObject
+{
+public:
+    typedef void (*Action)(OSObject* owner, ...);
+
+    virtual void enable();
+    virtual void disable();
+    bool isEnabled() const { return _enabled; }
+    OSObject* getOwner() const { return _owner; }
+
+protected:
+    friend class IOWorkLoop;
+
+    // called by the work loop with its state lock held; returns true and
+    // the time at which to look again (0: no timed work) when work is due
+    virtual bool checkForWork(uint64_t now, uint64_t* nextDeadline) { return false; }
+    virtual void runWork() {}
+
+    OSObject*   _owner {NULL};
+    void*       _action {NULL};
+    IOWorkLoop* _workLoop {NULL};
+    bool        _enabled {true};
+};
+
+class IOInterruptEventSource;
+typedef void (*IOInterruptEventAction)(OSObject* owner, IOInterruptEventSource* sender, int count);
+
+class IOInterruptEventSource : public IOEventSource
+{
+public:
+    typedef IOInterruptEventAction Action;
+
+    static IOInterruptEventSource* interruptEventSource(OSObject* owner, Action action,
+                                                        IOService* provider = 0, int intIndex = 0);
+    void interruptOccurred(void* refCon, IOService* nub, int index);
+
+protected:
+    bool checkForWork(uint64_t now, uint64_t* nextDeadline) override;
+    void runWork() override;
+
+private:
+    UInt32 _producerCount {0};
+    UInt32 _consumerCount {0};
+    int    _pending {0};
+};
+
+class IOTimerEventSource : public IOEventSource
+{
+public:
+    typedef void (*Action)(OSObject* owner, IOTimerEventSource* sender);
+
+    static IOTimerEventSource* timerEventSource(OSObject* owner, Action action = 0);
+    IOReturn setTimeoutMS(UInt32 ms) { return setTimeout(ms, kMillisecondScale); }
+    IOReturn setTimeoutUS(UInt32 us) { return setTimeout(us, kMicrosecondScale); }
+    IOReturn setTimeout(UInt32 interval, UInt32 scaleFactor);
+    IOReturn wakeAtTime(AbsoluteTime deadline);
+    void cancelTimeout();
+
+protected:
+    bool checkForWork(uint64_t now, uint64_t* nextDeadline) override;
+    void runWork() override;
+
+private:
+    uint64_t _deadline {0};
+};
+
+class IOCommandGate : public IOEventSource
+{
+public:
+    typedef IOReturn (*Action)(OSObject* owner, void* arg0, void* arg1, void* arg2, void* arg3);
+
+    static IOCommandGate* commandGate(OSObject* owner, Action action = 0);
+    IOReturn runAction(Action action, void* arg0 = 0, void* arg1 = 0, void* arg2 = 0, void* arg3 = 0);
+    IOReturn attemptAction(Action action, void* arg0 = 0, void* arg1 = 0, void* arg2 = 0, void* arg3 = 0);
+    IOReturn commandSleep(void* event, UInt32 interruptible = THREAD_UNINT);
+    IOReturn commandSleep(void* event, AbsoluteTime deadline, UInt32 interruptible);
+    void commandWakeup(void* event, bool oneThread = false);
+};
+
+class IOWorkLoop : public OSObject
+{
+public:
+    typedef IOReturn (*Action)(OSObject* target, void* arg0, void* arg1, void* arg2, void* arg3);
+
+    static IOWorkLoop* workLoop(void);
+
+    IOReturn addEventSource(IOEventSource* source);
+    IOReturn removeEventSource(IOEventSource* source);
+    bool onThread() const { return std::this_thread::get_id() == _threadId; }
+    bool inGate() const;
+    void closeGate();
+    void openGate();
+    bool tryCloseGate();
+    IOReturn runAction(Action action, OSObject* target, void* arg0 = 0, void* arg1 = 0, void* arg2 = 0, void* arg3 = 0);
+
+    // gate sleep for IOCommandGate, deadline 0 sleeps until woken
+    int sleepGate(void* event, uint64_t deadline);
+    void wakeupGate(void* event, bool oneThread);
+
+    // work from an event source is pending
+    void signalWorkAvailable();
+
+    // time the gate has been closed, in total and at most at once (ns);
+    // a closed gate blocks every other client of the work loop
+    struct GateStatistics
+    {
+        uint64_t heldTotal;
+        uint64_t heldMax;
+        uint64_t closes;
+    };
+    GateStatistics getGateStatistics();
+    void resetGateStatistics();
+
+private:
+    friend class IOEventSource;
+    friend class IOTimerEventSource;
+
+    struct Sleeper
+    {
+        void* event;
+        bool  woken;
+    };
+
+    void threadMain();
+    void acquireLocked(std::unique_lock<std::mutex>& lock);
+    void releaseLocked();
+
+    std::mutex                  _lock;
+    std::condition_variable     _condition;
+    std::thread::id             _owner;
+    int                         _depth {0};
+    uint64_t                    _closedAt {0};
+    GateStatistics              _stats {};
+    std::list<Sleeper*>         _sleepers;
+    std::vector<IOEventSource*> _sources;
+    std::thread::id             _threadId;
+    bool                        _workSignaled {false};
+};
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Memory descriptors, user clients and ACPI (present so the controller
+// builds, never backed by anything on the host)
+//
+
+#define kIODirectionInOut           3
+#define kIOMemoryKernelUserShared   0x00002000
+#define kIOMapReadOnly              0x00001000
+#define kIOClientPrivilegeAdministrator "root"
+
+class IOMemoryDescriptor : public OSObject {};
+
+class IOBufferMemoryDescriptor : public IOMemoryDescriptor
+{
+public:
+    static IOBufferMemoryDescriptor* withOptions(IOOptionBits options, size_t capacity, size_t alignment = 1);
+    ~IOBufferMemoryDescriptor() override;
+    void* getBytesNoCopy() { return _bytes; }
+
+private:
+    void*  _bytes {NULL};
+    size_t _length {0};
+};
+
+class IOUserClient : public IOService
+{
+public:
+    virtual bool initWithTask(task_t owningTask, void* securityToken, UInt32 type) { return init(); }
+    virtual IOReturn clientClose() { return kIOReturnUnsupported; }
+    virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory) { return kIOReturnUnsupported; }
+    static IOReturn clientHasPrivilege(void* securityToken, const char* privilegeName) { return kIOReturnNotPrivileged; }
+};
+
+class IOACPIPlatformDevice : public IOService
+{
+public:
+    IOReturn evaluateObject(const char* objectName, OSObject** result = 0, OSObject* params[] = 0,
+                            IOItemCount paramCount = 0, IOOptionBits options = 0) { return kIOReturnUnsupported; }
+    IOReturn evaluateInteger(const char* objectName, UInt32* result) { return kIOReturnUnsupported; }
+    IOReturn validateObject(const char* objectName) { return kIOReturnNotFound; }
+};
+
+#endif // _HOSTKIT_H
@@ -0,0 +1,5 @@
+//
+// HostKit forwarding header, see HostKit.h.
+//
+
+#include "../../HostKit.h"
@@ -0,0 +1,6 @@
+//
+// HostKit forwarding header, see HostKit.h.  The host tools build the
+// controller with PS2_PORT_IO_EXTERNAL, so there is no port I/O here.
+//
+
+#include "../../../HostKit.h"
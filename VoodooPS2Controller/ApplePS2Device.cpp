@@ -64,6 +64,9 @@ bool ApplePS2Device::attach(IOService * provider)
   _controller = (ApplePS2Controller*)provider;
   _controller->retain();
 
+  // decided once, the driver adds its event sources to whichever loop it gets
+  _dedicatedWorkLoop = _controller->wantsDedicatedWorkLoop(_port);
+
   return true;
 }
 
@@ -88,6 +91,41 @@ void ApplePS2Device::detach( IOService * provider )
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+IOWorkLoop* ApplePS2Device::getWorkLoop() const
+{
+  //
+  // Packets are always delivered on the nub's own workloop.  Normally the
+  // driver's command gate and timers run on the controller's workloop, so
+  // they race with packet processing.  With DedicatedWorkLoop they join
+  // the nub's loop instead, so packets, timers and the driver's own gate
+  // actions are serialized with each other, away from the keyboard and the
+  // request engine on the controller's loop.
+  //
+  // Not every driver entry point runs there.  These stay concurrent with
+  // the nub's loop, and a driver opting in must protect what they share
+  // with its packet handler, timers and gate actions:
+  //  - powerAction, from the controller's power change (under the
+  //    controller's gate) or from the OverlapDeviceWake callout
+  //  - message(), from the controller's message fan-out: under the
+  //    controller's gate, or with no gate at all for keystroke
+  //    notifications
+  // They are not moved onto the driver's gate because their callers may
+  // hold the controller's gate, and the lock order is driver gate, then
+  // controller gate.
+  //
+  // The controller state the driver reaches from its loop is either
+  // lock-free (submitRequest, counters, keystroke cell) or behind the
+  // controller's command gate (submitRequestAndBlock, setCommandByte,
+  // messages).  The controller never takes the driver's gate.
+  //
+
+  if (_dedicatedWorkLoop && _workloop)
+    return _workloop;
+  return super::getWorkLoop();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 PS2Request * ApplePS2Device::allocateRequest(int max)
 {
   return _controller->allocateRequest(max);
@@ -125,6 +163,13 @@ UInt8 ApplePS2Device::setCommandByte(UInt8 setBits, UInt8 clearBits)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+bool ApplePS2Device::getIdentification(PS2Identification* ids)
+{
+    return _controller->getIdentification(_port, ids);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 void ApplePS2Device::lock()
 {
     _controller->lock();
@@ -145,16 +190,57 @@ void ApplePS2Device::installInterruptAction(OSObject *         target,
     _controller->installInterruptAction(_port);
     _interrupt_action = interruptAction;
     _packet_action = packetAction;
+    _controller->setInterruptTarget(_port, target, interruptAction);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 void ApplePS2Device::uninstallInterruptAction()
 {
+    _controller->setInterruptTarget(_port, nullptr, nullptr);
     _controller->uninstallInterruptAction(_port);
     _interrupt_action = nullptr;
     _packet_action = nullptr;
     _client = nullptr;
+    __atomic_store_n(&_ringStats, nullptr, __ATOMIC_RELEASE);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Device::publishCounters()
+{
+    static const char* names[kPS2CT_Count] =
+    {
+        "Bytes", "Packets", "InvalidPackets", "Resyncs",
+        "ParityErrors", "TimeoutErrors", "ReadTimeouts", "Retries",
+    };
+
+    OSDictionary* dict = OSDictionary::withCapacity(kPS2CT_Count + 3);
+    if (!dict)
+        return;
+    OSNumber* num;
+    for (unsigned i = 0; i < kPS2CT_Count; i++)
+    {
+        if ((num = OSNumber::withNumber(__atomic_load_n(&_counters[i], __ATOMIC_RELAXED), 32))) { dict->setObject(names[i], num); num->release(); }
+    }
+    if (const RingBufferStats* ring = __atomic_load_n(&_ringStats, __ATOMIC_ACQUIRE))
+    {
+        if ((num = OSNumber::withNumber(__atomic_load_n(&ring->overflows, __ATOMIC_RELAXED), 32))) { dict->setObject("RingOverflows", num); num->release(); }
+        if ((num = OSNumber::withNumber(__atomic_load_n(&ring->dropped, __ATOMIC_RELAXED), 32))) { dict->setObject("RingDropped", num); num->release(); }
+    }
+    // lets snapshots taken apart be turned into rates
+    uint64_t now;
+    absolutetime_to_nanoseconds(mach_absolute_time(), &now);
+    if ((num = OSNumber::withNumber(now, 64))) { dict->setObject("Time", num); num->release(); }
+    setProperty("Counters", dict);
+    dict->release();
+}
+
+bool ApplePS2Device::serializeProperties(OSSerialize* s) const
+{
+    // the counters move with every byte, refresh them only when read
+    const_cast<ApplePS2Device*>(this)->publishCounters();
+    return super::serializeProperties(s);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -179,6 +265,24 @@ void ApplePS2Device::dispatchMessage(int message, void *data)
     _controller->dispatchMessage(message, data);
 }
 
+void ApplePS2Device::subscribeMessages(IOService* service, const UInt32* messages, size_t count)
+{
+    // must be set before the service is published (registerService)
+    OSArray* list = OSArray::withCapacity((unsigned)count);
+    if (!list)
+        return;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (OSNumber* num = OSNumber::withNumber(messages[i], 32))
+        {
+            list->setObject(num);
+            num->release();
+        }
+    }
+    service->setProperty(kDeliverNotificationMessages, list);
+    list->release();
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 IOReturn ApplePS2Device::startSMBusCompanion(OSDictionary *companionData, UInt8 smbusAddr)
@@ -193,6 +297,11 @@ ApplePS2Controller* ApplePS2Device::getController()
     return _controller;
 }
 
+PS2KeystrokeCell* ApplePS2Device::getKeystrokeCell()
+{
+    return _controller->getKeystrokeCell();
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 PS2InterruptResult ApplePS2Device::interruptAction(UInt8 data)
@@ -28,7 +28,6 @@
 #include <IOKit/IOService.h>
 #include <IOKit/IOLib.h>
 #include <IOKit/IOInterruptEventSource.h>
-#include <architecture/i386/pio.h>
 
 #ifdef DEBUG_MSG
 #define DEBUG_LOG(args...)  do { IOLog(args); } while (0)
@@ -173,85 +172,150 @@
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // RingBuffer
 //
-// A simple ring buffer class for devices to use in their real interrupt
-// routine for buffering packets.
+// A single-producer/single-consumer ring buffer for devices to use in their
+// real interrupt routine for buffering packets.  The interrupt routine is the
+// only producer (push, head, advanceHead) and the workloop packet action is
+// the only consumer (fetch, tail, peek, advanceTail/commit).  No lock is
+// needed: head and tail are free running counters, and each side publishes
+// its counter with release semantics after touching the data.
 //
-// Standard FIFO ring buffer implemented as an array.
+// N must be a power of two.  Indexing is a mask and count() is a subtraction.
 //
-// Note: there is no error checking in this class.  And no check for
-// overflow/underflow conditions.  Make sure you have a large enough
-// buffer to handle your needs.  And don't advance or try to fetch
-// data that doesn't exist (need to check result from count() first)
+// The buffer keeps S extra elements past the end, mirroring the first S
+// elements, so a packet of up to S elements at head() or tail() is always
+// contiguous, whatever the packet size.  Packets larger than S are not
+// supported.
 //
-// This class is written for simplicity and efficiency, not to be
-// user friendly.
+// When there is not enough space, push and advanceHead drop the data and
+// return false.  The drop is counted (see overflows/dropped) rather than
+// silently ignored.  While the buffer is nearly full, head() hands out a
+// staging area instead of a live slot, so a packet being assembled never
+// overwrites data the consumer has not read yet.
 //
-// The tail and head buffer can be accessed directly for effeciency,
-// but there are no provisions for dealing with "wrap-around," so it
-// is best that your buffer size is a mutliple of the packet size.
+// Don't advance or try to fetch data that doesn't exist (check count() or
+// the result of peek() first).
 //
 
-template <class T, unsigned N>
+struct RingBufferStats
+{
+    unsigned overflows;         // number of pushes/advances refused
+    unsigned dropped;           // number of elements refused
+};
+
+template <class T, unsigned N, unsigned S = 16>
 class RingBuffer
 {
+    static_assert(N && !(N & (N - 1)), "RingBuffer size must be a power of two");
+    static_assert(S <= N, "RingBuffer slack must not exceed its size");
+
 private:
-    T m_buffer[N];
-    volatile unsigned m_head;   // m_head is volatile: commonly accessed at interrupt time
-    unsigned m_tail;
-    unsigned count(unsigned head, unsigned tail)
+    enum { kMask = N - 1 };
+    T m_buffer[N + S];
+    T m_staging[S];             // used by head() when less than S elements free
+    bool m_staged;
+    unsigned m_head;            // written by producer only
+    unsigned m_tail;            // written by consumer only
+    RingBufferStats m_stats;
+
+    inline unsigned loadHead() { return __atomic_load_n(&m_head, __ATOMIC_ACQUIRE); }
+    inline unsigned loadTail() { return __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE); }
+    void overflow(unsigned move)
     {
-        if (head >= tail)
-            return head - tail;
-        else
-            return N - tail + head;
+        __atomic_fetch_add(&m_stats.overflows, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&m_stats.dropped, move, __ATOMIC_RELAXED);
     }
-    
+
 public:
-    inline RingBuffer() { reset(); }
+    inline RingBuffer() : m_staged(false), m_head(0), m_tail(0), m_stats() {}
     void reset()
     {
-        m_head = 0;
-        m_tail = 0;
+        // discard all available data (consumer side)
+        __atomic_store_n(&m_tail, loadHead(), __ATOMIC_RELEASE);
+    }
+    inline unsigned capacity() const { return N; }
+    inline unsigned count() { return loadHead() - m_tail; }
+    inline unsigned space() { return N - (m_head - loadTail()); }
+    inline unsigned overflows() { return __atomic_load_n(&m_stats.overflows, __ATOMIC_RELAXED); }
+    inline unsigned dropped() { return __atomic_load_n(&m_stats.dropped, __ATOMIC_RELAXED); }
+    inline const RingBufferStats* stats() const { return &m_stats; }
+
+    // producer side
+
+    bool push(T data)
+    {
+        if (!space())
+        {
+            overflow(1);
+            return false;
+        }
+        unsigned index = m_head & kMask;
+        m_buffer[index] = data;
+        if (index < S)
+            m_buffer[N + index] = data;
+        __atomic_store_n(&m_head, m_head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+    T* head()
+    {
+        // once staged, stay staged until the packet is committed
+        if (!m_staged && space() >= S)
+            return &m_buffer[m_head & kMask];
+        m_staged = true;
+        return m_staging;
     }
-    inline unsigned count() { return count(m_head, m_tail); }
-    void push(T data)
+    bool advanceHead(unsigned move)
     {
-        // add new data to head, check for overflow.
-        unsigned new_head = m_head + 1;
-        if (new_head >= N)
-            new_head = 0;
-        if (new_head != m_tail)
+        // commit move elements written at head(), refuse (and count) on overflow
+        bool staged = m_staged;
+        m_staged = false;
+        if (move > space())
+        {
+            overflow(move);
+            return false;
+        }
+        unsigned index = m_head & kMask;
+        if (staged)
         {
-            m_buffer[m_head] = data;
-            m_head = new_head;
+            for (unsigned i = 0; i < move; i++)
+            {
+                unsigned slot = (index + i) & kMask;
+                m_buffer[slot] = m_staging[i];
+                if (slot < S)
+                    m_buffer[N + slot] = m_staging[i];
+            }
         }
+        else if (index + move > N)
+            memcpy(&m_buffer[0], &m_buffer[N], (index + move - N) * sizeof(T));
+        else if (index < S)
+            memcpy(&m_buffer[N + index], &m_buffer[index], (min(index + move, S) - index) * sizeof(T));
+        __atomic_store_n(&m_head, m_head + move, __ATOMIC_RELEASE);
+        return true;
     }
+
+    // consumer side
+
     T fetch()
     {
         // grab new data from tail, no check for underflow.
-        T result = m_buffer[m_tail++];
-        if (m_tail >= N)
-            m_tail = 0;
+        T result = m_buffer[m_tail & kMask];
+        __atomic_store_n(&m_tail, m_tail + 1, __ATOMIC_RELEASE);
         return result;
     }
-    inline T* head() { return &m_buffer[m_head]; }
-    inline T* tail() { return &m_buffer[m_tail]; }
-    void advanceHead(unsigned move)
+    inline T* tail() { return &m_buffer[m_tail & kMask]; }
+    unsigned peek(T*& span)
     {
-        // advance head by specified amount, check for overflow
-        unsigned new_head = m_head + move;
-        if (new_head >= N)
-            new_head -= N;
-        if (count(new_head, m_tail) >= count())
-            m_head = new_head;
+        // longest contiguous run of available data starting at tail()
+        unsigned index = m_tail & kMask;
+        unsigned available = count();
+        span = &m_buffer[index];
+        return min(available, N + S - index);
     }
-    void advanceTail(unsigned move)
+    inline void advanceTail(unsigned move)
     {
         // advance tail by specified amount, no check for underflow.
-        m_tail += move;
-        if (m_tail >= N)
-            m_tail -= N;
+        __atomic_store_n(&m_tail, m_tail + move, __ATOMIC_RELEASE);
     }
+    inline void commit(unsigned move) { advanceTail(move); }
 };
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -333,6 +397,12 @@ typedef struct PS2Command PS2Command;
 //       over the keyboard input stream for a given command sequence. It
 //       does not depend on which driver it came from, rest assurred. If
 //       the mouse driver so chose, it could send keyboard commands.
+
+//    o  Once the device interrupts are installed, requests are processed
+//       asynchronously: the controller yields its workloop while waiting
+//       for each response.  A thread blocked in submitRequestAndBlock
+//       sleeps on the controller's command gate, so other actions on the
+//       workloop may run before the call returns.
 //
 // o  commands:
 //    o  Description:  Holds list of commands that controller should execute.
@@ -342,6 +412,13 @@ typedef struct PS2Command PS2Command;
 //    o  Description:  Holds the number of commands in the command list.
 //    o  Comments:     Number of commands should never exceed kMaxCommands.
 //
+// o  coalesceKind:
+//    o  Description:  Kind of a fire-and-forget request (see PS2CoalesceKind),
+//                     zero by default.  When a request of a non-zero kind is
+//                     submitted, older fire-and-forget requests of the same
+//                     kind for the same port that have not started yet are
+//                     superseded, and freed without being sent.
+//
 // o  completionRoutineTarget, Action, and Param:
 //    o  Description:  Object and method of the completion routine, which is
 //                     called when the request has finished. The Param field
@@ -395,6 +472,14 @@ typedef struct PS2Command PS2Command;
 
 #define kMaxCommands 30
 
+// Kinds of requests that may be coalesced (PS2Request::coalesceKind)
+
+enum PS2CoalesceKind
+{
+    kPS2CK_None = 0,                // never coalesced
+    kPS2CK_SetLEDs,                 // keyboard LED state
+};
+
 typedef void (*PS2CompletionAction)(void * target, void * param);
 
 struct PS2Request
@@ -406,12 +491,15 @@ protected:
     static void* operator new(size_t); // "hide" it
     static inline void* operator new(size_t, int max)
         { return ::operator new(sizeof(PS2Request) + sizeof(PS2Command)*max); }
+    static inline void* operator new(size_t, void* p)   // request pool
+        { return p; }
     static inline void operator delete(void*p)
         { ::operator delete(p); }
 
 public:
     size_t              port;
     UInt8               commandsCount;
+    UInt8               coalesceKind;
     void *              completionTarget;
     PS2CompletionAction completionAction;
     void *              completionParam;
@@ -439,6 +527,218 @@ public:
     PS2Command          commands[max];
 };
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// PS/2 Command Scripts
+//
+// TPS2Script<Steps...> is a TPS2Request whose size and layout are computed at
+// compile time from a list of steps.  Each step emits a fixed sequence of
+// PS2Commands (at most kCommands of them), and some steps produce results
+// (bytes read from the device).  Results are numbered in script order, and
+// result<K>() maps the K-th one to its command slot at compile time.
+//
+// Example (Synaptics style sliced query):
+//
+//      auto request = makePS2Script(PS2Send(kDP_SetDefaultsAndDisable),
+//                                   PS2Sliced(dataSelector),
+//                                   PS2Send(kDP_GetMouseInformation),
+//                                   PS2Read<3>(),
+//                                   PS2Send(kDP_SetDefaultsAndDisable));
+//      _device->submitRequestAndBlock(&request);
+//      if (!request.succeeded())
+//          return false;
+//      request.results(buf3);
+//
+// Step interface: kCommands (maximum number of commands emitted), kResults
+// (number of results, which must be the step's first commands), kFixed
+// (always emits kCommands) and int emit(PS2Command*) returning the number
+// of commands emitted.  result<K>() and results() need every step fixed.
+//
+
+// Send a byte to the device, expect an acknowledge.
+struct PS2Send
+{
+    enum { kCommands = 1, kResults = 0, kFixed = 1 };
+    UInt8 byte;
+    explicit PS2Send(UInt8 data) : byte(data) {}
+    int emit(PS2Command* commands) const
+    {
+        commands[0].command = kPS2C_SendCommandAndCompareAck;
+        commands[0].inOrOut = byte;
+        return 1;
+    }
+};
+
+// Write a byte to the data port, no acknowledge expected.
+struct PS2Write
+{
+    enum { kCommands = 1, kResults = 0, kFixed = 1 };
+    UInt8 byte;
+    explicit PS2Write(UInt8 data) : byte(data) {}
+    int emit(PS2Command* commands) const
+    {
+        commands[0].command = kPS2C_WriteDataPort;
+        commands[0].inOrOut = byte;
+        return 1;
+    }
+};
+
+// Read a byte, and abort the request if it differs from the given one.
+struct PS2Expect
+{
+    enum { kCommands = 1, kResults = 0, kFixed = 1 };
+    UInt8 byte;
+    explicit PS2Expect(UInt8 data) : byte(data) {}
+    int emit(PS2Command* commands) const
+    {
+        commands[0].command = kPS2C_ReadDataPortAndCompare;
+        commands[0].inOrOut = byte;
+        return 1;
+    }
+};
+
+// Read R bytes (results).
+template<int R>
+struct PS2Read
+{
+    enum { kCommands = R, kResults = R, kFixed = 1 };
+    int emit(PS2Command* commands) const
+    {
+        for (int i = 0; i < R; i++)
+        {
+            commands[i].command = kPS2C_ReadDataPort;
+            commands[i].inOrOut = 0;
+        }
+        return R;
+    }
+};
+
+// Send a byte as four Set Resolution commands carrying 2 bits each
+// ("sliced" command, understood by Synaptics, Elan and others).
+struct PS2Sliced
+{
+    enum { kCommands = 8, kResults = 0, kFixed = 1 };
+    UInt8 byte;
+    explicit PS2Sliced(UInt8 data) : byte(data) {}
+    int emit(PS2Command* commands) const
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            commands[2*i].command = kPS2C_SendCommandAndCompareAck;
+            commands[2*i].inOrOut = kDP_SetMouseResolution;
+            commands[2*i+1].command = kPS2C_SendCommandAndCompareAck;
+            commands[2*i+1].inOrOut = (byte >> (6 - 2*i)) & 0x3;
+        }
+        return 8;
+    }
+};
+
+// Sleep for the given number of milliseconds.
+struct PS2SleepMS
+{
+    enum { kCommands = 1, kResults = 0, kFixed = 1 };
+    UInt32 ms;
+    explicit PS2SleepMS(UInt32 time) : ms(time) {}
+    int emit(PS2Command* commands) const
+    {
+        commands[0].command = kPS2C_SleepMS;
+        commands[0].inOrOut32 = ms;
+        return 1;
+    }
+};
+
+// Linux libps2 style command word: command byte in bits 0-7, number of
+// bytes received in bits 8-11, number of bytes sent in bits 12-15.  At most
+// one parameter byte may be sent, or one byte received (and discarded).
+struct PS2EncodedCommand
+{
+    enum { kCommands = 2, kResults = 0, kFixed = 0 };
+    SInt32 word;
+    UInt8 param;
+    PS2EncodedCommand(SInt32 command, UInt8 data) : word(command), param(data) {}
+    int emit(PS2Command* commands) const
+    {
+        int count = 0;
+        commands[count].command = kPS2C_SendCommandAndCompareAck;
+        commands[count++].inOrOut = word & 0xff;
+        if ((word >> 12) & 0xf)
+        {
+            commands[count].command = kPS2C_SendCommandAndCompareAck;
+            commands[count++].inOrOut = param;
+        }
+        else if ((word >> 8) & 0xf)
+        {
+            commands[count].command = kPS2C_ReadDataPort;
+            commands[count++].inOrOut = 0;
+        }
+        return count;
+    }
+};
+
+template<class... Steps> struct PS2ScriptTraits
+{
+    enum { kCommands = 0, kResults = 0, kFixed = 1 };
+    static constexpr int slot(int, int) { return -1; }
+};
+
+template<class S, class... Rest> struct PS2ScriptTraits<S, Rest...>
+{
+    typedef PS2ScriptTraits<Rest...> Next;
+    enum
+    {
+        kCommands = S::kCommands + Next::kCommands,
+        kResults = S::kResults + Next::kResults,
+        kFixed = S::kFixed && Next::kFixed,
+    };
+    // command slot of result k, for a script starting at slot base
+    static constexpr int slot(int k, int base)
+    {
+        return k < S::kResults ? base + k : Next::slot(k - S::kResults, base + S::kCommands);
+    }
+};
+
+inline int ps2ScriptEmit(PS2Command*) { return 0; }
+
+template<class S, class... Rest>
+inline int ps2ScriptEmit(PS2Command* commands, const S& step, const Rest&... rest)
+{
+    int count = step.emit(commands);
+    return count + ps2ScriptEmit(commands + count, rest...);
+}
+
+template<class... Steps>
+struct TPS2Script : public TPS2Request<PS2ScriptTraits<Steps...>::kCommands>
+{
+    typedef PS2ScriptTraits<Steps...> Traits;
+    static_assert(Traits::kCommands <= kMaxCommands, "PS/2 script too long");
+
+    UInt8               scriptCount;
+
+    explicit TPS2Script(const Steps&... steps)
+    {
+        scriptCount = ps2ScriptEmit(this->commands, steps...);
+        this->commandsCount = scriptCount;
+    }
+    inline bool succeeded() const { return this->commandsCount == scriptCount; }
+    template<int K> inline UInt8 result() const
+    {
+        static_assert(Traits::kFixed, "PS/2 script results need fixed length steps");
+        static_assert(K >= 0 && K < Traits::kResults, "PS/2 script result out of range");
+        return this->commands[Traits::slot(K, 0)].inOrOut;
+    }
+    void results(UInt8* out) const
+    {
+        static_assert(Traits::kFixed, "PS/2 script results need fixed length steps");
+        for (int k = 0; k < Traits::kResults; k++)
+            out[k] = this->commands[Traits::slot(k, 0)].inOrOut;
+    }
+};
+
+template<class... Steps>
+inline TPS2Script<Steps...> makePS2Script(const Steps&... steps)
+{
+    return TPS2Script<Steps...>(steps...);
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // ApplePS2KeyboardDevice and ApplePS2MouseDevice Class Descriptions
 //
@@ -463,6 +763,12 @@ public:
 //                     any request sent down to your device from the interrupt
 //                     routine.  Obey, or deadlock.
 //
+// o  installInterruptAction<T, &T::interruptOccurred, &T::packetReady>(this):
+//    o  Description:  Same, with the routines bound at compile time (see
+//                     PS2InterruptHandler).  Preferred: the routines are
+//                     called directly, and can be inlined, on the per-byte
+//                     path.
+//
 // o  uninstallInterruptHandler:
 //    o  Description:  Ask the device to stop delivering asynchronous data.
 //
@@ -496,6 +802,26 @@ typedef PS2InterruptResult (*PS2InterruptAction)(void * target, UInt8 data);
 
 typedef void (*PS2PacketAction)(void * target);
 
+//
+// Compile-time bound driver routines.  PS2InterruptHandler<T, &T::method> is
+// a PS2InterruptAction that calls the given member of the driver directly,
+// so a non-virtual member is inlined into it.  An OSMemberFunctionCast
+// pointer is only known at runtime, and costs an extra indirect call per
+// byte.  The target is the OSObject given to installInterruptAction.
+//
+
+template <class T, PS2InterruptResult (T::*Method)(UInt8)>
+PS2InterruptResult PS2InterruptHandler(void * target, UInt8 data)
+{
+    return (static_cast<T*>(static_cast<OSObject*>(target))->*Method)(data);
+}
+
+template <class T, void (T::*Method)()>
+void PS2PacketHandler(void * target)
+{
+    (static_cast<T*>(static_cast<OSObject*>(target))->*Method)();
+}
+
 //
 // Defines the prototype of an action registered by a PS/2 device driver to
 // intercept power changes on the PS/2 controller, and to manage the device
@@ -516,6 +842,10 @@ typedef void (*PS2PowerControlAction)(void * target, UInt32 whatToDo);
 // Published property for devices to express interest in receiving messages
 #define kDeliverNotifications   "RM,deliverNotifications"
 
+// Published property listing the messages (numbers) a device is interested
+// in, without it the device receives all of them
+#define kDeliverNotificationMessages    "RM,deliverNotificationMessages"
+
 #define kSmbusCompanion         "VoodooSMBusCompanionDevice"
 
 // Published property for device nub port location
@@ -550,6 +880,127 @@ typedef struct PS2KeyInfo
     bool    eatKey;
 } PS2KeyInfo;
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// PS2KeystrokeCell Class Declaration
+//
+// Last keystroke, published by the keyboard driver and read by the trackpad
+// drivers on every packet without going through a message.  The cell is a
+// seqlock: readers retry while a writer is in the middle of an update.
+//
+
+struct PS2KeystrokeState
+{
+    uint64_t    time;           // last non-modifier key event (ns)
+    uint64_t    modifierTime;   // last modifier key release (ns)
+    UInt32      modifiers;      // modifier keys down, bit (adbKeyCode - 0x36)
+    UInt16      adbKeyCode;     // last key, modifier or not
+};
+
+class PS2KeystrokeCell
+{
+private:
+    UInt32 m_sequence;          // odd while an update is in progress
+    PS2KeystrokeState m_state;
+
+    template <typename T> static inline T load(const T& field) { return __atomic_load_n(&field, __ATOMIC_RELAXED); }
+    template <typename T> static inline void store(T& field, T value) { __atomic_store_n(&field, value, __ATOMIC_RELAXED); }
+
+public:
+    inline PS2KeystrokeCell() : m_sequence(0), m_state() {}
+
+    static inline bool isModifier(UInt16 adbKeyCode)
+    {
+        // shift, control, option, command and fn, but not caps lock (0x39)
+        return adbKeyCode >= 0x36 && adbKeyCode <= 0x3f && adbKeyCode != 0x39;
+    }
+
+    void publish(const PS2KeyInfo& info)
+    {
+        // claim the cell (even -> odd), so that concurrent writers take turns
+        UInt32 sequence = __atomic_load_n(&m_sequence, __ATOMIC_RELAXED);
+        while ((sequence & 1) || !__atomic_compare_exchange_n(&m_sequence, &sequence, sequence + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            sequence = __atomic_load_n(&m_sequence, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        if (!isModifier(info.adbKeyCode))
+            store(m_state.time, info.time);
+        else if (info.goingDown)
+            store(m_state.modifiers, load(m_state.modifiers) | 1U << (info.adbKeyCode - 0x36));
+        else
+        {
+            store(m_state.modifiers, load(m_state.modifiers) & ~(1U << (info.adbKeyCode - 0x36)));
+            store(m_state.modifierTime, info.time);
+        }
+        store(m_state.adbKeyCode, info.adbKeyCode);
+
+        __atomic_store_n(&m_sequence, sequence + 2, __ATOMIC_RELEASE);
+    }
+
+    PS2KeystrokeState read() const
+    {
+        PS2KeystrokeState state;
+        UInt32 sequence;
+        do
+        {
+            while ((sequence = __atomic_load_n(&m_sequence, __ATOMIC_ACQUIRE)) & 1)
+                ;
+            state.time = load(m_state.time);
+            state.modifierTime = load(m_state.modifierTime);
+            state.modifiers = load(m_state.modifiers);
+            state.adbKeyCode = load(m_state.adbKeyCode);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while (__atomic_load_n(&m_sequence, __ATOMIC_RELAXED) != sequence);
+        return state;
+    }
+};
+
+
+//
+// Per-port event counters, published by each device nub as "Counters" (keep
+// in sync with Docs/ps2counters.py).
+//
+
+enum PS2CounterKind
+{
+    kPS2CT_Bytes,               // bytes delivered to the driver
+    kPS2CT_Packets,             // packets completed by the driver
+    kPS2CT_InvalidPackets,      // packets the driver could not decode
+    kPS2CT_Resyncs,             // packet boundary lost, bytes skipped
+    kPS2CT_ParityErrors,        // bytes read with the parity error status bit
+    kPS2CT_TimeoutErrors,       // bytes read with the timeout error status bit
+    kPS2CT_ReadTimeouts,        // responses that never arrived
+    kPS2CT_Retries,             // commands repeated by the driver
+    kPS2CT_Count
+};
+
+//
+// Identification reports of an aux port.  The first driver to ask has the
+// controller send every known identification sequence once, and the raw
+// responses are kept until the next sleep, so competing drivers probe
+// without each resetting and querying the device in turn.
+//
+
+enum PS2IdentifyReport
+{
+    kPS2ID_Reset,               // FF: reset result and device id
+    kPS2ID_GetId,               // F2: device id
+    kPS2ID_Status,              // E9: status request
+    kPS2ID_SynapticsIdentify,   // sliced 00, E9
+    kPS2ID_ElanKnock,           // F6 F5 E6 E6 E6 E9
+    kPS2ID_ElanVersion,         // E6, sliced 01, E9 (right after the knock)
+    kPS2ID_E6Report,            // E8 00 E6 E6 E6 E9
+    kPS2ID_E7Report,            // E8 00 E7 E7 E7 E9
+    kPS2ID_ECReport,            // E8 00 EC EC EC E9
+    kPS2ID_Count
+};
+
+struct PS2Identification
+{
+    UInt32  valid;                      // reports received, bit per PS2IdentifyReport
+    UInt8   report[kPS2ID_Count][3];    // response bytes, unused ones zero
+
+    inline bool has(PS2IdentifyReport id) const { return valid & (1U << id); }
+};
 
 //
 // Enumeration of 'whatToDo' values passed to power control action.
@@ -580,12 +1031,33 @@ public:
     bool init(size_t port);
     bool attach(IOService * provider) override;
     void detach(IOService * provider) override;
+    IOWorkLoop* getWorkLoop() const override;
 
     // Interrupt Handling Routines
 
     virtual void installInterruptAction(OSObject *, PS2InterruptAction, PS2PacketAction);
+    template <class T, PS2InterruptResult (T::*Interrupt)(UInt8), void (T::*Packet)()>
+    void installInterruptAction(T * target)
+    {
+        installInterruptAction(target, &PS2InterruptHandler<T, Interrupt>, &PS2PacketHandler<T, Packet>);
+    }
     virtual void uninstallInterruptAction();
 
+    // Event Counters
+
+    inline void countEvent(PS2CounterKind kind, UInt32 count = 1)
+    {
+        __atomic_fetch_add(&_counters[kind], count, __ATOMIC_RELAXED);
+    }
+    template <typename T, unsigned N, unsigned S>
+    void watchRingBuffer(const RingBuffer<T, N, S>& ring)
+    {
+        // the driver's ring buffer overflows are published with the counters
+        // (until uninstallInterruptAction)
+        __atomic_store_n(&_ringStats, ring.stats(), __ATOMIC_RELEASE);
+    }
+    bool serializeProperties(OSSerialize* s) const override;
+
     // Request Submission Routines
 
     virtual PS2Request*  allocateRequest(int max = kMaxCommands);
@@ -593,6 +1065,7 @@ public:
     virtual bool         submitRequest(PS2Request * request);
     virtual void         submitRequestAndBlock(PS2Request * request);
     virtual UInt8        setCommandByte(UInt8 setBits, UInt8 clearBits);
+    virtual bool         getIdentification(PS2Identification* ids);
 
     // Power Control Handling Routines
 
@@ -606,6 +1079,7 @@ public:
 
     // Messaging
     virtual void dispatchMessage(int message, void *data);
+    static void subscribeMessages(IOService* service, const UInt32* messages, size_t count);
     virtual IOReturn startSMBusCompanion(OSDictionary *companionData, UInt8 smbusAddr);
 
     // Exclusive access (command byte contention)
@@ -615,30 +1089,22 @@ public:
 
     // Controller access
     virtual ApplePS2Controller* getController();
+    PS2KeystrokeCell* getKeystrokeCell();
 private:
     PS2InterruptAction      _interrupt_action {nullptr};
     PS2PacketAction         _packet_action {nullptr};
     PS2PowerControlAction   _power_action {nullptr};
     
     IOWorkLoop * _workloop {nullptr};
+    bool _dedicatedWorkLoop {false};
     IOInterruptEventSource * _interruptSource {nullptr};
     
     OSObject* _client {nullptr};
-};
 
-#if 0   // Note: Now using architecture/i386/pio.h (see above)
-typedef unsigned short i386_ioport_t;
-inline unsigned char inb(i386_ioport_t port)
-{
-    unsigned char datum;
-    asm volatile("inb %1, %0" : "=a" (datum) : "d" (port));
-    return(datum);
-}
+    UInt32 _counters[kPS2CT_Count] {};
+    const RingBufferStats* _ringStats {nullptr};
 
-inline void outb(i386_ioport_t port, unsigned char datum)
-{
-    asm volatile("outb %0, %1" : : "a" (datum), "d" (port));
-}
-#endif
+    void publishCounters();
+};
 
 #endif /* !_APPLEPS2DEVICE_H */
@@ -52,6 +52,7 @@ void ApplePS2Controller::interruptHandlerMouse(OSObject*, void* refCon, IOServic
   ApplePS2Controller* me = (ApplePS2Controller*)refCon;
   if (me->_ignoreInterrupts)
     return;
+  __atomic_fetch_add(&me->_irqLines[kPS2AuxLine].interrupts, 1, __ATOMIC_RELAXED);
     
   //
   // Wake our workloop to service the interrupt.    This is an edge-triggered
@@ -73,6 +74,7 @@ void ApplePS2Controller::interruptHandlerKeyboard(OSObject*, void* refCon, IOSer
   ApplePS2Controller* me = (ApplePS2Controller*)refCon;
   if (me->_ignoreInterrupts)
     return;
+  __atomic_fetch_add(&me->_irqLines[kPS2KbdLine].interrupts, 1, __ATOMIC_RELAXED);
     
 #if DEBUGGER_SUPPORT
   //
@@ -92,7 +94,7 @@ void ApplePS2Controller::interruptHandlerKeyboard(OSObject*, void* refCon, IOSer
 
   // Verify that data is available on the controller's input port.
 
-  if ( ((status = inb(kCommandPort)) & kOutputReady) )
+  if ( ((status = ps2_inb(kCommandPort)) & kOutputReady) )
   {
     // Verify that the data is keyboard data, otherwise call mouse handler.
     // This case should never really happen, but if it does, we handle it.
@@ -105,8 +107,8 @@ void ApplePS2Controller::interruptHandlerKeyboard(OSObject*, void* refCon, IOSer
     {
       // Retrieve the keyboard data on the controller's input port.
 
-      IODelay(kDataDelay);
-      key = inb(kDataPort);
+      me->settleDelay();
+      key = ps2_inb(kDataPort);
 
       // Call the debugger-key-sequence checking code (if a debugger sequence
       // completes, the debugger function will be invoked immediately within
@@ -161,20 +163,22 @@ void ApplePS2Controller::onWatchdogTimer()
 void ApplePS2Controller::handleInterrupt(bool watchdog)
 {
     // Loop only while there is data currently on the input stream.
-    bool wakePort[kPS2MuxMaxIdx] {};
+    UInt32 wakePorts = 0;
+    bool wakeRequest = false;
 
     while (1)
     {
         // while getting status and reading the port, no interrupts...
-        bool enable = ml_set_interrupts_enabled(false);
+        // (the lock keeps the workloop from reading the port at the same time)
+        IOInterruptState state = IOSimpleLockLockDisableInterrupt(_portLock);
         size_t port = kPS2KbdIdx;
-        IODelay(kDataDelay);
-        UInt8 status = inb(kCommandPort);
+        settleDelay();
+        UInt8 status = ps2_inb(kCommandPort);
       
         if (!(status & kOutputReady))
         {
             // no data available, so break out and return
-            ml_set_interrupts_enabled(enable);
+            IOSimpleLockUnlockEnableInterrupt(_portLock, state);
             break;
         }
         
@@ -182,18 +186,30 @@ void ApplePS2Controller::handleInterrupt(bool watchdog)
         // do not process mouse data in watchdog timer
         if (watchdog && (status & kMouseData))
         {
-            ml_set_interrupts_enabled(enable);
+            IOSimpleLockUnlockEnableInterrupt(_portLock, state);
             break;
         }
 #endif
       
         // read the data
-        IODelay(kDataDelay);
-        UInt8 data = inb(kDataPort);
+        settleDelay();
+        UInt8 data = ps2_inb(kDataPort);
+        port = getPortFromStatus(status);
+        traceByte(kPS2TR_Read, port, data, status);
+        countStatusErrors(port, status);
+
+        // responses to the active request are kept for the request engine
+        bool captured = captureResponseByte(port, data);
         
         // now ok for interrupts, we have read status, and found data...
         // (it does not matter [too much] if keyboard data is delivered out of order)
-        ml_set_interrupts_enabled(enable);
+        IOSimpleLockUnlockEnableInterrupt(_portLock, state);
+
+        if (captured)
+        {
+            wakeRequest = true;
+            continue;
+        }
       
 #if WATCHDOG_TIMER
         //REVIEW: remove this debug eventually...
@@ -201,19 +217,22 @@ void ApplePS2Controller::handleInterrupt(bool watchdog)
             IOLog("%s:handleInterrupt(kDT_Watchdog): %s = %02x\n", getName(), port > kPS2KbdIdx ? "mouse" : "keyboard", data);
 #endif
       
-        port = getPortFromStatus(status);
         if (kPS2IR_packetReady == _dispatchDriverInterrupt(port, data))
         {
-            wakePort[port] = true;
+            wakePorts |= 1 << port;
         }
     } // while (forever)
     
+    // resume the active request on the workloop if its response arrived
+    if (wakeRequest)
+        _interruptSourceQueue->interruptOccurred(0, 0, 0);
+
     // wake up workloop based mouse interrupt source if needed
-    for (size_t i = kPS2KbdIdx; i < _nubsCount; i++) {
-        if (wakePort[i])
-        {
-            _devices[i]->packetActionInterrupt();
-        }
+    while (wakePorts)
+    {
+        size_t i = __builtin_ctz(wakePorts);
+        wakePorts &= wakePorts - 1;
+        _devices[i]->packetActionInterrupt();
     }
 }
 
@@ -225,23 +244,31 @@ void ApplePS2Controller::handleInterrupt(bool watchdog)
     
     UInt8 status;
     size_t port;
-    IODelay(kDataDelay);
-    while ((status = inb(kCommandPort)) & kOutputReady)
+    settleDelay();
+    while ((status = ps2_inb(kCommandPort)) & kOutputReady)
     {
 #if WATCHDOG_TIMER
         if (watchdog && (status & kMouseData))
             break;
 #endif
-        IODelay(kDataDelay);
-        UInt8 data = inb(kDataPort);
+        settleDelay();
+        UInt8 data = ps2_inb(kDataPort);
         port = getPortFromStatus(status);
+        traceByte(kPS2TR_Read, port, data, status);
+        countStatusErrors(port, status);
 #if WATCHDOG_TIMER
         //REVIEW: remove this debug eventually...
         if (watchdog)
             IOLog("%s:handleInterrupt(kDT_Watchdog): %s = %02x\n", getName(), port > kPS2KbdIdx ? "mouse" : "keyboard", data);
 #endif
-        dispatchDriverInterrupt(port, data);
-        IODelay(kDataDelay);
+        IOInterruptState state = IOSimpleLockLockDisableInterrupt(_portLock);
+        bool captured = captureResponseByte(port, data);
+        IOSimpleLockUnlockEnableInterrupt(_portLock, state);
+        if (captured)
+            runRequestEngine();
+        else
+            dispatchDriverInterrupt(port, data);
+        settleDelay();
     }
 }
 
@@ -276,6 +303,17 @@ bool ApplePS2Controller::init(OSDictionary* dict)
   _cmdbyteLock = IOLockAlloc();
   if (!_cmdbyteLock)
       return false;
+
+  _portLock = IOSimpleLockAlloc();
+  if (!_portLock)
+      return false;
+
+  _identifyLock = IOLockAlloc();
+  if (!_identifyLock)
+      return false;
+
+  if (!initRequestPool())
+      return false;
 	
   _deliverNotification = OSSymbol::withCString(kDeliverNotifications);
    if (_deliverNotification == NULL)
@@ -285,7 +323,21 @@ bool ApplePS2Controller::init(OSDictionary* dict)
   if (_smbusCompanion == NULL)
       return false;
 
-  queue_init(&_requestQueue);
+  queue_init(&_pendingQueue);
+  buildStatusPortTable();
+
+#if BYTE_TRACE
+  // Tracing is best effort, the controller works without it.
+  _traceMemory = IOBufferMemoryDescriptor::withOptions(kIODirectionInOut | kIOMemoryKernelUserShared,
+                                                       sizeof(PS2TraceBuffer), page_size);
+  if (_traceMemory)
+  {
+    _trace = (PS2TraceBuffer*)_traceMemory->getBytesNoCopy();
+    bzero(_trace, sizeof(PS2TraceBuffer));
+    _trace->magic   = kTraceMagic;
+    _trace->entries = kTraceEntries;
+  }
+#endif
 
 #if DEBUGGER_SUPPORT
   queue_init(&_keyboardQueue);
@@ -295,8 +347,6 @@ bool ApplePS2Controller::init(OSDictionary* dict)
   if (!_controllerLock) return false;
 #endif //DEBUGGER_SUPPORT
     
-  _notificationServices = OSSet::withCapacity(1);
-    
   return true;
 }
 
@@ -325,6 +375,25 @@ void ApplePS2Controller::free(void)
         IOLockFree(_cmdbyteLock);
         _cmdbyteLock = 0;
     }
+
+    if (_portLock)
+    {
+        IOSimpleLockFree(_portLock);
+        _portLock = 0;
+    }
+
+    if (_identifyLock)
+    {
+        IOLockFree(_identifyLock);
+        _identifyLock = 0;
+    }
+
+    freeRequestPool();
+
+#if BYTE_TRACE
+    _trace = nullptr;
+    OSSafeReleaseNULL(_traceMemory);
+#endif
 	
 #if DEBUGGER_SUPPORT
     if (_controllerLock)
@@ -338,6 +407,43 @@ void ApplePS2Controller::free(void)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+#if BYTE_TRACE
+
+IOReturn ApplePS2Controller::newUserClient(task_t owningTask, void * securityID,
+                                           UInt32 type, IOUserClient ** handler)
+{
+  //
+  // The byte trace shows every keystroke, so only administrators may map it.
+  //
+
+  if (!_traceMemory)
+    return kIOReturnUnsupported;
+  if (IOUserClient::clientHasPrivilege(securityID, kIOClientPrivilegeAdministrator) != kIOReturnSuccess)
+    return kIOReturnNotPrivileged;
+
+  ApplePS2TraceClient* client = OSTypeAlloc(ApplePS2TraceClient);
+  if (!client)
+    return kIOReturnNoMemory;
+  if (!client->initWithTask(owningTask, securityID, type) || !client->attach(this))
+  {
+    client->release();
+    return kIOReturnError;
+  }
+  if (!client->start(this))
+  {
+    client->detach(this);
+    client->release();
+    return kIOReturnError;
+  }
+
+  *handler = client;
+  return kIOReturnSuccess;
+}
+
+#endif // BYTE_TRACE
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 IOReturn ApplePS2Controller::setPropertiesGated(OSObject* props)
 {
     OSDictionary* dict = OSDynamicCast(OSDictionary, props);
@@ -350,17 +456,58 @@ IOReturn ApplePS2Controller::setPropertiesGated(OSObject* props)
 		_wakedelay = (int)num->unsigned32BitValue();
         setProperty("WakeDelay", _wakedelay, 32);
     }
+    // get coalesceRequests
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, dict->getObject("CoalesceRequests")))
+    {
+        _coalesceRequests = flag->isTrue();
+        setProperty("CoalesceRequests", _coalesceRequests);
+    }
+    // get detectLostInterrupts
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, dict->getObject("DetectLostInterrupts")))
+    {
+        _detectLostInterrupts = flag->isTrue();
+        setProperty("DetectLostInterrupts", _detectLostInterrupts);
+        if (_lostInterruptTimer && _detectLostInterrupts)
+            _lostInterruptTimer->setTimeoutMS(kLostInterruptCheckMS);
+    }
     // get mouseWakeFirst
     if (OSBoolean* flag = OSDynamicCast(OSBoolean, dict->getObject("MouseWakeFirst")))
     {
         _mouseWakeFirst = flag->isTrue();
         setProperty("MouseWakeFirst", _mouseWakeFirst);
     }
+    // get dedicatedWorkLoop (only nubs created afterwards, ie. at start, use it)
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, dict->getObject("DedicatedWorkLoop")))
+    {
+        _dedicatedWorkLoop = flag->isTrue();
+        setProperty("DedicatedWorkLoop", _dedicatedWorkLoop);
+    }
+    // get overlapDeviceWake
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, dict->getObject("OverlapDeviceWake")))
+    {
+        _overlapDeviceWake = flag->isTrue();
+        setProperty("OverlapDeviceWake", _overlapDeviceWake);
+    }
+    // get dataDelay (replaced by the calibrated value if calibration is enabled)
+    if (OSNumber* num = OSDynamicCast(OSNumber, dict->getObject("DataDelay")))
+    {
+        _dataDelay = (int)num->unsigned32BitValue();
+        setProperty("DataDelay", _dataDelay, 32);
+    }
+    // get calibrateDataDelay
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, dict->getObject("CalibrateDataDelay")))
+    {
+        _calibrateDataDelay = flag->isTrue();
+        setProperty("CalibrateDataDelay", _calibrateDataDelay);
+    }
     return kIOReturnSuccess;
 }
 
 IOReturn ApplePS2Controller::setProperties(OSObject* props)
 {
+    // merged configurations may be stale after a change from user space
+    flushConfigurationCache();
+
     if (_cmdGate)
     {
         // syncronize through workloop...
@@ -386,8 +533,8 @@ void ApplePS2Controller::resetController()
         writeCommandPort(kCP_EnableMouseClock);
     writeCommandPort(kCP_EnableKeyboardClock);
     // Read current command
-    writeCommandPort(kCP_GetCommandByte);
-    commandByte = readDataPort(kPS2KbdIdx);
+    invalidateCommandByte();
+    commandByte = readCommandByte();
     DEBUG_LOG("%s: initial commandByte = %02x\n", getName(), commandByte);
     // Issue Test Controller to try to reset device
     writeCommandPort(kCP_TestController);
@@ -416,9 +563,153 @@ void ApplePS2Controller::resetController()
     else
         commandByte &= ~(kCB_EnableKeyboardIRQ | kCB_EnableMouseIRQ | kCB_DisableKeyboardClock);
     commandByte |= kCB_TranslateMode;
+    writeCommandByte(commandByte);
+    DEBUG_LOG("%s: new commandByte = %02x\n", getName(), commandByte);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+UInt8 ApplePS2Controller::readCommandByte()
+{
+    //
+    // Returns the command byte from its shadow copy.  The controller itself
+    // is only asked when the copy is not known: at start, after a reset or
+    // a wake, or when the copy is suspect (lost interrupts, mux mode
+    // changes).  Every change goes through writeCommandByte or one of the
+    // clock commands, which keep the copy up to date (see writeCommandPort).
+    //
+    // This method should only be called from our single-threaded work loop.
+    //
+
+    if (!_commandByteKnown)
+    {
+        writeCommandPort(kCP_GetCommandByte);
+        _commandByte = readDataPort(kPS2KbdIdx);
+        _commandByteKnown = true;
+    }
+    return _commandByte;
+}
+
+void ApplePS2Controller::writeCommandByte(UInt8 commandByte)
+{
     writeCommandPort(kCP_SetCommandByte);
     writeDataPort(commandByte);
-    DEBUG_LOG("%s: new commandByte = %02x\n", getName(), commandByte);
+    _commandByte = commandByte;
+    _commandByteKnown = true;
+}
+
+// -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::readCalibrationReply(size_t port, UInt8 command, UInt8 * reply, unsigned count)
+{
+    // Send one command to the device and read back its acknowledge plus reply.
+    if (port != kPS2KbdIdx)
+        writeCommandPort(kCP_TransmitToMouse);
+    writeDataPort(command);
+    for (unsigned i = 0; i < count; i++)
+        reply[i] = readDataPort(port);
+    return kSC_Acknowledge == reply[0];
+}
+
+void ApplePS2Controller::calibrateDataDelay()
+{
+    //
+    // Find the smallest delay between the status and the data port accesses
+    // that still reads device data correctly on this machine.  A device reply
+    // is requested repeatedly, first with the default delay as a reference,
+    // then with each candidate delay: the aux device's status (E9), or the
+    // keyboard's ID (F2) without an aux device.  The bytes of a reply follow
+    // each other on the wire, which is where a short delay shows up as stale
+    // or lost data.  Without any device reply, the default delay is kept.
+    //
+    // Only called at start, before any interrupt handler is installed.
+    //
+
+    static const int candidates[] = { 0, 1, 2, 4 };
+    int calibrated = kDataDelay;
+    UInt8 reference[4], reply[4];
+
+    _suppressTimeout = true;
+    _dataDelay = kDataDelay;
+    flushDataPort();
+
+    // a streaming aux device would mix its packets into the replies
+    size_t port = kPS2AuxIdx;
+    UInt8 command = kDP_GetMouseInformation;
+    unsigned count = 4;
+    if (_kbdOnly || !readCalibrationReply(port, kDP_SetDefaultsAndDisable, reference, 1) ||
+        !readCalibrationReply(port, command, reference, count))
+    {
+        flushDataPort();
+        port = kPS2KbdIdx;
+        command = kDP_GetId;
+        count = 3;
+        if (!readCalibrationReply(port, command, reference, count))
+        {
+            flushDataPort();
+            _suppressTimeout = false;
+            IOLog("%s: no device reply, keeping data delay %d us\n", getName(), _dataDelay);
+            setProperty("DataDelay", _dataDelay, 32);
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < countof(candidates) && calibrated == kDataDelay; i++)
+    {
+        _dataDelay = candidates[i];
+        bool valid = true;
+        for (int round = 0; round < kDataDelayCalibrationRounds && valid; round++)
+        {
+            // data must match, and nothing may be left behind in the output buffer
+            valid = readCalibrationReply(port, command, reply, count) &&
+                    !memcmp(reply, reference, count) &&
+                    !(ps2_inb(kCommandPort) & kOutputReady);
+        }
+        if (valid)
+            calibrated = candidates[i];
+        flushDataPort();
+    }
+    _dataDelay = calibrated;
+
+    //
+    // Measure the CPU time handleInterrupt spends per byte, on the same reply
+    // and with the calibrated delay.  Each byte is drained by its own call, as
+    // from the interrupt; no driver is attached yet, so the bytes go nowhere.
+    //
+
+    uint64_t total = 0;
+    unsigned bytes = 0;
+    for (int round = 0; round < kDataDelayCalibrationRounds; round++)
+    {
+        if (port != kPS2KbdIdx)
+            writeCommandPort(kCP_TransmitToMouse);
+        writeDataPort(command);
+        for (unsigned i = 0; i < count; i++)
+        {
+            int timeoutCounter = 20000;
+            while (timeoutCounter && !(ps2_inb(kCommandPort) & kOutputReady))
+            {
+                timeoutCounter--;
+                IODelay(kDataDelay);
+            }
+            if (!timeoutCounter)
+                break;
+            uint64_t start, end, ns;
+            clock_get_uptime(&start);
+            handleInterrupt();
+            clock_get_uptime(&end);
+            absolutetime_to_nanoseconds(end - start, &ns);
+            total += ns;
+            bytes++;
+        }
+    }
+    flushDataPort();
+    _suppressTimeout = false;
+    UInt32 byteCost = bytes ? (UInt32)(total / bytes) : 0;
+
+    IOLog("%s: calibrated data delay %d us (%u ns per byte)\n", getName(), _dataDelay, (unsigned)byteCost);
+    setProperty("DataDelay", _dataDelay, 32);
+    setProperty("ByteReadCost", byteCost, 32);
 }
 
 // -- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -453,11 +744,12 @@ void ApplePS2Controller::resetDevices()
 
 void ApplePS2Controller::flushDataPort()
 {
-    while ( inb(kCommandPort) & kOutputReady )
+    UInt8 status;
+    while ( (status = ps2_inb(kCommandPort)) & kOutputReady )
     {
-        IODelay(kDataDelay);
-        inb(kDataPort);
-        IODelay(kDataDelay);
+        settleDelay();
+        traceByte(kPS2TR_Flush, getPortFromStatus(status), ps2_inb(kDataPort), status);
+        settleDelay();
     }
 }
 
@@ -467,6 +759,9 @@ bool ApplePS2Controller::setMuxMode(bool enable)
 {
     UInt8 param = kDP_MuxCmd;
 
+    // some controllers rewrite the command byte when switching mux mode
+    invalidateCommandByte();
+
     writeCommandPort(kCP_WriteMouseOutputBuffer);
     writeDataPort(param);
     if (readDataPort(kPS2AuxIdx) != param)
@@ -531,6 +826,10 @@ bool ApplePS2Controller::start(IOService * provider)
     resetController();
   }
 
+  if (_calibrateDataDelay) {
+    calibrateDataDelay();
+  }
+
   //
   // Enable "Active PS/2 Multiplexing" if it exists.
   // This creates 4 Aux ports which pointing devices may connect to.
@@ -543,6 +842,7 @@ bool ApplePS2Controller::start(IOService * provider)
     _muxPresent = setMuxMode(true);
     _nubsCount = _muxPresent ? kPS2MuxMaxIdx : kPS2AuxMaxIdx;
   }
+  buildStatusPortTable();
   
   //
   // Reset attached devices and clear out garbage in the controller's input streams,
@@ -554,13 +854,6 @@ bool ApplePS2Controller::start(IOService * provider)
     flushDataPort();
   }
   
-  //
-  // Use a spin lock to protect the client async request queue.
-  //
-
-  _requestQueueLock = IOLockAlloc();
-  if (!_requestQueueLock) goto fail;
-
   //
   // Initialize our work loop, our command gate, and our interrupt event
   // sources.  The work loop can accept requests after this step.
@@ -571,10 +864,16 @@ bool ApplePS2Controller::start(IOService * provider)
   _cmdGate = IOCommandGate::commandGate(this);
   _interruptSourceQueue = IOInterruptEventSource::interruptEventSource( this,
       OSMemberFunctionCast(IOInterruptEventAction, this, &ApplePS2Controller::processRequestQueue));
+  _requestTimer = IOTimerEventSource::timerEventSource( this,
+      OSMemberFunctionCast(IOTimerEventSource::Action, this, &ApplePS2Controller::onRequestTimer));
+  _lostInterruptTimer = IOTimerEventSource::timerEventSource( this,
+      OSMemberFunctionCast(IOTimerEventSource::Action, this, &ApplePS2Controller::onLostInterruptTimer));
   
     
   if ( !_workLoop                ||
        !_interruptSourceQueue    ||
+       !_requestTimer            ||
+       !_lostInterruptTimer      ||
        !_cmdGate)  goto fail;
   
 #if HANDLE_INTERRUPT_DATA_LATER
@@ -596,6 +895,12 @@ bool ApplePS2Controller::start(IOService * provider)
     goto fail;
   if ( _workLoop->addEventSource(_cmdGate) != kIOReturnSuccess )
     goto fail;
+  if ( _workLoop->addEventSource(_requestTimer) != kIOReturnSuccess )
+    goto fail;
+  if ( _workLoop->addEventSource(_lostInterruptTimer) != kIOReturnSuccess )
+    goto fail;
+  if ( _detectLostInterrupts )
+    _lostInterruptTimer->setTimeoutMS(kLostInterruptCheckMS);
   
 #if WATCHDOG_TIMER
   _watchdogTimer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &ApplePS2Controller::onWatchdogTimer));
@@ -621,6 +926,15 @@ bool ApplePS2Controller::start(IOService * provider)
   if ( !_powerChangeThreadCall )
     goto fail;
 
+  for (size_t i = 0; i < kPS2AuxMaxIdx; i++)
+  {
+    _deviceWakeThreadCall[i] = thread_call_allocate(
+                               (thread_call_func_t)  deviceWakeCallout,
+                               (thread_call_param_t) this );
+    if ( !_deviceWakeThreadCall[i] )
+      goto fail;
+  }
+
   //
   // Initialize our PM superclass variables and register as the power
   // controlling driver.
@@ -669,6 +983,8 @@ bool ApplePS2Controller::start(IOService * provider)
     _devices[i]->registerService();
   }
   
+  // our personality asks for notifications, but we do not handle any
+  ApplePS2Device::subscribeMessages(this, NULL, 0);
   registerService();
 
   propertyMatch = propertyMatching(_deliverNotification, kOSBooleanTrue);
@@ -724,15 +1040,45 @@ void ApplePS2Controller::stop(IOService * provider)
   _publishNotify->remove();
   _terminateNotify->remove();
 
-  _notificationServices->flushCollection();
-  OSSafeReleaseNULL(_notificationServices);
+  // Drop the message subscribers, once no delivery is using them
+  // (seq_cst pairs the slot clear and reader count with deliverMessage)
+  IOService* subscribers[kMaxMessageSubscribers] {};
+  for (UInt32 i = 0; i < _subscriberCount; i++)
+    subscribers[i] = __atomic_exchange_n(&_subscribers[i].service, nullptr, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&_messageReaders, __ATOMIC_SEQ_CST))
+    IOSleep(1);
+  for (UInt32 i = 0; i < _subscriberCount; i++)
+    OSSafeReleaseNULL(subscribers[i]);
+  _subscriberCount = 0;
     
+  // Empty out the request queue (this completes the active request, so it
+  // must happen before the request timer and the command gate go away).
+  if (_requestTimer)
+  {
+    _hardwareOffline = true;
+    processRequestQueue(0, 0);
+  }
+
   // Free the nubs we created.
   for (size_t i = 0; i < kPS2MuxMaxIdx; i++) {
     OSSafeReleaseNULL(_devices[i]);
   }
 
   // Free the event/interrupt sources
+  if (_requestTimer)
+  {
+    _requestTimer->cancelTimeout();
+    if (_workLoop)
+      _workLoop->removeEventSource(_requestTimer);
+  }
+  OSSafeReleaseNULL(_requestTimer);
+  if (_lostInterruptTimer)
+  {
+    _lostInterruptTimer->cancelTimeout();
+    if (_workLoop)
+      _workLoop->removeEventSource(_lostInterruptTimer);
+  }
+  OSSafeReleaseNULL(_lostInterruptTimer);
   OSSafeReleaseNULL(_interruptSourceQueue);
   OSSafeReleaseNULL(_cmdGate);
    
@@ -748,26 +1094,28 @@ void ApplePS2Controller::stop(IOService * provider)
   // Free the work loop.
   OSSafeReleaseNULL(_workLoop);
 
-  // Free the RMCF configuration cache
+  // Free the RMCF and merged configuration caches
   OSSafeReleaseNULL(_rmcfCache);
+  OSSafeReleaseNULL(_configCache);
+  OSSafeReleaseNULL(_platformManufacturer);
+  OSSafeReleaseNULL(_platformProduct);
   OSSafeReleaseNULL(_deliverNotification);
   OSSafeReleaseNULL(_smbusCompanion);
 
-  // Free the request queue lock and empty out the request queue.
-  if (_requestQueueLock)
-  {
-    _hardwareOffline = true;
-    processRequestQueue(0, 0);
-    IOLockFree(_requestQueueLock);
-    _requestQueueLock = 0;
-  }
-
   // Free the power management thread call.
   if (_powerChangeThreadCall)
   {
     thread_call_free(_powerChangeThreadCall);
     _powerChangeThreadCall = 0;
   }
+  for (size_t i = 0; i < kPS2AuxMaxIdx; i++)
+  {
+    if (_deviceWakeThreadCall[i])
+    {
+      thread_call_free(_deviceWakeThreadCall[i]);
+      _deviceWakeThreadCall[i] = 0;
+    }
+  }
 
   // Detach from power management plane.
   PMstop();
@@ -851,6 +1199,26 @@ void ApplePS2Controller::installInterruptAction(size_t port)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+void ApplePS2Controller::setInterruptTarget(size_t port, void * client, PS2InterruptAction action)
+{
+  //
+  // Sets the interrupt routine that each byte of the given input stream
+  // is handed to.  The client is published before the routine, so that
+  // the interrupt handler never calls a routine without its client.
+  //
+
+  assert(port < kPS2MuxMaxIdx);
+
+  PS2DispatchSlot& slot = _dispatch[port];
+  __atomic_store_n(&slot.action, (PS2InterruptAction) nullptr, __ATOMIC_RELEASE);
+  if (!action)
+    return;
+  slot.client = client;
+  __atomic_store_n(&slot.action, action, __ATOMIC_RELEASE);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 void ApplePS2Controller::uninstallInterruptAction(size_t port)
 {
   //
@@ -893,17 +1261,22 @@ PS2Request * ApplePS2Controller::allocateRequest(int max)
 {
   //
   // Allocate a request structure.  Blocks until successful.
-  // Most of request structure is guaranteed to be zeroed.
+  // Most of request structure is guaranteed to be zeroed, commands
+  // included, whether it comes from the pool or from the heap.
   //
     
   assert(max > 0);
-    
+
+  if (PS2Request* request = allocatePooledRequest(max))
+    return request;
+
   return new(max) PS2Request;
 }
 
 EXPORT PS2Request::PS2Request()
 {
   commandsCount = 0;
+  coalesceKind = kPS2CK_None;
   completionTarget = 0;
   completionAction = 0;
   completionParam = 0;
@@ -924,7 +1297,168 @@ void ApplePS2Controller::freeRequest(PS2Request * request)
   // Deallocate a request structure.
   //
 
-  delete request;
+  if (!freePooledRequest(request))
+    delete request;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::initRequestPool()
+{
+  static const int sizes[kRequestPoolClasses] = kRequestPoolSizes;
+  static const UInt32 counts[kRequestPoolClasses] = kRequestPoolCounts;
+
+  for (int i = 0; i < kRequestPoolClasses; i++)
+  {
+    PS2RequestSlab& slab = _requestPool[i];
+    // keep each slot pointer aligned
+    slab.slotSize = (sizeof(PS2Request) + sizeof(PS2Command) * sizes[i] + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    slab.slotCount = counts[i];
+    slab.maxCommands = sizes[i];
+    slab.base = (UInt8*)IOMalloc(slab.slotSize * slab.slotCount);
+    slab.links = (UInt32*)IOMalloc(sizeof(UInt32) * slab.slotCount);
+    if (!slab.base || !slab.links)
+      return false;
+
+    // thread all slots onto the free list, slot 0 on top
+    for (UInt32 index = 0; index < slab.slotCount; index++)
+      slab.links[index] = index + 1 < slab.slotCount ? index + 2 : 0;
+    slab.freeHead = 1;
+  }
+  return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::freeRequestPool()
+{
+  for (int i = 0; i < kRequestPoolClasses; i++)
+  {
+    PS2RequestSlab& slab = _requestPool[i];
+    assert(!slab.inUse);
+    if (slab.base)
+      IOFree(slab.base, slab.slotSize * slab.slotCount);
+    if (slab.links)
+      IOFree(slab.links, sizeof(UInt32) * slab.slotCount);
+    slab.base = 0;
+    slab.links = 0;
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+PS2Request* ApplePS2Controller::allocatePooledRequest(int max)
+{
+  //
+  // Pop a slot from the smallest class that fits.  Returns NULL (caller uses
+  // the heap) when no class fits or the class is exhausted.
+  //
+
+  for (int i = 0; i < kRequestPoolClasses; i++)
+  {
+    PS2RequestSlab& slab = _requestPool[i];
+    if (max > slab.maxCommands)
+      continue;
+
+    UInt64 head = __atomic_load_n(&slab.freeHead, __ATOMIC_ACQUIRE);
+    UInt64 next;
+    UInt32 index;
+    do
+    {
+      index = (UInt32)head;
+      if (!index)
+        break;
+      next = ((head >> 32) + 1) << 32 | __atomic_load_n(&slab.links[index - 1], __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&slab.freeHead, &head, next, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    if (!index)
+    {
+      // only counted here, published when the registry is read
+      __atomic_fetch_add(&slab.exhausted, 1, __ATOMIC_RELAXED);
+      return NULL;
+    }
+
+    UInt32 inUse = __atomic_add_fetch(&slab.inUse, 1, __ATOMIC_RELAXED);
+    UInt32 highWater = __atomic_load_n(&slab.highWater, __ATOMIC_RELAXED);
+    while (inUse > highWater &&
+           !__atomic_compare_exchange_n(&slab.highWater, &highWater, inUse, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      ;
+
+    // slots are reused, clear them like the heap (zero-filling new) does
+    UInt8* slot = slab.base + (index - 1) * slab.slotSize;
+    bzero(slot, slab.slotSize);
+    return new(slot) PS2Request;
+  }
+
+  __atomic_fetch_add(&_requestPoolOversize, 1, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::freePooledRequest(PS2Request* request)
+{
+  //
+  // Push the slot back on its class' free list.  Returns false if the
+  // request did not come from the pool.
+  //
+
+  for (int i = 0; i < kRequestPoolClasses; i++)
+  {
+    PS2RequestSlab& slab = _requestPool[i];
+    UInt8* p = (UInt8*)request;
+    if (p < slab.base || p >= slab.base + slab.slotSize * slab.slotCount)
+      continue;
+
+    UInt32 index = (UInt32)((p - slab.base) / slab.slotSize) + 1;
+    UInt64 head = __atomic_load_n(&slab.freeHead, __ATOMIC_RELAXED);
+    UInt64 next;
+    do
+    {
+      __atomic_store_n(&slab.links[index - 1], (UInt32)head, __ATOMIC_RELAXED);
+      next = ((head >> 32) + 1) << 32 | index;
+    } while (!__atomic_compare_exchange_n(&slab.freeHead, &head, next, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    __atomic_sub_fetch(&slab.inUse, 1, __ATOMIC_RELAXED);
+    return true;
+  }
+  return false;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::publishRequestStatistics()
+{
+  //
+  // Publish "RequestPool" as an array of per class dictionaries, and the
+  // request queue counters.  Called when the properties are read and when
+  // going to sleep, never from the allocation path.
+  //
+
+  OSArray* classes = OSArray::withCapacity(kRequestPoolClasses);
+  if (!classes)
+    return;
+  for (int i = 0; i < kRequestPoolClasses; i++)
+  {
+    PS2RequestSlab& slab = _requestPool[i];
+    if (OSDictionary* dict = OSDictionary::withCapacity(4))
+    {
+      OSNumber* num;
+      if ((num = OSNumber::withNumber(slab.maxCommands, 32))) { dict->setObject("Commands", num); num->release(); }
+      if ((num = OSNumber::withNumber(slab.slotCount, 32))) { dict->setObject("Capacity", num); num->release(); }
+      if ((num = OSNumber::withNumber(slab.highWater, 32))) { dict->setObject("HighWater", num); num->release(); }
+      if ((num = OSNumber::withNumber(slab.exhausted, 32))) { dict->setObject("Exhausted", num); num->release(); }
+      classes->setObject(dict);
+      dict->release();
+    }
+  }
+  setProperty("RequestPool", classes);
+  setProperty("RequestPoolOversize", _requestPoolOversize, 32);
+  setProperty("RequestsCoalesced", _requestsCoalesced, 32);
+  setProperty("RequestsDropped", _requestsDropped, 32);
+  setProperty("ResponsesReordered", _responsesReordered, 32);
+  setProperty("BytesReplayed", _bytesReplayed, 32);
+  classes->release();
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -945,55 +1479,178 @@ void ApplePS2Controller::setCommandByteGated(PS2Request* request)
 {
     UInt8 setBits = request->commands[0].setBits;
     UInt8 clearBits = request->commands[0].clearBits;
+    quiesceRequestEngine();
     ++_ignoreInterrupts;
-    writeCommandPort(kCP_GetCommandByte);
-    UInt8 oldCommandByte = readDataPort(kPS2KbdIdx);
+    UInt8 oldCommandByte = readCommandByte();
     --_ignoreInterrupts;
     DEBUG_LOG("%s: oldCommandByte = %02x\n", getName(), oldCommandByte);
     UInt8 newCommandByte = (oldCommandByte | setBits) & ~clearBits;
     if (oldCommandByte != newCommandByte)
     {
         DEBUG_LOG("%s: newCommandByte = %02x\n", getName(), newCommandByte);
-        writeCommandPort(kCP_SetCommandByte);
-        writeDataPort(newCommandByte);
+        writeCommandByte(newCommandByte);
     }
     request->commands[0].oldBits = oldCommandByte;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-bool ApplePS2Controller::submitRequest(PS2Request * request)
+bool ApplePS2Controller::getIdentification(size_t port, PS2Identification* ids)
 {
-  assert(request->port < kPS2MuxMaxIdx);
-
-  //
-  // Submit the request to the controller for processing, asynchronously.
-  //
-  IOLockLock(_requestQueueLock);
-  queue_enter(&_requestQueue, request, PS2Request *, chain);
-  IOLockUnlock(_requestQueueLock);
-
-  _interruptSourceQueue->interruptOccurred(0, 0, 0);
+    if (port < kPS2AuxIdx || port >= _nubsCount)
+        return false;
 
-  return true;
+    // Drivers probe one after the other, so the pass normally runs once per
+    // port at boot, and every later probe is answered from memory.
+    IOLockLock(_identifyLock);
+    if (!(__atomic_load_n(&_identified, __ATOMIC_ACQUIRE) & (1U << port)))
+    {
+        runIdentification(port, &_identification[port]);
+        __atomic_fetch_or(&_identified, 1U << port, __ATOMIC_RELEASE);
+    }
+    *ids = _identification[port];
+    IOLockUnlock(_identifyLock);
+    return true;
 }
 
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-
-void ApplePS2Controller::submitRequestAndBlock(PS2Request * request)
+template <class... Steps>
+bool ApplePS2Controller::identifyReport(size_t port, PS2Identification* ids, PS2IdentifyReport id, const Steps&... steps)
 {
-    assert(request->port < kPS2MuxMaxIdx);
-  
-    _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &ApplePS2Controller::submitRequestAndBlockGated), request);
+    TPS2Script<Steps...> request(steps...);
+    static_assert(TPS2Script<Steps...>::Traits::kResults <= sizeof(ids->report[0]), "identification report too long");
+    request.port = port;
+    submitRequestAndBlock(&request);
+    if (!request.succeeded())
+        return false;
+    request.results(ids->report[id]);
+    ids->valid |= 1U << id;
+    return true;
 }
 
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-
-void ApplePS2Controller::submitRequestAndBlockGated(PS2Request* request)
+void ApplePS2Controller::runIdentification(size_t port, PS2Identification* ids)
 {
-    processRequestQueue(0, 0);
-    processRequest(request);
-}
+    bzero(ids, sizeof(*ids));
+
+    //
+    // Every sequence the aux drivers used to send from their own probe, in
+    // the order Linux psmouse tries them.  A reset separates the vendor
+    // knocks, so a device confused by a foreign one still answers the next.
+    //
+
+    bool present = identifyReport(port, ids, kPS2ID_Reset, PS2Send(kDP_Reset), PS2Read<2>());
+    present |= identifyReport(port, ids, kPS2ID_GetId, PS2Send(kDP_GetId), PS2Read<1>());
+    if (!present)
+    {
+        DEBUG_LOG("%s: no device answers on port %d\n", getName(), (int)port);
+        return;
+    }
+    identifyReport(port, ids, kPS2ID_Status, PS2Send(kDP_GetMouseInformation), PS2Read<3>());
+    identifyReport(port, ids, kPS2ID_SynapticsIdentify,
+                   PS2Send(kDP_SetDefaultsAndDisable), PS2Sliced(0x00),
+                   PS2Send(kDP_GetMouseInformation), PS2Read<3>(),
+                   PS2Send(kDP_SetDefaultsAndDisable));
+
+    identifyReport(port, ids, kPS2ID_Reset, PS2Send(kDP_Reset), PS2Read<2>());
+    if (identifyReport(port, ids, kPS2ID_ElanKnock,
+                       PS2Send(kDP_SetDefaults), PS2Send(kDP_SetDefaultsAndDisable),
+                       PS2Send(kDP_SetMouseScaling1To1), PS2Send(kDP_SetMouseScaling1To1),
+                       PS2Send(kDP_SetMouseScaling1To1),
+                       PS2Send(kDP_GetMouseInformation), PS2Read<3>()))
+    {
+        identifyReport(port, ids, kPS2ID_ElanVersion,
+                       PS2Send(kDP_SetMouseScaling1To1), PS2Sliced(0x01),
+                       PS2Send(kDP_GetMouseInformation), PS2Read<3>());
+    }
+
+    identifyReport(port, ids, kPS2ID_Reset, PS2Send(kDP_Reset), PS2Read<2>());
+    static const UInt8 alpsReports[][2] =
+    {
+        { kPS2ID_E6Report, kDP_SetMouseScaling1To1 },
+        { kPS2ID_E7Report, kDP_SetMouseScaling2To1 },
+        { kPS2ID_ECReport, kDP_MouseResetWrap },
+    };
+    for (const UInt8* report : alpsReports)
+    {
+        identifyReport(port, ids, (PS2IdentifyReport)report[0],
+                       PS2Send(kDP_SetMouseResolution), PS2Send(0),
+                       PS2Send(report[1]), PS2Send(report[1]), PS2Send(report[1]),
+                       PS2Send(kDP_GetMouseInformation), PS2Read<3>());
+    }
+
+    // Leave ALPS command mode, then leave the device as the drivers expect
+    // it at probe: reset and disabled.
+    auto request = makePS2Script(PS2Send(kDP_SetMouseStreamMode),
+                                 PS2Send(kDP_Reset), PS2Read<2>(),
+                                 PS2Send(kDP_SetDefaultsAndDisable));
+    request.port = port;
+    submitRequestAndBlock(&request);
+
+    DEBUG_LOG("%s: port %d identification reports %03x\n", getName(), (int)port, ids->valid);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::submitRequest(PS2Request * request)
+{
+  assert(request->port < kPS2MuxMaxIdx);
+
+  //
+  // Submit the request to the controller for processing, asynchronously.
+  // Any thread may submit: the request is pushed on a lock-free list, which
+  // only the workloop (spliceRequestQueue) takes apart.
+  //
+  PS2Request* head = __atomic_load_n(&_submitList, __ATOMIC_RELAXED);
+  do
+  {
+    request->chain.next = (queue_entry_t)head;
+  } while (!__atomic_compare_exchange_n(&_submitList, &head, request, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  _interruptSourceQueue->interruptOccurred(0, 0, 0);
+
+  return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::submitRequestAndBlock(PS2Request * request)
+{
+    assert(request->port < kPS2MuxMaxIdx);
+  
+    _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &ApplePS2Controller::submitRequestAndBlockGated), request);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::submitRequestAndBlockGated(PS2Request* request)
+{
+    // Requests submitted before this one go first.
+    spliceRequestQueue();
+
+    //
+    // Sleeping on the command gate lets the workloop run (and other requests
+    // be processed) while we wait.  That is not possible on the workloop
+    // thread itself, or when the request cannot be processed asynchronously.
+    // In that case, everything is processed by polling, right here.
+    //
+
+    if (_workLoop->onThread() || !canProcessAsync(request))
+    {
+        quiesceRequestEngine();
+        while (!queue_empty(&_pendingQueue))
+        {
+            PS2Request* pending;
+            queue_remove_first(&_pendingQueue, pending, PS2Request *, chain);
+            processRequest(pending);
+        }
+        processRequest(request);
+        return;
+    }
+
+    queue_enter(&_pendingQueue, request, PS2Request *, chain);
+    runRequestEngine();
+    while (isRequestPending(request))
+        _cmdGate->commandSleep(request, THREAD_UNINT);
+}
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
@@ -1035,7 +1692,7 @@ void ApplePS2Controller::interruptOccurred(IOInterruptEventSource* source, int)
 
     // See if data is available on the mouse input stream (off real port).
 
-    status = inb(kCommandPort);
+    status = ps2_inb(kCommandPort);
     if ( ( status & (kOutputReady | kMouseData)) !=
                     (kOutputReady | kMouseData))
     {
@@ -1043,9 +1700,9 @@ void ApplePS2Controller::interruptOccurred(IOInterruptEventSource* source, int)
     }
     
     unlockController(state);
-    IODelay(kDataDelay);
+    settleDelay();
     size_t port = getPortFromStatus(status);
-    dispatchDriverInterrupt(port, inb(kDataPort));
+    dispatchDriverInterrupt(port, ps2_inb(kDataPort));
     lockController(&state);
   }
   unlockController(state);      // (release interrupt lockout + access to queue)
@@ -1059,18 +1716,15 @@ void ApplePS2Controller::interruptOccurred(IOInterruptEventSource* source, int)
 
 PS2InterruptResult ApplePS2Controller::_dispatchDriverInterrupt(size_t port, UInt8 data)
 {
-    PS2InterruptResult result = kPS2IR_packetBuffering;
-  
-    if (port >= kPS2AuxIdx && _interruptInstalledMouse)
-    {
-        // Dispatch the data to the mouse driver.
-        result = _devices[port]->interruptAction(data);
-    }
-    else if (kPS2KbdIdx == port && _interruptInstalledKeyboard)
-    {
-        // Dispatch the data to the keyboard driver.
-        result = _devices[kPS2KbdIdx]->interruptAction(data);
-    }
+    // Dispatch the data straight to the driver of that input stream.
+    const PS2DispatchSlot& slot = _dispatch[port];
+    PS2InterruptAction action = __atomic_load_n(&slot.action, __ATOMIC_ACQUIRE);
+    if (!action)
+        return kPS2IR_packetBuffering;
+    PS2InterruptResult result = action(slot.client, data);
+    _devices[port]->countEvent(kPS2CT_Bytes);
+    if (kPS2IR_packetReady == result)
+        _devices[port]->countEvent(kPS2CT_Packets);
     return result;
 }
 
@@ -1099,15 +1753,26 @@ void ApplePS2Controller::processRequest(PS2Request * request)
   // This method should only be called from our single-threaded work loop.
   //
 
-  UInt8         byte;
-  size_t        devicePort      = request->port;
-  bool          failed          = false;
-  unsigned      index;
+  processRequestFrom(request, 0, false);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::processRequestFrom(PS2Request * request,
+                                            unsigned     index,
+                                            bool         issued)
+{
+  //
+  // Process the request by polling, starting with the command at index.  If
+  // issued is true, that command has already been written to the controller
+  // by the asynchronous request engine, and only its response is missing.
+  //
+
+  bool failed = false;
 
   if (_hardwareOffline)
   {
     failed = true;
-    index  = 0;
     goto hardware_offline;
   }
 
@@ -1118,155 +1783,1141 @@ void ApplePS2Controller::processRequest(PS2Request * request)
 
   // Process each of the commands in the list.
 
-  for (index = 0; index < request->commandsCount; index++)
+  for (; index < request->commandsCount; index++)
+  {
+    if (!issued)
+    {
+      replayHeldBytes(request->port, 0);
+      if (request->commands[index].command == kPS2C_SleepMS)
+      {
+        // Let interrupts (eg. keystrokes) through while the device settles.
+        // If the device is still to answer (eg. the self-test result after
+        // a reset), its bytes are captured for the reads that follow.
+        if (expectsMoreData(request, index + 1))
+          setCapturePort(request->port);
+        --_ignoreInterrupts;
+        issueCommand(request, index);
+        ++_ignoreInterrupts;
+      }
+      else
+      {
+        issueCommand(request, index);
+      }
+    }
+    issued = false;
+
+    if (responsePort(request, index) != kPS2NoPort)
+      failed = completeCommand(request, index, readResponse(request, index));
+
+    if (failed) break;
+  }
+    
+  // Now it is ok to process interrupts normally.
+    
+  --_ignoreInterrupts;
+    
+hardware_offline:
+
+  completeRequest(request, index, failed);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::completeRequest(PS2Request * request,
+                                         unsigned     index,
+                                         bool         failed)
+{
+  // Bytes captured for the request but never read belong to the driver.
+
+  setCapturePort(kPS2NoPort);
+
+  // If a command failed and stopped the request processing, store its
+  // index into the commandsCount field.
+
+  if (failed) request->commandsCount = index;
+
+  if (failed && _hardwareOffline) ++_requestsDropped;
+
+  // Invoke the completion routine, if one was supplied.
+
+  if (request->completionTarget == kStackCompletionTarget)
+  {
+    // Wake up the submitRequestAndBlock caller, if it is sleeping.
+    if (_cmdGate)
+      _cmdGate->commandWakeup(request);
+  }
+  else if (request->completionTarget && request->completionAction)
+  {
+    (*request->completionAction)(request->completionTarget,
+                                 request->completionParam);
+  }
+  else
+  {
+    freeRequest(request);
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+size_t ApplePS2Controller::responsePort(PS2Request * request, unsigned index)
+{
+  //
+  // Returns the input stream the response to the given command arrives on,
+  // or kPS2NoPort if the command does not read anything.
+  //
+
+  switch (request->commands[index].command)
+  {
+    case kPS2C_ReadDataPort:
+    case kPS2C_ReadDataPortAndCompare:
+    case kPS2C_SendCommandAndCompareAck:
+      return request->port;
+
+    case kPS2C_ModifyCommandByte:
+      // nothing to read while the shadow copy is known
+      return _commandByteKnown ? kPS2NoPort : kPS2KbdIdx;
+
+    default:
+      return kPS2NoPort;
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::expectsMoreData(PS2Request * request, unsigned index)
+{
+  //
+  // Returns true if the device of the request still has bytes to send for
+  // the commands before index: the next command that is not a sleep reads
+  // without writing anything first.
+  //
+
+  for (; index < request->commandsCount; index++)
   {
     switch (request->commands[index].command)
     {
-      case kPS2C_ReadDataPort:
-        request->commands[index].inOrOut = readDataPort(devicePort);
-        break;
+      case kPS2C_SleepMS:
+        continue;
 
+      case kPS2C_ReadDataPort:
       case kPS2C_ReadDataPortAndCompare:
+        return true;
+
+      default:
+        return false;
+    }
+  }
+  return false;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::issueCommand(PS2Request * request, unsigned index)
+{
+  //
+  // Writes the given command to the controller.  Reading the response (if
+  // any) is left to the caller, see responsePort and completeCommand.
+  //
+
+  PS2Command * command    = &request->commands[index];
+  size_t       devicePort = request->port;
+
+  timelineRecord(kPS2TK_Command, devicePort, command->inOrOut, command->command);
+
+  switch (command->command)
+  {
+    case kPS2C_ReadDataPort:
+    case kPS2C_ReadDataPortAndCompare:
+      break;
+
+    //
+    // kPS2C_SendCommandAndCompareAck is a composite mouse command that is
+    // equivalent to the following (frequently used) command sequence:
+    //
+    // 1. kPS2C_WriteDataPort( command )
+    // 2. kPS2C_ReadDataPortAndCompare( kSC_Acknowledge )
+    //
+
+    case kPS2C_WriteDataPort:
+    case kPS2C_SendCommandAndCompareAck:
+      if (devicePort >= kPS2AuxIdx) {
+        if (_muxPresent) {
+          writeCommandPort(kCP_TransmitToMuxedMouse + (devicePort - kPS2AuxIdx));
+        } else {
+          writeCommandPort(kCP_TransmitToMouse);
+        }
+      }
+
+      writeDataPort(command->inOrOut);
+      break;
+
+    case kPS2C_FlushDataPort:
+    {
+      // The interrupt handler must not read the data port at the same time.
+      IOInterruptState state = IOSimpleLockLockDisableInterrupt(_portLock);
+      command->inOrOut32 = 0;
+      UInt8 status;
+      while ( (status = ps2_inb(kCommandPort)) & kOutputReady )
+      {
+          ++command->inOrOut32;
+          settleDelay();
+          traceByte(kPS2TR_Flush, getPortFromStatus(status), ps2_inb(kDataPort), status);
+          settleDelay();
+      }
+      IOSimpleLockUnlockEnableInterrupt(_portLock, state);
+      break;
+    }
+
+    case kPS2C_SleepMS:
+      IOSleep(command->inOrOut32);
+      break;
+
+    case kPS2C_ModifyCommandByte:
+      if (_commandByteKnown)
+      {
+        command->oldBits = _commandByte;
+        UInt8 commandByte = (_commandByte | command->setBits) & ~command->clearBits;
+        if (commandByte != _commandByte)
+          writeCommandByte(commandByte);
+      }
+      else
+      {
+        writeCommandPort(kCP_GetCommandByte);
+      }
+      break;
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::completeCommand(PS2Request * request,
+                                         unsigned     index,
+                                         UInt8        byte)
+{
+  //
+  // Finishes the given command with the response byte that was read for it.
+  // Returns true if the command failed.
+  //
+
+  PS2Command * command = &request->commands[index];
+  bool         failed  = false;
+
+  switch (command->command)
+  {
+    case kPS2C_ReadDataPort:
+      command->inOrOut = byte;
+      break;
+
+    case kPS2C_ReadDataPortAndCompare:
+      failed = (byte != command->inOrOut);
+      command->inOrOut = byte;
+      break;
+
+    case kPS2C_SendCommandAndCompareAck:
+      failed = (byte != kSC_Acknowledge);
+      break;
+
+    case kPS2C_ModifyCommandByte:
+      writeCommandByte((byte | command->setBits) & ~command->clearBits);
+      command->oldBits = byte;
+      break;
+
+    default:
+      break;
+  }
+
+  timelineRecord(kPS2TK_Response, request->port, byte, failed);
+  return failed;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::acceptResponseByte(PS2Request * request,
+                                            unsigned     index,
+                                            UInt8        byte,
+                                            UInt8 *      result)
+{
+  //
+  // Feeds one byte read from the response port of the given command.
+  // Returns true once the response is known (stored in result).  This is
+  // the asynchronous counterpart of readDataPort:expecting:, and shares its
+  // reorder buffer (see OUT_OF_ORDER_DATA_CORRECTION_FEATURE).
+  //
+
 #if OUT_OF_ORDER_DATA_CORRECTION_FEATURE
-        byte = readDataPort(devicePort, request->commands[index].inOrOut);
-#else 
-        byte = readDataPort(devicePort);
+  PS2Command * command = &request->commands[index];
+  UInt8        expectedByte;
+
+  switch (command->command)
+  {
+    case kPS2C_ReadDataPortAndCompare:
+      expectedByte = command->inOrOut;
+      break;
+
+    case kPS2C_SendCommandAndCompareAck:
+      expectedByte = kSC_Acknowledge;
+      break;
+
+    default:
+      *result = byte;
+      return true;
+  }
+
+  return reorderResponseByte(responsePort(request, index), byte, expectedByte, result);
+#else
+  *result = byte;
+  return true;
 #endif
-        failed = (byte != request->commands[index].inOrOut);
-        request->commands[index].inOrOut = byte;
-        break;
+}
 
-      case kPS2C_WriteDataPort:
-        if (devicePort >= kPS2AuxIdx) {
-          if (_muxPresent) {
-            writeCommandPort(kCP_TransmitToMuxedMouse + (devicePort - kPS2AuxIdx));
-          } else {
-            writeCommandPort(kCP_TransmitToMouse);
-          }
-        }
-        
-        writeDataPort(request->commands[index].inOrOut);
-        break;
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-      //
-      // Send a composite mouse command that is equivalent to the following
-      // (frequently used) command sequence:
-      //
-      // 1. kPS2C_WriteDataPort( command )
-      // 2. kPS2C_ReadDataPortAndCompare( kSC_Acknowledge )
-      //
+UInt8 ApplePS2Controller::readResponse(PS2Request * request, unsigned index)
+{
+  //
+  // Reads the response to the given command by polling the controller.
+  //
+  // This method should only be called from our single-threaded work loop.
+  //
+
+  size_t port = responsePort(request, index);
+  UInt8  byte;
+  UInt8  result;
+
+  // Bytes captured while the request was processed asynchronously come first.
+
+  while (popCapturedByte(port, &byte))
+  {
+    if (acceptResponseByte(request, index, byte, &result))
+      return result;
+  }
+
+  // Polling continues where the asynchronous engine left off: bytes it put
+  // aside are still in the reorder buffer of the port.
 
-      case kPS2C_SendCommandAndCompareAck:
-        if (devicePort >= kPS2AuxIdx) {
-          if (_muxPresent) {
-            writeCommandPort(kCP_TransmitToMuxedMouse + (devicePort - kPS2AuxIdx));
-          } else {
-            writeCommandPort(kCP_TransmitToMouse);
-          }
-        }
-        
-        writeDataPort(request->commands[index].inOrOut);
 #if OUT_OF_ORDER_DATA_CORRECTION_FEATURE
-        byte = readDataPort(devicePort, kSC_Acknowledge);
-#else 
-        byte = readDataPort(devicePort);
+  switch (request->commands[index].command)
+  {
+    case kPS2C_ReadDataPortAndCompare:
+      return readDataPort(port, request->commands[index].inOrOut);
+
+    case kPS2C_SendCommandAndCompareAck:
+      return readDataPort(port, kSC_Acknowledge);
+
+    default:
+      break;
+  }
 #endif
-        failed = (byte != kSC_Acknowledge);
-        break;
-            
-      case kPS2C_FlushDataPort:
-        request->commands[index].inOrOut32 = 0;
-        while ( inb(kCommandPort) & kOutputReady )
-        {
-            ++request->commands[index].inOrOut32;
-            IODelay(kDataDelay);
-            inb(kDataPort);
-            IODelay(kDataDelay);
-        }
-        break;
-      
-      case kPS2C_SleepMS:
-        IOSleep(request->commands[index].inOrOut32);
-        break;
-            
-      case kPS2C_ModifyCommandByte:
-        writeCommandPort(kCP_GetCommandByte);
-        UInt8 commandByte = readDataPort(kPS2KbdIdx);
-        writeCommandPort(kCP_SetCommandByte);
-        writeDataPort((commandByte | request->commands[index].setBits) & ~request->commands[index].clearBits);
-        request->commands[index].oldBits = commandByte;
-        break;
-    }
 
-    if (failed) break;
-  }
-    
-  // Now it is ok to process interrupts normally.
-    
-  --_ignoreInterrupts;
-    
-hardware_offline:
+  return readDataPort(port);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::spliceRequestQueue()
+{
+  //
+  // Transfer submitted (async) requests to the end of the pending queue.
+  // The submit list is taken as a whole, and is newest first.
+  //
+
+  PS2Request* list = __atomic_exchange_n(&_submitList, (PS2Request*)NULL, __ATOMIC_ACQUIRE);
+  PS2Request* ordered = NULL;
+
+  while (list)
+  {
+    PS2Request* next = (PS2Request*)list->chain.next;
+    list->chain.next = (queue_entry_t)ordered;
+    ordered = list;
+    list = next;
+  }
+
+  while (ordered)
+  {
+    PS2Request* next = (PS2Request*)ordered->chain.next;
+    if (_coalesceRequests && ordered->coalesceKind != kPS2CK_None)
+      coalesceRequest(ordered);
+    queue_enter(&_pendingQueue, ordered, PS2Request *, chain);
+    ordered = next;
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::coalesceRequest(PS2Request * request)
+{
+  //
+  // The given request is about to be queued.  Free the pending requests it
+  // supersedes: same kind, same port, fire-and-forget (nobody waits for them)
+  // and not started yet (the active request is not on the pending queue).
+  //
+
+  PS2Request* pending = (PS2Request*)queue_first(&_pendingQueue);
+  while (!queue_end(&_pendingQueue, (queue_entry_t)pending))
+  {
+    PS2Request* next = (PS2Request*)queue_next(&pending->chain);
+    if (pending->coalesceKind == request->coalesceKind &&
+        pending->port == request->port &&
+        !pending->completionTarget)
+    {
+      queue_remove(&_pendingQueue, pending, PS2Request *, chain);
+      freeRequest(pending);
+      ++_requestsCoalesced;
+    }
+    pending = next;
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::processRequestQueue(IOInterruptEventSource *, int)
+{
+  spliceRequestQueue();
+  runRequestEngine();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::canProcessAsync(PS2Request * request)
+{
+  //
+  // A request can only be processed asynchronously if the interrupts for
+  // every input stream it reads from are installed, and nobody asked for
+  // interrupts to be ignored (eg. power transitions).
+  //
+
+#if ASYNC_REQUEST_ENGINE
+  if (_hardwareOffline || _ignoreInterrupts)
+    return false;
+
+  for (unsigned index = 0; index < request->commandsCount; index++)
+  {
+    // the command byte shadow may be invalidated before the request runs
+    size_t port = request->commands[index].command == kPS2C_ModifyCommandByte ? kPS2KbdIdx : responsePort(request, index);
+    if (port == kPS2NoPort)
+      continue;
+    if (port == kPS2KbdIdx && !_interruptInstalledKeyboard)
+      return false;
+    if (port >= kPS2AuxIdx && !_interruptInstalledMouse)
+      return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::isExclusiveRequest(PS2Request * request)
+{
+  //
+  // Requests that access the controller itself, rather than their device,
+  // must not be interleaved with anything else.
+  //
+
+  for (unsigned index = 0; index < request->commandsCount; index++)
+  {
+    switch (request->commands[index].command)
+    {
+      case kPS2C_ModifyCommandByte:
+      case kPS2C_FlushDataPort:
+        return true;
+      default:
+        break;
+    }
+  }
+  return false;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::isEngineIdle()
+{
+  for (size_t port = 0; port < kPS2MuxMaxIdx; port++)
+  {
+    if (_active[port].request)
+      return false;
+  }
+  return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::admitPendingRequests()
+{
+  //
+  // Moves pending requests into the free port slots, in submission order.
+  // A request never overtakes an earlier one for the same port.  Exclusive
+  // requests and requests that must be polled are barriers: they wait until
+  // every slot is free, and nothing behind them is admitted meanwhile.
+  //
+
+  bool blocked[kPS2MuxMaxIdx] {};
+  bool admitted = false;
+
+  while (!_exclusiveActive)
+  {
+    PS2Request * request = (PS2Request *)queue_first(&_pendingQueue);
+    PS2Request * next;
+
+    // find the first request that can be admitted now
+    for (; !queue_end(&_pendingQueue, (queue_entry_t)request); request = next)
+    {
+      next = (PS2Request *)queue_next(&request->chain);
+
+      bool async = canProcessAsync(request);
+      if (!async || isExclusiveRequest(request))
+      {
+        if (admitted || !isEngineIdle() || request != (PS2Request *)queue_first(&_pendingQueue))
+          return;
+
+        queue_remove(&_pendingQueue, request, PS2Request *, chain);
+        if (!async)
+        {
+          processRequest(request);
+          break;
+        }
+        _exclusiveActive = true;
+      }
+      else
+      {
+        if (blocked[request->port] || _active[request->port].request)
+        {
+          blocked[request->port] = true;
+          continue;
+        }
+        queue_remove(&_pendingQueue, request, PS2Request *, chain);
+      }
+
+      PS2ActiveRequest& slot = _active[request->port];
+      slot.request  = request;
+      slot.index    = 0;
+      slot.state    = kPS2RS_Issue;
+      slot.failed   = false;
+      slot.deadline = 0;
+      admitted = true;
+      break;
+    }
+
+    if (queue_end(&_pendingQueue, (queue_entry_t)request))
+      return;
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+size_t ApplePS2Controller::nextReadyPort()
+{
+  //
+  // Returns the port whose request should run its next command: the one
+  // owning the wire if any (nobody else may use it, even while the owner
+  // sleeps), otherwise the highest priority (lowest index) request that is
+  // not sleeping.
+  //
+
+  uint64_t now;
+  clock_get_uptime(&now);
+
+  if (_busOwner != kPS2NoPort)
+  {
+    PS2ActiveRequest& owner = _active[_busOwner];
+    if (owner.state == kPS2RS_Sleeping && now < owner.deadline && !_hardwareOffline)
+      return kPS2NoPort;
+    return _busOwner;
+  }
+
+  for (size_t port = 0; port < kPS2MuxMaxIdx; port++)
+  {
+    PS2ActiveRequest& slot = _active[port];
+    if (!slot.request)
+      continue;
+    if (slot.state == kPS2RS_Sleeping && now < slot.deadline && !_hardwareOffline)
+      continue;
+    return port;
+  }
+  return kPS2NoPort;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::runRequestEngine()
+{
+  //
+  // Processes pending requests until all of them have to wait for the
+  // controller (a response or a sleep).
+  //
+  // This method should only be called from our single-threaded work loop.
+  //
+
+  while (1)
+  {
+    admitPendingRequests();
+
+    size_t port = nextReadyPort();
+    if (port == kPS2NoPort)
+      break;
+
+    PS2ActiveRequest& slot = _active[port];
+    PS2RequestState   state = slot.state;
+    unsigned          index = slot.index;
+
+    advanceActiveRequest(port);
+
+    // Stop when the wire owner is still waiting for its response.
+    if (slot.request && slot.state == state && slot.index == index)
+      break;
+  }
+
+  armRequestTimer();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::advanceActiveRequest(size_t port)
+{
+  //
+  // Runs one step of the request in progress on the given port: issues its
+  // next command, collects the response it is waiting for, or ends its
+  // sleep.  Completes the request after its last command.
+  //
+
+  PS2ActiveRequest& slot    = _active[port];
+  PS2Request *      request = slot.request;
+
+  if (_hardwareOffline)
+    slot.failed = true;
+
+  if (slot.failed || slot.index >= request->commandsCount)
+  {
+    finishActiveRequest(port);
+    return;
+  }
+
+  PS2Command * command = &request->commands[slot.index];
+
+  switch (slot.state)
+  {
+    case kPS2RS_Issue:
+    {
+      if (command->command == kPS2C_SleepMS)
+      {
+        // the wire stays with us if the device answers after the sleep
+        if (_busOwner != port && expectsMoreData(request, slot.index + 1))
+        {
+          setCapturePort(request->port);
+          _busOwner = port;
+        }
+        clock_interval_to_deadline(command->inOrOut32, kMillisecondScale, &slot.deadline);
+        slot.state = kPS2RS_Sleeping;
+        return;
+      }
+
+      size_t responseFrom = responsePort(request, slot.index);
+      if (responseFrom == kPS2NoPort)
+      {
+        // a write whose answer is read by the next commands takes the wire
+        // (and the capture) before it goes out
+        if (expectsMoreData(request, slot.index + 1))
+        {
+          setCapturePort(request->port);
+          replayHeldBytes(request->port, 0);
+          _busOwner = port;
+        }
+        issueCommand(request, slot.index);
+        ++slot.index;
+        break;
+      }
+
+      // Capture must be armed before the command goes out on the wire.
+
+      UInt32 timeout = kResponseCompareTimeout;
+      if (command->command == kPS2C_ReadDataPort || command->command == kPS2C_ModifyCommandByte)
+        timeout = kResponseTimeout;
+
+      setCapturePort(responseFrom);
+      replayHeldBytes(responseFrom, 0);
+      _busOwner      = port;
+      slot.state     = kPS2RS_Waiting;
+      clock_interval_to_deadline(timeout, kMillisecondScale, &slot.deadline);
+      issueCommand(request, slot.index);
+      return;
+    }
+
+    case kPS2RS_Waiting:
+    {
+      UInt8 result;
+      if (!collectResponse(port, &result))
+        return;
+
+      slot.state  = kPS2RS_Issue;
+      slot.failed = completeCommand(request, slot.index, result);
+      if (!slot.failed)
+        ++slot.index;
+
+      // Keep the wire (and the capture) while the device is still talking,
+      // eg. between the ACK of GetMouseInformation and its status bytes.
+      if (slot.failed || !expectsMoreData(request, slot.index))
+        _busOwner = kPS2NoPort;
+      break;
+    }
+
+    case kPS2RS_Sleeping:
+      slot.state = kPS2RS_Issue;
+      ++slot.index;
+      break;
+  }
+
+  if (slot.failed || slot.index >= request->commandsCount)
+    finishActiveRequest(port);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::finishActiveRequest(size_t port)
+{
+  PS2ActiveRequest& slot    = _active[port];
+  PS2Request *      request = slot.request;
+
+  if (_busOwner == port)
+    _busOwner = kPS2NoPort;
+  if (_exclusiveActive)
+    _exclusiveActive = false;
+
+  slot.request = nullptr;
+  slot.state   = kPS2RS_Issue;
+  completeRequest(request, slot.index, slot.failed);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::armRequestTimer()
+{
+  //
+  // Sets the request timer to the earliest response deadline or end of
+  // sleep among the requests in progress.
+  //
+
+  uint64_t deadline = 0;
+
+  for (size_t port = 0; port < kPS2MuxMaxIdx; port++)
+  {
+    PS2ActiveRequest& slot = _active[port];
+    if (!slot.request || slot.state == kPS2RS_Issue)
+      continue;
+    if (!deadline || slot.deadline < deadline)
+      deadline = slot.deadline;
+  }
+
+  if (deadline)
+    _requestTimer->wakeAtTime(deadline);
+  else
+    _requestTimer->cancelTimeout();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::collectResponse(size_t port, UInt8 * result)
+{
+  //
+  // Looks at the bytes captured for the request of the given port.  Returns
+  // true once the response to its current command is known, or its deadline
+  // expired.
+  //
+
+  PS2ActiveRequest& slot = _active[port];
+  size_t responseFrom = responsePort(slot.request, slot.index);
+  UInt8  byte;
+
+  while (popCapturedByte(responseFrom, &byte))
+  {
+    if (acceptResponseByte(slot.request, slot.index, byte, result))
+      return true;
+  }
+
+  uint64_t now;
+  clock_get_uptime(&now);
+  if (now < slot.deadline)
+    return false;
+
+  //
+  // If we timed out, we return the first byte put aside, if any.  Otherwise
+  // something went awfully wrong and we return a fake value.
+  //
+
+  if (releaseHeldBytes(responseFrom, result))
+    return true;
+
+  IOLog("%s: Timed out on input stream %ld.\n", getName(), responseFrom);
+  countEvent(responseFrom, kPS2CT_ReadTimeouts);
+  *result = 0;
+  return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::onRequestTimer()
+{
+  //
+  // A response deadline (or a sleep) expired.  In case the interrupt got
+  // lost, look at the controller ourselves first.
+  //
+
+  if (_busOwner != kPS2NoPort && !_ignoreInterrupts)
+  {
+    if (_detectLostInterrupts)
+      checkLostInterrupts(true);
+    handleInterrupt();
+  }
+
+  runRequestEngine();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::checkLostInterrupts(bool deadlineExpired)
+{
+  //
+  // Looks for data waiting in the controller that no interrupt told us
+  // about: data that was already waiting at the last check, with no
+  // interrupt on its line since, or data waiting when a response deadline
+  // expired.  Some machines drop the edge of IRQ1/IRQ12, and the device then
+  // stays dead until its next interrupt.  The line is polled instead, for
+  // at most kLostInterruptPollTime, until its interrupts come back.
+  //
+  // This method should only be called from our single-threaded work loop.
+  //
+
+  if (_ignoreInterrupts || _hardwareOffline)
+    return;
+
+  IOInterruptState state = IOSimpleLockLockDisableInterrupt(_portLock);
+  settleDelay();
+  UInt8 status = ps2_inb(kCommandPort);
+  IOSimpleLockUnlockEnableInterrupt(_portLock, state);
+
+  for (unsigned line = kPS2KbdLine; line < kPS2Lines; line++)
+  {
+    PS2InterruptLine& irq = _irqLines[line];
+    UInt32 interrupts = __atomic_load_n(&irq.interrupts, __ATOMIC_RELAXED);
+    bool installed = (line == kPS2KbdLine) ? _interruptInstalledKeyboard : _interruptInstalledMouse;
+    bool pending = (status & kOutputReady) &&
+                   (getPortFromStatus(status) == kPS2KbdIdx) == (line == kPS2KbdLine);
+
+    if (installed && pending && !irq.pollUntil &&
+        interrupts == irq.lastInterrupts && (irq.dataPending || deadlineExpired))
+    {
+      DEBUG_LOG("%s: Lost %s interrupt, polling.\n", getName(), line == kPS2KbdLine ? "keyboard" : "mouse");
+      // firmware (eg. legacy USB emulation) may have rewritten the IRQ enables
+      invalidateCommandByte();
+      clock_get_uptime(&irq.pollStart);
+      clock_interval_to_deadline(kLostInterruptPollTime, kMillisecondScale, &irq.pollUntil);
+      irq.detections++;
+      _lostInterruptTimer->setTimeoutMS(kLostInterruptPollMS);
+    }
+    irq.dataPending    = pending;
+    irq.lastInterrupts = interrupts;
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::onLostInterruptTimer()
+{
+  //
+  // Polls the controller while a line lost its interrupts, and checks for
+  // lost interrupts otherwise.
+  //
+
+  if (!_detectLostInterrupts)
+    return;
+
+  uint64_t now;
+  clock_get_uptime(&now);
+  bool polling = false;
+
+  for (unsigned line = kPS2KbdLine; line < kPS2Lines; line++)
+  {
+    PS2InterruptLine& irq = _irqLines[line];
+    if (!irq.pollUntil)
+      continue;
+
+    if (__atomic_load_n(&irq.interrupts, __ATOMIC_RELAXED) != irq.lastInterrupts || now >= irq.pollUntil)
+    {
+      // interrupts came back, or we polled long enough
+      irq.polledTime += now - irq.pollStart;
+      irq.pollUntil   = 0;
+      irq.dataPending = false;
+      publishLostInterruptStatistics();
+      continue;
+    }
+    polling = true;
+  }
+
+  if (polling && !_ignoreInterrupts && !_hardwareOffline)
+    handleInterrupt();
+  else
+    checkLostInterrupts(false);
+
+  _lostInterruptTimer->setTimeoutMS(polling ? kLostInterruptPollMS : kLostInterruptCheckMS);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::publishLostInterruptStatistics()
+{
+  //
+  // Publish "LostInterrupts" with how often each line lost its interrupts,
+  // and how long it was polled in total.
+  //
+
+  static const char* names[kPS2Lines] = { "Keyboard", "Aux" };
+
+  OSDictionary* lines = OSDictionary::withCapacity(kPS2Lines);
+  if (!lines)
+    return;
+  for (unsigned line = kPS2KbdLine; line < kPS2Lines; line++)
+  {
+    PS2InterruptLine& irq = _irqLines[line];
+    if (OSDictionary* dict = OSDictionary::withCapacity(2))
+    {
+      uint64_t ns;
+      absolutetime_to_nanoseconds(irq.polledTime, &ns);
+      OSNumber* num;
+      if ((num = OSNumber::withNumber(irq.detections, 32))) { dict->setObject("Detections", num); num->release(); }
+      if ((num = OSNumber::withNumber(ns / 1000000, 32))) { dict->setObject("PolledMS", num); num->release(); }
+      lines->setObject(names[line], dict);
+      dict->release();
+    }
+  }
+  setProperty("LostInterrupts", lines);
+  lines->release();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::quiesceRequestEngine()
+{
+  //
+  // Finishes the asynchronous requests in progress (if any) by polling,
+  // the one waiting for a response first, then by priority.  Called before
+  // the controller is accessed directly, so that nothing gets in between
+  // the commands of a request.
+  //
+  // This method should only be called from our single-threaded work loop.
+  //
+
+  _requestTimer->cancelTimeout();
+
+  for (size_t i = 0; i <= kPS2MuxMaxIdx; i++)
+  {
+    size_t port = (i == 0) ? _busOwner : i - 1;
+    if (port == kPS2NoPort || !_active[port].request)
+      continue;
+
+    PS2ActiveRequest& slot    = _active[port];
+    PS2Request *      request = slot.request;
+    bool              issued  = (slot.state == kPS2RS_Waiting);
+
+    slot.request = nullptr;
+    if (_busOwner == port)
+      _busOwner = kPS2NoPort;
+
+    if (slot.failed || slot.index >= request->commandsCount)
+    {
+      slot.state = kPS2RS_Issue;
+      completeRequest(request, slot.index, slot.failed);
+      continue;
+    }
+
+    if (slot.state == kPS2RS_Sleeping)
+    {
+      uint64_t now, ns;
+      clock_get_uptime(&now);
+      if (now < slot.deadline)
+      {
+        absolutetime_to_nanoseconds(slot.deadline - now, &ns);
+        IOSleep((unsigned)(ns / 1000000) + 1);
+      }
+      ++slot.index;
+    }
+
+    slot.state = kPS2RS_Issue;
+    processRequestFrom(request, slot.index, issued);
+  }
+  _exclusiveActive = false;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::isRequestPending(PS2Request * request)
+{
+  if (_active[request->port].request == request)
+    return true;
+
+  PS2Request * pending;
+  queue_iterate(&_pendingQueue, pending, PS2Request *, chain)
+  {
+    if (pending == request)
+      return true;
+  }
+  return false;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::timelineBegin()
+{
+#if RESUME_TIMELINE
+  clock_get_uptime(&_timelineStart);
+  _timelineCount  = 0;
+  _timelineActive = true;
+  timelineRecord(kPS2TK_PhaseBegin, kPS2NoPort, kPS2TP_Resume);
+#endif
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::timelineRecord(UInt8 kind, size_t port, UInt8 data, UInt8 extra)
+{
+  //
+  // Appends an entry to the resume timeline while a resume is recorded.
+  // Entries past kTimelineEntries are lost (the last one is kept for the
+  // end of the resume).
+  //
+  // Devices are woken from their own threads (see wakeDevices), so the
+  // entry is claimed atomically.
+  //
+
+#if RESUME_TIMELINE
+  if (!_timelineActive)
+    return;
 
-  // If a command failed and stopped the request processing, store its
-  // index into the commandsCount field.
+  uint64_t now, ns;
+  clock_get_uptime(&now);
+  absolutetime_to_nanoseconds(now - _timelineStart, &ns);
+
+  unsigned index = __atomic_fetch_add(&_timelineCount, 1, __ATOMIC_RELAXED);
+  if (index >= kTimelineEntries)
+    index = kTimelineEntries - 1;
+  PS2TimelineEntry& entry = _timeline[index];
+  entry.time  = (UInt32)(ns / 1000);
+  entry.kind  = kind;
+  entry.port  = (UInt8)port;
+  entry.data  = data;
+  entry.extra = extra;
+#endif
+}
 
-  if (failed) request->commandsCount = index;
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-  // Invoke the completion routine, if one was supplied.
+void ApplePS2Controller::timelineEnd()
+{
+#if RESUME_TIMELINE
+  timelineRecord(kPS2TK_PhaseEnd, kPS2NoPort, kPS2TP_Resume);
+  _timelineActive = false;
 
-  if (request->completionTarget != kStackCompletionTarget && request->completionTarget && request->completionAction)
-  {
-    (*request->completionAction)(request->completionTarget,
-                                 request->completionParam);
-  }
-  else
+  unsigned count = min(_timelineCount, kTimelineEntries);
+  if (OSData* data = OSData::withBytes(_timeline, count * sizeof(PS2TimelineEntry)))
   {
-    if (request->completionTarget != kStackCompletionTarget)
-      freeRequest(request);
+    setProperty("ResumeTimeline", data);
+    data->release();
   }
+  setProperty("ResumeTime", _timeline[count - 1].time, 32);
+#endif
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-void ApplePS2Controller::processRequestQueue(IOInterruptEventSource *, int)
+void ApplePS2Controller::setCapturePort(size_t port)
 {
-  queue_head_t localQueue;
+  //
+  // Selects the input stream that handleInterrupt captures response bytes
+  // from.  Bytes still held for the previous stream were not consumed by
+  // the request, so they are delivered to the driver of that stream.  That
+  // happens under _portLock, before the stream stops being captured, so
+  // handleInterrupt cannot dispatch newer bytes to the same driver ring at
+  // the same time or ahead of them.
+  //
 
-  // Transfer queued (async) requests to a local queue.
+  bool   ready = false;
+  size_t oldPort;
 
-  IOLockLock(_requestQueueLock);
+  IOInterruptState state = IOSimpleLockLockDisableInterrupt(_portLock);
+  oldPort = _capturePort;
+  if (oldPort != port)
+  {
+    while (_captureBuffer.count())
+      if (kPS2IR_packetReady == _dispatchDriverInterrupt(oldPort, _captureBuffer.fetch()))
+        ready = true;
+    _capturePort = port;
+  }
+  IOSimpleLockUnlockEnableInterrupt(_portLock, state);
 
-  if (!queue_empty(&_requestQueue))
+  // the packet itself is handled outside the lock
+  if (ready)
   {
-    queue_assign(&localQueue, &_requestQueue, PS2Request *, chain);
-    queue_init(&_requestQueue);
+#if HANDLE_INTERRUPT_DATA_LATER
+    _devices[oldPort]->packetAction(nullptr, 0);
+#else
+    _devices[oldPort]->packetActionInterrupt();
+#endif
   }
-  else queue_init(&localQueue);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::captureResponseByte(size_t port, UInt8 data)
+{
+  //
+  // Called from handleInterrupt with _portLock held.  Returns true if the
+  // byte was taken for the active request.
+  //
+
+  if (port != _capturePort)
+    return false;
+
+  return _captureBuffer.push(data);
+}
 
-  IOLockUnlock(_requestQueueLock);
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-  // Process each request in order.
+bool ApplePS2Controller::popCapturedByte(size_t port, UInt8 * data)
+{
+  bool result = false;
 
-  while (!queue_empty(&localQueue))
+  IOInterruptState state = IOSimpleLockLockDisableInterrupt(_portLock);
+  if (port == _capturePort && _captureBuffer.count())
   {
-    PS2Request * request;
-    queue_remove_first(&localQueue, request, PS2Request *, chain);
-    processRequest(request);
+    *data  = _captureBuffer.fetch();
+    result = true;
   }
+  IOSimpleLockUnlockEnableInterrupt(_portLock, state);
+
+  return result;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-size_t ApplePS2Controller::getPortFromStatus(UInt8 status)
+void ApplePS2Controller::buildStatusPortTable()
 {
-    bool auxPort = status & kMouseData;
-    size_t port = auxPort ? kPS2AuxIdx : kPS2KbdIdx;
-  
-    if (_muxPresent && auxPort) {
-        port += (status >> PS2_STA_MUX_SHIFT) & PS2_STA_MUX_MASK;
+    //
+    // Precomputes the input stream of every status byte, so that finding
+    // where a byte came from is a single lookup (see getPortFromStatus).
+    // Must be rebuilt whenever _muxPresent changes.
+    //
+
+    for (unsigned status = 0; status < 256; status++)
+    {
+        bool auxPort = status & kMouseData;
+        size_t port = auxPort ? kPS2AuxIdx : kPS2KbdIdx;
+
+        if (_muxPresent && auxPort) {
+            port += (status >> PS2_STA_MUX_SHIFT) & PS2_STA_MUX_MASK;
+        }
+
+        _statusPort[status] = port;
     }
-  
-    return port;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -1306,7 +2957,7 @@ UInt8 ApplePS2Controller::readDataPort(size_t expectedPort)
     // Wait for the controller's output buffer to become ready.
     //
 
-    while (timeoutCounter && !((status = inb(kCommandPort)) & kOutputReady))
+    while (timeoutCounter && !((status = ps2_inb(kCommandPort)) & kOutputReady))
     {
       timeoutCounter--;
       IODelay(kDataDelay);
@@ -1322,9 +2973,12 @@ UInt8 ApplePS2Controller::readDataPort(size_t expectedPort)
       unlockController(state);  // (release interrupt lockout + access to queue)
 #endif //DEBUGGER_SUPPORT
 
-	  if (!_suppressTimeout)
-		IOLog("%s: Timed out on input stream %ld.\n", getName(), expectedPort);
-        return 0;
+      if (!_suppressTimeout)
+      {
+        IOLog("%s: Timed out on input stream %ld.\n", getName(), expectedPort);
+        countEvent(expectedPort, kPS2CT_ReadTimeouts);
+      }
+      return 0;
     }
 
     //
@@ -1333,14 +2987,16 @@ UInt8 ApplePS2Controller::readDataPort(size_t expectedPort)
     // data will be available if this wait is not performed.
     //
 
-    IODelay(kDataDelay);
+    settleDelay();
 
     //
     // Read in the data.  We return the data, however, only if it arrived on
     // the requested input stream.
     //
 
-    readByte = inb(kDataPort);
+    readByte = ps2_inb(kDataPort);
+    traceByte(kPS2TR_Read, getPortFromStatus(status), readByte, status);
+    countStatusErrors(getPortFromStatus(status), status);
 
 #if DEBUGGER_SUPPORT
     unlockController(state);    // (release interrupt lockout + access to queue)
@@ -1387,20 +3043,19 @@ UInt8 ApplePS2Controller::readDataPort(size_t expectedPort,
   // (a) the data byte we did get was  "asynchronous" data being sent by
   //     the device, which has not figured out that it has to respond to
   //     the command we just sent to it.
-  // (b) that the real  "expected" response will be the next byte in the
-  //     stream;   so what we do is put aside the first byte we read and
-  //     wait for the next byte; if it's the expected value, we dispatch
-  //     the first byte we read to the driver's interrupt handler,  then
-  //     return the expected byte. The caller will have never known that
-  //     asynchronous data arrived at a very bad time.
+  // (b) that the real  "expected" response will follow within the next
+  //     kReorderDepth bytes of the stream;  so what we do is put aside the
+  //     bytes we read until the expected value shows up, then we dispatch
+  //     the bytes put aside to the driver's interrupt handler (in order),
+  //     and return the expected byte. The caller will have never known
+  //     that asynchronous data arrived at a very bad time.
   // (c) that the real "expected" response will arrive within (kDataDelay
   //     X timeoutCounter) microseconds from the time the call is made.
   //
 
-  UInt8  firstByte     = 0;
-  bool   firstByteHeld = false;
   size_t port          = kPS2KbdIdx;
   UInt8  readByte;
+  UInt8  result;
   bool   requestedStream;
   UInt8  status = 0;
   UInt32 timeoutCounter = 10000;    // (timeoutCounter * kDataDelay = 70 ms)
@@ -1421,16 +3076,16 @@ UInt8 ApplePS2Controller::readDataPort(size_t expectedPort,
     // Wait for the controller's output buffer to become ready.
     //
 
-    while (timeoutCounter && !((status = inb(kCommandPort)) & kOutputReady))
+    while (timeoutCounter && !((status = ps2_inb(kCommandPort)) & kOutputReady))
     {
       timeoutCounter--;
       IODelay(kDataDelay);
     }
 
     //
-    // If we timed out, we return the first byte we read, unless THIS IS the
-    // first byte we are trying to read,  then something went awfully wrong
-    // and we return a fake value rather than lock up the controller longer.
+    // If we timed out, we return the first byte we put aside, unless we did
+    // not read anything yet, then something went awfully wrong and we return
+    // a fake value rather than lock up the controller longer.
     //
 
     if (timeoutCounter == 0)
@@ -1439,9 +3094,10 @@ UInt8 ApplePS2Controller::readDataPort(size_t expectedPort,
       unlockController(state);  // (release interrupt lockout + access to queue)
 #endif //DEBUGGER_SUPPORT
 
-      if (firstByteHeld)  return firstByte;
+      if (releaseHeldBytes(expectedPort, &result))  return result;
 
       IOLog("%s: Timed out on input stream %ld.\n", getName(), expectedPort);
+      countEvent(expectedPort, kPS2CT_ReadTimeouts);
       return 0;
     }
 
@@ -1451,16 +3107,18 @@ UInt8 ApplePS2Controller::readDataPort(size_t expectedPort,
     // data will be available if this wait is not performed.
     //
 
-    IODelay(kDataDelay);
+    settleDelay();
 
     //
     // Read in the data.  We process the data, however, only if it arrived on
     // the requested input stream.
     //
 
-    readByte        = inb(kDataPort);
+    readByte        = ps2_inb(kDataPort);
     requestedStream = false;
     port            = getPortFromStatus(status);
+    traceByte(kPS2TR_Read, port, readByte, status);
+    countStatusErrors(port, status);
 
     if (expectedPort == port) { requestedStream = true; }
 
@@ -1471,52 +3129,13 @@ skipForwardToY:
 
     if (requestedStream)
     {
-      if (readByte == expectedByte)
-      {
-        if (firstByteHeld == false)
-        {
-          //
-          // Normal case.  Return first byte received.
-          //
-
-          return readByte;
-        }
-        else
-        {
-          //
-          // Our assumption was correct.  The second byte matched.  Dispatch
-          // the first byte to the interrupt handler, and return the second.
-          //
-
-          if (!_ignoreOutOfOrder)
-            dispatchDriverInterrupt(expectedPort, firstByte);
-          return readByte;
-        }
-      }
-      else // (readByte does not match expectedByte)
-      {
-        if (firstByteHeld == false)
-        {
-          //
-          // The first byte was received, and does not match the byte we are
-          // expecting.  Put it aside for the moment.
-          //
+      //
+      // Return the expected byte as soon as it arrives, replaying whatever
+      // was put aside before it; put other bytes aside.
+      //
 
-          firstByteHeld = true;
-          firstByte     = readByte;
-        }
-        else
-        {
-          //
-          // The second byte mismatched as well.  I have yet to see this case
-          // occur [Dan], however I do think it's plausible.  No error logged.
-          //
-
-          if (!_ignoreOutOfOrder)
-            dispatchDriverInterrupt(expectedPort, readByte);
-          return firstByte;
-        }
-      }
+      if (reorderResponseByte(expectedPort, readByte, expectedByte, &result))
+        return result;
     }
     else
     {
@@ -1535,6 +3154,88 @@ skipForwardToY:
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+bool ApplePS2Controller::reorderResponseByte(size_t port,
+                                             UInt8  byte,
+                                             UInt8  expectedByte,
+                                             UInt8* result)
+{
+  //
+  // Feeds one byte read from the given input stream while its command
+  // response is expected.  Returns true once the response is known (stored
+  // in result).
+  //
+
+  PS2ReorderBuffer& held = _reorder[port];
+
+  if (byte == expectedByte)
+  {
+    // Replay the bytes put aside (if any), in order, and return this one.
+    if (held.count)
+      ++_responsesReordered;
+    replayHeldBytes(port, 0);
+    *result = byte;
+    return true;
+  }
+
+  if (held.count < kReorderDepth)
+  {
+    // Does not match, put it aside for the moment.
+    held.bytes[held.count++] = byte;
+    return false;
+  }
+
+  //
+  // The buffer is full, and the expected byte still did not show up.  Take
+  // the first byte as the response, and replay the others and this one.
+  //
+
+  *result = held.bytes[0];
+  replayHeldBytes(port, 1);
+  ++_bytesReplayed;
+  if (!_ignoreOutOfOrder)
+    dispatchDriverInterrupt(port, byte);
+  return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+bool ApplePS2Controller::releaseHeldBytes(size_t port, UInt8* result)
+{
+  //
+  // The response timed out.  If bytes were put aside, the first one is taken
+  // as the response, and the others are replayed.
+  //
+
+  if (!_reorder[port].count)
+    return false;
+
+  *result = _reorder[port].bytes[0];
+  replayHeldBytes(port, 1);
+  return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::replayHeldBytes(size_t port, unsigned from)
+{
+  //
+  // Dispatches the bytes put aside for the given input stream, starting at
+  // index from, and empties its reorder buffer.
+  //
+
+  PS2ReorderBuffer& held = _reorder[port];
+
+  for (unsigned i = from; i < held.count; i++)
+  {
+    ++_bytesReplayed;
+    if (!_ignoreOutOfOrder)
+      dispatchDriverInterrupt(port, held.bytes[i]);
+  }
+  held.count = 0;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 void ApplePS2Controller::writeDataPort(UInt8 byte)
 {
   //
@@ -1544,10 +3245,11 @@ void ApplePS2Controller::writeDataPort(UInt8 byte)
   // This method should only be dispatched from our single-threaded work loop.
   //
 
-  while (inb(kCommandPort) & kInputBusy)
+  while (ps2_inb(kCommandPort) & kInputBusy)
       IODelay(kDataDelay);
-  IODelay(kDataDelay);
-  outb(kDataPort, byte);
+  settleDelay();
+  ps2_outb(kDataPort, byte);
+  traceByte(kPS2TR_WriteData, kPS2NoPort, byte);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -1561,10 +3263,21 @@ void ApplePS2Controller::writeCommandPort(UInt8 byte)
   // This method should only be dispatched from our single-threaded work loop.
   //
 
-  while (inb(kCommandPort) & kInputBusy)
+  while (ps2_inb(kCommandPort) & kInputBusy)
       IODelay(kDataDelay);
-  IODelay(kDataDelay);
-  outb(kCommandPort, byte);
+  settleDelay();
+  ps2_outb(kCommandPort, byte);
+  traceByte(kPS2TR_WriteCommand, kPS2NoPort, byte);
+
+  // The clock commands change the command byte too, keep its shadow copy.
+  switch (byte)
+  {
+    case kCP_DisableKeyboardClock: _commandByte |= kCB_DisableKeyboardClock;  break;
+    case kCP_EnableKeyboardClock:  _commandByte &= ~kCB_DisableKeyboardClock; break;
+    case kCP_DisableMouseClock:    _commandByte |= kCB_DisableMouseClock;     break;
+    case kCP_EnableMouseClock:     _commandByte &= ~kCB_DisableMouseClock;    break;
+    case kCP_TestController:       invalidateCommandByte();                   break;
+  }
 }
 
 // =============================================================================
@@ -1647,10 +3360,10 @@ bool ApplePS2Controller::doEscape(UInt8 scancode)
     {
       // Disable the mouse by forcing the clock line low.
 
-      while (inb(kCommandPort) & kInputBusy)
+      while (ps2_inb(kCommandPort) & kInputBusy)
           IODelay(kDataDelay);
-      IODelay(kDataDelay);
-      outb(kCommandPort, kCP_DisableMouseClock);
+      settleDelay();
+      ps2_outb(kCommandPort, kCP_DisableMouseClock);
 
       // Call the debugger function.
 
@@ -1658,11 +3371,11 @@ bool ApplePS2Controller::doEscape(UInt8 scancode)
 
       // Re-enable the mouse by making the clock line active.
 
-      while (inb(kCommandPort) & kInputBusy)
+      while (ps2_inb(kCommandPort) & kInputBusy)
           IODelay(kDataDelay);
-      IODelay(kDataDelay);
+      settleDelay();
       if(!_kbdOnly)
-          outb(kCommandPort, kCP_EnableMouseClock);
+          ps2_outb(kCommandPort, kCP_EnableMouseClock);
 
       releaseModifiers = true;
     }
@@ -1823,6 +3536,9 @@ void ApplePS2Controller::setPowerStateGated( UInt32 powerState )
 {
   if ( _currentPowerState != powerState )
   {
+    // The controller is accessed directly below, finish the active request.
+    quiesceRequestEngine();
+
     switch ( powerState )
     {
       case kPS2PowerStateSleep:
@@ -1846,6 +3562,10 @@ void ApplePS2Controller::setPowerStateGated( UInt32 powerState )
         //    the PS/2 port.
 
         _hardwareOffline = true;
+        publishRequestStatistics();
+
+        // A different device may be docked by the time we wake up.
+        __atomic_store_n(&_identified, 0, __ATOMIC_RELEASE);
 
         // 4. Disable the PS/2 port.
 
@@ -1868,9 +3588,16 @@ void ApplePS2Controller::setPowerStateGated( UInt32 powerState )
           // require no action, since both are working states.
           break;
         }
-            
+
+        timelineBegin();
+
+        // The firmware initialized the controller again while we slept.
+        invalidateCommandByte();
+
+        timelineRecord(kPS2TK_PhaseBegin, kPS2NoPort, kPS2TP_WakeDelay);
         if (_wakedelay)
             IOSleep(_wakedelay);
+        timelineRecord(kPS2TK_PhaseEnd, kPS2NoPort, kPS2TP_WakeDelay);
             
 #if FULL_INIT_AFTER_WAKE
         //
@@ -1879,20 +3606,26 @@ void ApplePS2Controller::setPowerStateGated( UInt32 powerState )
         
         if (_resetControllerFlag & RESET_CONTROLLER_ON_WAKEUP)
         {
+          timelineRecord(kPS2TK_PhaseBegin, kPS2NoPort, kPS2TP_ResetController);
           resetController();
+          timelineRecord(kPS2TK_PhaseEnd, kPS2NoPort, kPS2TP_ResetController);
         }
 
 #endif // FULL_INIT_AFTER_WAKE
 
         if (_muxPresent) {
+          timelineRecord(kPS2TK_PhaseBegin, kPS2NoPort, kPS2TP_MuxMode);
           setMuxMode(true);
+          timelineRecord(kPS2TK_PhaseEnd, kPS2NoPort, kPS2TP_MuxMode);
         }
         
 #if FULL_INIT_AFTER_WAKE
         if (_resetControllerFlag & RESET_CONTROLLER_ON_WAKEUP)
         {
+          timelineRecord(kPS2TK_PhaseBegin, kPS2NoPort, kPS2TP_ResetDevices);
           resetDevices();
           flushDataPort();
+          timelineRecord(kPS2TK_PhaseEnd, kPS2NoPort, kPS2TP_ResetDevices);
         }
 #endif // FULL_INIT_AFTER_WAKE
         
@@ -1902,6 +3635,7 @@ void ApplePS2Controller::setPowerStateGated( UInt32 powerState )
 
         // 1. Enable the PS/2 port -- but just the clocks
         
+        timelineRecord(kPS2TK_PhaseBegin, kPS2NoPort, kPS2TP_EnableClocks);
         if (_muxPresent)
         {
           enableMuxPorts();
@@ -1912,6 +3646,7 @@ void ApplePS2Controller::setPowerStateGated( UInt32 powerState )
             setCommandByte(0, kCB_DisableKeyboardClock | kCB_DisableMouseClock | kCB_EnableKeyboardIRQ | kCB_EnableMouseIRQ);
         else
             setCommandByte(0, kCB_DisableKeyboardClock | kCB_EnableKeyboardIRQ | kCB_EnableMouseIRQ);
+        timelineRecord(kPS2TK_PhaseEnd, kPS2NoPort, kPS2TP_EnableClocks);
 
         // 2. Unblock the request queue and wake up all driver threads
         //    that were blocked by submitRequest().
@@ -1921,26 +3656,23 @@ void ApplePS2Controller::setPowerStateGated( UInt32 powerState )
         // 3. Notify clients about the state change: Keyboard, then Mouse.
         //   (This ordering is also part of the fix for ProBook 4x40s trackpad wake issue)
         //    The ordering can be reversed from normal by setting MouseWakeFirst=true
+        //    With OverlapDeviceWake=true, both are woken on their own thread
+        //    and the ordering only decides who goes first (see wakeDevices).
 
-        if (!_mouseWakeFirst)
-        {
-            dispatchDriverPowerControl( kPS2C_EnableDevice, kPS2KbdIdx );
-            dispatchDriverPowerControl( kPS2C_EnableDevice, kPS2AuxIdx );
-        }
-        else
-        {
-            dispatchDriverPowerControl( kPS2C_EnableDevice, kPS2AuxIdx );
-            dispatchDriverPowerControl( kPS2C_EnableDevice, kPS2KbdIdx );
-        }
+        wakeDevices();
 
         // 4. Now safe to enable the IRQs...
             
         DEBUG_LOG("%s: setCommandByte for wake 2\n", getName());
+        timelineRecord(kPS2TK_PhaseBegin, kPS2NoPort, kPS2TP_EnableIRQs);
         if (!_kbdOnly)
             setCommandByte(kCB_EnableKeyboardIRQ | kCB_EnableMouseIRQ | kCB_SystemFlag, 0);
         else
             setCommandByte(kCB_EnableKeyboardIRQ | kCB_SystemFlag, 0);
+        timelineRecord(kPS2TK_PhaseEnd, kPS2NoPort, kPS2TP_EnableIRQs);
         --_ignoreInterrupts;
+
+        timelineEnd();
         break;
 
       default:
@@ -1969,21 +3701,112 @@ void ApplePS2Controller::dispatchDriverPowerControl( UInt32 whatToDo, size_t por
   
     if (port == kPS2KbdIdx)
     {
+        timelineRecord(kPS2TK_PhaseBegin, kPS2KbdIdx, kPS2TP_WakeDevice);
         _devices[kPS2KbdIdx]->powerAction(whatToDo);
+        timelineRecord(kPS2TK_PhaseEnd, kPS2KbdIdx, kPS2TP_WakeDevice);
         return;
     }
 
     for (size_t i = kPS2AuxIdx; i < _nubsCount; i++) {
+        timelineRecord(kPS2TK_PhaseBegin, i, kPS2TP_WakeDevice);
         _devices[i]->powerAction(whatToDo);
+        timelineRecord(kPS2TK_PhaseEnd, i, kPS2TP_WakeDevice);
     }
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+void ApplePS2Controller::wakeDevices()
+{
+  //
+  // Runs the wake power action of the keyboard and of the aux devices.
+  //
+  // With OverlapDeviceWake each port is woken on its own thread, and the
+  // gate is released while we wait for the drivers to finish.  The overlap
+  // is partial: interrupts are still off, so every request is polled, and a
+  // polled request keeps the gate until it is done, including its own
+  // kPS2C_SleepMS and the time its device takes to answer (eg. a reset and
+  // its self-test result).  Only what a driver does between requests, such
+  // as the IOSleep before the Elan reset, overlaps with the other port's
+  // requests.  Bytes of one port read while the other port's request polls
+  // are dispatched straight to their driver, as at any other time.
+  //
+  // This method should only be called from setPowerStateGated.
+  //
+
+  size_t first  = _mouseWakeFirst ? kPS2AuxIdx : kPS2KbdIdx;
+  size_t second = _mouseWakeFirst ? kPS2KbdIdx : kPS2AuxIdx;
+
+  if (!_overlapDeviceWake)
+  {
+    dispatchDriverPowerControl( kPS2C_EnableDevice, first );
+    dispatchDriverPowerControl( kPS2C_EnableDevice, second );
+    return;
+  }
+
+  _deviceWakePending = 2;
+  thread_call_enter1(_deviceWakeThreadCall[first], (thread_call_param_t) first);
+  thread_call_enter1(_deviceWakeThreadCall[second], (thread_call_param_t) second);
+
+  while (_deviceWakePending)
+    _cmdGate->commandSleep(&_deviceWakePending, THREAD_UNINT);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::deviceWakeCallout( thread_call_param_t param0,
+                                            thread_call_param_t param1 )
+{
+  ApplePS2Controller * me = (ApplePS2Controller *) param0;
+  assert(me);
+
+  me->dispatchDriverPowerControl( kPS2C_EnableDevice, (size_t) param1 );
+  me->_cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, me, &ApplePS2Controller::deviceWakeDoneGated));
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ApplePS2Controller::deviceWakeDoneGated()
+{
+  if (--_deviceWakePending == 0)
+    _cmdGate->commandWakeup(&_deviceWakePending);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 void ApplePS2Controller::notificationHandlerPublishGated(IOService * newService, IONotifier * notifier)
 {
-    IOLog("%s: Notification consumer published: %s\n", getName(), newService->getName());
-    _notificationServices->setObject(newService);
+    // services list the messages they handle, those that do not get everything
+    UInt32 messages = ~0U;
+    if (OSArray* list = OSDynamicCast(OSArray, newService->getProperty(kDeliverNotificationMessages)))
+    {
+        messages = 0;
+        for (unsigned i = 0; i < list->getCount(); i++)
+            if (OSNumber* num = OSDynamicCast(OSNumber, list->getObject(i)))
+                messages |= messageBit(num->unsigned32BitValue());
+    }
+
+    UInt32 slot = _subscriberCount;
+    for (UInt32 i = 0; i < _subscriberCount; i++)
+    {
+        if (_subscribers[i].service == newService)
+            return;
+        if (!_subscribers[i].service && slot == _subscriberCount)
+            slot = i;
+    }
+    if (slot >= kMaxMessageSubscribers)
+    {
+        IOLog("%s: Too many notification consumers, ignoring %s\n", getName(), newService->getName());
+        return;
+    }
+
+    IOLog("%s: Notification consumer published: %s (messages %08x)\n", getName(), newService->getName(), messages);
+    newService->retain();
+    // deliveries outside the gate read the slot, so fill it before publishing
+    __atomic_store_n(&_subscribers[slot].messages, messages, __ATOMIC_RELAXED);
+    __atomic_store_n(&_subscribers[slot].service, newService, __ATOMIC_RELEASE);
+    if (slot == _subscriberCount)
+        __atomic_store_n(&_subscriberCount, slot + 1, __ATOMIC_RELEASE);
 }
 
 bool ApplePS2Controller::notificationHandlerPublish(void * refCon, IOService * newService, IONotifier * notifier)
@@ -1993,33 +3816,89 @@ bool ApplePS2Controller::notificationHandlerPublish(void * refCon, IOService * n
     return true;
 }
 
-void ApplePS2Controller::notificationHandlerTerminateGated(IOService * newService, IONotifier * notifier)
+void ApplePS2Controller::notificationHandlerTerminateGated(IOService * newService, bool * removed)
 {
-    IOLog("%s: Notification consumer terminated: %s\n", getName(), newService->getName());
-    _notificationServices->removeObject(newService);
+    for (UInt32 i = 0; i < _subscriberCount; i++)
+    {
+        if (_subscribers[i].service == newService)
+        {
+            IOLog("%s: Notification consumer terminated: %s\n", getName(), newService->getName());
+            // seq_cst, so the reader count loaded afterwards cannot miss a
+            // delivery that still saw the service
+            __atomic_store_n(&_subscribers[i].service, nullptr, __ATOMIC_SEQ_CST);
+            *removed = true;
+            return;
+        }
+    }
 }
 
 bool ApplePS2Controller::notificationHandlerTerminate(void * refCon, IOService * newService, IONotifier * notifier)
 {
     assert(_cmdGate != nullptr);
-    _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &ApplePS2Controller::notificationHandlerTerminateGated), newService, notifier);
+    bool removed = false;
+    _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &ApplePS2Controller::notificationHandlerTerminateGated), newService, &removed);
+    if (removed)
+    {
+        // a keystroke notification may still be calling it from outside the gate
+        while (__atomic_load_n(&_messageReaders, __ATOMIC_SEQ_CST))
+            IOSleep(1);
+        newService->release();
+    }
     return true;
 }
 
-void ApplePS2Controller::dispatchMessageGated(int* message, void* data)
+UInt32 ApplePS2Controller::messageBit(UInt32 message)
 {
-    OSCollectionIterator* i = OSCollectionIterator::withCollection(_notificationServices);
-    
-    if (i != NULL) {
-        while (IOService* service = OSDynamicCast(IOService, i->getNextObject())) {
-            service->message(*message, this, data);
+    switch (message)
+    {
+        case kPS2M_setDisableTouchpad:  return 1 << 0;
+        case kPS2M_getDisableTouchpad:  return 1 << 1;
+        case kPS2M_notifyKeyPressed:    return 1 << 2;
+        case kPS2M_notifyKeyTime:       return 1 << 3;
+        case kPS2M_resetTouchpad:       return 1 << 4;
+        case kPS2K_setKeyboardStatus:   return 1 << 5;
+        case kPS2K_getKeyboardStatus:   return 1 << 6;
+        case kPS2K_notifyKeystroke:     return 1 << 7;
+        default:                        return 1U << 31;    // anything else shares one bit
+    }
+}
+
+void ApplePS2Controller::deliverMessage(int message, void* data)
+{
+    UInt32 bit = messageBit(message);
+    UInt32 delivered = 0, filtered = 0;
+
+    // seq_cst on the reader count and the slot loads: a terminating
+    // consumer clears its slot and then waits for the count, and either
+    // sees this delivery or this delivery sees the cleared slot
+    __atomic_add_fetch(&_messageReaders, 1, __ATOMIC_SEQ_CST);
+    UInt32 count = __atomic_load_n(&_subscriberCount, __ATOMIC_ACQUIRE);
+    for (UInt32 i = 0; i < count; i++)
+    {
+        const PS2MessageSubscriber& subscriber = _subscribers[i];
+        IOService* service = __atomic_load_n(&subscriber.service, __ATOMIC_SEQ_CST);
+        if (!service)
+            continue;
+        if (!(__atomic_load_n(&subscriber.messages, __ATOMIC_RELAXED) & bit))
+        {
+            ++filtered;
+            continue;
         }
-        i->release();
+        service->message(message, this, data);
+        ++delivered;
     }
-    
+    __atomic_sub_fetch(&_messageReaders, 1, __ATOMIC_RELEASE);
+
+    __atomic_add_fetch(&_messagesDelivered, delivered, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&_messagesFiltered, filtered, __ATOMIC_RELAXED);
+}
+
+void ApplePS2Controller::fanOutMessage(int message, void* data)
+{
+    deliverMessage(message, data);
 
     // Convert kPS2M_notifyKeyPressed events into additional kPS2M_notifyKeyTime events for external consumers
-    if (*message == kPS2M_notifyKeyPressed) {
+    if (message == kPS2M_notifyKeyPressed) {
         
         // Register last key press, used for palm detection
         PS2KeyInfo* pInfo = (PS2KeyInfo*)data;
@@ -2038,19 +3917,49 @@ void ApplePS2Controller::dispatchMessageGated(int* message, void* data)
             case 0x3f:  // osx fn (function)
                 break;
             default:
-            
-                int dispatchMsg = kPS2M_notifyKeyTime;
-                dispatchMessageGated(&dispatchMsg, &(pInfo->time));
+                deliverMessage(kPS2M_notifyKeyTime, &(pInfo->time));
         }
     }
 }
 
+void ApplePS2Controller::dispatchMessageGated(int* message, void* data)
+{
+    fanOutMessage(*message, data);
+}
+
 void ApplePS2Controller::dispatchMessage(int message, void* data)
 {
+    // Keystroke notifications only hand a timestamp to the consumers, so
+    // they skip the command gate; everything else is serialized with it.
+    if (message == kPS2M_notifyKeyPressed || message == kPS2M_notifyKeyTime)
+    {
+        fanOutMessage(message, data);
+        return;
+    }
 	assert(_cmdGate != nullptr);
     _cmdGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &ApplePS2Controller::dispatchMessageGated), &message, data);
 }
 
+void ApplePS2Controller::publishMessageStatistics()
+{
+    OSDictionary* dict = OSDictionary::withCapacity(2);
+    if (!dict)
+        return;
+    OSNumber* num;
+    if ((num = OSNumber::withNumber(__atomic_load_n(&_messagesDelivered, __ATOMIC_RELAXED), 64))) { dict->setObject("Delivered", num); num->release(); }
+    if ((num = OSNumber::withNumber(__atomic_load_n(&_messagesFiltered, __ATOMIC_RELAXED), 64))) { dict->setObject("Filtered", num); num->release(); }
+    setProperty("Messages", dict);
+    dict->release();
+}
+
+bool ApplePS2Controller::serializeProperties(OSSerialize* s) const
+{
+    // the counters change with every keystroke, refresh them only when read
+    const_cast<ApplePS2Controller*>(this)->publishMessageStatistics();
+    const_cast<ApplePS2Controller*>(this)->publishRequestStatistics();
+    return super::serializeProperties(s);
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 void ApplePS2Controller::lock()
@@ -2218,28 +4127,36 @@ static OSDictionary* _getConfigurationNode(OSDictionary *root, const char *name)
     return configuration;
 }
 
-OSDictionary* ApplePS2Controller::getConfigurationNode(IORegistryEntry* entry, OSDictionary* list)
+static OSDictionary* _getPlatformNode(OSDictionary* list, OSString* manufacturer, OSString* platformProduct)
 {
     OSDictionary *configuration = NULL;
 
-    if (OSString *manufacturer = getPlatformManufacturer(entry))
+    if (manufacturer)
     {
         if (OSDictionary *manufacturerNode = OSDynamicCast(OSDictionary, list->getObject(manufacturer)))
         {
-            if (OSString *platformProduct = getPlatformProduct(entry))
-            {
+            if (platformProduct)
                 configuration = _getConfigurationNode(manufacturerNode, platformProduct);
-                platformProduct->release();
-            }
             else
               configuration = _getConfigurationNode(manufacturerNode, kDefault);
         }
-        manufacturer->release();
     }
 
     return configuration;
 }
 
+OSDictionary* ApplePS2Controller::getConfigurationNode(IORegistryEntry* entry, OSDictionary* list)
+{
+    OSString *manufacturer = getPlatformManufacturer(entry);
+    OSString *platformProduct = manufacturer ? getPlatformProduct(entry) : NULL;
+
+    OSDictionary *configuration = _getPlatformNode(list, manufacturer, platformProduct);
+
+    OSSafeReleaseNULL(platformProduct);
+    OSSafeReleaseNULL(manufacturer);
+    return configuration;
+}
+
 OSObject* ApplePS2Controller::translateEntry(OSObject* obj)
 {
     // Note: non-NULL result is retained...
@@ -2367,10 +4284,31 @@ OSDictionary* ApplePS2Controller::makeConfigurationNode(OSDictionary* list, cons
 
     lock(); // called from various probe functions, must protect against re-rentry
 
+    // a section is merged once and then shared by every later caller, as long
+    // as it asks with the same Platform Profile
+    if (OSArray* cached = _configCache ? OSDynamicCast(OSArray, _configCache->getObject(section)) : NULL)
+    {
+        OSDictionary* result = OSDynamicCast(OSDictionary, cached->getObject(1));
+        if (result && cached->getObject(0) == list)
+        {
+            result->retain();
+            unlock();
+            return result;
+        }
+    }
+
+    // the platform IDs do not change while the system is up, look them up once
+    if (!_platformIdsKnown)
+    {
+        _platformManufacturer = getPlatformManufacturer(this);
+        _platformProduct = _platformManufacturer ? getPlatformProduct(this) : NULL;
+        _platformIdsKnown = true;
+    }
+
     // first merge Default with specific platform profile overrides
     OSDictionary* result = 0;
     OSDictionary* defaultNode = _getConfigurationNode(list, kDefault);
-    OSDictionary* platformNode = getConfigurationNode(this, list);
+    OSDictionary* platformNode = _getPlatformNode(list, _platformManufacturer, _platformProduct);
     if (defaultNode)
     {
         // have default node, result is merge with platform node
@@ -2424,11 +4362,32 @@ OSDictionary* ApplePS2Controller::makeConfigurationNode(OSDictionary* list, cons
         }
     }
 
+    // remember the merged result (the list is kept so its pointer stays unique)
+    if (result)
+    {
+        if (!_configCache)
+            _configCache = OSDictionary::withCapacity(8);
+        if (OSArray* cached = _configCache ? OSArray::withCapacity(2) : NULL)
+        {
+            cached->setObject(list);
+            cached->setObject(result);
+            _configCache->setObject(section, cached);
+            cached->release();
+        }
+    }
+
     unlock();
 
     return result;
 }
 
+void ApplePS2Controller::flushConfigurationCache()
+{
+    lock();
+    OSSafeReleaseNULL(_configCache);
+    unlock();
+}
+
 IOReturn ApplePS2Controller::startSMBusCompanion(OSDictionary *companionData, UInt8 smbusAddr) {
   IOReturn ret = callPlatformFunction(_smbusCompanion,
                                       false,
@@ -2438,3 +4397,35 @@ IOReturn ApplePS2Controller::startSMBusCompanion(OSDictionary *companionData, UI
                                       nullptr);
   return ret;
 }
+
+#if BYTE_TRACE
+
+// =============================================================================
+// ApplePS2TraceClient Class Implementation
+//
+
+OSDefineMetaClassAndStructors(ApplePS2TraceClient, IOUserClient);
+
+IOReturn ApplePS2TraceClient::clientClose()
+{
+  terminate();
+  return kIOReturnSuccess;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+IOReturn ApplePS2TraceClient::clientMemoryForType(UInt32 type, IOOptionBits * options,
+                                                  IOMemoryDescriptor ** memory)
+{
+  ApplePS2Controller* controller = OSDynamicCast(ApplePS2Controller, getProvider());
+  if (type != 0 || !controller || !controller->getTraceMemory())
+    return kIOReturnBadArgument;
+
+  // the caller releases it
+  controller->getTraceMemory()->retain();
+  *memory  = controller->getTraceMemory();
+  *options = kIOMapReadOnly;
+  return kIOReturnSuccess;
+}
+
+#endif // BYTE_TRACE
@@ -24,8 +24,11 @@
 #define _APPLEPS2CONTROLLER_H
 
 #include <libkern/version.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
 #include <IOKit/IOInterruptEventSource.h>
 #include <IOKit/IOService.h>
+#include <IOKit/IOTimerEventSource.h>
+#include <IOKit/IOUserClient.h>
 #include <IOKit/IOWorkLoop.h>
 #include "ApplePS2Device.h"
 
@@ -91,11 +94,62 @@ class ApplePS2MouseDevice;
 // driver writer disable the mouse first, then send any dangerous commands, and
 // re-enable the mouse when the command completes. 
 //
+// A whole packet may be in flight when the command is sent (a trackpad
+// reports up to 8 bytes at a time), so one second chance is not always
+// enough.  Unexpected bytes are therefore put aside in a small reorder buffer
+// kept per input stream, up to kReorderDepth of them.  When the expected byte
+// shows up, the bytes put aside are replayed to the driver in the order they
+// arrived.  If it never shows up (buffer full or timeout), the first byte put
+// aside is taken as the response and the others are replayed, which is what
+// the single second chance did.  Bytes of the other input streams are never
+// held: they are dispatched to their drivers as they arrive.
+//
 // Note that the OUT_OF_ORDER_DATA_CORRECTION_FEATURE can be turned off at
 // compile time.    Please see the readDataPort:expecting: method for more
 // information about the assumptions necessary for this feature.
 //
 
+//
+// Asynchronous request processing (ASYNC_REQUEST_ENGINE).
+//
+// Polling the data port from the workloop for every response byte stalls
+// all PS/2 traffic (and all interrupt handling) until the request is done.
+// Once the interrupt handlers are installed, requests are instead executed
+// by a small state machine.  Each command is issued, then the engine yields
+// the workloop.  While a request is active, bytes that arrive on the port it
+// expects a response from are captured by handleInterrupt into a small
+// buffer, and the request resumes on the workloop once they are there.
+// Bytes for any other port are dispatched to their drivers as usual.
+//
+// A timer guards every response.  When it fires, the controller is checked
+// for data (in case the interrupt was lost), and the response is otherwise
+// treated exactly like a timeout of readDataPort.
+//
+// Whenever the engine cannot be used (interrupts not installed yet, during
+// power transitions, or when a blocking request is issued on the workloop
+// thread itself), requests are executed by polling as before.  Anything the
+// controller does directly (eg. setCommandByte) first finishes the active
+// requests by polling.
+//
+// Scheduling.  Each port has its own request slot, so one request per port
+// can be in progress at a time; requests of one port still run in order.
+// The wire is shared at command granularity: only one port owns it at any
+// time, from the command that makes its device talk until the device has
+// nothing more to send for it.  A multi-byte reply (eg. the ACK and three
+// status bytes of GetMouseInformation, or the self-test result of a reset
+// read after a kPS2C_SleepMS) therefore always reaches its request.  Between
+// two such exchanges, and during the sleeps that are not followed by a read,
+// the commands of other ports may go out.  The port with the lowest index has
+// priority, so keyboard traffic overtakes a long trackpad configuration
+// sequence.  Requests that touch the controller itself
+// (kPS2C_ModifyCommandByte, kPS2C_FlushDataPort) run alone.
+//
+// Requests executed by polling still keep the controller for themselves,
+// but let interrupts through while sleeping (kPS2C_SleepMS), so keystrokes
+// are not held back by a device's multi-second settle delays.  Bytes of the
+// request's own port that arrive meanwhile are captured for it.
+//
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // Definitions
 //
@@ -109,6 +163,23 @@ class ApplePS2MouseDevice;
 
 #define OUT_OF_ORDER_DATA_CORRECTION_FEATURE 1
 
+// Enable interrupt-driven execution of requests once the device interrupts
+// are installed.  When zero, all requests are executed by polling.
+
+#define ASYNC_REQUEST_ENGINE 1
+
+// Enable the resume timeline: every phase of the wake sequence, and every
+// command sent during it, is timestamped and published as ResumeTimeline
+// (see Docs/resumetimeline.py).
+
+#define RESUME_TIMELINE 1
+
+// Enable the byte trace: every byte read from or written to the controller
+// is recorded in a ring that user space maps through ApplePS2TraceClient
+// (see Docs/ps2trace.c and Docs/ps2trace.py).
+
+#define BYTE_TRACE 1
+
 // Enable handling of interrupt data in workloop instead of at interrupt
 // time.  This way is easier to debug.  For production use, this should
 // be zero, such that PS2 data is buffered at real interrupt time, and handled
@@ -124,15 +195,43 @@ class ApplePS2MouseDevice;
 #define kIPL_Keyboard           6
 #define kIPL_Mouse              3
 
-// Port timings.
+// Port timings.  kDataDelay paces the polling loops, and is the default
+// settle delay between status and data port accesses (see DataDelay and
+// CalibrateDataDelay properties).
 
 #define kDataDelay              7       // usec to delay before data is valid
+#define kDataDelayCalibrationRounds 8   // device replies per candidate delay
 
 // Ports used to control the PS/2 keyboard/mouse and read data from it.
 
 #define kDataPort               0x60    // keyboard data & cmds (read/write)
 #define kCommandPort            0x64    // keybd status (read), command (write)
 
+//
+// Port I/O backend.  All controller port accesses go through ps2_inb and
+// ps2_outb.  By default these are the x86 in/out instructions.  Building
+// with PS2_PORT_IO_EXTERNAL defined routes them to functions supplied by
+// the build instead (eg. a software model of the i8042), so the controller
+// logic can be run and measured off-target.
+//
+
+#ifndef PS2_PORT_IO_EXTERNAL
+#include <architecture/i386/pio.h>
+
+static inline UInt8 ps2_inb(UInt16 port)
+{
+    return inb(port);
+}
+
+static inline void ps2_outb(UInt16 port, UInt8 data)
+{
+    outb(port, data);
+}
+#else
+extern "C" UInt8 ps2_inb(UInt16 port);
+extern "C" void  ps2_outb(UInt16 port, UInt8 data);
+#endif // PS2_PORT_IO_EXTERNAL
+
 // Bit definitions for kCommandPort read values (status).
 
 #define kOutputReady            0x01    // output (from keybd) buffer full
@@ -141,6 +240,51 @@ class ApplePS2MouseDevice;
 #define kCommandLastSent        0x08    // 1 = cmd, 0 = data last sent
 #define kKeyboardInhibited      0x10    // 0 if keyboard inhibited
 #define kMouseData              0x20    // mouse data available
+#define kTimeoutError           0x40    // timeout error (not in mux mode)
+#define kParityError            0x80    // parity error (not in mux mode)
+
+// Response timeouts (ms) used by the asynchronous request engine.  These
+// match the polling timeouts of the readDataPort variants.
+
+#define kResponseTimeout        140
+#define kResponseCompareTimeout 70
+
+// Number of unexpected bytes put aside per input stream while waiting for a
+// command response (see OUT_OF_ORDER_DATA_CORRECTION_FEATURE).
+
+#define kReorderDepth           8
+
+// Size of the buffer holding response bytes captured at interrupt time.
+
+#define kResponseBufferSize     16
+
+// Request pool.  Asynchronous requests (allocateRequest) are carved from
+// preallocated slabs, one per size class, each with a lock-free free list.
+// Requests larger than the largest class, or allocated while a class is
+// exhausted, fall back to the heap.
+
+#define kRequestPoolClasses     3
+#define kRequestPoolSizes       { 4, 8, kMaxCommands }     // commands per request
+#define kRequestPoolCounts      { 16, 8, 4 }               // requests per class
+
+// Resume timeline definitions
+
+#define kTimelineEntries        1024
+
+// Byte trace definitions
+
+#define kTraceEntries           4096        // must be a power of two
+#define kTraceMagic             0x54325350  // 'PS2T'
+
+// Lost interrupt detector definitions
+
+#define kLostInterruptCheckMS   250     // look for data no interrupt told us about
+#define kLostInterruptPollMS    5       // poll interval while interrupts are lost
+#define kLostInterruptPollTime  2000    // longest polling (ms) per detection
+
+// Message subscription definitions
+
+#define kMaxMessageSubscribers  16
 
 // Watchdog timer definitions
 
@@ -210,6 +354,154 @@ enum {
     kPS2MuxMaxIdx = PS2_MUX_PORTS + 1
 };
 
+// Marker for "no port" (eg. no response expected by a command)
+
+#define kPS2NoPort      ((size_t)-1)
+
+// States of the active request in the asynchronous request engine
+
+enum PS2RequestState
+{
+    kPS2RS_Issue,       // next command has not been issued yet
+    kPS2RS_Waiting,     // waiting for the response to the current command
+    kPS2RS_Sleeping,    // waiting for kPS2C_SleepMS to elapse
+};
+
+// Bytes put aside on one input stream while waiting for a command response
+
+struct PS2ReorderBuffer
+{
+    UInt8               bytes[kReorderDepth];
+    unsigned            count;
+};
+
+// Lost interrupt detector state of one interrupt line (keyboard or aux)
+
+enum
+{
+    kPS2KbdLine = 0,
+    kPS2AuxLine,
+    kPS2Lines
+};
+
+struct PS2InterruptLine
+{
+    UInt32              interrupts;     // counted at interrupt time
+    UInt32              lastInterrupts; // at the last check
+    bool                dataPending;    // data was waiting at the last check
+    uint64_t            pollStart;
+    uint64_t            pollUntil;      // polling instead of interrupts until then
+    UInt32              detections;
+    uint64_t            polledTime;     // total, in absolute time units
+};
+
+// A service that consumes messages from dispatchMessage, with the set of
+// messages it asked for (see messageBit)
+
+struct PS2MessageSubscriber
+{
+    IOService*          service;
+    UInt32              messages;
+};
+
+// Byte trace ring, shared read-only with user space (keep in sync with
+// Docs/ps2trace.py)
+
+enum PS2TraceKind
+{
+    kPS2TR_Read,            // byte read from an input stream
+    kPS2TR_Flush,           // byte read and dropped
+    kPS2TR_WriteData,       // byte written to the data port (port = 0xff)
+    kPS2TR_WriteCommand,    // byte written to the command port (port = 0xff)
+};
+
+struct PS2TraceEntry
+{
+    uint64_t            time;       // mach absolute time
+    UInt32              sequence;   // index + 1, written last (0 while written)
+    UInt8               kind;       // PS2TraceKind
+    UInt8               port;
+    UInt8               data;
+    UInt8               status;     // status register, for reads
+};
+
+struct PS2TraceBuffer
+{
+    UInt32              magic;
+    UInt32              entries;
+    UInt32              head;       // entries ever recorded
+    UInt32              reserved;
+    PS2TraceEntry       entry[kTraceEntries];
+};
+
+// Driver interrupt routine of one input stream, called for each byte
+
+struct PS2DispatchSlot
+{
+    void *              client;
+    PS2InterruptAction  action;
+};
+
+// Resume timeline entry (published as is, keep in sync with
+// Docs/resumetimeline.py)
+
+enum PS2TimelineKind
+{
+    kPS2TK_PhaseBegin,  // data = PS2TimelinePhase
+    kPS2TK_PhaseEnd,    // data = PS2TimelinePhase
+    kPS2TK_Command,     // data = byte written (if any), extra = PS2CommandEnum
+    kPS2TK_Response,    // data = byte read, extra = 1 if the command failed
+};
+
+enum PS2TimelinePhase
+{
+    kPS2TP_Resume,
+    kPS2TP_WakeDelay,
+    kPS2TP_ResetController,
+    kPS2TP_MuxMode,
+    kPS2TP_ResetDevices,
+    kPS2TP_EnableClocks,
+    kPS2TP_WakeDevice,  // port = device
+    kPS2TP_EnableIRQs,
+};
+
+struct PS2TimelineEntry
+{
+    UInt32              time;           // usec since the resume began
+    UInt8               kind;           // PS2TimelineKind
+    UInt8               port;
+    UInt8               data;
+    UInt8               extra;
+};
+
+// Request in progress on one port
+
+struct PS2ActiveRequest
+{
+    PS2Request*         request;
+    unsigned            index;          // current command
+    PS2RequestState     state;
+    bool                failed;
+    uint64_t            deadline;       // response timeout or end of sleep
+};
+
+// One size class of the request pool.  The free list is a stack of slot
+// indexes (index+1, zero terminated) whose head carries a generation tag in
+// its upper 32 bits, so a compare-and-swap cannot be fooled by ABA.
+
+struct PS2RequestSlab
+{
+    UInt8*              base;           // slotCount slots of slotSize bytes
+    UInt32*             links;          // next free slot (index+1) per slot
+    size_t              slotSize;
+    UInt32              slotCount;
+    int                 maxCommands;
+    UInt64              freeHead;       // tag << 32 | (index+1)
+    UInt32              inUse;
+    UInt32              highWater;
+    UInt32              exhausted;      // allocations that fell back to the heap
+};
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // ApplePS2Controller Class Declaration
 //
@@ -240,9 +532,45 @@ public:
 
 private:
   IOWorkLoop *             _workLoop {nullptr};
-  queue_head_t             _requestQueue {nullptr};
-  IOLock*                  _requestQueueLock {nullptr};
+  PS2Request*              _submitList {nullptr};           // lock-free LIFO, linked by chain.next
+  bool                     _coalesceRequests {true};
+  UInt32                   _requestsCoalesced {0};
+  UInt32                   _requestsDropped {0};
   IOLock*                  _cmdbyteLock {nullptr};
+  UInt8                    _commandByte {0};                // shadow of the 8042 command byte
+  bool                     _commandByteKnown {false};       // shadow valid, see readCommandByte
+
+  // asynchronous request engine (see ASYNC_REQUEST_ENGINE)
+  queue_head_t             _pendingQueue {nullptr};         // requests not started yet
+  PS2ActiveRequest         _active[kPS2MuxMaxIdx] {};       // one request in progress per port
+  size_t                   _busOwner {kPS2NoPort};          // port whose device is talking
+  bool                     _exclusiveActive {false};        // active request runs alone
+  PS2ReorderBuffer         _reorder[kPS2MuxMaxIdx] {};      // bytes put aside per input stream
+  PS2DispatchSlot          _dispatch[kPS2MuxMaxIdx] {};     // driver interrupt routines
+#if BYTE_TRACE
+  IOBufferMemoryDescriptor* _traceMemory {nullptr};
+  PS2TraceBuffer*          _trace {nullptr};
+#endif
+  UInt8                    _statusPort[256] {};             // input stream of each status byte
+  UInt32                   _responsesReordered {0};         // responses found behind other bytes
+  UInt32                   _bytesReplayed {0};              // bytes put aside, then dispatched
+  IOTimerEventSource*      _requestTimer {nullptr};
+  IOTimerEventSource*      _lostInterruptTimer {nullptr};
+  PS2InterruptLine         _irqLines[kPS2Lines] {};
+  bool                     _detectLostInterrupts {true};
+  IOSimpleLock*            _portLock {nullptr};             // status/data port read + capture
+  size_t                   _capturePort {kPS2NoPort};       // protected by _portLock
+  RingBuffer<UInt8, kResponseBufferSize> _captureBuffer;   // protected by _portLock
+
+  PS2RequestSlab           _requestPool[kRequestPoolClasses] {};
+  UInt32                   _requestPoolOversize {0};        // heap requests larger than any class
+
+#if RESUME_TIMELINE
+  PS2TimelineEntry         _timeline[kTimelineEntries] {};
+  unsigned                 _timelineCount {0};
+  bool                     _timelineActive {false};
+  uint64_t                 _timelineStart {0};
+#endif
 
   bool                     _interruptInstalledKeyboard {false};
   int                      _interruptInstalledMouse {0};
@@ -251,11 +579,19 @@ private:
   int                      _ignoreOutOfOrder {0};
     
   ApplePS2Device *         _devices [kPS2MuxMaxIdx] {nullptr};
+  IOLock*                  _identifyLock {nullptr};         // one identification pass at a time
+  UInt32                   _identified {0};                 // ports with reports, bit per port
+  PS2Identification        _identification[kPS2MuxMaxIdx] {};
 
   IONotifier*              _publishNotify {nullptr};
   IONotifier*              _terminateNotify {nullptr};
     
-  OSSet*                   _notificationServices {nullptr};
+  PS2MessageSubscriber     _subscribers[kMaxMessageSubscribers] {};
+  UInt32                   _subscriberCount {0};    // slots in use, some may be empty
+  UInt32                   _messageReaders {0};     // deliveries in flight
+  UInt64                   _messagesDelivered {0};
+  UInt64                   _messagesFiltered {0};
+  PS2KeystrokeCell         _keystrokes;
     
 #if DEBUGGER_SUPPORT
   IOSimpleLock *           _controllerLock {nullptr};       // mach simple spin lock
@@ -269,10 +605,16 @@ private:
 #endif //DEBUGGER_SUPPORT
 
   thread_call_t            _powerChangeThreadCall {0};
+  thread_call_t            _deviceWakeThreadCall[kPS2AuxMaxIdx] {};
+  unsigned                 _deviceWakePending {0};
+  bool                     _overlapDeviceWake {true};
+  bool                     _dedicatedWorkLoop {false};
   UInt32                   _currentPowerState {kPS2PowerStateNormal};
   bool                     _hardwareOffline {false};
   bool   				   _suppressTimeout {false};
   int                      _wakedelay {10};
+  int                      _dataDelay {kDataDelay};
+  bool                     _calibrateDataDelay {false};
   bool                     _mouseWakeFirst {false};
   bool                     _muxPresent {false};
   size_t                   _nubsCount {0};
@@ -281,6 +623,10 @@ private:
   IOTimerEventSource*      _watchdogTimer {nullptr};
 #endif
   OSDictionary*            _rmcfCache {nullptr};
+  OSDictionary*            _configCache {nullptr};
+  OSString*                _platformManufacturer {nullptr};
+  OSString*                _platformProduct {nullptr};
+  bool                     _platformIdsKnown {false};
   const OSSymbol*          _deliverNotification {nullptr};
   const OSSymbol*          _smbusCompanion {nullptr};
 
@@ -298,6 +644,47 @@ private:
 #endif
   virtual void  processRequest(PS2Request * request);
   virtual void  processRequestQueue(IOInterruptEventSource *, int);
+  void processRequestFrom(PS2Request* request, unsigned index, bool issued);
+  void completeRequest(PS2Request* request, unsigned index, bool failed);
+  size_t responsePort(PS2Request* request, unsigned index);
+  bool expectsMoreData(PS2Request* request, unsigned index);
+  void issueCommand(PS2Request* request, unsigned index);
+  bool completeCommand(PS2Request* request, unsigned index, UInt8 byte);
+  bool acceptResponseByte(PS2Request* request, unsigned index, UInt8 byte, UInt8* result);
+  UInt8 readResponse(PS2Request* request, unsigned index);
+  bool reorderResponseByte(size_t port, UInt8 byte, UInt8 expectedByte, UInt8* result);
+  bool releaseHeldBytes(size_t port, UInt8* result);
+  void replayHeldBytes(size_t port, unsigned from);
+
+  void spliceRequestQueue();
+  void coalesceRequest(PS2Request* request);
+  bool canProcessAsync(PS2Request* request);
+  bool isExclusiveRequest(PS2Request* request);
+  bool isEngineIdle();
+  void admitPendingRequests();
+  size_t nextReadyPort();
+  void runRequestEngine();
+  void advanceActiveRequest(size_t port);
+  void finishActiveRequest(size_t port);
+  void armRequestTimer();
+  bool collectResponse(size_t port, UInt8* result);
+  void quiesceRequestEngine();
+  bool isRequestPending(PS2Request* request);
+  void onRequestTimer();
+  void onLostInterruptTimer();
+  void checkLostInterrupts(bool deadlineExpired);
+  void publishLostInterruptStatistics();
+  bool initRequestPool();
+  void freeRequestPool();
+  PS2Request* allocatePooledRequest(int max);
+  bool freePooledRequest(PS2Request* request);
+  void publishRequestStatistics();
+  void timelineBegin();
+  void timelineRecord(UInt8 kind, size_t port, UInt8 data, UInt8 extra = 0);
+  void timelineEnd();
+  void setCapturePort(size_t port);
+  bool captureResponseByte(size_t port, UInt8 data);
+  bool popCapturedByte(size_t port, UInt8* data);
 
 #if OUT_OF_ORDER_DATA_CORRECTION_FEATURE
   virtual UInt8 readDataPort(size_t port, UInt8 expectedByte);
@@ -306,7 +693,13 @@ private:
   virtual UInt8 readDataPort(size_t port);
   virtual void  writeCommandPort(UInt8 byte);
   virtual void  writeDataPort(UInt8 byte);
+  UInt8 readCommandByte(void);
+  void  writeCommandByte(UInt8 commandByte);
+  inline void invalidateCommandByte() { _commandByteKnown = false; }
   void resetController(void);
+  bool readCalibrationReply(size_t port, UInt8 command, UInt8* reply, unsigned count);
+  void calibrateDataDelay(void);
+  inline void settleDelay() { if (_dataDelay) IODelay(_dataDelay); }
   bool setMuxMode(bool);
   void flushDataPort(void);
   void resetDevices(void);
@@ -317,10 +710,14 @@ private:
   void notificationHandlerPublishGated(IOService * newService, IONotifier * notifier);
   bool notificationHandlerPublish(void * refCon, IOService * newService, IONotifier * notifier);
     
-  void notificationHandlerTerminateGated(IOService * newService, IONotifier * notifier);
+  void notificationHandlerTerminateGated(IOService * newService, bool * removed);
   bool notificationHandlerTerminate(void * refCon, IOService * newService, IONotifier * notifier);
 
+  static UInt32 messageBit(UInt32 message);
+  void deliverMessage(int message, void* data);
+  void fanOutMessage(int message, void* data);
   void dispatchMessageGated(int* message, void* data);
+  void publishMessageStatistics();
     
   static void setPowerStateCallout(thread_call_param_t param0,
                                    thread_call_param_t param1);
@@ -332,11 +729,55 @@ private:
   virtual void setPowerStateGated(UInt32 newPowerState);
 
   virtual void dispatchDriverPowerControl(UInt32 whatToDo, size_t port);
+  static void deviceWakeCallout(thread_call_param_t param0,
+                                thread_call_param_t param1);
+  void deviceWakeDoneGated();
+  void wakeDevices();
   void free(void) override;
   IOReturn setPropertiesGated(OSObject* props);
   void submitRequestAndBlockGated(PS2Request* request);
+  void runIdentification(size_t port, PS2Identification* ids);
+  template <class... Steps>
+  bool identifyReport(size_t port, PS2Identification* ids, PS2IdentifyReport id, const Steps&... steps);
   
-  size_t getPortFromStatus(UInt8 status);
+  void buildStatusPortTable();
+  size_t getPortFromStatus(UInt8 status) { return _statusPort[status]; }
+
+  inline void countEvent(size_t port, PS2CounterKind kind)
+  {
+    if (port < _nubsCount)
+      _devices[port]->countEvent(kind);
+  }
+
+  inline void countStatusErrors(size_t port, UInt8 status)
+  {
+    // in mux mode the error bits of aux data carry the aux port instead
+    if (__builtin_expect(status & (kTimeoutError | kParityError), 0) && !(_muxPresent && (status & kMouseData)))
+    {
+      if (status & kParityError)
+        countEvent(port, kPS2CT_ParityErrors);
+      if (status & kTimeoutError)
+        countEvent(port, kPS2CT_TimeoutErrors);
+    }
+  }
+
+  inline void traceByte(UInt8 kind, size_t port, UInt8 data, UInt8 status = 0)
+  {
+#if BYTE_TRACE
+    // Lock-free: writers claim an entry, the reader checks its sequence.
+    if (!_trace)
+      return;
+    UInt32 index = __atomic_fetch_add(&_trace->head, 1, __ATOMIC_RELAXED);
+    PS2TraceEntry& entry = _trace->entry[index & (kTraceEntries - 1)];
+    __atomic_store_n(&entry.sequence, 0, __ATOMIC_RELAXED);
+    entry.time   = mach_absolute_time();
+    entry.kind   = kind;
+    entry.port   = (UInt8)port;
+    entry.data   = data;
+    entry.status = status;
+    __atomic_store_n(&entry.sequence, index + 1, __ATOMIC_RELEASE);
+#endif
+  }
 
 public:
   bool init(OSDictionary * properties) override;
@@ -345,10 +786,13 @@ public:
   void stop(IOService * provider) override;
 
   IOWorkLoop * getWorkLoop() const override;
+  // aux drivers get a workloop of their own, see ApplePS2Device::getWorkLoop
+  bool wantsDedicatedWorkLoop(size_t port) const { return _dedicatedWorkLoop && port >= kPS2AuxIdx; }
 
   void enableMuxPorts();
   virtual void installInterruptAction(size_t port);
   virtual void uninstallInterruptAction(size_t port);
+  void setInterruptTarget(size_t port, void * client, PS2InterruptAction action);
 
   virtual PS2Request*  allocateRequest(int max = kMaxCommands);
   virtual void         freeRequest(PS2Request * request);
@@ -356,24 +800,56 @@ public:
   virtual void         submitRequestAndBlock(PS2Request * request);
   virtual UInt8        setCommandByte(UInt8 setBits, UInt8 clearBits);
   void setCommandByteGated(PS2Request* request);
+  virtual bool         getIdentification(size_t port, PS2Identification* ids);
 
   IOReturn setPowerState(unsigned long powerStateOrdinal,
                                  IOService *   policyMaker) override;
     
   virtual void dispatchMessage(int message, void* data);
+  PS2KeystrokeCell* getKeystrokeCell() { return &_keystrokes; }
     
   IOReturn setProperties(OSObject* props) override;
+  bool serializeProperties(OSSerialize* s) const override;
   virtual void lock();
   virtual void unlock();
     
   static OSDictionary* getConfigurationNode(IORegistryEntry* entry, OSDictionary* list);
+  // result is retained and shared with other callers, treat it as read-only
   virtual OSDictionary* makeConfigurationNode(OSDictionary* list, const char* section);
+  void flushConfigurationCache();
 
   OSDictionary* getConfigurationOverride(IOACPIPlatformDevice* acpi, const char* method);
   OSObject* translateArray(OSArray* array);
   OSObject* translateEntry(OSObject* obj);
   
   IOReturn startSMBusCompanion(OSDictionary *companionData, UInt8 smbusAddr);
+
+#if BYTE_TRACE
+  IOReturn newUserClient(task_t owningTask, void * securityID,
+                         UInt32 type, IOUserClient ** handler) override;
+  IOBufferMemoryDescriptor* getTraceMemory() const { return _traceMemory; }
+#endif
 };
 
+#if BYTE_TRACE
+
+// =============================================================================
+// ApplePS2TraceClient Class Declaration
+//
+// Maps the byte trace (memory type 0) read-only into the client task.
+//
+
+class EXPORT ApplePS2TraceClient : public IOUserClient
+{
+  typedef IOUserClient super;
+  OSDeclareDefaultStructors(ApplePS2TraceClient);
+
+public:
+  IOReturn clientClose() override;
+  IOReturn clientMemoryForType(UInt32 type, IOOptionBits * options,
+                               IOMemoryDescriptor ** memory) override;
+};
+
+#endif // BYTE_TRACE
+
 #endif /* _APPLEPS2CONTROLLER_H */
@@ -345,6 +345,8 @@ bool ApplePS2Keyboard::start(IOService * provider)
     setProperty(kDeliverNotifications, kOSBooleanTrue);
 
     setProperty(kDeliverNotifications, kOSBooleanTrue);
+    static const UInt32 messages[] = { kPS2K_setKeyboardStatus, kPS2K_getKeyboardStatus, kPS2K_notifyKeystroke };
+    ApplePS2Device::subscribeMessages(this, messages, sizeof(messages) / sizeof(messages[0]));
     //
     // The driver has been instructed to start.   This is called after a
     // successful attach.
@@ -472,10 +474,9 @@ bool ApplePS2Keyboard::start(IOService * provider)
     // Install our driver's interrupt handler, for asynchronous data delivery.
     //
 
-    _device->installInterruptAction(this,
-        OSMemberFunctionCast(PS2InterruptAction, this, &ApplePS2Keyboard::interruptOccurred),
-        OSMemberFunctionCast(PS2PacketAction,this,&ApplePS2Keyboard::packetReady));
+    _device->installInterruptAction<ApplePS2Keyboard, &ApplePS2Keyboard::interruptOccurred, &ApplePS2Keyboard::packetReady>(this);
     _interruptHandlerInstalled = true;
+    _device->watchRingBuffer(_ringBuffer);
 
     // now safe to allow other threads
     _device->unlock();
@@ -1794,6 +1795,7 @@ bool ApplePS2Keyboard::dispatchKeyboardEventWithPacket(const UInt8* packet)
     info.goingDown = goingDown;
     info.eatKey = eatKey;
 
+    _device->getKeystrokeCell()->publish(info);
     _device->dispatchMessage(kPS2M_notifyKeyPressed, &info);
 
     //REVIEW: work around for caps lock bug on Sierra 10.12...
@@ -1904,6 +1906,8 @@ void ApplePS2Keyboard::setLEDs(UInt8 ledState)
     request->commands[3].command = kPS2C_ReadDataPortAndCompare;
     request->commands[3].inOrOut = kSC_Acknowledge;
     request->commandsCount = 4;
+    // a newer LED state supersedes any still queued
+    request->coalesceKind = kPS2CK_SetLEDs;
     _device->submitRequest(request);
 }
 
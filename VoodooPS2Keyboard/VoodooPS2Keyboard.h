@@ -173,8 +173,8 @@ public:
     bool start(IOService * provider) override;
     void stop(IOService * provider) override;
 
-    virtual PS2InterruptResult interruptOccurred(UInt8 scanCode);
-    virtual void packetReady();
+    PS2InterruptResult interruptOccurred(UInt8 scanCode);
+    void packetReady();
     
     UInt32 deviceType() override;
     UInt32 interfaceID() override;
@@ -228,24 +228,12 @@ ApplePS2Mouse* ApplePS2Mouse::probe(IOService * provider, SInt32 * score)
   // Check to see if acknowledges are being received for commands to the mouse.
   //
 
-  // (get information command)
-  TPS2Request<5> request;
-  request.commands[0].command = kPS2C_WriteDataPort;
-  request.commands[0].inOrOut = kDP_GetMouseInformation;
-  request.commands[1].command = kPS2C_ReadDataPortAndCompare;
-  request.commands[1].inOrOut = kSC_Acknowledge;
-  request.commands[2].command = kPS2C_ReadDataPort;
-  request.commands[2].inOrOut = 0;
-  request.commands[3].command = kPS2C_ReadDataPort;
-  request.commands[3].inOrOut = 0;
-  request.commands[4].command = kPS2C_ReadDataPort;
-  request.commands[4].inOrOut = 0;
-  request.commandsCount = 5;
-  assert(request.commandsCount <= countof(request.commands));
-  device->submitRequestAndBlock(&request);
+  // (get information command, sent by the controller on the first probe of the port)
+  PS2Identification ids;
+  bool success = device->getIdentification(&ids) && ids.has(kPS2ID_Status);
 
   DEBUG_LOG("ApplePS2Mouse::probe leaving.\n");
-  return 5 == request.commandsCount ? this : 0;
+  return success ? this : 0;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -306,10 +294,9 @@ bool ApplePS2Mouse::start(IOService * provider)
   // Install our driver's interrupt handler, for asynchronous data delivery.
   //
 
-  _device->installInterruptAction(this,
-    OSMemberFunctionCast(PS2InterruptAction, this, &ApplePS2Mouse::interruptOccurred),
-    OSMemberFunctionCast(PS2PacketAction, this, &ApplePS2Mouse::packetReady));
+  _device->installInterruptAction<ApplePS2Mouse, &ApplePS2Mouse::interruptOccurred, &ApplePS2Mouse::packetReady>(this);
   _interruptHandlerInstalled = true;
+  _device->watchRingBuffer(_ringBuffer);
 
   // now safe to allow other threads
   _device->unlock();
@@ -327,6 +314,7 @@ bool ApplePS2Mouse::start(IOService * provider)
   //
   
   setProperty(kDeliverNotifications, true);
+  ApplePS2Device::subscribeMessages(this, NULL, 0);    // no message() handler
 
   return true;
 }
@@ -554,6 +542,7 @@ PS2InterruptResult ApplePS2Mouse::interruptOccurred(UInt8 data)      // PS2Inter
     if (_packetByteCount == 0 && ((data == kSC_Acknowledge) || !(data & 0x08)))
     {
         IOLog("%s: Unexpected byte0 data (%02x) from PS/2 controller\n", getName(), data);
+        _device->countEvent(kPS2CT_Resyncs);
         
         //
         // Reset the mouse when packet synchronization is lost. Limit the number
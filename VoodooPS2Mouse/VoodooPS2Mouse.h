@@ -129,8 +129,8 @@ public:
   bool start(IOService * provider) override;
   void stop(IOService * provider) override;
 
-  virtual PS2InterruptResult interruptOccurred(UInt8 data);
-  virtual void packetReady();
+  PS2InterruptResult interruptOccurred(UInt8 data);
+  void packetReady();
 
   UInt32 deviceType() override;
   UInt32 interfaceID() override;
@@ -267,17 +267,15 @@ ApplePS2ALPSGlidePoint *ApplePS2ALPSGlidePoint::probe(IOService *provider, SInt3
         OSSafeReleaseNULL(config);
     }
 
-    _device->lock();
-    resetMouse();
-
+    // the controller sent the E6/E7/EC reports on the first probe of the port
+    PS2Identification ids;
     bool success;
-    if (identify() != 0) {
+    if (!_device->getIdentification(&ids) || identify(ids) != 0) {
         success = false;
     } else {
         success = true;
         IOLog("%s: TouchPad driver started...\n", getName());
     }
-    _device->unlock();
 
     _device = 0;
 
@@ -345,6 +343,7 @@ bool ApplePS2ALPSGlidePoint::start( IOService * provider ) {
 
     _device = (ApplePS2MouseDevice *) provider;
     _device->retain();
+    _keystrokes = _device->getKeystrokeCell();
 
     //
     // Setup workloop with command gate for thread synchronization...
@@ -382,10 +381,9 @@ bool ApplePS2ALPSGlidePoint::start( IOService * provider ) {
     // Install our driver's interrupt handler, for asynchronous data delivery.
     //
 
-    _device->installInterruptAction(this,
-                                    OSMemberFunctionCast(PS2InterruptAction, this, &ApplePS2ALPSGlidePoint::interruptOccurred),
-                                    OSMemberFunctionCast(PS2PacketAction, this, &ApplePS2ALPSGlidePoint::packetReady));
+    _device->installInterruptAction<ApplePS2ALPSGlidePoint, &ApplePS2ALPSGlidePoint::interruptOccurred, &ApplePS2ALPSGlidePoint::packetReady>(this);
     _interruptHandlerInstalled = true;
+    _device->watchRingBuffer(_ringBuffer);
 
     // now safe to allow other threads
     _device->unlock();
@@ -403,6 +401,8 @@ bool ApplePS2ALPSGlidePoint::start( IOService * provider ) {
     //
 
     //setProperty(kDeliverNotifications, true);
+    static const UInt32 messages[] = { kPS2M_getDisableTouchpad, kPS2M_setDisableTouchpad, kPS2M_resetTouchpad };
+    ApplePS2Device::subscribeMessages(this, messages, sizeof(messages) / sizeof(messages[0]));
 
     registerService();
 
@@ -572,6 +572,7 @@ void ApplePS2ALPSGlidePoint::packetReady() {
                 (this->*process_packet)(packet);
         } else {
             IOLog("%s: an invalid or bare packet has been dropped...\n", getName());
+            _device->countEvent(kPS2CT_InvalidPackets);
             /* Might need to perform a full HW reset here if we keep receiving bad packets (consecutively) */
         }
         _packetByteCount = 0;
@@ -1744,19 +1745,16 @@ bool ApplePS2ALPSGlidePoint::alps_command_mode_send_nibble(int nibble) {
     SInt32 command;
     // The largest amount of requests we will have is 2 right now
     // 1 for the initial command, and 1 for sending data OR 1 for receiving data
-    // If the nibble commands at the top change then this will need to change as
-    // well. For now we will just validate that the request will not overload
-    // this object.
-    TPS2Request<2> request;
-    int cmdCount = 0, send = 0, receive = 0, i;
+    // (see PS2EncodedCommand). If the nibble commands at the top change then
+    // this will need to change as well. For now we will just validate that the
+    // request will not overload this object.
+    int send = 0, receive = 0;
 
     if (nibble > 0xf) {
         IOLog("%s::alps_command_mode_send_nibble ERROR: nibble value is greater than 0xf, command may fail\n", getName());
     }
 
-    request.commands[cmdCount].command = kPS2C_SendCommandAndCompareAck;
     command = priv.nibble_commands[nibble].command;
-    request.commands[cmdCount++].inOrOut = command & 0xff;
 
     send = (command >> 12 & 0xf);
     receive = (command >> 8 & 0xf);
@@ -1765,22 +1763,10 @@ bool ApplePS2ALPSGlidePoint::alps_command_mode_send_nibble(int nibble) {
         return false;
     }
 
-    if (send > 0) {
-        request.commands[cmdCount].command = kPS2C_SendCommandAndCompareAck;
-        request.commands[cmdCount++].inOrOut = priv.nibble_commands[nibble].data;
-    }
-
-    for (i = 0; i < receive; i++) {
-        request.commands[cmdCount].command = kPS2C_ReadDataPort;
-        request.commands[cmdCount++].inOrOut = 0;
-    }
-
-    request.commandsCount = cmdCount;
-    assert(request.commandsCount <= countof(request.commands));
-
+    TPS2Script<PS2EncodedCommand> request(PS2EncodedCommand(command, priv.nibble_commands[nibble].data));
     _device->submitRequestAndBlock(&request);
 
-    return request.commandsCount == cmdCount;
+    return request.succeeded();
 }
 
 bool ApplePS2ALPSGlidePoint::alps_command_mode_set_addr(int addr) {
@@ -2998,9 +2984,6 @@ IOReturn ApplePS2ALPSGlidePoint::identify() {
 
     /*
      * First try "E6 report".
-     * ALPS should return 0,0,10 or 0,0,100 if no buttons are pressed.
-     * The bits 0-2 of the first byte will be 1s if some buttons are
-     * pressed.
      */
 
     if (!alps_rpt_cmd(kDP_SetMouseResolution, NULL, kDP_SetMouseScaling1To1, &e6)) {
@@ -3008,11 +2991,6 @@ IOReturn ApplePS2ALPSGlidePoint::identify() {
         //return kIOReturnIOError;
     }
 
-    if ((e6.bytes[0] & 0xf8) != 0 || e6.bytes[1] != 0 || (e6.bytes[2] != 10 && e6.bytes[2] != 100)) {
-        IOLog("%s: identify: not an ALPS device. Invalid E6 report\n", getName());
-        //return kIOReturnInvalid;
-    }
-
     /*
      * Now get the "E7" and "EC" reports.  These will uniquely identify
      * most ALPS touchpads.
@@ -3024,6 +3002,37 @@ IOReturn ApplePS2ALPSGlidePoint::identify() {
         return kIOReturnIOError;
     }
 
+    return identify(e6, e7, ec);
+}
+
+IOReturn ApplePS2ALPSGlidePoint::identify(const PS2Identification &ids) {
+    ALPSStatus_t e6 {}, e7, ec;
+
+    if (!ids.has(kPS2ID_E6Report)) {
+        IOLog("%s: identify: not an ALPS device. Error getting E6 report\n", getName());
+    }
+    if (!ids.has(kPS2ID_E7Report) || !ids.has(kPS2ID_ECReport)) {
+        IOLog("%s: identify: not an ALPS device. Error getting E7/EC report\n", getName());
+        return kIOReturnIOError;
+    }
+
+    memcpy(e6.bytes, ids.report[kPS2ID_E6Report], sizeof(e6.bytes));
+    memcpy(e7.bytes, ids.report[kPS2ID_E7Report], sizeof(e7.bytes));
+    memcpy(ec.bytes, ids.report[kPS2ID_ECReport], sizeof(ec.bytes));
+    return identify(e6, e7, ec);
+}
+
+IOReturn ApplePS2ALPSGlidePoint::identify(ALPSStatus_t &e6, ALPSStatus_t &e7, ALPSStatus_t &ec) {
+    /*
+     * ALPS should return 0,0,10 or 0,0,100 to "E6 report" if no buttons
+     * are pressed.  The bits 0-2 of the first byte will be 1s if some
+     * buttons are pressed.
+     */
+    if ((e6.bytes[0] & 0xf8) != 0 || e6.bytes[1] != 0 || (e6.bytes[2] != 10 && e6.bytes[2] != 100)) {
+        IOLog("%s: identify: not an ALPS device. Invalid E6 report\n", getName());
+        //return kIOReturnInvalid;
+    }
+
     if (matchTable(&e7, &ec)) {
         return 0;
 
@@ -3304,6 +3313,8 @@ void ApplePS2ALPSGlidePoint::sendTouchData() {
     absolutetime_to_nanoseconds(timestamp, &timestamp_ns);
 
     // Ignore input for specified time after keyboard/trackpoint usage
+    PS2KeystrokeState keys = _keystrokes->read();
+    uint64_t keytime = keys.time > keys.modifierTime ? keys.time : keys.modifierTime;
     if (timestamp_ns - keytime < maxaftertyping)
         return;
 
@@ -3433,9 +3444,6 @@ void ApplePS2ALPSGlidePoint::initTouchPad() {
     _packetByteCount = 0;
     _ringBuffer.reset();
 
-    // clear state of control key cache
-    _modifierdown = 0;
-
     // initialize the touchpad
     deviceSpecificInit();
 }
@@ -3583,9 +3591,8 @@ IOReturn ApplePS2ALPSGlidePoint::message(UInt32 type, IOService* provider, void*
     // This allows for the keyboard driver to enable/disable the trackpad
     // when a certain keycode is pressed.
     //
-    // It also allows the trackpad driver to learn the last time a key
-    // has been pressed, so it can implement various "ignore trackpad
-    // input while typing" options.
+    // The last key press is read from the keystroke cell instead, see
+    // sendTouchData.
     //
 
     switch (type)
@@ -3624,54 +3631,6 @@ IOReturn ApplePS2ALPSGlidePoint::message(UInt32 type, IOService* provider, void*
             }
             break;
         }
-
-        case kPS2M_notifyKeyPressed:
-        {
-            // just remember last time key pressed... this can be used in
-            // interrupt handler to detect unintended input while typing
-            PS2KeyInfo* pInfo = (PS2KeyInfo*)argument;
-            static const int masks[] =
-            {
-                0x10,       // 0x36
-                0x100000,   // 0x37
-                0,          // 0x38
-                0,          // 0x39
-                0x080000,   // 0x3a
-                0x040000,   // 0x3b
-                0,          // 0x3c
-                0x08,       // 0x3d
-                0x04,       // 0x3e
-                0x200000,   // 0x3f
-            };
-
-            switch (pInfo->adbKeyCode)
-            {
-                // don't store key time for modifier keys going down
-                // track modifiers for scrollzoom feature...
-                // (note: it turns out we didn't need to do this, but leaving this code in for now in case it is useful)
-                case 0x38:  // left shift
-                case 0x3c:  // right shift
-                case 0x3b:  // left control
-                case 0x3e:  // right control
-                case 0x3a:  // left windows (option)
-                case 0x3d:  // right windows
-                case 0x37:  // left alt (command)
-                case 0x36:  // right alt
-                case 0x3f:  // osx fn (function)
-                    if (pInfo->goingDown)
-                    {
-                        _modifierdown |= masks[pInfo->adbKeyCode-0x36];
-                        break;
-                    }
-                    _modifierdown &= ~masks[pInfo->adbKeyCode-0x36];
-                    keytime = pInfo->time;
-                    break;
-
-                default:
-                    keytime = pInfo->time;
-            }
-            break;
-        }
     }
 
     return kIOReturnSuccess;
@@ -363,9 +363,10 @@ class EXPORT ApplePS2ALPSGlidePoint : public IOService {
 private:
     IOService *voodooInputInstance {nullptr};
     ApplePS2MouseDevice * _device {nullptr};
+    PS2KeystrokeCell *  _keystrokes {nullptr};
     bool                _interruptHandlerInstalled {false};
     bool                _powerControlHandlerInstalled {false};
-    RingBuffer<UInt8, kPacketLength*32> _ringBuffer {};
+    RingBuffer<UInt8, 256> _ringBuffer {};    // 42 packets of 6 bytes (32 of 8 on ALPS v4)
     UInt32              _packetByteCount {0};
 
     IOCommandGate*      _cmdGate {nullptr};
@@ -407,7 +408,6 @@ private:
     // normal state
     UInt32 lastbuttons {0};
     UInt32 lastTrackStickButtons, lastTouchpadButtons;
-    uint64_t keytime {0};
     bool ignoreall {false};
     int z_finger {45};
     uint64_t maxaftertyping {100000000};
@@ -426,8 +426,6 @@ private:
     IONotifier* bluetooth_hid_publish_notify {nullptr}; // Notification when a bluetooth HID device is connected
     IONotifier* bluetooth_hid_terminate_notify {nullptr}; // Notification when a bluetooth HID device is disconnected
 
-    int _modifierdown {0}; // state of left+right control keys
-
     // for scaling x/y values
     int xupmm {50}, yupmm {50}; // 50 is just arbitrary, but same
 
@@ -506,6 +504,8 @@ private:
     void set_protocol();
     bool matchTable(ALPSStatus_t *e7, ALPSStatus_t *ec);
     IOReturn identify();
+    IOReturn identify(const PS2Identification &ids);
+    IOReturn identify(ALPSStatus_t &e6, ALPSStatus_t &e7, ALPSStatus_t &ec);
     void setTouchPadEnable(bool enable);
     void ps2_command(unsigned char value, UInt8 command);
     void ps2_command_short(UInt8 command);
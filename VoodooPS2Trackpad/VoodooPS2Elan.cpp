@@ -17,7 +17,7 @@
 #endif
 
 // ETD0108 firmware version macro for cleaner code
-#define IS_ETD0108() (info.fw_version == 0x381f17)
+#define IS_ETD0108() (info.fw_version == ETP_FW_VERSION_ETD0108)
 
 #include <IOKit/IOService.h>
 #include <IOKit/IOLib.h>
@@ -33,15 +33,6 @@
 #include "VoodooInputMultitouch/VoodooInputTransducer.h"
 #include "VoodooInputMultitouch/VoodooInputMessages.h"
 
-// =============================================================================
-// Minimal drag continuity support
-//
-
-// Saved finger positions for drag continuity
-static bool __finger_saved[ETP_MAX_FINGERS] = {false, false, false, false, false};
-static unsigned int __saved_x[ETP_MAX_FINGERS] = {0, 0, 0, 0, 0};
-static unsigned int __saved_y[ETP_MAX_FINGERS] = {0, 0, 0, 0, 0};
-
 // =============================================================================
 // ApplePS2Elan Class Implementation
 //
@@ -138,11 +129,8 @@ ApplePS2Elan *ApplePS2Elan::probe(IOService *provider, SInt32 *score) {
         OSSafeReleaseNULL(config);
     }
 
-    resetMouse();
-
     DEBUG_LOG("VoodooPS2Elan: Detecting Elantech device\n");
-    DEBUG_LOG("VoodooPS2Elan: send magic knock to the device.\n");
-    // send magic knock to the device
+    // the controller sent the magic knock on the first probe of the port
     if (elantechDetect()) {
         DEBUG_LOG("VoodooPS2Elan: elantechDetect() failed - not an Elantech device\n");
         DEBUG_LOG("VoodooPS2Elan: elan touchpad not detected\n");
@@ -159,6 +147,7 @@ ApplePS2Elan *ApplePS2Elan::probe(IOService *provider, SInt32 *score) {
         return NULL;
     }
     DEBUG_LOG("VoodooPS2Elan: elantechQueryInfo() SUCCESS, fw=0x%06x\n", info.fw_version);
+    _decoder.selectClassifier();
 
     DEBUG_LOG("VoodooPS2Elan: capabilities: %x %x %x\n", info.capabilities[0], info.capabilities[1], info.capabilities[2]);
     DEBUG_LOG("VoodooPS2Elan: hw_version: %x\n", info.hw_version);
@@ -226,6 +215,11 @@ bool ApplePS2Elan::start(IOService *provider) {
     // Maintain a pointer to and retain the provider object.
     _device = (ApplePS2MouseDevice *)provider;
     _device->retain();
+    _keystrokes = _device->getKeystrokeCell();
+
+    // Only the messages handled in message() are delivered (before the setup registers us)
+    static const UInt32 messages[] = { kPS2M_getDisableTouchpad, kPS2M_setDisableTouchpad, kPS2M_resetTouchpad };
+    ApplePS2Device::subscribeMessages(this, messages, sizeof(messages) / sizeof(messages[0]));
 
     // Announce hardware properties.
     char buf[128];
@@ -286,10 +280,9 @@ bool ApplePS2Elan::start(IOService *provider) {
     elantechSetupPS2();
 
     // Install our driver's interrupt handler, for asynchronous data delivery.
-    _device->installInterruptAction(this,
-                                    OSMemberFunctionCast(PS2InterruptAction, this, &ApplePS2Elan::interruptOccurred),
-                                    OSMemberFunctionCast(PS2PacketAction, this, &ApplePS2Elan::packetReady));
+    _device->installInterruptAction<ApplePS2Elan, &ApplePS2Elan::interruptOccurred, &ApplePS2Elan::packetReady>(this);
     _interruptHandlerInstalled = true;
+    _device->watchRingBuffer(_ringBuffer);
 
     // Enable the touchpad
     setTouchPadEnable(true);
@@ -384,6 +377,7 @@ void ApplePS2Elan::setParamPropertiesGated(OSDictionary *config) {
         {"ProcessUSBMouseStopsTrackpad",       &_processusbmouse},
         {"ProcessBluetoothMouseStopsTrackpad", &_processbluetoothmouse},
         {"SetHwResolution",                    &_set_hw_resolution},
+        {"WarmResume",                         &_warmResume},
     };
 
     const struct {const char *name; bool *var;} lowbitvars[] = {
@@ -468,9 +462,8 @@ IOReturn ApplePS2Elan::message(UInt32 type, IOService* provider, void* argument)
     // This allows for the keyboard driver to enable/disable the trackpad
     // when a certain keycode is pressed.
     //
-    // It also allows the trackpad driver to learn the last time a key
-    // has been pressed, so it can implement various "ignore trackpad
-    // input while typing" options.
+    // The last key press is read from the keystroke cell instead, see
+    // sendTouchData.
     switch (type) {
         case kPS2M_getDisableTouchpad:
         {
@@ -504,14 +497,6 @@ IOReturn ApplePS2Elan::message(UInt32 type, IOService* provider, void* argument)
             }
             break;
         }
-
-        case kPS2M_notifyKeyTime:
-        {
-            // just remember last time key pressed... this can be used in
-            // interrupt handler to detect unintended input while typing
-            keytime = *((uint64_t*)argument);
-            break;
-        }
     }
 
     return kIOReturnSuccess;
@@ -533,9 +518,14 @@ void ApplePS2Elan::setDevicePowerState(UInt32 whatToDo) {
             _packetByteCount = 0;
             _ringBuffer.reset();
 
-            // Reset and enable the touchpad
+            // Reset and enable the touchpad, replaying the last setup if
+            // the touchpad still identifies as the one we set up
             resetMouse();
-            elantechSetupPS2();
+            if (!_warmResume || elantechWarmResume()) {
+                if (_warmResume)
+                    resetMouse();
+                elantechSetupPS2();
+            }
             setTouchPadEnable(true);
             break;
     }
@@ -672,22 +662,11 @@ bool ApplePS2Elan::notificationHIDAttachedHandler(void *refCon, IOService *newSe
 
 template<int I>
 int ApplePS2Elan::ps2_command(UInt8 *params, unsigned int command) {
-    TPS2Request<1 + I> request;
-    request.commands[0].command = kPS2C_SendCommandAndCompareAck;
-    request.commands[0].inOrOut = command;
-    for (int i = 0; i < I; i++) {
-        request.commands[1 + i].command = kPS2C_ReadDataPort;
-    }
-
-    request.commandsCount = 1 + I;
-    assert(request.commandsCount <= countof(request.commands));
+    TPS2Script<PS2Send, PS2Read<I>> request(PS2Send(command), PS2Read<I>());
     _device->submitRequestAndBlock(&request);
+    request.results(params);
 
-    for (int i = 0; i < I; i++) {
-        params[i] = request.commands[i + 1].inOrOut;
-    }
-
-    return request.commandsCount != 1 + I;
+    return !request.succeeded();
 }
 
 /*
@@ -705,6 +684,7 @@ int ApplePS2Elan::elantech_ps2_command(unsigned char *param, int command) {
         }
         tries--;
         DEBUG_LOG("VoodooPS2Elan: retrying ps2 command 0x%02x (%d).\n", command, tries);
+        _device->countEvent(kPS2CT_Retries);
         IOSleep(ETP_PS2_COMMAND_DELAY);
     } while (tries > 0);
 
@@ -723,25 +703,10 @@ int ApplePS2Elan::elantech_ps2_command(unsigned char *param, int command) {
  * is the command.
  */
 int ApplePS2Elan::ps2_sliced_command(UInt8 command) {
-    int j = 0;
-
-    TPS2Request<> request;
-    request.commands[j].command = kPS2C_SendCommandAndCompareAck;
-    request.commands[j++].inOrOut = kDP_SetMouseScaling1To1;
-
-    for (int i = 6; i >= 0; i -= 2) {
-        UInt8 d = (command >> i) & 3;
-        request.commands[j].command = kPS2C_SendCommandAndCompareAck;
-        request.commands[j++].inOrOut = kDP_SetMouseResolution;
-
-        request.commands[j].command = kPS2C_SendCommandAndCompareAck;
-        request.commands[j++].inOrOut = d;
-    }
-
-    request.commandsCount = j;
+    auto request = makePS2Script(PS2Send(kDP_SetMouseScaling1To1), PS2Sliced(command));
     _device->submitRequestAndBlock(&request);
 
-    return request.commandsCount != j;
+    return !request.succeeded();
 }
 
 /*
@@ -833,20 +798,16 @@ int ApplePS2Elan::elantech_get_resolution_v4(unsigned int *x_res, unsigned int *
  * Use magic knock to detect Elantech touchpad
  */
 int ApplePS2Elan::elantechDetect() {
-    unsigned char param[3];
+    PS2Identification ids;
 
-    if (ps2_command<0>(NULL, kDP_SetDefaults) ||
-        ps2_command<0>(NULL, kDP_SetDefaultsAndDisable) ||
-        ps2_command<0>(NULL, kDP_SetMouseScaling1To1) ||
-        ps2_command<0>(NULL, kDP_SetMouseScaling1To1) ||
-        ps2_command<0>(NULL, kDP_SetMouseScaling1To1) ||
-        ps2_command<3>(param, kDP_GetMouseInformation)) {
+    if (!_device->getIdentification(&ids) || !ids.has(kPS2ID_ElanKnock)) {
         DEBUG_LOG("VoodooPS2Elan: sending Elantech magic knock failed.\n");
         return -1;
     }
 
     // Report this in case there are Elantech models that use a different
     // set of magic numbers
+    const unsigned char *param = ids.report[kPS2ID_ElanKnock];
     if (param[0] != 0x3c || param[1] != 0x03 || (param[2] != 0xc8 && param[2] != 0x00)) {
         DEBUG_LOG("VoodooPS2Elan: unexpected magic knock result 0x%02x, 0x%02x, 0x%02x.\n", param[0], param[1], param[2]);
         return -1;
@@ -855,11 +816,12 @@ int ApplePS2Elan::elantechDetect() {
     // Query touchpad's firmware version and see if it reports known
     // value to avoid mis-detection. Logitech mice are known to respond
     // to Elantech magic knock and there might be more.
-    if (synaptics_send_cmd<3>(ETP_FW_VERSION_QUERY, param)) {
+    if (!ids.has(kPS2ID_ElanVersion)) {
         DEBUG_LOG("VoodooPS2Elan: failed to query firmware version.\n");
         return -1;
     }
 
+    param = ids.report[kPS2ID_ElanVersion];
     DEBUG_LOG("VoodooPS2Elan: Elantech version query result 0x%02x, 0x%02x, 0x%02x.\n", param[0], param[1], param[2]);
 
     if (!elantech_is_signature_valid(param)) {
@@ -1167,6 +1129,7 @@ int ApplePS2Elan::elantechSetAbsoluteMode() {
             }
             tries--;
             DEBUG_LOG("VoodooPS2Elan: retrying read (%d).\n", tries);
+            _device->countEvent(kPS2CT_Retries);
             IOSleep(ETP_READ_BACK_DELAY);
         } while (tries > 0);
 
@@ -1197,6 +1160,28 @@ int ApplePS2Elan::elantechSetupPS2() {
     for (int i = 1; i < 256; i++)
         etd.parity[i] = etd.parity[i & (i - 1)] ^ 1;
 
+    // Record the register writes of the setup for elantechWarmResume, and
+    // stop recording whichever way it ends
+    _warmProfile.count = 0;
+    _warmProfile.valid = false;
+    _warmProfile.recording = true;
+
+    int rc = elantechSetupRegisters();
+
+    _warmProfile.valid = !rc && _warmProfile.recording;
+    _warmProfile.recording = false;
+
+    if (rc) {
+        return rc;
+    }
+
+    return elantechSetPS2Params();
+}
+
+/*
+ * Put the touchpad into absolute mode and read its range
+ */
+int ApplePS2Elan::elantechSetupRegisters() {
     // Special handling for firmware 0x381f17 BEFORE trying absolute mode
     // This firmware has a bug where reg_07 gets cleared
     bool needs_reg07_fix = (IS_ETD0108());
@@ -1257,6 +1242,13 @@ int ApplePS2Elan::elantechSetupPS2() {
         return -1;
     }
 
+    return 0;
+}
+
+/*
+ * Set the PS/2 rate and resolution, and enable data reporting
+ */
+int ApplePS2Elan::elantechSetPS2Params() {
     // set resolution and dpi
     TPS2Request<> request;
     request.commands[0].command = kPS2C_SendCommandAndCompareAck;
@@ -1295,6 +1287,51 @@ int ApplePS2Elan::elantechSetupPS2() {
     return 0;
 }
 
+/*
+ * Bring the touchpad back after a wake without setting it up from scratch.
+ * The firmware version and capabilities are checked against the ones found
+ * at probe, then the register writes of the last full setup are replayed.
+ * Returns non-zero if the full setup is needed.
+ */
+int ApplePS2Elan::elantechWarmResume() {
+    unsigned char param[3];
+    unsigned char val;
+
+    if (!_warmProfile.valid) {
+        return -1;
+    }
+
+    if (synaptics_send_cmd<3>(ETP_FW_VERSION_QUERY, param) ||
+        ((param[0] << 16) | (param[1] << 8) | param[2]) != info.fw_version) {
+        DEBUG_LOG("VoodooPS2Elan: firmware version changed, doing a full setup.\n");
+        return -1;
+    }
+
+    if (send_cmd<3>(ETP_CAPABILITIES_QUERY, param) ||
+        memcmp(param, info.capabilities, sizeof(param))) {
+        DEBUG_LOG("VoodooPS2Elan: capabilities changed, doing a full setup.\n");
+        return -1;
+    }
+
+    for (int i = 0; i < _warmProfile.count; i++) {
+        if (elantechWriteReg(_warmProfile.reg[i], _warmProfile.val[i])) {
+            return -1;
+        }
+    }
+
+    // Same check as elantechSetAbsoluteMode, but without retrying: a touchpad
+    // that is not ready yet gets the full setup
+    if (info.hw_version != 4) {
+        if (elantechReadReg(0x10, &val) ||
+            (info.hw_version == 1 && !(val & ETP_R10_ABSOLUTE_MODE))) {
+            return -1;
+        }
+    }
+
+    DEBUG_LOG("VoodooPS2Elan: warm resume, replayed %d registers.\n", _warmProfile.count);
+    return elantechSetPS2Params();
+}
+
 /*
  * Send an Elantech style special command to read a value from a register
  */
@@ -1416,582 +1453,43 @@ int ApplePS2Elan::elantechWriteReg(unsigned char reg, unsigned char val) {
 
     if (rc) {
         DEBUG_LOG("VoodooPS2Elan: failed to write register 0x%02x with value 0x%02x.\n", reg, val);
-    }
-
-    return rc;
-}
-
-int ApplePS2Elan::elantechDebounceCheckV2() {
-    // When we encounter packet that matches this exactly, it means the
-    // hardware is in debounce status. Just ignore the whole packet.
-    static const uint8_t debounce_packet[] = {
-        0x84, 0xff, 0xff, 0x02, 0xff, 0xff
-    };
-
-    unsigned char *packet = _ringBuffer.tail();
-
-    return !memcmp(packet, debounce_packet, sizeof(debounce_packet));
-}
-
-int ApplePS2Elan::elantechPacketCheckV1() {
-    unsigned char *packet = _ringBuffer.tail();
-    unsigned char p1, p2, p3;
-
-    // Parity bits are placed differently
-    if (info.fw_version < 0x020000) {
-        // byte 0:  D   U  p1  p2   1  p3   R   L
-        p1 = (packet[0] & 0x20) >> 5;
-        p2 = (packet[0] & 0x10) >> 4;
-    } else {
-        // byte 0: n1  n0  p2  p1   1  p3   R   L
-        p1 = (packet[0] & 0x10) >> 4;
-        p2 = (packet[0] & 0x20) >> 5;
-    }
-
-    p3 = (packet[0] & 0x04) >> 2;
-
-    return etd.parity[packet[1]] == p1 &&
-           etd.parity[packet[2]] == p2 &&
-           etd.parity[packet[3]] == p3;
-}
-
-int ApplePS2Elan::elantechPacketCheckV2() {
-    unsigned char *packet = _ringBuffer.tail();
-
-    // V2 hardware has two flavors. Older ones that do not report pressure,
-    // and newer ones that reports pressure and width. With newer ones, all
-    // packets (1, 2, 3 finger touch) have the same constant bits. With
-    // older ones, 1/3 finger touch packets and 2 finger touch packets
-    // have different constant bits.
-    // With all three cases, if the constant bits are not exactly what I
-    // expected, I consider them invalid.
-
-    if (info.reports_pressure) {
-        return (packet[0] & 0x0c) == 0x04 && (packet[3] & 0x0f) == 0x02;
-    }
-
-    if ((packet[0] & 0xc0) == 0x80) {
-        return (packet[0] & 0x0c) == 0x0c && (packet[3] & 0x0e) == 0x08;
-    }
-
-    return (packet[0] & 0x3c) == 0x3c &&
-           (packet[1] & 0xf0) == 0x00 &&
-           (packet[3] & 0x3e) == 0x38 &&
-           (packet[4] & 0xf0) == 0x00;
-}
-
-int ApplePS2Elan::elantechPacketCheckV3() {
-    static const uint8_t debounce_packet[] = {
-        0xc4, 0xff, 0xff, 0x02, 0xff, 0xff
-    };
-
-    unsigned char *packet = _ringBuffer.tail();
-
-    // check debounce first, it has the same signature in byte 0
-    // and byte 3 as PACKET_V3_HEAD.
-    if (!memcmp(packet, debounce_packet, sizeof(debounce_packet))) {
-        return PACKET_DEBOUNCE;
-    }
-
-    // If the hardware flag 'crc_enabled' is set the packets have different signatures.
-    if (info.crc_enabled) {
-        if ((packet[3] & 0x09) == 0x08) {
-            return PACKET_V3_HEAD;
-        }
-
-        if ((packet[3] & 0x09) == 0x09) {
-            return PACKET_V3_TAIL;
-        }
-    } else {
-        if ((packet[0] & 0x0c) == 0x04 && (packet[3] & 0xcf) == 0x02) {
-            return PACKET_V3_HEAD;
-        }
-
-        if ((packet[0] & 0x0c) == 0x0c && (packet[3] & 0xce) == 0x0c) {
-            return PACKET_V3_TAIL;
-        }
-
-        if ((packet[3] & 0x0f) == 0x06) {
-            return PACKET_TRACKPOINT;
-        }
-    }
-
-    return PACKET_UNKNOWN;
-}
-
-void ApplePS2Elan::elantechRescale(unsigned int &x, unsigned int &y) {
-    bool needs_update = false;
-
-    if (x > info.x_max) {
-        info.x_max = x;
-        needs_update = true;
-    }
-    if (x < info.x_min) {
-        info.x_min = x;
-        needs_update = true;
-    }
-
-    if (y > info.y_max) {
-        info.y_max = y;
-        needs_update = true;
-    }
-    if (y < info.y_min) {
-        info.y_min = y;
-        needs_update = true;
-    }
-
-    if (needs_update) {
-        setProperty(VOODOO_INPUT_LOGICAL_MAX_X_KEY, info.x_max - info.x_min, 32);
-        setProperty(VOODOO_INPUT_LOGICAL_MAX_Y_KEY, info.y_max - info.y_min, 32);
-
-        UInt32 physical_max_x = (info.x_max - info.x_min + 1) * 100 / info.x_res;
-        UInt32 physical_max_y = (info.y_max - info.y_min + 1) * 100 / info.y_res;
-        
-        setProperty(VOODOO_INPUT_PHYSICAL_MAX_X_KEY, physical_max_x, 32);
-        setProperty(VOODOO_INPUT_PHYSICAL_MAX_Y_KEY, physical_max_y, 32);
-
-        if (voodooInputInstance) {
-            VoodooInputDimensions dims = {
-                .min_x = static_cast<SInt32>(info.x_min),
-                .max_x = static_cast<SInt32>(info.x_max),
-                .min_y = static_cast<SInt32>(info.y_min),
-                .max_y = static_cast<SInt32>(info.y_max)
-            };
-            super::messageClient(kIOMessageVoodooInputUpdateDimensionsMessage, voodooInputInstance, &dims, sizeof(VoodooInputDimensions));
-        }
-
-        DEBUG_LOG("VoodooPS2Elan: rescaled logical range to %dx%d, physical %dx%d\n",
-            info.x_max - info.x_min, info.y_max - info.y_min,
-            physical_max_x, physical_max_y);
-    }
-}
-
-int ApplePS2Elan::elantechPacketCheckV4() {
-    unsigned char *packet = _ringBuffer.tail();
-    unsigned char packet_type = packet[3] & 0x03;
-    unsigned int ic_version;
-    bool sanity_check;
-
-    // CALIBRATION: Complete packet logging for comprehensive analysis
-    DEBUG_LOG("VoodooPS2Elan: Received packet for fw=0x%06x\n", info.fw_version);
-
-    if (info.has_trackpoint && (packet[3] & 0x0f) == 0x06) {
-        return PACKET_TRACKPOINT;
-    }
-
-    // ETD0108 debug logging but treat as normal V4 hardware
-    if (IS_ETD0108()) {
-        DEBUG_LOG("ETD0108: Processing packet\n");
-        DEBUG_LOG("ETD0108: packet_type=%d\n", packet_type);
-        
-        // Check all possible multi-touch indicators
-        if (packet_type == 0) {
-            DEBUG_LOG("ETD0108: STATUS packet detected\n");
-        } else if (packet_type == 1) {
-            DEBUG_LOG("ETD0108: HEAD packet detected! (RARE for ETD0108)\n");
-        } else if (packet_type == 2) {
-            DEBUG_LOG("ETD0108: MOTION packet detected\n");
-            // Check if this might be a multi-touch MOTION packet
-            if ((packet[0] & 0x30) == 0x20) {
-                DEBUG_LOG("ETD0108: Possible SECOND finger MOTION\n");
-            } else if ((packet[0] & 0x30) == 0x10) {
-                DEBUG_LOG("ETD0108: Possible FIRST finger MOTION\n");
-            } else if ((packet[0] & 0x30) == 0x30) {
-                DEBUG_LOG("ETD0108: Possible DUAL finger MOTION\n");
-            }
-        }
-    }
-
-    // This represents the version of IC body.
-    ic_version = (info.fw_version & 0x0f0000) >> 16;
-
-    INTERRUPT_LOG("VoodooPS2Elan: icVersion(%d), crc(%d), samples[1](%d) \n", ic_version, info.crc_enabled, info.samples[1]);
-
-    // Sanity check based on the constant bits of a packet.
-    // The constant bits change depending on the value of
-    // the hardware flag 'crc_enabled' and the version of
-    // the IC body, but are the same for every packet,
-    // regardless of the type.
-    if (info.crc_enabled) {
-        sanity_check = ((packet[3] & 0x08) == 0x00);
-    } else if (ic_version == 7 && info.samples[1] == 0x2A) {
-        sanity_check = ((packet[3] & 0x1c) == 0x10);
-    } else {
-        sanity_check = ((packet[0] & 0x08) == 0x00 && (packet[3] & 0x1c) == 0x10);
-    }
-
-    if (!sanity_check) {
-        return PACKET_UNKNOWN;
-    }
-
-    switch (packet_type) {
-        case 0:
-            return PACKET_V4_STATUS;
-
-        case 1:
-            return PACKET_V4_HEAD;
-
-        case 2:
-            return PACKET_V4_MOTION;
-    }
-
-    return PACKET_UNKNOWN;
-}
-
-
-void ApplePS2Elan::elantechReportAbsoluteV1() {
-    unsigned char *packet = _ringBuffer.tail();
-    unsigned int fingers = 0, x = 0, y = 0;
-
-    if (info.fw_version < 0x020000) {
-        // byte 0:  D   U  p1  p2   1  p3   R   L
-        // byte 1:  f   0  th  tw  x9  x8  y9  y8
-        fingers = ((packet[1] & 0x80) >> 7) + ((packet[1] & 0x30) >> 4);
-    } else {
-        // byte 0: n1  n0  p2  p1   1  p3   R   L
-        // byte 1:  0   0   0   0  x9  x8  y9  y8
-        fingers = (packet[0] & 0xc0) >> 6;
-    }
-
-    if (info.jumpy_cursor) {
-        if (fingers != 1) {
-            etd.single_finger_reports = 0;
-        } else if (etd.single_finger_reports < 2) {
-            // Discard first 2 reports of one finger, bogus
-            etd.single_finger_reports++;
-            INTERRUPT_LOG("VoodooPS2Elan: discarding packet\n");
-            return;
-        }
-    }
-
-    // byte 2: x7  x6  x5  x4  x3  x2  x1  x0
-    // byte 3: y7  y6  y5  y4  y3  y2  y1  y0
-    x = ((packet[1] & 0x0c) << 6) | packet[2];
-    y = info.y_max - (((packet[1] & 0x03) << 8) | packet[3]);
-
-    virtualFinger[0].touch = false;
-    virtualFinger[1].touch = false;
-    virtualFinger[2].touch = false;
-
-    leftButton = packet[0] & 0x01;
-    rightButton = packet[0] & 0x02;
-
-    if (fingers == 1) {
-        virtualFinger[0].touch = true;
-        virtualFinger[0].button = packet[0] & 0x03;
-        virtualFinger[0].prev = virtualFinger[0].now;
-        virtualFinger[0].now.x = x;
-        virtualFinger[0].now.y = y;
-        if (lastFingers != 1) {
-            virtualFinger[0].prev = virtualFinger[0].now;
-        }
-    }
-
-    if (fingers == 2) {
-        virtualFinger[0].touch = virtualFinger[1].touch = true;
-        virtualFinger[0].button = virtualFinger[1].button = packet[0] & 0x03;
-        virtualFinger[0].prev = virtualFinger[0].now;
-        virtualFinger[1].prev = virtualFinger[1].now;
-
-        int h = 100;
-        int dy = (int)(sin30deg * h);
-        int dx = (int)(cos30deg * h);
-
-        virtualFinger[0].now.x = x;
-        virtualFinger[0].now.y = y - h;
-
-        virtualFinger[1].now.x = x + dx;
-        virtualFinger[1].now.y = y + dy;
-
-        if (lastFingers != 2) {
-            virtualFinger[0].prev = virtualFinger[0].now;
-            virtualFinger[1].prev = virtualFinger[1].now;
-        }
-    }
-
-    if (fingers == 3) {
-        virtualFinger[0].touch = virtualFinger[1].touch = virtualFinger[2].touch = true;
-        virtualFinger[0].button = virtualFinger[1].button = virtualFinger[2].button = packet[0] & 0x03;
-        virtualFinger[0].prev = virtualFinger[0].now;
-        virtualFinger[1].prev = virtualFinger[1].now;
-        virtualFinger[2].prev = virtualFinger[2].now;
-
-        int h = 100;
-        int dy = (int)(sin30deg * h);
-        int dx = (int)(cos30deg * h);
-
-        virtualFinger[0].now.x = x;
-        virtualFinger[0].now.y = y - h;
-
-        virtualFinger[1].now.x = x - dx;
-        virtualFinger[1].now.y = y + dy;
-
-        virtualFinger[2].now.x = x + dx;
-        virtualFinger[2].now.y = y + dy;
-
-        if (lastFingers != 3) {
-            virtualFinger[0].prev = virtualFinger[0].now;
-            virtualFinger[1].prev = virtualFinger[1].now;
-            virtualFinger[2].prev = virtualFinger[2].now;
-        }
-    }
-
-    lastFingers = fingers;
-    sendTouchData();
-}
-
-void ApplePS2Elan::elantechReportAbsoluteV2() {
-    unsigned char *packet = _ringBuffer.tail();
-    unsigned int fingers = 0, x1 = 0, y1 = 0, x2 = 0, y2 = 0;
-
-    // byte 0: n1  n0   .   .   .   .   R   L
-    fingers = (packet[0] & 0xc0) >> 6;
-
-    switch (fingers) {
-        case 3:
-        case 1:
-            // byte 1:  .   .   .   .  x11 x10 x9  x8
-            // byte 2: x7  x6  x5  x4  x4  x2  x1  x0
-            x1 = ((packet[1] & 0x0f) << 8) | packet[2];
-
-            // byte 4:  .   .   .   .  y11 y10 y9  y8
-            // byte 5: y7  y6  y5  y4  y3  y2  y1  y0
-            y1 = info.y_max - (((packet[4] & 0x0f) << 8) | packet[5]);
-
-            // pressure: (packet[1] & 0xf0) | ((packet[4] & 0xf0) >> 4);
-            // finger width: ((packet[0] & 0x30) >> 2) | ((packet[3] & 0x30) >> 4);
-            break;
-
-        case 2:
-            // The coordinate of each finger is reported separately
-            // with a lower resolution for two finger touches:
-
-            // byte 0:  .   .  ay8 ax8  .   .   .   .
-            // byte 1: ax7 ax6 ax5 ax4 ax3 ax2 ax1 ax0
-            x1 = (((packet[0] & 0x10) << 4) | packet[1]) << 2;
-
-            // byte 2: ay7 ay6 ay5 ay4 ay3 ay2 ay1 ay0
-            y1 = info.y_max - ((((packet[0] & 0x20) << 3) | packet[2]) << 2);
-
-            // byte 3:  .   .  by8 bx8  .   .   .   .
-            // byte 4: bx7 bx6 bx5 bx4 bx3 bx2 bx1 bx0
-            x2 = (((packet[3] & 0x10) << 4) | packet[4]) << 2;
-
-            // byte 5: by7 by8 by5 by4 by3 by2 by1 by0
-            y2 = info.y_max - ((((packet[3] & 0x20) << 3) | packet[5]) << 2);
-            break;
-    }
-
-    virtualFinger[0].touch = false;
-    virtualFinger[1].touch = false;
-    virtualFinger[2].touch = false;
-
-    leftButton = packet[0] & 0x01;
-    rightButton = packet[0] & 0x02;
-
-    if (fingers == 1 || fingers == 2) {
-        virtualFinger[0].touch = true;
-        virtualFinger[0].button = packet[0] & 0x03;
-        virtualFinger[0].prev = virtualFinger[0].now;
-        virtualFinger[0].now.x = x1;
-        virtualFinger[0].now.y = y1;
-        if (lastFingers != 1 && lastFingers != 2) {
-            virtualFinger[0].prev = virtualFinger[0].now;
-        }
-    }
-
-    if (fingers == 2) {
-        virtualFinger[1].touch = true;
-        virtualFinger[1].button = packet[0] & 0x03;
-        virtualFinger[1].prev = virtualFinger[1].now;
-        virtualFinger[1].now.x = x2;
-        virtualFinger[1].now.y = y2;
-        if (lastFingers != 2) {
-            virtualFinger[1].prev = virtualFinger[1].now;
-        }
-    }
-
-    if (fingers == 3) {
-        virtualFinger[0].touch = virtualFinger[1].touch = virtualFinger[2].touch = true;
-        virtualFinger[0].button = virtualFinger[1].button = virtualFinger[2].button = packet[0] & 0x03;
-        virtualFinger[0].prev = virtualFinger[0].now;
-        virtualFinger[1].prev = virtualFinger[1].now;
-        virtualFinger[2].prev = virtualFinger[2].now;
-
-        int h = 100;
-        int dy = (int)(sin30deg * h);
-        int dx = (int)(cos30deg * h);
-
-        virtualFinger[0].now.x = x1;
-        virtualFinger[0].now.y = y1 - h;
-
-        virtualFinger[1].now.x = x1 - dx;
-        virtualFinger[1].now.y = y1 + dy;
-
-        virtualFinger[2].now.x = x1 + dx;
-        virtualFinger[2].now.y = y1 + dy;
-
-        if (lastFingers != 3) {
-            virtualFinger[0].prev = virtualFinger[0].now;
-            virtualFinger[1].prev = virtualFinger[1].now;
-            virtualFinger[2].prev = virtualFinger[2].now;
+    } else if (_warmProfile.recording) {
+        if (_warmProfile.count < ETP_WARM_PROFILE_REGS) {
+            _warmProfile.reg[_warmProfile.count] = reg;
+            _warmProfile.val[_warmProfile.count] = val;
+            _warmProfile.count++;
+        } else {
+            _warmProfile.recording = false;
         }
     }
 
-    lastFingers = fingers;
-    sendTouchData();
+    return rc;
 }
 
-void ApplePS2Elan::elantechReportAbsoluteV3(int packetType) {
-    unsigned char *packet = _ringBuffer.tail();
-    unsigned int fingers = 0, x1 = 0, y1 = 0, x2 = 0, y2 = 0;
-    
-    // byte 0: n1  n0   .   .   .   .   R   L
-    fingers = (packet[0] & 0xc0) >> 6;
-
-    INTERRUPT_LOG("report abs v3 type %d finger %u x %d y %d btn %d (%02x %02x %02x %02x %02x %02x)\n", packetType, fingers,
-                  ((packet[1] & 0x0f) << 8) | packet[2],
-                  (((packet[4] & 0x0f) << 8) | packet[5]),
-                  packet[0] & 0x03, packet[0], packet[1], packet[2], packet[3], packet[4], packet[5]);
-
-    switch (fingers) {
-        case 3:
-        case 1:
-            // byte 1:  .   .   .   .  x11 x10 x9  x8
-            // byte 2: x7  x6  x5  x4  x4  x2  x1  x0
-            x1 = ((packet[1] & 0x0f) << 8) | packet[2];
-
-            // byte 4:  .   .   .   .  y11 y10 y9  y8
-            // byte 5: y7  y6  y5  y4  y3  y2  y1  y0
-            y1 = (((packet[4] & 0x0f) << 8) | packet[5]);
-            elantechRescale(x1, y1);
-            y1 = info.y_max - y1;
-            break;
-
-        case 2:
-            if (packetType == PACKET_V3_HEAD) {
-                // byte 1:   .    .    .    .  ax11 ax10 ax9  ax8
-                // byte 2: ax7  ax6  ax5  ax4  ax3  ax2  ax1  ax0
-                etd.mt[0].x = ((packet[1] & 0x0f) << 8) | packet[2];
-
-                // byte 4:   .    .    .    .  ay11 ay10 ay9  ay8
-                // byte 5: ay7  ay6  ay5  ay4  ay3  ay2  ay1  ay0
-                etd.mt[0].y = info.y_max - (((packet[4] & 0x0f) << 8) | packet[5]);
-
-                // wait for next packet
-                return;
-            }
-
-            // packet_type == PACKET_V3_TAIL
-            x1 = etd.mt[0].x;
-            y1 = etd.mt[0].y;
-            x2 = ((packet[1] & 0x0f) << 8) | packet[2];
-            y2 = (((packet[4] & 0x0f) << 8) | packet[5]);
-            elantechRescale(x2, y2);
-            y2 = info.y_max - y2;
-            break;
-    }
-
-    // pressure: (packet[1] & 0xf0) | ((packet[4] & 0xf0) >> 4);
-    // finger width: ((packet[0] & 0x30) >> 2) | ((packet[3] & 0x30) >> 4);
-
-    virtualFinger[0].touch = false;
-    virtualFinger[1].touch = false;
-    virtualFinger[2].touch = false;
-
-    leftButton = packet[0] & 0x01;
-    rightButton = packet[0] & 0x02;
-
-    if (fingers == 1 || fingers == 2) {
-        virtualFinger[0].touch = true;
-        virtualFinger[0].button = packet[0] & 0x03;
-        virtualFinger[0].prev = virtualFinger[0].now;
-        virtualFinger[0].now.x = x1;
-        virtualFinger[0].now.y = y1;
-        if (lastFingers != 1 && lastFingers != 2) {
-            virtualFinger[0].prev = virtualFinger[0].now;
-        }
-    }
-
-    if (fingers == 2) {
-        virtualFinger[1].touch = true;
-        virtualFinger[1].button = packet[0] & 0x03;
-        virtualFinger[1].prev = virtualFinger[1].now;
-        virtualFinger[1].now.x = x2;
-        virtualFinger[1].now.y = y2;
-        if (lastFingers != 2) {
-            virtualFinger[1].prev = virtualFinger[1].now;
-        }
-    }
-
-    if (fingers == 3) {
-        virtualFinger[0].touch = virtualFinger[1].touch = virtualFinger[2].touch = true;
-        virtualFinger[0].button = virtualFinger[1].button = virtualFinger[2].button = packet[0] & 0x03;
-        virtualFinger[0].prev = virtualFinger[0].now;
-        virtualFinger[1].prev = virtualFinger[1].now;
-        virtualFinger[2].prev = virtualFinger[2].now;
-
-        int h = 100;
-        int dy = (int)(sin30deg * h);
-        int dx = (int)(cos30deg * h);
-
-        virtualFinger[0].now.x = x1;
-        virtualFinger[0].now.y = y1 - h;
-
-        virtualFinger[1].now.x = x1 - dx;
-        virtualFinger[1].now.y = y1 + dy;
-
-        virtualFinger[2].now.x = x1 + dx;
-        virtualFinger[2].now.y = y1 + dy;
-
-        if (lastFingers != 3) {
-            virtualFinger[0].prev = virtualFinger[0].now;
-            virtualFinger[1].prev = virtualFinger[1].now;
-            virtualFinger[2].prev = virtualFinger[2].now;
-        }
-    }
-
-    lastFingers = fingers;
-    sendTouchData();
-}
+void ApplePS2Elan::elantechUpdateDimensions() {
+    // the decoder grew info's x/y range to fit a packet
+    setProperty(VOODOO_INPUT_LOGICAL_MAX_X_KEY, info.x_max - info.x_min, 32);
+    setProperty(VOODOO_INPUT_LOGICAL_MAX_Y_KEY, info.y_max - info.y_min, 32);
 
-void ApplePS2Elan::elantechReportAbsoluteV4(int packetType) {
-    if (IS_ETD0108()) {
-        DEBUG_LOG("[ETD0108_PROCESS] PacketType=%d\n", packetType);
-    }
+    UInt32 physical_max_x = (info.x_max - info.x_min + 1) * 100 / info.x_res;
+    UInt32 physical_max_y = (info.y_max - info.y_min + 1) * 100 / info.y_res;
     
-    switch (packetType) {
-        case PACKET_V4_STATUS:
-            processPacketStatusV4();
-            break;
-
-        case PACKET_V4_HEAD:
-            processPacketHeadV4();
-            break;
-
-        case PACKET_V4_MOTION:
-            processPacketMotionV4();
-            break;
+    setProperty(VOODOO_INPUT_PHYSICAL_MAX_X_KEY, physical_max_x, 32);
+    setProperty(VOODOO_INPUT_PHYSICAL_MAX_Y_KEY, physical_max_y, 32);
 
-        case PACKET_UNKNOWN:
-        default:
-            if (IS_ETD0108()) {
-                unsigned char *packet = _ringBuffer.tail();
-                DEBUG_LOG("ETD0108_UNKNOWN_PACKET: Type=%d RAW[0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x]\n",
-                      packetType, packet[0], packet[1], packet[2], packet[3], packet[4], packet[5]);
-                
-                // Try to extract coordinates like ETD0108MultiTouch would
-                if (packetType == 5 || packetType == 6) {
-                    unsigned int x = packet[1] | ((packet[3] & 0x0F) << 8);
-                    unsigned int y = packet[2] | ((packet[4] & 0x0F) << 8);
-                    DEBUG_LOG("ETD0108_UNKNOWN_COORDS: Type=%d X=%d Y=%d (V4-style extraction)\n", 
-                          packetType, x, y);
-                }
-            } else {
-                IOLog("VoodooPS2Elan: Got UNKNOWN packet type %d\n", packetType);
-            }
-            break;
-    }
+    if (voodooInputInstance) {
+        VoodooInputDimensions dims = {
+            .min_x = static_cast<SInt32>(info.x_min),
+            .max_x = static_cast<SInt32>(info.x_max),
+            .min_y = static_cast<SInt32>(info.y_min),
+            .max_y = static_cast<SInt32>(info.y_max)
+        };
+        super::messageClient(kIOMessageVoodooInputUpdateDimensionsMessage, voodooInputInstance, &dims, sizeof(VoodooInputDimensions));
+    }
+
+    DEBUG_LOG("VoodooPS2Elan: rescaled logical range to %dx%d, physical %dx%d\n",
+        info.x_max - info.x_min, info.y_max - info.y_min,
+        physical_max_x, physical_max_y);
 }
 
 void ApplePS2Elan::elantechReportTrackpoint() {
@@ -2016,6 +1514,7 @@ void ApplePS2Elan::elantechReportTrackpoint() {
         signature != 0x26800010U &&
         signature != 0x36808000U) {
         INTERRUPT_LOG("VoodooPS2Elan: unexpected trackpoint packet skipped\n");
+        _device->countEvent(kPS2CT_InvalidPackets);
         return;
     }
 
@@ -2033,268 +1532,6 @@ void ApplePS2Elan::elantechReportTrackpoint() {
     DEBUG_LOG("VoodooPS2Elan: Trackpoint message disabled - ELAN touchpad should use multitouch only\n");
 }
 
-void ApplePS2Elan::processPacketStatusV4() {
-    unsigned char *packet = _ringBuffer.tail();
-    unsigned fingers;
-    leftButton = packet[0] & 0x1;
-    rightButton = packet[0] & 0x2;
-    
-    // ETD0108 STATUS packet handling
-    if (IS_ETD0108()) {
-        static int status_pkt_num = 0;
-        status_pkt_num++;
-        
-        DEBUG_LOG("[ETD0108_STATUS_%04d] RAW[0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x]\n",
-              status_pkt_num, packet[0], packet[1], packet[2], packet[3], packet[4], packet[5]);
-        
-        int fingerBits = (packet[0] & 0x30) >> 4;
-        fingers = packet[1] & 0x1f;
-        
-        DEBUG_LOG("[ETD0108_STATUS_%04d] finger_count=%d fingerBits=0x%x\n", 
-              status_pkt_num, fingers, fingerBits);
-        
-        // Clear all fingers on STATUS packet (finger lift)
-        if (fingers == 0) {
-            DEBUG_LOG("[ETD0108_STATUS_%04d] All fingers lifted - clearing touch state\n", status_pkt_num);
-            for (int i = 0; i < ETP_MAX_FINGERS; i++) {
-                virtualFinger[i].touch = false;
-            }
-            sendTouchData();
-            return;
-        }
-        
-        // ETD0108 FIX: Button-based STATUS processing  
-        // Drag needs button press - gestures don't use buttons
-        if (leftButton || rightButton) {
-            // Button pressed: process STATUS for drag continuity
-            DEBUG_LOG("ETD0108_STATUS_FIXED: Button pressed - processing STATUS for drag continuity\n");
-        } else {
-            // No button: bypass STATUS for reliable gestures
-            DEBUG_LOG("ETD0108_STATUS_FIXED: No button - bypassing STATUS for reliable gestures\n");
-            return;
-        }
-    }
-
-    // notify finger state change
-    int count = 0;
-    
-    fingers = packet[1] & 0x1f;
-    
-    // DEBUG: Log STATUS packet parsing for ETD0108 debugging
-    if (IS_ETD0108()) {
-        DEBUG_LOG("ETD0108_STATUS_DEBUG: RAW[0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x]\n",
-              packet[0], packet[1], packet[2], packet[3], packet[4], packet[5]);
-        DEBUG_LOG("ETD0108_STATUS_DEBUG: fingers=0x%02x (from packet[1]&0x1f)\n", fingers);
-    }
-    
-    for (int i = 0; i < ETP_MAX_FINGERS; i++) {
-        if ((fingers & (1 << i)) == 0) {
-            // finger has been lifted off the touchpad
-            if (virtualFinger[i].touch) {
-                DEBUG_LOG("VoodooPS2Elan: %d finger has been lifted off the touchpad\n", i);
-                
-                // DRAG_SAVE: Save finger position if drag is active
-                if (leftButton || rightButton) {
-                    __finger_saved[i] = true;
-                    __saved_x[i] = virtualFinger[i].now.x;
-                    __saved_y[i] = virtualFinger[i].now.y;
-                    IOLog("VoodooPS2Elan: DRAG_SAVE F%d at (%u,%u) - button pressed\n", i, 
-                          __saved_x[i], __saved_y[i]);
-                }
-            }
-            virtualFinger[i].touch = false;
-        } else {
-            virtualFinger[i].touch = true;
-            count++;
-        }
-    }
-    
-    // DEBUG: Log final finger count for ETD0108
-    if (IS_ETD0108()) {
-        DEBUG_LOG("ETD0108_STATUS_DEBUG: Final count=%d (1-2 fingers processed normally)\n", count);
-        // For 1-2 fingers: process normally like other hardware
-        heldFingers = count;
-        headPacketsCount = 0;
-    } else {
-        heldFingers = count;
-        headPacketsCount = 0;
-    }
-    
-    // if count > 0, we wait for HEAD packets to report so that we report all fingers at once.
-    // if count == 0, we have to report the fact fingers are taken off, because there won't be any HEAD packets
-    if (count == 0) {
-        sendTouchData();
-    }
-}
-
-void ApplePS2Elan::processPacketHeadV4() {
-    unsigned char *packet = _ringBuffer.tail();
-    int id;
-    int pres, traces;
-
-    // ETD0108 special HEAD packet handling for Multi-Touch
-    if (IS_ETD0108()) {
-        static int head_pkt_num = 0;
-        head_pkt_num++;
-        
-        DEBUG_LOG("[ETD0108_HEAD_%04d] RAW[0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x]\n",
-              head_pkt_num, packet[0], packet[1], packet[2], packet[3], packet[4], packet[5]);
-        
-        // ETD0108: HEAD packets are RARE! Usually uses MOTION packets
-        // When HEAD occurs, it's usually single touch
-        int fingerBits = (packet[0] & 0x30) >> 4;
-        
-        // For HEAD packets, always use standard V4 finger ID extraction
-        // HEAD packets don't follow the fbits pattern like MOTION
-        id = ((packet[3] & 0xe0) >> 5) - 1;
-        if (id < 0 || id >= ETP_MAX_FINGERS) {
-            id = 0;  // Default to F0
-        }
-        
-        DEBUG_LOG("[ETD0108_HEAD_%04d] RARE HEAD packet! id=%d fbits=0x%x\n", 
-              head_pkt_num, id, fingerBits);
-    } else {
-        // Standard V4 processing for non-ETD0108
-        id = ((packet[3] & 0xe0) >> 5) - 1;
-    }
-
-    leftButton = packet[0] & 0x1;
-    rightButton = packet[0] & 0x2;
-    
-    // Clear saved positions if no buttons pressed
-    if (!leftButton && !rightButton) {
-        for (int i = 0; i < ETP_MAX_FINGERS; i++) {
-            if (__finger_saved[i]) {
-                __finger_saved[i] = false;
-                IOLog("VoodooPS2Elan: HEAD cleared saved F%d (buttons released)\n", i);
-            }
-        }
-    }
-    
-    headPacketsCount++;
-    
-    // Validate finger ID
-    if (id < 0 || id >= ETP_MAX_FINGERS) {
-        if (IS_ETD0108()) {
-            DEBUG_LOG("[ETD0108_HEAD_ERROR] Invalid finger ID %d, dropping packet\n", id);
-        }
-        return;
-    }
-    
-    if (IS_ETD0108()) {
-        DEBUG_LOG("[ETD0108_HEAD_FINGER] Processing for finger F%d\n", id);
-    }
-
-    int x = ((packet[1] & 0x0f) << 8) | packet[2];
-    int y = info.y_max - (((packet[4] & 0x0f) << 8) | packet[5]);
-    
-    // Coordinate extraction debug for ETD0108
-    if (IS_ETD0108()) {
-        DEBUG_LOG("[ETD0108_COORDS] Finger %d:\n", id);
-        DEBUG_LOG("  - X: packet[1]&0x0f=0x%02x << 8 | packet[2]=0x%02x = %d\n",
-              packet[1] & 0x0f, packet[2], x);
-        DEBUG_LOG("  - Y: packet[4]&0x0f=0x%02x << 8 | packet[5]=0x%02x = %d (inverted=%d)\n",
-              packet[4] & 0x0f, packet[5], ((packet[4] & 0x0f) << 8) | packet[5], y);
-    }
-
-    pres = (packet[1] & 0xf0) | ((packet[4] & 0xf0) >> 4);
-    traces = (packet[0] & 0xf0) >> 4;
-
-    if (IS_ETD0108()) {
-        DEBUG_LOG("[ETD0108_TOUCH] F%d: X=%d Y=%d pres=%d traces=%d btn=%d\n", 
-              id, x, y, pres, traces, packet[0] & 0x3);
-    }
-    
-    INTERRUPT_LOG("VoodooPS2Elan: pres: %d, traces: %d, width: %d\n", pres, traces, traces);
-
-    virtualFinger[id].button = (packet[0] & 0x3);
-    virtualFinger[id].prev = virtualFinger[id].now;
-    virtualFinger[id].pressure = pres;
-    virtualFinger[id].width = traces;
-    virtualFinger[id].touch = 1;  // Mark finger as active
-
-    virtualFinger[id].now.x = x;
-    virtualFinger[id].now.y = y;
-    
-    // DRAG_RESTORE: Restore saved position if finger reappears during drag
-    if ((leftButton || rightButton) && __finger_saved[id]) {
-        virtualFinger[id].prev.x = __saved_x[id];
-        virtualFinger[id].prev.y = __saved_y[id];
-        __finger_saved[id] = false;  // Clear after restoring
-        IOLog("VoodooPS2Elan: DRAG_RESTORE F%d prev=(%u,%u) now=(%d,%d) - smooth continuity\n", 
-              id, __saved_x[id], __saved_y[id], x, y);
-    }
-    
-    // REMOVED EDGE DETECTION: VoodooInput handles this natively with correct dimensions
-
-    // ETD0108 LINUX IMPLEMENTATION - Use traces only for touch area like Linux kernel
-    if (IS_ETD0108()) {
-        // Linux approach: traces is only used for touch area calculation, not finger detection
-        // virtualFinger[id].width already set above to traces (same as Linux)
-        DEBUG_LOG("[ETD0108_LINUX] HEAD packet - id=%d, x=%d, y=%d, traces=%d (touch_area_only)\n", 
-              id, x, y, traces);
-    }
-
-    // ETD0108: HEAD packets are rare, send immediately
-    if (IS_ETD0108()) {
-        DEBUG_LOG("[ETD0108_HEAD_SEND] Sending HEAD packet data immediately\n");
-        sendTouchData();
-    } else {
-        // Standard V4: Wait for all HEAD packets
-        if (headPacketsCount == heldFingers) {
-            headPacketsCount = 0;
-            sendTouchData();
-        }
-    }
-}
-
-void ApplePS2Elan::processPacketMotionV4() {
-    unsigned char *packet = _ringBuffer.tail();
-    
-    // ETD0108 LINUX IMPLEMENTATION: Use standard V4 MOTION processing (no special case)
-    if (IS_ETD0108()) {
-        DEBUG_LOG("[ETD0108_LINUX] Using standard V4 motion processing - no special handling\n");
-    }
-    
-    // Standard V4 MOTION packet processing (relative deltas)
-    int weight, delta_x1 = 0, delta_y1 = 0, delta_x2 = 0, delta_y2 = 0;
-    int id, sid;
-
-    leftButton = packet[0] & 0x1;
-    rightButton = packet[0] & 0x2;
-
-    id = ((packet[0] & 0xe0) >> 5) - 1;
-    if (id < 0) {
-        INTERRUPT_LOG("VoodooPS2Elan: invalid id, aborting\n");
-        return;
-    }
-
-    sid = ((packet[3] & 0xe0) >> 5) - 1;
-    weight = (packet[0] & 0x10) ? ETP_WEIGHT_VALUE : 1;
-
-    // Motion packets give us the delta of x, y values of specific fingers,
-    // but in two's complement. Let the compiler do the conversion for us.
-    // Also _enlarge_ the numbers to int, in case of overflow.
-    delta_x1 = (signed char)packet[1];
-    delta_y1 = (signed char)packet[2];
-    delta_x2 = (signed char)packet[4];
-    delta_y2 = (signed char)packet[5];
-
-    virtualFinger[id].button = (packet[0] & 0x3);
-    virtualFinger[id].prev = virtualFinger[id].now;
-    virtualFinger[id].now.x += delta_x1 * weight;
-    virtualFinger[id].now.y -= delta_y1 * weight;
-
-    if (sid >= 0) {
-        virtualFinger[sid].button = (packet[0] & 0x3);
-        virtualFinger[sid].prev = virtualFinger[sid].now;
-        virtualFinger[sid].now.x += delta_x2 * weight;
-        virtualFinger[sid].now.y -= delta_y2 * weight;
-    }
-
-    sendTouchData();
-}
-
 // REMOVED: Dead processPacketETD0108() function - ETD0108 uses standard V4 processing
 
 // REMOVED: Dead processPacketETD0108MultiTouch() function - was designed for wrong packet system
@@ -2316,6 +1553,7 @@ MT2FingerType ApplePS2Elan::GetBestFingerType(int i) {
 
 void ApplePS2Elan::sendTouchData() {
     uint64_t timestamp = mach_absolute_time();
+    const elantech_finger *finger = _decoder.frame().finger;
     
     // Use mach_absolute_time directly (already in appropriate units for comparison)
     // Note: mach_absolute_time units are platform-dependent but consistent for comparisons
@@ -2323,7 +1561,8 @@ void ApplePS2Elan::sendTouchData() {
     // Simple button processing - no complex tap-and-hold state machine
 
     // Ignore input for specified time after keyboard/trackpoint usage
-    if (timestamp - keytime < maxaftertyping) {
+    uint64_t lastKeyTime = _keystrokes->read().time;
+    if (timestamp - (keytime > lastKeyTime ? keytime : lastKeyTime) < maxaftertyping) {
         return;
     }
 
@@ -2341,10 +1580,10 @@ void ApplePS2Elan::sendTouchData() {
     if (IS_ETD0108()) {
         int active_count = 0;
         for (int i = 0; i < ETP_MAX_FINGERS; i++) {
-            if (virtualFinger[i].touch) {
+            if (finger[i].touch) {
                 active_count++;
                 DEBUG_LOG("ETD0108_FINGER_ACTIVE: F%d at X=%d Y=%d\n", 
-                      i, (int)virtualFinger[i].now.x, (int)virtualFinger[i].now.y);
+                      i, (int)finger[i].now.x, (int)finger[i].now.y);
             }
         }
         DEBUG_LOG("ETD0108_SENDING: %d active fingers to VoodooInput\n", active_count);
@@ -2368,22 +1607,22 @@ void ApplePS2Elan::sendTouchData() {
         UInt32 left_right_split = info.x_max / 2;
         
         for (int j = 0; j < ETP_MAX_FINGERS; j++) {
-            if (virtualFinger[j].touch) {
+            if (finger[j].touch) {
                 total_fingers++;
-                if (virtualFinger[j].now.y < button_area_threshold) {
+                if (finger[j].now.y < button_area_threshold) {
                     navigation_fingers++;
                 } else {
                     button_fingers++;
                     // Check which button area is clicked
-                    if (virtualFinger[j].button != 0) {
-                        if (virtualFinger[j].now.x < left_right_split) {
+                    if (finger[j].button != 0) {
+                        if (finger[j].now.x < left_right_split) {
                             left_button_pressed = true;
                         } else {
                             right_button_pressed = true;
                         }
                     }
                 }
-                if (virtualFinger[j].button != 0) {
+                if (finger[j].button != 0) {
                     is_clickpad_pressed = true;
                 }
             }
@@ -2406,7 +1645,7 @@ void ApplePS2Elan::sendTouchData() {
     }
     
     for (int i = 0; i < ETP_MAX_FINGERS; i++) {
-        const auto &state = virtualFinger[i];
+        const auto &state = finger[i];
         if (!state.touch) {
             continue;
         }
@@ -2414,8 +1653,8 @@ void ApplePS2Elan::sendTouchData() {
 
         auto &transducer = inputEvent.transducers[transducers_count];
 
-        transducer.currentCoordinates = state.now;
-        transducer.previousCoordinates = state.prev;
+        transducer.currentCoordinates = {state.now.x, state.now.y};
+        transducer.previousCoordinates = {state.prev.x, state.prev.y};
         
         // Convert uint64_t to AbsoluteTime - use bcopy for safe type conversion
         bcopy(&timestamp, &transducer.timestamp, sizeof(AbsoluteTime));
@@ -2594,90 +1833,26 @@ void ApplePS2Elan::packetReady() {
             continue;
         }
 
-        int packetType;
-        switch (info.hw_version) {
-            case 1:
-                if (info.paritycheck && !elantechPacketCheckV1()) {
-                    // ignore invalid packet
-                    INTERRUPT_LOG("VoodooPS2Elan: invalid packet received\n");
-                    break;
-                }
-
-                INTERRUPT_LOG("VoodooPS2Elan: Handling absolute mode\n");
-                elantechReportAbsoluteV1();
-                break;
+        int result = _decoder.decode(_ringBuffer.tail());
 
-            case 2:
-                if (elantechDebounceCheckV2()) {
-                    // ignore debounce
-                    break;
-                }
-
-                if (info.paritycheck && !elantechPacketCheckV2()) {
-                    // ignore invalid packet
-                    INTERRUPT_LOG("VoodooPS2Elan: invalid packet received\n");
-                    break;
-                }
-
-                INTERRUPT_LOG("VoodooPS2Elan: Handling absolute mode\n");
-                elantechReportAbsoluteV2();
-                break;
-
-            case 3:
-                packetType = elantechPacketCheckV3();
-                INTERRUPT_LOG("VoodooPS2Elan: Packet Type %d\n", packetType);
-
-                switch (packetType) {
-                    case PACKET_UNKNOWN:
-                        INTERRUPT_LOG("VoodooPS2Elan: invalid packet received\n");
-                        break;
-
-                    case PACKET_DEBOUNCE:
-                        // ignore debounce
-                        break;
-
-                    case PACKET_TRACKPOINT:
-                        INTERRUPT_LOG("VoodooPS2Elan: Handling trackpoint packet\n");
-                        elantechReportTrackpoint();
-                        break;
-
-                    default:
-                        INTERRUPT_LOG("VoodooPS2Elan: Handling absolute mode\n");
-                        elantechReportAbsoluteV3(packetType);
-                        break;
-                }
-                break;
-
-            case 4:
-                // Normal V4 handling
-                {
-                    UInt8 *packet = _ringBuffer.tail();
-                    DEBUG_LOG("VoodooPS2Elan: Processing V4 packet [%02x %02x %02x %02x %02x %02x]\n", 
-                              packet[0], packet[1], packet[2], packet[3], packet[4], packet[5]);
-                }
-                packetType = elantechPacketCheckV4();
-                INTERRUPT_LOG("VoodooPS2Elan: Packet Type %d\n", packetType);
-
-                switch (packetType) {
-                    case PACKET_UNKNOWN:
-                        INTERRUPT_LOG("VoodooPS2Elan: invalid packet received\n");
-                        break;
-
-                    case PACKET_TRACKPOINT:
-                        INTERRUPT_LOG("VoodooPS2Elan: Handling trackpoint packet\n");
-                        elantechReportTrackpoint();
-                        break;
+        if (result & kElanDecodeInvalid) {
+            INTERRUPT_LOG("VoodooPS2Elan: invalid packet received\n");
+            _device->countEvent(kPS2CT_InvalidPackets);
+        }
 
+        if (result & kElanDecodeTrackpoint) {
+            INTERRUPT_LOG("VoodooPS2Elan: Handling trackpoint packet\n");
+            elantechReportTrackpoint();
+        }
 
-                    default:
-                        INTERRUPT_LOG("VoodooPS2Elan: Handling absolute mode\n");
-                        elantechReportAbsoluteV4(packetType);
-                        break;
-                }
-                break;
+        if (result & kElanDecodeRescaled) {
+            elantechUpdateDimensions();
+        }
 
-            default:
-                INTERRUPT_LOG("VoodooPS2Elan: invalid packet received\n");
+        if (result & kElanDecodeFrame) {
+            leftButton = _decoder.frame().buttons & 0x1;
+            rightButton = _decoder.frame().buttons & 0x2;
+            sendTouchData();
         }
 
         _ringBuffer.advanceTail(_packetLength);
@@ -2707,11 +1882,12 @@ void ApplePS2Elan::onButtonTimer(void) {
 
 // Check if any finger is actively touching the trackpad
 bool ApplePS2Elan::isAnyFingerActive(void) {
+    const elantech_finger *finger = _decoder.frame().finger;
     for (int i = 0; i < ETP_MAX_FINGERS; i++) {
-        if (virtualFinger[i].touch) {
+        if (finger[i].touch) {
             // Log any active finger position for debugging  
             DEBUG_LOG("VoodooPS2Elan: ACTIVE_FINGER_DETECTED: F%d at X=%d Y=%d (trackpad_max=%dx%d)\n", 
-                     i, (int)virtualFinger[i].now.x, (int)virtualFinger[i].now.y, info.x_max, info.y_max);
+                     i, (int)finger[i].now.x, (int)finger[i].now.y, info.x_max, info.y_max);
             return true;  // ANY active finger should trigger prevention logic
         }
     }
@@ -2720,6 +1896,7 @@ bool ApplePS2Elan::isAnyFingerActive(void) {
 
 // Check if multiple fingers are active with one in navigation area
 bool ApplePS2Elan::isMultiFingerWithNavigation(void) {
+    const elantech_finger *finger = _decoder.frame().finger;
     const UInt32 button_area_height = 100;
     if (info.y_max <= button_area_height) return false;
     UInt32 nav_threshold = info.y_max - button_area_height;
@@ -2728,12 +1905,12 @@ bool ApplePS2Elan::isMultiFingerWithNavigation(void) {
     bool has_nav_finger = false;
     
     for (int i = 0; i < ETP_MAX_FINGERS; i++) {
-        if (virtualFinger[i].touch) {
+        if (finger[i].touch) {
             active_fingers++;
-            if (virtualFinger[i].now.y < nav_threshold) {
+            if (finger[i].now.y < nav_threshold) {
                 has_nav_finger = true;
                 DEBUG_LOG("VoodooPS2Elan: NAV_FINGER_F%d: y=%d < %d (nav area)\n",
-                          i, (int)virtualFinger[i].now.y, nav_threshold);
+                          i, (int)finger[i].now.y, nav_threshold);
             }
         }
     }
@@ -19,16 +19,7 @@
 
 #include "VoodooInputMultitouch/VoodooInputEvent.h"
 #include "VoodooPS2TrackpadCommon.h"
-
-struct elan_virtual_finger_state {
-    TouchCoordinates prev;
-    TouchCoordinates now;
-    uint8_t pressure;
-    uint8_t width;
-    bool touch;
-    bool button;
-    MT2FingerType fingerType;
-};
+#include "VoodooPS2ElanDecoder.h"
 
 #define kPacketLengthMax 6
 
@@ -68,6 +59,7 @@ struct elan_virtual_finger_state {
  */
 #define ETP_READ_BACK_TRIES           5
 #define ETP_READ_BACK_DELAY           2000
+#define ETP_WARM_PROFILE_REGS         8
 
 /*
  * Register bitmasks for hardware version 1
@@ -109,29 +101,6 @@ struct elan_virtual_finger_state {
 #define ETP_WMIN_V2                   0
 #define ETP_WMAX_V2                   15
 
-/*
- * v3 hardware has 2 kinds of packet types,
- * v4 hardware has 3.
- */
-#define PACKET_UNKNOWN                0x01
-#define PACKET_DEBOUNCE               0x02
-#define PACKET_V3_HEAD                0x03
-#define PACKET_V3_TAIL                0x04
-#define PACKET_V4_HEAD                0x05
-#define PACKET_V4_MOTION              0x06
-#define PACKET_V4_STATUS              0x07
-#define PACKET_TRACKPOINT             0x08
-
-/*
- * track up to 5 fingers for v4 hardware
- */
-#define ETP_MAX_FINGERS               5
-
-/*
- * weight value for v4 hardware
- */
-#define ETP_WEIGHT_VALUE              5
-
 /*
  * Bus information on 3rd byte of query ETP_RESOLUTION_QUERY(0x04)
  */
@@ -157,53 +126,14 @@ struct elan_virtual_finger_state {
          ((fw_version) & 0x0000ff) > 0)
 
 /*
- * The base position for one finger, v4 hardware
+ * Register writes of the last full setup, replayed on warm resume
  */
-struct finger_pos {
-    unsigned int x;
-    unsigned int y;
-};
-
-struct elantech_device_info {
-    unsigned char capabilities[3];
-    unsigned char samples[3];
-    unsigned char debug;
-    unsigned char hw_version;
-    unsigned int fw_version;
-    unsigned int x_min;
-    unsigned int y_min;
-    unsigned int x_max;
-    unsigned int y_max;
-    unsigned int x_res;
-    unsigned int y_res;
-    unsigned int x_traces;
-    unsigned int y_traces;
-    unsigned int width;
-    unsigned int bus;
-    bool paritycheck;
-    bool jumpy_cursor;
-    bool reports_pressure;
-    bool crc_enabled;
-    bool set_hw_resolution;
-    bool is_buttonpad;
-    bool has_trackpoint;
-    bool has_middle_button;
-};
-
-struct elantech_data {
-    unsigned char reg_07;
-    unsigned char reg_10;
-    unsigned char reg_11;
-    unsigned char reg_20;
-    unsigned char reg_21;
-    unsigned char reg_22;
-    unsigned char reg_23;
-    unsigned char reg_24;
-    unsigned char reg_25;
-    unsigned char reg_26;
-    unsigned int single_finger_reports;
-    struct finger_pos mt[ETP_MAX_FINGERS];
-    unsigned char parity[256];
+struct elantech_warm_profile {
+    unsigned char reg[ETP_WARM_PROFILE_REGS];
+    unsigned char val[ETP_WARM_PROFILE_REGS];
+    int count;
+    bool recording;
+    bool valid;
 };
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -217,11 +147,12 @@ class EXPORT ApplePS2Elan : public IOService {
 private:
     IOService*            voodooInputInstance {nullptr};
     ApplePS2MouseDevice*  _device {nullptr};
+    PS2KeystrokeCell*     _keystrokes {nullptr};
     bool                  _interruptHandlerInstalled {false};
     bool                  _powerControlHandlerInstalled {false};
     UInt32                _packetByteCount {0};
     UInt32                _packetLength {0};
-    RingBuffer<UInt8, kPacketLengthMax * 32> _ringBuffer {};
+    RingBuffer<UInt8, 256> _ringBuffer {};    // 42 packets
 
     IOCommandGate*        _cmdGate {nullptr};
 
@@ -251,14 +182,6 @@ private:
     uint64_t _maxmiddleclicktime = 100000000;  // 100ms like VoodooPS2Mouse
     int _fakemiddlebutton = 1;  // Enable middle button simulation
 
-    const float sin30deg = 0.5f;
-    const float cos30deg = 0.86602540378f;
-    UInt32 lastFingers = 0;
-
-    int heldFingers = 0;
-    int headPacketsCount = 0;
-    elan_virtual_finger_state virtualFinger[ETP_MAX_FINGERS] {};
-
     static_assert(ETP_MAX_FINGERS <= kMT2FingerTypeLittleFinger, "Too many fingers for one hand");
 
     ForceTouchMode _forceTouchMode {FORCE_TOUCH_BUTTON};
@@ -278,6 +201,7 @@ private:
     int _mouseSampleRate {200};
 
     bool _set_hw_resolution {false};
+    bool _warmResume {false};
 
     bool ignoreall {false};
     bool usb_mouse_stops_trackpad {true};
@@ -285,7 +209,7 @@ private:
     bool _processusbmouse {true};
     bool _processbluetoothmouse {true};
 
-    uint64_t keytime {0};
+    uint64_t keytime {0};                   // last trackpoint use
     uint64_t maxaftertyping {600000000};  // Increased to 600ms for better typing palm rejection
 
     OSSet *attachedHIDPointerDevices {nullptr};
@@ -296,8 +220,8 @@ private:
     IONotifier *bluetooth_hid_publish_notify {nullptr};    // Notification when a bluetooth HID device is connected
     IONotifier *bluetooth_hid_terminate_notify {nullptr};  // Notification when a bluetooth HID device is disconnected
 
-    virtual PS2InterruptResult interruptOccurred(UInt8 data);
-    virtual void packetReady();
+    PS2InterruptResult interruptOccurred(UInt8 data);
+    void packetReady();
     virtual void setDevicePowerState(UInt32 whatToDo);
 
     bool handleOpen(IOService *forClient, IOOptionBits options, void *arg) override;
@@ -316,28 +240,21 @@ private:
 
     elantech_data etd {};
     elantech_device_info info {};
+    elantech_warm_profile _warmProfile {};
+    ElanDecoder _decoder {info, etd};
     int elantechDetect();
     int elantechQueryInfo();
     int elantechSetProperties();
     int elantechSetAbsoluteMode();
     int elantechSetInputParams();
     int elantechSetupPS2();
+    int elantechSetupRegisters();
+    int elantechSetPS2Params();
+    int elantechWarmResume();
     int elantechReadReg(unsigned char reg, unsigned char *val);
     int elantechWriteReg(unsigned char reg, unsigned char val);
-    int elantechDebounceCheckV2();
-    int elantechPacketCheckV1();
-    int elantechPacketCheckV2();
-    int elantechPacketCheckV3();
-    int elantechPacketCheckV4();
-    void elantechRescale(unsigned int &x, unsigned int &y);
-    void elantechReportAbsoluteV1();
-    void elantechReportAbsoluteV2();
-    void elantechReportAbsoluteV3(int packetType);
-    void elantechReportAbsoluteV4(int packetType);
+    void elantechUpdateDimensions();
     void elantechReportTrackpoint();
-    void processPacketStatusV4();
-    void processPacketHeadV4();
-    void processPacketMotionV4();
     void sendTouchData();
     void onButtonTimer(void);
     bool isAnyFingerActive(void);
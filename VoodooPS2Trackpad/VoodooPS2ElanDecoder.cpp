@@ -0,0 +1,725 @@
+/*
+ * Elan PS2 touchpad packet decoder
+ *
+ * Mostly contains code ported from Linux
+ * https://github.com/torvalds/linux/blob/master/drivers/input/mouse/elantech.c
+ *
+ * Created by Bartosz Korczyński (@bandysc), Hiep Bao Le (@hieplpvip)
+ * Special thanks to Kishor Prins (@kprinssu), EMlyDinEsHMG and whole VoodooInput team
+ */
+
+#include <string.h>
+#include "VoodooPS2ElanDecoder.h"
+
+#define IS_ETD0108() (info.fw_version == ETP_FW_VERSION_ETD0108)
+
+static const float sin30deg = 0.5f;
+static const float cos30deg = 0.86602540378f;
+
+int ElanDecoder::decode(const uint8_t *packet) {
+    int packetType;
+
+    switch (info.hw_version) {
+        case 1:
+            if (info.paritycheck && !packetCheckV1(packet)) {
+                return kElanDecodeInvalid;
+            }
+
+            return reportAbsoluteV1(packet);
+
+        case 2:
+            if (debounceCheckV2(packet)) {
+                // ignore debounce
+                return 0;
+            }
+
+            if (info.paritycheck && !packetCheckV2(packet)) {
+                return kElanDecodeInvalid;
+            }
+
+            return reportAbsoluteV2(packet);
+
+        case 3:
+            packetType = packetCheckV3(packet);
+
+            switch (packetType) {
+                case PACKET_UNKNOWN:
+                    return kElanDecodeInvalid;
+
+                case PACKET_DEBOUNCE:
+                    // ignore debounce
+                    return 0;
+
+                case PACKET_TRACKPOINT:
+                    return kElanDecodeTrackpoint;
+            }
+
+            return reportAbsoluteV3(packet, packetType);
+
+        case 4:
+            packetType = packetCheckV4(packet);
+
+            switch (packetType) {
+                case PACKET_TRACKPOINT:
+                    return kElanDecodeTrackpoint;
+
+                case PACKET_V4_STATUS:
+                    return processPacketStatusV4(packet);
+
+                case PACKET_V4_HEAD:
+                    return processPacketHeadV4(packet);
+
+                case PACKET_V4_MOTION:
+                    return processPacketMotionV4(packet);
+            }
+
+            return kElanDecodeInvalid;
+    }
+
+    return kElanDecodeInvalid;
+}
+
+int ElanDecoder::debounceCheckV2(const uint8_t *packet) {
+    // When we encounter packet that matches this exactly, it means the
+    // hardware is in debounce status. Just ignore the whole packet.
+    static const uint8_t debounce_packet[] = {
+        0x84, 0xff, 0xff, 0x02, 0xff, 0xff
+    };
+
+    return !memcmp(packet, debounce_packet, sizeof(debounce_packet));
+}
+
+int ElanDecoder::packetCheckV1(const uint8_t *packet) {
+    unsigned char p1, p2, p3;
+
+    // Parity bits are placed differently
+    if (info.fw_version < 0x020000) {
+        // byte 0:  D   U  p1  p2   1  p3   R   L
+        p1 = (packet[0] & 0x20) >> 5;
+        p2 = (packet[0] & 0x10) >> 4;
+    } else {
+        // byte 0: n1  n0  p2  p1   1  p3   R   L
+        p1 = (packet[0] & 0x10) >> 4;
+        p2 = (packet[0] & 0x20) >> 5;
+    }
+
+    p3 = (packet[0] & 0x04) >> 2;
+
+    return etd.parity[packet[1]] == p1 &&
+           etd.parity[packet[2]] == p2 &&
+           etd.parity[packet[3]] == p3;
+}
+
+int ElanDecoder::packetCheckV2(const uint8_t *packet) {
+    // V2 hardware has two flavors. Older ones that do not report pressure,
+    // and newer ones that reports pressure and width. With newer ones, all
+    // packets (1, 2, 3 finger touch) have the same constant bits. With
+    // older ones, 1/3 finger touch packets and 2 finger touch packets
+    // have different constant bits.
+    // With all three cases, if the constant bits are not exactly what I
+    // expected, I consider them invalid.
+
+    if (info.reports_pressure) {
+        return (packet[0] & 0x0c) == 0x04 && (packet[3] & 0x0f) == 0x02;
+    }
+
+    if ((packet[0] & 0xc0) == 0x80) {
+        return (packet[0] & 0x0c) == 0x0c && (packet[3] & 0x0e) == 0x08;
+    }
+
+    return (packet[0] & 0x3c) == 0x3c &&
+           (packet[1] & 0xf0) == 0x00 &&
+           (packet[3] & 0x3e) == 0x38 &&
+           (packet[4] & 0xf0) == 0x00;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// v3/v4 packet classification
+//
+// The packet type only depends on a few bits of bytes 0 and 3, and on flags
+// that are fixed once the device is identified. The rules below are folded
+// at compile time into one table per set of flags, indexed by those bits,
+// and selectClassifier() picks the table for the device.
+
+// v3: byte 0 bits 2-3, byte 3 bits 0-3 and 6-7
+static inline constexpr unsigned int packetIndexV3(const uint8_t *packet) {
+    return ((packet[0] & 0x0c) << 4) | ((packet[3] & 0xc0) >> 2) | (packet[3] & 0x0f);
+}
+
+static constexpr uint8_t packetRuleV3(unsigned int index, bool crc_enabled) {
+    const unsigned int p0 = (index >> 4) & 0x0c;
+    const unsigned int p3 = ((index << 2) & 0xc0) | (index & 0x0f);
+
+    // If the hardware flag 'crc_enabled' is set the packets have different signatures.
+    if (crc_enabled) {
+        if ((p3 & 0x09) == 0x08) {
+            return PACKET_V3_HEAD;
+        }
+
+        if ((p3 & 0x09) == 0x09) {
+            return PACKET_V3_TAIL;
+        }
+    } else {
+        if ((p0 & 0x0c) == 0x04 && (p3 & 0xcf) == 0x02) {
+            return PACKET_V3_HEAD;
+        }
+
+        if ((p0 & 0x0c) == 0x0c && (p3 & 0xce) == 0x0c) {
+            return PACKET_V3_TAIL;
+        }
+
+        if ((p3 & 0x0f) == 0x06) {
+            return PACKET_TRACKPOINT;
+        }
+    }
+
+    return PACKET_UNKNOWN;
+}
+
+// v4: byte 0 bit 3, byte 3 bits 0-4
+static inline constexpr unsigned int packetIndexV4(const uint8_t *packet) {
+    return ((packet[0] & 0x08) << 2) | (packet[3] & 0x1f);
+}
+
+// how the constant bits of v4 packets are checked
+enum {
+    kElanV4SanityDefault,       // byte 0 and byte 3
+    kElanV4SanityIC7,           // byte 3 only, IC body 7 with samples[1] 0x2A
+    kElanV4SanityCRC,           // byte 3 only, 'crc_enabled' set
+    kElanV4SanityCount
+};
+
+static constexpr uint8_t packetRuleV4(unsigned int index, int sanity, bool has_trackpoint) {
+    const unsigned int p0 = (index >> 2) & 0x08;
+    const unsigned int p3 = index & 0x1f;
+    bool sanity_check = false;
+
+    if (has_trackpoint && (p3 & 0x0f) == 0x06) {
+        return PACKET_TRACKPOINT;
+    }
+
+    // Sanity check based on the constant bits of a packet.
+    // The constant bits change depending on the value of
+    // the hardware flag 'crc_enabled' and the version of
+    // the IC body, but are the same for every packet,
+    // regardless of the type.
+    if (sanity == kElanV4SanityCRC) {
+        sanity_check = ((p3 & 0x08) == 0x00);
+    } else if (sanity == kElanV4SanityIC7) {
+        sanity_check = ((p3 & 0x1c) == 0x10);
+    } else {
+        sanity_check = ((p0 & 0x08) == 0x00 && (p3 & 0x1c) == 0x10);
+    }
+
+    if (!sanity_check) {
+        return PACKET_UNKNOWN;
+    }
+
+    switch (p3 & 0x03) {
+        case 0:
+            return PACKET_V4_STATUS;
+
+        case 1:
+            return PACKET_V4_HEAD;
+
+        case 2:
+            return PACKET_V4_MOTION;
+    }
+
+    return PACKET_UNKNOWN;
+}
+
+template <unsigned int N>
+struct ElanPacketTable {
+    uint8_t type[N];
+};
+
+static constexpr ElanPacketTable<256> makePacketTableV3(bool crc_enabled) {
+    ElanPacketTable<256> table {};
+    for (unsigned int i = 0; i < 256; i++) {
+        table.type[i] = packetRuleV3(i, crc_enabled);
+    }
+    return table;
+}
+
+static constexpr ElanPacketTable<64> makePacketTableV4(int sanity, bool has_trackpoint) {
+    ElanPacketTable<64> table {};
+    for (unsigned int i = 0; i < 64; i++) {
+        table.type[i] = packetRuleV4(i, sanity, has_trackpoint);
+    }
+    return table;
+}
+
+// indexed by crc_enabled
+static constexpr ElanPacketTable<256> packetTablesV3[2] = {
+    makePacketTableV3(false),
+    makePacketTableV3(true),
+};
+
+// indexed by sanity check, then has_trackpoint
+static constexpr ElanPacketTable<64> packetTablesV4[kElanV4SanityCount][2] = {
+    {makePacketTableV4(kElanV4SanityDefault, false), makePacketTableV4(kElanV4SanityDefault, true)},
+    {makePacketTableV4(kElanV4SanityIC7, false), makePacketTableV4(kElanV4SanityIC7, true)},
+    {makePacketTableV4(kElanV4SanityCRC, false), makePacketTableV4(kElanV4SanityCRC, true)},
+};
+
+static_assert(packetTablesV3[0].type[0x42] == PACKET_V3_HEAD, "v3 head signature");
+static_assert(packetTablesV3[1].type[0x09] == PACKET_V3_TAIL, "v3 crc tail signature");
+static_assert(packetTablesV4[kElanV4SanityDefault][1].type[0x06] == PACKET_TRACKPOINT, "v4 trackpoint signature");
+static_assert(packetTablesV4[kElanV4SanityDefault][0].type[0x32] == PACKET_UNKNOWN, "v4 byte 0 constant bit");
+
+void ElanDecoder::selectClassifier() {
+    // This represents the version of IC body.
+    unsigned int ic_version = (info.fw_version & 0x0f0000) >> 16;
+    int sanity = kElanV4SanityDefault;
+
+    if (info.crc_enabled) {
+        sanity = kElanV4SanityCRC;
+    } else if (ic_version == 7 && info.samples[1] == 0x2A) {
+        sanity = kElanV4SanityIC7;
+    }
+
+    _packetTableV3 = packetTablesV3[info.crc_enabled].type;
+    _packetTableV4 = packetTablesV4[sanity][info.has_trackpoint].type;
+}
+
+int ElanDecoder::packetType(const uint8_t *packet) {
+    return info.hw_version == 3 ? packetCheckV3(packet) : packetCheckV4(packet);
+}
+
+int ElanDecoder::packetCheckV3(const uint8_t *packet) {
+    static const uint8_t debounce_packet[] = {
+        0xc4, 0xff, 0xff, 0x02, 0xff, 0xff
+    };
+
+    // check debounce first, it has the same signature in byte 0
+    // and byte 3 as PACKET_V3_HEAD.
+    if (!memcmp(packet, debounce_packet, sizeof(debounce_packet))) {
+        return PACKET_DEBOUNCE;
+    }
+
+    return _packetTableV3[packetIndexV3(packet)];
+}
+
+int ElanDecoder::packetCheckV4(const uint8_t *packet) {
+    return _packetTableV4[packetIndexV4(packet)];
+}
+
+int ElanDecoder::rescale(unsigned int x, unsigned int y) {
+    int result = 0;
+
+    if (x > info.x_max) {
+        info.x_max = x;
+        result = kElanDecodeRescaled;
+    }
+    if (x < info.x_min) {
+        info.x_min = x;
+        result = kElanDecodeRescaled;
+    }
+
+    if (y > info.y_max) {
+        info.y_max = y;
+        result = kElanDecodeRescaled;
+    }
+    if (y < info.y_min) {
+        info.y_min = y;
+        result = kElanDecodeRescaled;
+    }
+
+    return result;
+}
+
+int ElanDecoder::reportAbsoluteV1(const uint8_t *packet) {
+    unsigned int fingers = 0, x = 0, y = 0;
+    elantech_finger *finger = _frame.finger;
+
+    if (info.fw_version < 0x020000) {
+        // byte 0:  D   U  p1  p2   1  p3   R   L
+        // byte 1:  f   0  th  tw  x9  x8  y9  y8
+        fingers = ((packet[1] & 0x80) >> 7) + ((packet[1] & 0x30) >> 4);
+    } else {
+        // byte 0: n1  n0  p2  p1   1  p3   R   L
+        // byte 1:  0   0   0   0  x9  x8  y9  y8
+        fingers = (packet[0] & 0xc0) >> 6;
+    }
+
+    if (info.jumpy_cursor) {
+        if (fingers != 1) {
+            etd.single_finger_reports = 0;
+        } else if (etd.single_finger_reports < 2) {
+            // Discard first 2 reports of one finger, bogus
+            etd.single_finger_reports++;
+            return 0;
+        }
+    }
+
+    // byte 2: x7  x6  x5  x4  x3  x2  x1  x0
+    // byte 3: y7  y6  y5  y4  y3  y2  y1  y0
+    x = ((packet[1] & 0x0c) << 6) | packet[2];
+    y = info.y_max - (((packet[1] & 0x03) << 8) | packet[3]);
+
+    finger[0].touch = false;
+    finger[1].touch = false;
+    finger[2].touch = false;
+
+    _frame.buttons = packet[0] & 0x03;
+
+    if (fingers == 1) {
+        finger[0].touch = true;
+        finger[0].button = packet[0] & 0x03;
+        finger[0].prev = finger[0].now;
+        finger[0].now.x = x;
+        finger[0].now.y = y;
+        if (_lastFingers != 1) {
+            finger[0].prev = finger[0].now;
+        }
+    }
+
+    if (fingers == 2) {
+        finger[0].touch = finger[1].touch = true;
+        finger[0].button = finger[1].button = packet[0] & 0x03;
+        finger[0].prev = finger[0].now;
+        finger[1].prev = finger[1].now;
+
+        int h = 100;
+        int dy = (int)(sin30deg * h);
+        int dx = (int)(cos30deg * h);
+
+        finger[0].now.x = x;
+        finger[0].now.y = y - h;
+
+        finger[1].now.x = x + dx;
+        finger[1].now.y = y + dy;
+
+        if (_lastFingers != 2) {
+            finger[0].prev = finger[0].now;
+            finger[1].prev = finger[1].now;
+        }
+    }
+
+    if (fingers == 3) {
+        finger[0].touch = finger[1].touch = finger[2].touch = true;
+        finger[0].button = finger[1].button = finger[2].button = packet[0] & 0x03;
+        finger[0].prev = finger[0].now;
+        finger[1].prev = finger[1].now;
+        finger[2].prev = finger[2].now;
+
+        int h = 100;
+        int dy = (int)(sin30deg * h);
+        int dx = (int)(cos30deg * h);
+
+        finger[0].now.x = x;
+        finger[0].now.y = y - h;
+
+        finger[1].now.x = x - dx;
+        finger[1].now.y = y + dy;
+
+        finger[2].now.x = x + dx;
+        finger[2].now.y = y + dy;
+
+        if (_lastFingers != 3) {
+            finger[0].prev = finger[0].now;
+            finger[1].prev = finger[1].now;
+            finger[2].prev = finger[2].now;
+        }
+    }
+
+    _lastFingers = fingers;
+    return kElanDecodeFrame;
+}
+
+int ElanDecoder::reportFingers(unsigned int fingers, finger_pos first, finger_pos second, unsigned int buttons) {
+    // v2 and v3 report one position for 1 and 3 fingers, and both
+    // positions for 2 fingers
+    elantech_finger *finger = _frame.finger;
+
+    finger[0].touch = false;
+    finger[1].touch = false;
+    finger[2].touch = false;
+
+    _frame.buttons = buttons;
+
+    if (fingers == 1 || fingers == 2) {
+        finger[0].touch = true;
+        finger[0].button = buttons;
+        finger[0].prev = finger[0].now;
+        finger[0].now = first;
+        if (_lastFingers != 1 && _lastFingers != 2) {
+            finger[0].prev = finger[0].now;
+        }
+    }
+
+    if (fingers == 2) {
+        finger[1].touch = true;
+        finger[1].button = buttons;
+        finger[1].prev = finger[1].now;
+        finger[1].now = second;
+        if (_lastFingers != 2) {
+            finger[1].prev = finger[1].now;
+        }
+    }
+
+    if (fingers == 3) {
+        finger[0].touch = finger[1].touch = finger[2].touch = true;
+        finger[0].button = finger[1].button = finger[2].button = buttons;
+        finger[0].prev = finger[0].now;
+        finger[1].prev = finger[1].now;
+        finger[2].prev = finger[2].now;
+
+        int h = 100;
+        int dy = (int)(sin30deg * h);
+        int dx = (int)(cos30deg * h);
+
+        finger[0].now.x = first.x;
+        finger[0].now.y = first.y - h;
+
+        finger[1].now.x = first.x - dx;
+        finger[1].now.y = first.y + dy;
+
+        finger[2].now.x = first.x + dx;
+        finger[2].now.y = first.y + dy;
+
+        if (_lastFingers != 3) {
+            finger[0].prev = finger[0].now;
+            finger[1].prev = finger[1].now;
+            finger[2].prev = finger[2].now;
+        }
+    }
+
+    _lastFingers = fingers;
+    return kElanDecodeFrame;
+}
+
+int ElanDecoder::reportAbsoluteV2(const uint8_t *packet) {
+    unsigned int fingers = 0;
+    finger_pos first {}, second {};
+
+    // byte 0: n1  n0   .   .   .   .   R   L
+    fingers = (packet[0] & 0xc0) >> 6;
+
+    switch (fingers) {
+        case 3:
+        case 1:
+            // byte 1:  .   .   .   .  x11 x10 x9  x8
+            // byte 2: x7  x6  x5  x4  x4  x2  x1  x0
+            first.x = ((packet[1] & 0x0f) << 8) | packet[2];
+
+            // byte 4:  .   .   .   .  y11 y10 y9  y8
+            // byte 5: y7  y6  y5  y4  y3  y2  y1  y0
+            first.y = info.y_max - (((packet[4] & 0x0f) << 8) | packet[5]);
+
+            // pressure: (packet[1] & 0xf0) | ((packet[4] & 0xf0) >> 4);
+            // finger width: ((packet[0] & 0x30) >> 2) | ((packet[3] & 0x30) >> 4);
+            break;
+
+        case 2:
+            // The coordinate of each finger is reported separately
+            // with a lower resolution for two finger touches:
+
+            // byte 0:  .   .  ay8 ax8  .   .   .   .
+            // byte 1: ax7 ax6 ax5 ax4 ax3 ax2 ax1 ax0
+            first.x = (((packet[0] & 0x10) << 4) | packet[1]) << 2;
+
+            // byte 2: ay7 ay6 ay5 ay4 ay3 ay2 ay1 ay0
+            first.y = info.y_max - ((((packet[0] & 0x20) << 3) | packet[2]) << 2);
+
+            // byte 3:  .   .  by8 bx8  .   .   .   .
+            // byte 4: bx7 bx6 bx5 bx4 bx3 bx2 bx1 bx0
+            second.x = (((packet[3] & 0x10) << 4) | packet[4]) << 2;
+
+            // byte 5: by7 by8 by5 by4 by3 by2 by1 by0
+            second.y = info.y_max - ((((packet[3] & 0x20) << 3) | packet[5]) << 2);
+            break;
+    }
+
+    return reportFingers(fingers, first, second, packet[0] & 0x03);
+}
+
+int ElanDecoder::reportAbsoluteV3(const uint8_t *packet, int packetType) {
+    unsigned int fingers = 0;
+    finger_pos first {}, second {};
+    int result = 0;
+
+    // byte 0: n1  n0   .   .   .   .   R   L
+    fingers = (packet[0] & 0xc0) >> 6;
+
+    switch (fingers) {
+        case 3:
+        case 1:
+            // byte 1:  .   .   .   .  x11 x10 x9  x8
+            // byte 2: x7  x6  x5  x4  x4  x2  x1  x0
+            first.x = ((packet[1] & 0x0f) << 8) | packet[2];
+
+            // byte 4:  .   .   .   .  y11 y10 y9  y8
+            // byte 5: y7  y6  y5  y4  y3  y2  y1  y0
+            first.y = (((packet[4] & 0x0f) << 8) | packet[5]);
+            result = rescale(first.x, first.y);
+            first.y = info.y_max - first.y;
+            break;
+
+        case 2:
+            if (packetType == PACKET_V3_HEAD) {
+                // byte 1:   .    .    .    .  ax11 ax10 ax9  ax8
+                // byte 2: ax7  ax6  ax5  ax4  ax3  ax2  ax1  ax0
+                etd.mt[0].x = ((packet[1] & 0x0f) << 8) | packet[2];
+
+                // byte 4:   .    .    .    .  ay11 ay10 ay9  ay8
+                // byte 5: ay7  ay6  ay5  ay4  ay3  ay2  ay1  ay0
+                etd.mt[0].y = info.y_max - (((packet[4] & 0x0f) << 8) | packet[5]);
+
+                // wait for next packet
+                return 0;
+            }
+
+            // packet_type == PACKET_V3_TAIL
+            first = etd.mt[0];
+            second.x = ((packet[1] & 0x0f) << 8) | packet[2];
+            second.y = (((packet[4] & 0x0f) << 8) | packet[5]);
+            result = rescale(second.x, second.y);
+            second.y = info.y_max - second.y;
+            break;
+    }
+
+    // pressure: (packet[1] & 0xf0) | ((packet[4] & 0xf0) >> 4);
+    // finger width: ((packet[0] & 0x30) >> 2) | ((packet[3] & 0x30) >> 4);
+
+    return result | reportFingers(fingers, first, second, packet[0] & 0x03);
+}
+
+int ElanDecoder::processPacketStatusV4(const uint8_t *packet) {
+    unsigned int fingers = packet[1] & 0x1f;
+    int count = 0;
+
+    _frame.buttons = packet[0] & 0x03;
+
+    if (IS_ETD0108()) {
+        // ETD0108 reports a lift right away, and otherwise only looks at
+        // status packets while a button is held so drags keep going
+        if (fingers == 0) {
+            for (int i = 0; i < ETP_MAX_FINGERS; i++) {
+                _frame.finger[i].touch = false;
+            }
+            return kElanDecodeFrame;
+        }
+
+        if (!_frame.buttons) {
+            return 0;
+        }
+    }
+
+    // notify finger state change
+    for (int i = 0; i < ETP_MAX_FINGERS; i++) {
+        if ((fingers & (1 << i)) == 0) {
+            // finger has been lifted off the touchpad, remember where it
+            // was if it is dragging so it can pick up there again
+            if (_frame.finger[i].touch && _frame.buttons) {
+                _dragSaved[i] = true;
+                _dragPos[i] = _frame.finger[i].now;
+            }
+            _frame.finger[i].touch = false;
+        } else {
+            _frame.finger[i].touch = true;
+            count++;
+        }
+    }
+
+    _heldFingers = count;
+    _headPacketsCount = 0;
+
+    // if count > 0, we wait for HEAD packets to report so that we report all fingers at once.
+    // if count == 0, we have to report the fact fingers are taken off, because there won't be any HEAD packets
+    return count == 0 ? kElanDecodeFrame : 0;
+}
+
+int ElanDecoder::processPacketHeadV4(const uint8_t *packet) {
+    int id = ((packet[3] & 0xe0) >> 5) - 1;
+
+    // ETD0108 falls back to the first finger rather than dropping the packet
+    if (IS_ETD0108() && (id < 0 || id >= ETP_MAX_FINGERS)) {
+        id = 0;
+    }
+
+    _frame.buttons = packet[0] & 0x03;
+
+    // drags end when the buttons are released
+    if (!_frame.buttons) {
+        for (int i = 0; i < ETP_MAX_FINGERS; i++) {
+            _dragSaved[i] = false;
+        }
+    }
+
+    _headPacketsCount++;
+
+    if (id < 0 || id >= ETP_MAX_FINGERS) {
+        return 0;
+    }
+
+    elantech_finger &finger = _frame.finger[id];
+    int pres = (packet[1] & 0xf0) | ((packet[4] & 0xf0) >> 4);
+    int traces = (packet[0] & 0xf0) >> 4;
+
+    finger.button = (packet[0] & 0x3);
+    finger.prev = finger.now;
+    finger.pressure = pres;
+    finger.width = traces;
+    finger.touch = true;
+
+    finger.now.x = ((packet[1] & 0x0f) << 8) | packet[2];
+    finger.now.y = info.y_max - (((packet[4] & 0x0f) << 8) | packet[5]);
+
+    // a finger coming back during a drag continues from where it was lifted
+    if (_frame.buttons && _dragSaved[id]) {
+        finger.prev = _dragPos[id];
+        _dragSaved[id] = false;
+    }
+
+    // ETD0108 rarely sends HEAD packets, report each one immediately
+    if (IS_ETD0108()) {
+        return kElanDecodeFrame;
+    }
+
+    // otherwise wait for the HEAD packets of all fingers
+    if (_headPacketsCount == _heldFingers) {
+        _headPacketsCount = 0;
+        return kElanDecodeFrame;
+    }
+
+    return 0;
+}
+
+int ElanDecoder::processPacketMotionV4(const uint8_t *packet) {
+    int weight, delta_x1 = 0, delta_y1 = 0, delta_x2 = 0, delta_y2 = 0;
+    int id, sid;
+
+    _frame.buttons = packet[0] & 0x03;
+
+    id = ((packet[0] & 0xe0) >> 5) - 1;
+    if (id < 0 || id >= ETP_MAX_FINGERS) {
+        return 0;
+    }
+
+    sid = ((packet[3] & 0xe0) >> 5) - 1;
+    weight = (packet[0] & 0x10) ? ETP_WEIGHT_VALUE : 1;
+
+    // Motion packets give us the delta of x, y values of specific fingers,
+    // but in two's complement. Let the compiler do the conversion for us.
+    // Also _enlarge_ the numbers to int, in case of overflow.
+    delta_x1 = (signed char)packet[1];
+    delta_y1 = (signed char)packet[2];
+    delta_x2 = (signed char)packet[4];
+    delta_y2 = (signed char)packet[5];
+
+    _frame.finger[id].button = (packet[0] & 0x3);
+    _frame.finger[id].prev = _frame.finger[id].now;
+    _frame.finger[id].now.x += delta_x1 * weight;
+    _frame.finger[id].now.y -= delta_y1 * weight;
+
+    if (sid >= 0 && sid < ETP_MAX_FINGERS) {
+        _frame.finger[sid].button = (packet[0] & 0x3);
+        _frame.finger[sid].prev = _frame.finger[sid].now;
+        _frame.finger[sid].now.x += delta_x2 * weight;
+        _frame.finger[sid].now.y -= delta_y2 * weight;
+    }
+
+    return kElanDecodeFrame;
+}
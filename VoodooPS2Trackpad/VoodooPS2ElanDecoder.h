@@ -0,0 +1,175 @@
+/*
+ * Elan PS2 touchpad packet decoder
+ *
+ * Mostly contains code ported from Linux
+ * https://github.com/torvalds/linux/blob/master/drivers/input/mouse/elantech.c
+ *
+ * Plain C++ without IOKit: turns the packets of hardware versions 1 to 4
+ * into finger frames, and leaves reporting them to ApplePS2Elan.
+ */
+
+#ifndef _VOODOOPS2ELANDECODER_H
+#define _VOODOOPS2ELANDECODER_H
+
+#include <stdint.h>
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+//
+// FROM LINUX ELANTECH.C
+
+/*
+ * v3 hardware has 2 kinds of packet types,
+ * v4 hardware has 3.
+ */
+#define PACKET_UNKNOWN                0x01
+#define PACKET_DEBOUNCE               0x02
+#define PACKET_V3_HEAD                0x03
+#define PACKET_V3_TAIL                0x04
+#define PACKET_V4_HEAD                0x05
+#define PACKET_V4_MOTION              0x06
+#define PACKET_V4_STATUS              0x07
+#define PACKET_TRACKPOINT             0x08
+
+/*
+ * track up to 5 fingers for v4 hardware
+ */
+#define ETP_MAX_FINGERS               5
+
+/*
+ * weight value for v4 hardware
+ */
+#define ETP_WEIGHT_VALUE              5
+
+/*
+ * ETD0108 firmware, whose v4 status and head packets need special handling
+ */
+#define ETP_FW_VERSION_ETD0108        0x381f17
+
+/*
+ * The base position for one finger, v4 hardware
+ */
+struct finger_pos {
+    unsigned int x;
+    unsigned int y;
+};
+
+struct elantech_device_info {
+    unsigned char capabilities[3];
+    unsigned char samples[3];
+    unsigned char debug;
+    unsigned char hw_version;
+    unsigned int fw_version;
+    unsigned int x_min;
+    unsigned int y_min;
+    unsigned int x_max;
+    unsigned int y_max;
+    unsigned int x_res;
+    unsigned int y_res;
+    unsigned int x_traces;
+    unsigned int y_traces;
+    unsigned int width;
+    unsigned int bus;
+    bool paritycheck;
+    bool jumpy_cursor;
+    bool reports_pressure;
+    bool crc_enabled;
+    bool set_hw_resolution;
+    bool is_buttonpad;
+    bool has_trackpoint;
+    bool has_middle_button;
+};
+
+struct elantech_data {
+    unsigned char reg_07;
+    unsigned char reg_10;
+    unsigned char reg_11;
+    unsigned char reg_20;
+    unsigned char reg_21;
+    unsigned char reg_22;
+    unsigned char reg_23;
+    unsigned char reg_24;
+    unsigned char reg_25;
+    unsigned char reg_26;
+    unsigned int single_finger_reports;
+    struct finger_pos mt[ETP_MAX_FINGERS];
+    unsigned char parity[256];
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// ElanDecoder
+//
+
+/*
+ * One finger of a frame, y grows downwards
+ */
+struct elantech_finger {
+    finger_pos prev;
+    finger_pos now;
+    uint8_t pressure;
+    uint8_t width;
+    bool touch;
+    bool button;
+};
+
+struct elantech_frame {
+    elantech_finger finger[ETP_MAX_FINGERS];
+    unsigned int buttons;               // bit 0 left, bit 1 right
+};
+
+/*
+ * What ElanDecoder::decode made of a packet, may be combined
+ */
+enum {
+    kElanDecodeFrame        = 0x01,     // frame() holds fingers to report
+    kElanDecodeRescaled     = 0x02,     // info's x/y range grew to fit the packet
+    kElanDecodeTrackpoint   = 0x04,     // trackpoint packet, left to the caller
+    kElanDecodeInvalid      = 0x08,     // failed the parity or constant bit checks
+};
+
+class ElanDecoder {
+public:
+    ElanDecoder(elantech_device_info &info, elantech_data &etd) : info(info), etd(etd) {}
+
+    // picks the v3/v4 packet tables, once info is filled in
+    void selectClassifier();
+
+    // decodes one packet of info.hw_version, returns kElanDecode flags
+    int decode(const uint8_t *packet);
+
+    // the PACKET_ type decode() sees in a v3 or v4 packet
+    int packetType(const uint8_t *packet);
+
+    const elantech_frame &frame() const { return _frame; }
+
+private:
+    elantech_device_info &info;
+    elantech_data &etd;
+
+    const uint8_t *_packetTableV3 {nullptr};
+    const uint8_t *_packetTableV4 {nullptr};
+
+    elantech_frame _frame {};
+    unsigned int _lastFingers {0};
+    int _heldFingers {0};
+    int _headPacketsCount {0};
+
+    // where fingers lifted during a drag were, in case they come back
+    bool _dragSaved[ETP_MAX_FINGERS] {};
+    finger_pos _dragPos[ETP_MAX_FINGERS] {};
+
+    int debounceCheckV2(const uint8_t *packet);
+    int packetCheckV1(const uint8_t *packet);
+    int packetCheckV2(const uint8_t *packet);
+    int packetCheckV3(const uint8_t *packet);
+    int packetCheckV4(const uint8_t *packet);
+    int rescale(unsigned int x, unsigned int y);
+    int reportFingers(unsigned int fingers, finger_pos first, finger_pos second, unsigned int buttons);
+    int reportAbsoluteV1(const uint8_t *packet);
+    int reportAbsoluteV2(const uint8_t *packet);
+    int reportAbsoluteV3(const uint8_t *packet, int packetType);
+    int processPacketStatusV4(const uint8_t *packet);
+    int processPacketHeadV4(const uint8_t *packet);
+    int processPacketMotionV4(const uint8_t *packet);
+};
+
+#endif /* _VOODOOPS2ELANDECODER_H */
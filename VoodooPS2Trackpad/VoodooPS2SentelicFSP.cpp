@@ -362,10 +362,9 @@ bool ApplePS2SentelicFSP::start( IOService * provider )
     // Install our driver's interrupt handler, for asynchronous data delivery.
     //
 	
-    _device->installInterruptAction(this,
-                                    OSMemberFunctionCast(PS2InterruptAction, this, &ApplePS2SentelicFSP::interruptOccurred),
-                                    OSMemberFunctionCast(PS2PacketAction, this, &ApplePS2SentelicFSP::packetReady));
+    _device->installInterruptAction<ApplePS2SentelicFSP, &ApplePS2SentelicFSP::interruptOccurred, &ApplePS2SentelicFSP::packetReady>(this);
     _interruptHandlerInstalled = true;
+    _device->watchRingBuffer(_ringBuffer);
 	
     // now safe to allow other threads
     _device->unlock();
@@ -436,6 +435,7 @@ PS2InterruptResult ApplePS2SentelicFSP::interruptOccurred( UInt8 data )
     if (_packetByteCount == 0 && ((data == kSC_Acknowledge) || !(data & 0x08)))
     {
         DEBUG_LOG("%s: Unexpected byte0 data (%02x) from PS/2 controller\n", getName(), data);
+        _device->countEvent(kPS2CT_Resyncs);
         return kPS2IR_packetBuffering;
     }
 	
@@ -58,8 +58,8 @@ private:
     virtual bool   setTouchPadModeByte( UInt8 modeByteValue,
                                        bool  enableStreamMode = false );
     
-    virtual PS2InterruptResult interruptOccurred(UInt8 data);
-    virtual void packetReady();
+    PS2InterruptResult interruptOccurred(UInt8 data);
+    void packetReady();
     virtual void   setDevicePowerState(UInt32 whatToDo);
     
 protected:
@@ -169,12 +169,14 @@ IOService* ApplePS2SynapticsTouchPad::probe(IOService * provider, SInt32 * score
       OSSafeReleaseNULL(config);
     }
 
-    bool success = getTouchPadData(SYNAPTICS_IDENTIFY_QUERY, reinterpret_cast<uint8_t*>(&_identity));
-    if (!success)
+    // the controller sent the identify query on the first probe of the port
+    PS2Identification ids;
+    if (!_device->getIdentification(&ids) || !ids.has(kPS2ID_SynapticsIdentify))
     {
         IOLog("VoodooPS2Trackpad: Identify TouchPad command failed\n");
         return 0;
     }
+    memcpy(&_identity, ids.report[kPS2ID_SynapticsIdentify], sizeof(_identity));
     
     INFO_LOG("VoodooPS2Trackpad: Identity = { 0x%x.%x, constant: %x }\n",
              _identity.major_ver, _identity.minor_ver, _identity.synaptics_const);
@@ -444,6 +446,7 @@ bool ApplePS2SynapticsTouchPad::start( IOService * provider )
 
     _device = (ApplePS2MouseDevice *) provider;
     _device->retain();
+    _keystrokes = _device->getKeystrokeCell();
     
     //
     // Announce hardware properties.
@@ -498,10 +501,9 @@ bool ApplePS2SynapticsTouchPad::start( IOService * provider )
     // Install our driver's interrupt handler, for asynchronous data delivery.
     //
     
-    _device->installInterruptAction(this,
-                                    OSMemberFunctionCast(PS2InterruptAction,this,&ApplePS2SynapticsTouchPad::interruptOccurred),
-                                    OSMemberFunctionCast(PS2PacketAction, this, &ApplePS2SynapticsTouchPad::packetReady));
+    _device->installInterruptAction<ApplePS2SynapticsTouchPad, &ApplePS2SynapticsTouchPad::interruptOccurred, &ApplePS2SynapticsTouchPad::packetReady>(this);
     _interruptHandlerInstalled = true;
+    _device->watchRingBuffer(_ringBuffer);
     
     // now safe to allow other threads
     _device->unlock();
@@ -518,6 +520,8 @@ bool ApplePS2SynapticsTouchPad::start( IOService * provider )
     // Request message registration for keyboard to trackpad communication
     //
     //setProperty(kDeliverNotifications, true);
+    static const UInt32 messages[] = { kPS2M_getDisableTouchpad, kPS2M_setDisableTouchpad, kPS2M_resetTouchpad };
+    ApplePS2Device::subscribeMessages(this, messages, sizeof(messages) / sizeof(messages[0]));
     
     // get IOACPIPlatformDevice for Device (PS2M)
     //REVIEW: should really look at the parent chain for IOACPIPlatformDevice instead.
@@ -649,6 +653,7 @@ PS2InterruptResult ApplePS2SynapticsTouchPad::interruptOccurred(UInt8 data)
     if (0 == _packetByteCount && (data & 0xc8) != 0x80)
     {
         IOLog("%s: Unexpected byte0 data (%02x) from PS/2 controller\n", getName(), data);
+        _device->countEvent(kPS2CT_Resyncs);
         
         packet[0] = 0x00;
         packet[1] = 0;  // reason=byte0
@@ -658,6 +663,7 @@ PS2InterruptResult ApplePS2SynapticsTouchPad::interruptOccurred(UInt8 data)
     if (3 == _packetByteCount && (data & 0xc8) != 0xc0)
     {
         IOLog("%s: Unexpected byte3 data (%02x) from PS/2 controller\n", getName(), data);
+        _device->countEvent(kPS2CT_Resyncs);
         
         packet[0] = 0x00;
         packet[1] = 3;  // reason=byte3
@@ -1395,7 +1401,9 @@ void ApplePS2SynapticsTouchPad::sendTouchData() {
 
     // Lenovo Yoga tablet mode works by sending this key every second to disable the touchpad.
     // That key is mapped to ADB dead key (0x80).
-    if (timestamp_ns - keytime < (keycode == specialKey ? maxafterspecialtyping : maxaftertyping))
+    PS2KeystrokeState keys = _keystrokes->read();
+    uint64_t keytime = keys.time > keys.modifierTime ? keys.time : keys.modifierTime;
+    if (timestamp_ns - keytime < (keys.adbKeyCode == specialKey ? maxafterspecialtyping : maxaftertyping))
         return;
 
     if (lastFingerCount != clampedFingerCount) {
@@ -1579,54 +1587,20 @@ bool ApplePS2SynapticsTouchPad::getTouchPadStatus(  UInt8 buf3[] )
 
 bool ApplePS2SynapticsTouchPad::getTouchPadData(UInt8 dataSelector, UInt8 buf3[])
 {
-    TPS2Request<14> request;
-
-    // Disable stream mode before the command sequence.
-    request.commands[0].command  = kPS2C_SendCommandAndCompareAck;
-    request.commands[0].inOrOut  = kDP_SetDefaultsAndDisable;
-
-    // 4 set resolution commands, each encode 2 data bits.
-    request.commands[1].command  = kPS2C_SendCommandAndCompareAck;
-    request.commands[1].inOrOut  = kDP_SetMouseResolution;
-    request.commands[2].command  = kPS2C_SendCommandAndCompareAck;
-    request.commands[2].inOrOut  = (dataSelector >> 6) & 0x3;
-
-    request.commands[3].command  = kPS2C_SendCommandAndCompareAck;
-    request.commands[3].inOrOut  = kDP_SetMouseResolution;
-    request.commands[4].command  = kPS2C_SendCommandAndCompareAck;
-    request.commands[4].inOrOut  = (dataSelector >> 4) & 0x3;
-
-    request.commands[5].command  = kPS2C_SendCommandAndCompareAck;
-    request.commands[5].inOrOut  = kDP_SetMouseResolution;
-    request.commands[6].command  = kPS2C_SendCommandAndCompareAck;
-    request.commands[6].inOrOut  = (dataSelector >> 2) & 0x3;
-
-    request.commands[7].command  = kPS2C_SendCommandAndCompareAck;
-    request.commands[7].inOrOut  = kDP_SetMouseResolution;
-    request.commands[8].command  = kPS2C_SendCommandAndCompareAck;
-    request.commands[8].inOrOut  = (dataSelector >> 0) & 0x3;
-
-    // Read response bytes.
-    request.commands[9].command  = kPS2C_SendCommandAndCompareAck;
-    request.commands[9].inOrOut  = kDP_GetMouseInformation;
-    request.commands[10].command = kPS2C_ReadDataPort;
-    request.commands[10].inOrOut = 0;
-    request.commands[11].command = kPS2C_ReadDataPort;
-    request.commands[11].inOrOut = 0;
-    request.commands[12].command = kPS2C_ReadDataPort;
-    request.commands[12].inOrOut = 0;
-    request.commands[13].command = kPS2C_SendCommandAndCompareAck;
-    request.commands[13].inOrOut = kDP_SetDefaultsAndDisable;
-    request.commandsCount = 14;
-    assert(request.commandsCount <= countof(request.commands));
+    // Disable stream mode before the command sequence, send the selector
+    // as 4 set resolution commands (each encode 2 data bits), then read
+    // the response bytes.
+    auto request = makePS2Script(PS2Send(kDP_SetDefaultsAndDisable),
+                                 PS2Sliced(dataSelector),
+                                 PS2Send(kDP_GetMouseInformation),
+                                 PS2Read<3>(),
+                                 PS2Send(kDP_SetDefaultsAndDisable));
     _device->submitRequestAndBlock(&request);
-    if (14 != request.commandsCount)
+    if (!request.succeeded())
         return false;
     
     // store results
-    buf3[0] = request.commands[10].inOrOut;
-    buf3[1] = request.commands[11].inOrOut;
-    buf3[2] = request.commands[12].inOrOut;
+    request.results(buf3);
     return true;
 }
 
@@ -1647,9 +1621,6 @@ void ApplePS2SynapticsTouchPad::initTouchPad()
     _lastExtendedButtons = 0;
     tracksecondary=false;
     
-    // clear state of control key cache
-    _modifierdown = 0;
-    
     //
     // Resend the touchpad mode byte sequence
     // IRQ is enabled as side effect of setting mode byte
@@ -1991,9 +1962,8 @@ IOReturn ApplePS2SynapticsTouchPad::message(UInt32 type, IOService* provider, vo
     // This allows for the keyboard driver to enable/disable the trackpad
     // when a certain keycode is pressed.
     //
-    // It also allows the trackpad driver to learn the last time a key
-    //  has been pressed, so it can implement various "ignore trackpad
-    //  input while typing" options.
+    // The last key press is read from the keystroke cell instead, see
+    // sendTouchData.
     //
     switch (type)
     {
@@ -2031,86 +2001,6 @@ IOReturn ApplePS2SynapticsTouchPad::message(UInt32 type, IOService* provider, vo
             }
             break;
         }
-        case kPS2M_notifyKeyPressed:
-        {
-            // just remember last time key pressed... this can be used in
-            // interrupt handler to detect unintended input while typing
-            PS2KeyInfo* pInfo = (PS2KeyInfo*)argument;
-            static const int masks[] =
-            {
-                0x10,       // 0x36
-                0x100000,   // 0x37
-                0,          // 0x38
-                0,          // 0x39
-                0x080000,   // 0x3a
-                0x040000,   // 0x3b
-                0,          // 0x3c
-                0x08,       // 0x3d
-                0x04,       // 0x3e
-                0x200000,   // 0x3f
-            };
-#ifdef SIMULATE_PASSTHRU
-            /*
-            static int buttons = 0;
-            int button;
-            switch (pInfo->adbKeyCode)
-            {
-                // make right Alt,Menu,Ctrl into three button passthru
-                case 0x36:
-                    button = 0x1;
-                    goto dispatch_it;
-                case 0x3f:
-                    button = 0x4;
-                    goto dispatch_it;
-                case 0x3e:
-                    button = 0x2;
-                    // fall through...
-                dispatch_it:
-                    if (pInfo->goingDown)
-                        buttons |= button;
-                    else
-                        buttons &= ~button;
-                    UInt8 packet[6];
-                    packet[0] = 0x84 | trackbuttons;
-                    packet[1] = 0x08 | buttons;
-                    packet[2] = 0;
-                    packet[3] = 0xC4 | trackbuttons;
-                    packet[4] = 0;
-                    packet[5] = 0;
-                    dispatchEventsWithPacket(packet, 6);
-                    pInfo->eatKey = true;
-            }
-             */
-#endif
-            switch (pInfo->adbKeyCode)
-            {
-                // don't store key time for modifier keys going down
-                // track modifiers for scrollzoom feature...
-                // (note: it turns out we didn't need to do this, but leaving this code in for now in case it is useful)
-                case 0x38:  // left shift
-                case 0x3c:  // right shift
-                case 0x3b:  // left control
-                case 0x3e:  // right control
-                case 0x3a:  // left windows (option)
-                case 0x3d:  // right windows
-                case 0x37:  // left alt (command)
-                case 0x36:  // right alt
-                case 0x3f:  // osx fn (function)
-                    if (pInfo->goingDown)
-                    {
-                        _modifierdown |= masks[pInfo->adbKeyCode-0x36];
-                        break;
-                    }
-                    _modifierdown &= ~masks[pInfo->adbKeyCode-0x36];
-                    keytime = pInfo->time;
-                    break;
-                    
-                default:
-                    keytime = pInfo->time;
-            }
-            keycode = pInfo->adbKeyCode;
-            break;
-        }
     }
     
     return kIOReturnSuccess;
@@ -212,9 +212,10 @@ class EXPORT ApplePS2SynapticsTouchPad : public IOService
 private:
     IOService *voodooInputInstance {nullptr};
     ApplePS2MouseDevice * _device {nullptr};
+    PS2KeystrokeCell *    _keystrokes {nullptr};
 	bool                _interruptHandlerInstalled {false};
     bool                _powerControlHandlerInstalled {false};
-	RingBuffer<UInt8, kPacketLength*32> _ringBuffer {};
+	RingBuffer<UInt8, 256> _ringBuffer {};    // 42 packets
 	UInt32              _packetByteCount {0};
     UInt8               _lastdata {0};
     
@@ -312,8 +313,6 @@ private:
     bool tracksecondary {false};
     
     // normal state
-    uint64_t keytime {0};
-    UInt16 keycode {0};
     bool ignoreall {false};
 #ifdef SIMULATE_PASSTHRU
 	UInt32 trackbuttons {0};
@@ -333,8 +332,6 @@ private:
     IONotifier* bluetooth_hid_publish_notify {nullptr}; // Notification when a bluetooth HID device is connected
     IONotifier* bluetooth_hid_terminate_notify {nullptr}; // Notification when a bluetooth HID device is disconnected
     
-	int _modifierdown {0}; // state of left+right control keys
-    
     inline bool isInDisableZone(int x, int y)
         { return x > diszl && x < diszr && y > diszb && y < diszt; }
 	
@@ -345,8 +342,8 @@ private:
     virtual void   setTouchPadEnable( bool enable );
     virtual bool   getTouchPadData( UInt8 dataSelector, UInt8 buf3[] );
     virtual bool   getTouchPadStatus(  UInt8 buf3[] );
-	virtual PS2InterruptResult interruptOccurred(UInt8 data);
-    virtual void packetReady();
+	PS2InterruptResult interruptOccurred(UInt8 data);
+    void packetReady();
     virtual void   setDevicePowerState(UInt32 whatToDo);
     
     void updateTouchpadLED();